@@ -0,0 +1,132 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "benchmark.h"
+
+#include <nunchuk-config.h>
+#include <utils/json.hpp>
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace nunchuk {
+namespace bench {
+
+static const int64_t MAX_ITERATIONS = 1000000000;
+
+namespace {
+struct Entry {
+  std::string name;
+  Function function;
+};
+
+std::vector<Entry>& Registry() {
+  static std::vector<Entry> registry;
+  return registry;
+}
+
+struct Result {
+  std::string name;
+  int64_t iterations;
+  double ns_per_op;
+  double items_per_second;
+};
+}  // namespace
+
+bool Register(const std::string& name, Function function) {
+  Registry().push_back({name, function});
+  return true;
+}
+
+// Grow the iteration count until a run lasts min_time, like the usual
+// benchmark libraries
+static Result Run(const Entry& entry, double min_time) {
+  int64_t iterations = 1;
+  while (true) {
+    State state(iterations);
+    entry.function(state);
+    double seconds =
+        std::chrono::duration<double>(state.elapsed()).count();
+    if (seconds >= min_time || iterations >= MAX_ITERATIONS) {
+      double items = double(state.items_per_iteration()) * iterations;
+      return {entry.name, iterations, seconds * 1e9 / iterations,
+              seconds > 0 ? items / seconds : 0};
+    }
+    // Aim 40% past min_time, but grow at most 10x per step
+    double multiplier = seconds > 0 ? min_time * 1.4 / seconds : 10;
+    if (multiplier > 10) multiplier = 10;
+    int64_t next = static_cast<int64_t>(iterations * multiplier);
+    iterations = next > iterations ? next : iterations + 1;
+  }
+}
+
+static std::string Timestamp() {
+  char buf[32];
+  std::time_t now = std::time(nullptr);
+  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  return buf;
+}
+
+int Main(int argc, char** argv) {
+  std::string filter;
+  std::string json_file;
+  double min_time = 0.5;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 9, "--filter=") == 0) {
+      filter = arg.substr(9);
+    } else if (arg.compare(0, 7, "--json=") == 0) {
+      json_file = arg.substr(7);
+    } else if (arg.compare(0, 11, "--min-time=") == 0) {
+      min_time = std::stod(arg.substr(11));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter=<substring>] [--min-time=<seconds>]"
+                   " [--json=<file>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << std::left << std::setw(40) << "benchmark" << std::right
+            << std::setw(12) << "iterations" << std::setw(16) << "ns/op"
+            << std::setw(16) << "items/s" << std::endl;
+  json results = json::array();
+  for (auto&& entry : Registry()) {
+    if (entry.name.find(filter) == std::string::npos) continue;
+    Result rs = Run(entry, min_time);
+    std::cout << std::left << std::setw(40) << rs.name << std::right
+              << std::setw(12) << rs.iterations << std::fixed
+              << std::setprecision(1) << std::setw(16) << rs.ns_per_op
+              << std::setw(16) << rs.items_per_second << std::endl;
+    results.push_back({{"name", rs.name},
+                       {"iterations", rs.iterations},
+                       {"ns_per_op", rs.ns_per_op},
+                       {"items_per_second", rs.items_per_second}});
+  }
+
+  if (!json_file.empty()) {
+    json report = {{"context",
+                    {{"date", Timestamp()},
+                     {"version", CLIENT_VER},
+                     {"min_time", min_time}}},
+                   {"benchmarks", results}};
+    std::ofstream file(json_file);
+    file << report.dump(2) << std::endl;
+    if (!file) {
+      std::cerr << "Can not write " << json_file << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace nunchuk
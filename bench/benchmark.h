@@ -0,0 +1,62 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_BENCH_BENCHMARK_H
+#define NUNCHUK_BENCH_BENCHMARK_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace nunchuk {
+namespace bench {
+
+// Passed to a benchmark body, which runs the measured code once per
+// KeepRunning() call. Setup before the loop is not timed
+class State {
+ public:
+  explicit State(int64_t iterations) : iterations_(iterations) {}
+
+  bool KeepRunning() {
+    if (remaining_ == iterations_) start_ = std::chrono::steady_clock::now();
+    if (remaining_-- > 0) return true;
+    elapsed_ = std::chrono::steady_clock::now() - start_;
+    return false;
+  }
+  int64_t iterations() const { return iterations_; }
+  std::chrono::steady_clock::duration elapsed() const { return elapsed_; }
+
+  // Items (transactions, coins, addresses) processed per iteration, reported
+  // as a throughput
+  void SetItemsPerIteration(int64_t items) { items_ = items; }
+  int64_t items_per_iteration() const { return items_; }
+
+ private:
+  int64_t iterations_;
+  int64_t remaining_ = iterations_;
+  int64_t items_ = 0;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::duration elapsed_{0};
+};
+
+typedef std::function<void(State&)> Function;
+
+// Returns true so it can initialize a static at namespace scope
+bool Register(const std::string& name, Function function);
+
+// Runs the registered benchmarks matching --filter, each until --min-time
+// seconds, and prints a table. --json=<file> also writes the results
+int Main(int argc, char** argv);
+
+}  // namespace bench
+}  // namespace nunchuk
+
+#define NUNCHUK_BENCH_CONCAT2(a, b) a##b
+#define NUNCHUK_BENCH_CONCAT(a, b) NUNCHUK_BENCH_CONCAT2(a, b)
+#define BENCHMARK(name, function)                                     \
+  static bool NUNCHUK_BENCH_CONCAT(bench_registered_, __LINE__) =     \
+      ::nunchuk::bench::Register(name, function)
+
+#endif  // NUNCHUK_BENCH_BENCHMARK_H
@@ -0,0 +1,303 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "datagen.h"
+
+#include <coreutils.h>
+#include <storage.h>
+#include <utils/json.hpp>
+#include <utils/txutils.hpp>
+
+#include <core_io.h>
+#include <key_io.h>
+#include <primitives/transaction.h>
+#include <script/standard.h>
+#include <uint256.h>
+
+#include <boost/filesystem.hpp>
+
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+
+using json = nlohmann::json;
+
+namespace nunchuk {
+namespace datagen {
+
+static const std::string TPUB =
+    "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5A"
+    "oysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL";
+static const int START_HEIGHT = 600000;
+static const time_t START_TIME = 1577836800;
+// Virtual sizes of a P2WPKH input, output and the tx overhead
+static const int INPUT_VSIZE = 68;
+static const int OUTPUT_VSIZE = 31;
+static const int TX_VSIZE = 11;
+
+namespace {
+
+// Batches the whole history into one SQL transaction
+class GeneratorDb : public NunchukWalletDb {
+ public:
+  using NunchukWalletDb::NunchukWalletDb;
+  void Exec(const char* sql) { sqlite3_exec(db_, sql, NULL, NULL, NULL); }
+};
+
+struct Coin {
+  COutPoint outpoint;
+  std::string address;
+  CScript script;
+  Amount amount;
+  int height;
+};
+
+struct Payee {
+  std::string address;
+  CScript script;
+};
+
+class Generator {
+ public:
+  Generator(const WalletSpec& spec, GeneratedWallet& wallet, GeneratorDb& db)
+      : spec_(spec), wallet_(wallet), db_(db), rng_(spec.seed) {}
+
+  void Run() {
+    DeriveAddresses();
+    for (int i = 0; i < spec_.transactions; i++) {
+      int height = START_HEIGHT + i;
+      // Consolidate above the target, otherwise mostly receive
+      bool send = coins_.size() > (size_t)spec_.utxos ||
+                  (!coins_.empty() && rng_() % 4 == 0);
+      send ? Send(height) : Receive(height);
+    }
+    StoreUtxos();
+    for (int i = 0; i < spec_.drafts && !coins_.empty(); i++) Draft(i);
+    for (int i = 0; i < spec_.replaced && !coins_.empty(); i++) Replace(i);
+  }
+
+ private:
+  std::vector<unsigned char> RandomBytes(size_t size) {
+    std::vector<unsigned char> rs(size);
+    for (auto&& b : rs) b = rng_() & 0xff;
+    return rs;
+  }
+
+  Amount RandomAmount(Amount min, Amount max) {
+    return min + rng_() % (max - min);
+  }
+
+  Payee ExternalPayee() {
+    CTxDestination dest = WitnessV0KeyHash(uint160(RandomBytes(20)));
+    return {EncodeDestination(dest), GetScriptForDestination(dest)};
+  }
+
+  Payee WalletPayee(const std::vector<std::string>& addresses) {
+    auto& address = addresses[rng_() % addresses.size()];
+    return {address, GetScriptForDestination(DecodeDestination(address))};
+  }
+
+  // Signature and pubkey sized like a real P2WPKH spend, the txid does not
+  // cover it
+  void AddWitness(CTxIn& input) {
+    auto pubkey = RandomBytes(33);
+    pubkey[0] = 0x02;
+    input.scriptWitness.stack = {RandomBytes(71), pubkey};
+  }
+
+  void DeriveAddresses() {
+    auto& core = CoreUtils::getInstance();
+    std::string internal = db_.GetDescriptor(true);
+    for (int i = 0; i < spec_.addresses; i++) {
+      wallet_.addresses.push_back(core.DeriveAddresses(wallet_.descriptor, i));
+      db_.AddAddress(wallet_.addresses.back(), i, false);
+      wallet_.change_addresses.push_back(core.DeriveAddresses(internal, i));
+      db_.AddAddress(wallet_.change_addresses.back(), i, true);
+    }
+  }
+
+  // Take a random coin out of the wallet's set
+  Coin TakeCoin() {
+    size_t i = rng_() % coins_.size();
+    Coin coin = coins_[i];
+    coins_[i] = coins_.back();
+    coins_.pop_back();
+    return coin;
+  }
+
+  const Coin& PickCoin() { return coins_[rng_() % coins_.size()]; }
+
+  void Receive(int height) {
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(uint256(RandomBytes(32)), 0)));
+    AddWitness(mtx.vin.back());
+    Payee payee = WalletPayee(wallet_.addresses);
+    Amount amount = RandomAmount(10000, 5000000);
+    Payee sender_change = ExternalPayee();
+    mtx.vout.push_back(CTxOut(amount, payee.script));
+    mtx.vout.push_back(
+        CTxOut(RandomAmount(10000, 50000000), sender_change.script));
+    uint32_t pos = rng_() % 2;
+    if (pos == 1) std::swap(mtx.vout[0], mtx.vout[1]);
+    Insert(mtx, height, 0, -1);
+    coins_.push_back({COutPoint(mtx.GetHash(), pos), payee.address,
+                      payee.script, amount, height});
+  }
+
+  void Send(int height) {
+    size_t excess = coins_.size() > (size_t)spec_.utxos
+                        ? coins_.size() - spec_.utxos
+                        : 0;
+    size_t count = std::min<size_t>(3, excess + 1);
+    std::vector<Coin> spent;
+    for (size_t i = 0; i < count; i++) spent.push_back(TakeCoin());
+    int change_pos = -1;
+    Payee change;
+    Amount fee = 0;
+    auto mtx = Spend(spent, 1 + rng_() % 20, change_pos, change, fee);
+    for (auto&& input : mtx.vin) AddWitness(input);
+    Insert(mtx, height, fee, change_pos);
+    if (change_pos >= 0) {
+      coins_.push_back({COutPoint(mtx.GetHash(), change_pos), change.address,
+                        change.script, mtx.vout[change_pos].nValue, height});
+    }
+  }
+
+  // Pay part of the coins to an external address, the rest back to change
+  // unless it would be dust
+  CMutableTransaction Spend(const std::vector<Coin>& coins, Amount fee_rate,
+                            int& change_pos, Payee& change, Amount& fee) {
+    CMutableTransaction mtx;
+    Amount total = 0;
+    for (auto&& coin : coins) {
+      mtx.vin.push_back(CTxIn(coin.outpoint));
+      total += coin.amount;
+    }
+    fee = fee_rate * (TX_VSIZE + INPUT_VSIZE * coins.size() + OUTPUT_VSIZE * 2);
+    Amount payment = (total - fee) * (10 + rng_() % 80) / 100;
+    Amount rest = total - fee - payment;
+    mtx.vout.push_back(CTxOut(payment, ExternalPayee().script));
+    change_pos = -1;
+    if (rest >= 1000) {
+      change = WalletPayee(wallet_.change_addresses);
+      change_pos = rng_() % 2;
+      mtx.vout.insert(mtx.vout.begin() + change_pos,
+                      CTxOut(rest, change.script));
+    } else {
+      fee += rest;
+    }
+    return mtx;
+  }
+
+  Transaction Insert(const CMutableTransaction& mtx, int height, Amount fee,
+                     int change_pos) {
+    std::string memo = rng_() % 10 == 0 ? "payment " + std::to_string(height)
+                                        : std::string();
+    auto tx = db_.InsertTransaction(
+        EncodeHexTx(CTransaction(mtx)), height,
+        START_TIME + 600 * (height - START_HEIGHT), fee, memo, change_pos);
+    wallet_.tx_ids.push_back(tx.get_txid());
+    return tx;
+  }
+
+  // Electrum listunspent results, one SetUtxos per address
+  void StoreUtxos() {
+    std::map<std::string, json> utxos;
+    for (auto&& coin : coins_) {
+      auto& list = utxos[coin.address];
+      if (list.is_null()) list = json::array();
+      list.push_back({{"tx_hash", coin.outpoint.hash.GetHex()},
+                      {"tx_pos", coin.outpoint.n},
+                      {"height", coin.height},
+                      {"value", coin.amount}});
+    }
+    for (auto&& i : utxos) db_.SetUtxos(i.first, i.second.dump());
+    wallet_.utxo_count = coins_.size();
+  }
+
+  std::string CreatePsbt(const Coin& coin, Amount fee_rate,
+                         const std::string& replace_tx,
+                         CMutableTransaction& mtx) {
+    int change_pos;
+    Payee change;
+    Amount fee;
+    mtx = Spend({coin}, fee_rate, change_pos, change, fee);
+    PartiallySignedTransaction psbtx(mtx);
+    psbtx.inputs[0].witness_utxo = CTxOut(coin.amount, coin.script);
+    std::string psbt = EncodePsbt(psbtx);
+    std::map<std::string, Amount> outputs;
+    for (size_t i = 0; i < mtx.vout.size(); i++) {
+      if ((int)i == change_pos) continue;
+      CTxDestination dest;
+      ExtractDestination(mtx.vout[i].scriptPubKey, dest);
+      outputs[EncodeDestination(dest)] = mtx.vout[i].nValue;
+    }
+    auto tx = db_.CreatePsbt(psbt, fee, {}, change_pos, outputs,
+                             fee_rate * 1000, false, replace_tx);
+    wallet_.tx_ids.push_back(tx.get_txid());
+    return tx.get_txid();
+  }
+
+  void Draft(int i) {
+    CMutableTransaction mtx;
+    CreatePsbt(PickCoin(), 1 + i % 20, {}, mtx);
+  }
+
+  // Broadcast a transaction, then a fee bump of it spending the same coin
+  void Replace(int i) {
+    const Coin& coin = PickCoin();
+    CMutableTransaction original;
+    std::string original_id = CreatePsbt(coin, 1 + i % 10, {}, original);
+    for (auto&& input : original.vin) AddWitness(input);
+    db_.UpdateTransaction(EncodeHexTx(CTransaction(original)), 0, 0, {});
+    CMutableTransaction bump;
+    CreatePsbt(coin, 20 + i % 10, original_id, bump);
+    for (auto&& input : bump.vin) AddWitness(input);
+    db_.UpdateTransaction(EncodeHexTx(CTransaction(bump)), 0, 0, {});
+  }
+
+  const WalletSpec& spec_;
+  GeneratedWallet& wallet_;
+  GeneratorDb& db_;
+  std::mt19937_64 rng_;
+  std::vector<Coin> coins_;
+};
+
+}  // namespace
+
+GeneratedWallet GenerateWallet(const std::string& datadir,
+                               const std::string& passphrase,
+                               const WalletSpec& spec) {
+  CoreUtils::getInstance().SetChain(Chain::TESTNET);
+  std::stringstream fingerprint;
+  fingerprint << std::hex << std::setw(8) << std::setfill('0')
+              << (spec.seed & 0xffffffff);
+  SingleSigner signer(spec.name, TPUB, {},
+                      "m/84h/1h/" + std::to_string(spec.seed % 0x80000000) +
+                          "h",
+                      fingerprint.str(), 0);
+
+  GeneratedWallet rs;
+  {
+    NunchukStorage storage(datadir, passphrase);
+    auto wallet = storage.CreateWallet(Chain::TESTNET, spec.name, 1, 1,
+                                       {signer}, AddressType::NATIVE_SEGWIT,
+                                       false, "generated by datagen");
+    rs.id = wallet.get_id();
+    rs.descriptor = storage.GetDescriptor(Chain::TESTNET, rs.id, false);
+  }
+  rs.file = (boost::filesystem::system_complete(datadir) / "testnet" /
+             "wallets" / rs.id)
+                .string();
+
+  GeneratorDb db{Chain::TESTNET, rs.id, rs.file, passphrase};
+  db.Exec("BEGIN TRANSACTION;");
+  Generator(spec, rs, db).Run();
+  db.Exec("COMMIT;");
+  return rs;
+}
+
+}  // namespace datagen
+}  // namespace nunchuk
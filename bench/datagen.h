@@ -0,0 +1,54 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_BENCH_DATAGEN_H
+#define NUNCHUK_BENCH_DATAGEN_H
+
+#include <nunchuk.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nunchuk {
+namespace datagen {
+
+// Shape of a generated testnet single-sig wallet. Transactions are confirmed
+// one per block and keep the wallet's coin count at `utxos` once it has been
+// reached
+struct WalletSpec {
+  std::string name = "datagen";
+  // Derived and stored for both the receive and the change chain
+  int addresses = 100;
+  int transactions = 1000;
+  int utxos = 100;
+  // Unsigned PSBTs (height -1) spending current coins
+  int drafts = 0;
+  // Pending transactions bumped by a second pending transaction
+  int replaced = 0;
+  uint64_t seed = 1;
+};
+
+struct GeneratedWallet {
+  std::string id;
+  std::string file;
+  std::string descriptor;
+  std::vector<std::string> addresses;
+  std::vector<std::string> change_addresses;
+  std::vector<std::string> tx_ids;
+  int utxo_count = 0;
+};
+
+// Create a wallet in the storage at datadir and fill it. An empty passphrase
+// creates an unencrypted db. The wallet is created through NunchukStorage;
+// its history is then written with a single keyed open, in one SQL
+// transaction, using the same NunchukWalletDb calls the synchronizer uses.
+GeneratedWallet GenerateWallet(const std::string& datadir,
+                               const std::string& passphrase,
+                               const WalletSpec& spec);
+
+}  // namespace datagen
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_BENCH_DATAGEN_H
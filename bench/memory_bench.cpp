@@ -0,0 +1,170 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Usage: memory_bench [transactions]
+//
+// Builds a transaction history and its coins the way storage does, then
+// reports heap allocations and resident memory per transaction, and the CPU
+// time to build the history and to walk it with the vector getters and with
+// the element accessors. Run it on two builds to compare Transaction /
+// UnspentOutput layouts.
+
+#include <nunchuk.h>
+
+#include <malloc.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace nunchuk;
+
+static std::atomic<long> live_allocations{0};
+static std::atomic<long> live_bytes{0};
+static std::atomic<long> total_allocations{0};
+
+void* operator new(size_t size) {
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  live_allocations++;
+  total_allocations++;
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (p == nullptr) return;
+  live_allocations--;
+  live_bytes -= malloc_usable_size(p);
+  std::free(p);
+}
+
+static long ReadRssKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) return std::stol(line.substr(6));
+  }
+  return 0;
+}
+
+// Deterministic lowercase hex, like the txids storage reads back
+static std::string Hash(long seed) {
+  char buf[65];
+  unsigned long x = seed * 2654435761ul + 1;
+  for (int i = 0; i < 64; i++) {
+    x = x * 6364136223846793005ul + 1442695040888963407ul;
+    buf[i] = "0123456789abcdef"[(x >> 60) & 0xf];
+  }
+  buf[64] = '\0';
+  return buf;
+}
+
+static std::string Address(long seed) {
+  return "tb1q" + Hash(seed).substr(0, 38);
+}
+
+// Nanoseconds and heap allocations per transaction of one pass of f
+template <typename F>
+static void Measure(const char* name, long count, F f) {
+  long allocations_before = total_allocations;
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  long allocations = total_allocations - allocations_before;
+  std::cout << std::left << std::setw(14) << name << std::right
+            << std::setw(10) << double(ns) / count << " ns per tx, "
+            << double(allocations) / count << " allocations per tx"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  long count = argc > 1 ? std::atol(argv[1]) : 50000;
+  // Most outputs pay to a small set of wallet addresses
+  const long wallet_addresses = 200;
+
+  std::vector<std::string> addresses;
+  for (long i = 0; i < wallet_addresses; i++) addresses.push_back(Address(i));
+
+  long rss_before = ReadRssKb();
+  long allocations_before = live_allocations;
+  long bytes_before = live_bytes;
+  auto build_start = std::chrono::steady_clock::now();
+  std::vector<Transaction> history;
+  std::vector<UnspentOutput> coins;
+  history.reserve(count);
+  coins.reserve(count);
+  for (long i = 0; i < count; i++) {
+    Transaction tx;
+    tx.set_txid(Hash(1000000 + i));
+    tx.set_height(i);
+    tx.add_input({Hash(2000000 + i), 0});
+    tx.add_input({Hash(3000000 + i), 1});
+    const std::string& mine = addresses[i % wallet_addresses];
+    tx.add_output({mine, 10000 + i});
+    tx.add_output({Address(4000000 + i), 20000 + i});
+    tx.add_receive_output({mine, 10000 + i});
+    tx.set_signer("a1b2c3d4", true);
+    tx.set_signer("e5f6a7b8", false);
+    tx.set_m(1);
+    history.push_back(std::move(tx));
+
+    UnspentOutput coin;
+    coin.set_txid(Hash(1000000 + i));
+    coin.set_vout(0);
+    coin.set_address(mine);
+    coin.set_amount(10000 + i);
+    coin.set_height(i);
+    coins.push_back(std::move(coin));
+  }
+  auto build_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - build_start)
+                      .count();
+  long allocations = live_allocations - allocations_before;
+  long bytes = live_bytes - bytes_before;
+  long rss = ReadRssKb() - rss_before;
+
+  std::cout << count << " transactions and coins" << std::endl
+            << std::fixed << std::setprecision(2) << "heap blocks   "
+            << std::setw(10) << allocations << " ("
+            << double(allocations) / count << " per tx)" << std::endl
+            << "heap bytes    " << std::setw(10) << bytes << " ("
+            << double(bytes) / count << " per tx)" << std::endl
+            << "rss           " << std::setw(10) << rss << " KiB ("
+            << rss * 1024.0 / count << " bytes per tx)" << std::endl
+            << "build         " << std::setw(10) << double(build_ns) / count
+            << " ns per tx" << std::endl;
+
+  // What storage does per transaction: sum the outputs and look up inputs
+  Amount sum = 0;
+  size_t txid_chars = 0;
+  Measure("read vectors", count, [&] {
+    for (auto&& tx : history) {
+      for (auto&& output : tx.get_outputs()) sum += output.second;
+      for (auto&& input : tx.get_inputs()) txid_chars += input.first.size();
+    }
+  });
+  Measure("read elements", count, [&] {
+    for (auto&& tx : history) {
+      for (size_t i = 0; i < tx.get_output_count(); i++) {
+        sum += tx.get_output_amount(i);
+      }
+      for (size_t i = 0; i < tx.get_input_count(); i++) {
+        txid_chars += tx.get_input_txid(i).size();
+      }
+    }
+  });
+  // Keeps the passes from being optimized out
+  if (sum == 0 && txid_chars == 0) std::cout << std::endl;
+  return 0;
+}
@@ -0,0 +1,258 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Usage: microbench [--filter=<substring>] [--min-time=<seconds>]
+//                   [--json=<file>]
+//
+// Microbenchmarks for storage, coin selection, descriptors, address
+// derivation and Electrum message parsing. Wallet databases come from
+// datagen in a temporary directory, nothing touches the network.
+
+#include "benchmark.h"
+#include "datagen.h"
+
+#include <coinselector.h>
+#include <coreutils.h>
+#include <descriptor.h>
+#include <iostats.h>
+#include <storage.h>
+#include <utils/json.hpp>
+
+#include <uint256.h>
+
+#include <boost/filesystem.hpp>
+
+#include <memory>
+#include <random>
+
+using namespace nunchuk;
+using namespace nunchuk::bench;
+using json = nlohmann::json;
+
+namespace {
+
+const std::string PASSPHRASE = "microbench-passphrase";
+
+boost::filesystem::path TempDir() {
+  static struct Dir {
+    Dir()
+        : path(boost::filesystem::temp_directory_path() /
+               boost::filesystem::unique_path("nunchuk-microbench-%%%%%%")) {
+      boost::filesystem::create_directories(path);
+    }
+    ~Dir() {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(path, ec);
+    }
+    boost::filesystem::path path;
+  } dir;
+  return dir.path;
+}
+
+std::vector<SingleSigner> MakeSigners(int n) {
+  const std::string tpub =
+      "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5"
+      "AoysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL";
+  std::vector<SingleSigner> signers;
+  for (int i = 0; i < n; i++) {
+    signers.push_back(SingleSigner("signer" + std::to_string(i), tpub, {},
+                                   "m/48h/1h/" + std::to_string(i) + "h/2h",
+                                   "0b93c5" + std::to_string(10 + i), 0));
+  }
+  return signers;
+}
+
+// Electrum listunspent result
+json MakeUtxos(std::mt19937_64& rng, int count, int height) {
+  json utxos = json::array();
+  for (int i = 0; i < count; i++) {
+    uint256 hash;
+    for (auto it = hash.begin(); it != hash.end(); ++it) *it = rng() & 0xff;
+    utxos.push_back({{"tx_hash", hash.GetHex()},
+                     {"tx_pos", i},
+                     {"height", height},
+                     {"value", 10000 + rng() % 1000000}});
+  }
+  return utxos;
+}
+
+// Unencrypted generated wallet with tx_count transactions, half as many
+// coins, built once per size
+struct WalletFixture {
+  datagen::GeneratedWallet wallet;
+
+  static datagen::GeneratedWallet Generate(int tx_count,
+                                           const std::string& passphrase) {
+    auto datadir = TempDir() / ((passphrase.empty() ? "plain-" : "keyed-") +
+                                std::to_string(tx_count));
+    boost::filesystem::create_directories(datadir);
+    datagen::WalletSpec spec;
+    spec.addresses = 200;
+    spec.transactions = tx_count;
+    spec.utxos = tx_count / 2;
+    spec.seed = tx_count;
+    return datagen::GenerateWallet(datadir.string(), passphrase, spec);
+  }
+
+  NunchukWalletDb Open() const {
+    return NunchukWalletDb{Chain::TESTNET, wallet.id, wallet.file, ""};
+  }
+
+  static const WalletFixture& Get(int tx_count) {
+    static std::map<int, std::unique_ptr<WalletFixture>> fixtures;
+    auto& fixture = fixtures[tx_count];
+    if (!fixture) fixture.reset(new WalletFixture{Generate(tx_count, "")});
+    return *fixture;
+  }
+};
+
+void OpenPlain(State& state) {
+  auto& fixture = WalletFixture::Get(100);
+  while (state.KeepRunning()) fixture.Open();
+}
+
+// Keyed open, dominated by the passphrase KDF
+void OpenEncrypted(State& state) {
+  static auto wallet = WalletFixture::Generate(100, PASSPHRASE);
+  while (state.KeepRunning()) {
+    NunchukWalletDb db{Chain::TESTNET, wallet.id, wallet.file, PASSPHRASE};
+  }
+}
+
+void GetWallet(State& state) {
+  auto db = WalletFixture::Get(1000).Open();
+  while (state.KeepRunning()) db.GetWallet();
+}
+
+void UpdateTransactionMemo(State& state) {
+  auto& fixture = WalletFixture::Get(1000);
+  auto db = fixture.Open();
+  int i = 0;
+  while (state.KeepRunning()) {
+    auto& tx_ids = fixture.wallet.tx_ids;
+    db.UpdateTransactionMemo(tx_ids[i % tx_ids.size()],
+                             "memo " + std::to_string(i));
+    i++;
+  }
+}
+
+void SetUtxos(State& state) {
+  auto& fixture = WalletFixture::Get(1000);
+  auto db = fixture.Open();
+  std::mt19937_64 rng(1);
+  // Alternate so every call is a real update
+  std::string utxos[] = {MakeUtxos(rng, 5, 100).dump(),
+                         MakeUtxos(rng, 5, 100).dump()};
+  int i = 0;
+  while (state.KeepRunning()) {
+    db.SetUtxos(fixture.wallet.addresses[0], utxos[i++ % 2]);
+  }
+}
+
+std::function<void(State&)> GetTransactions(int tx_count) {
+  return [tx_count](State& state) {
+    auto db = WalletFixture::Get(tx_count).Open();
+    state.SetItemsPerIteration(tx_count);
+    while (state.KeepRunning()) db.GetTransactions(tx_count, 0);
+  };
+}
+
+std::function<void(State&)> GetUnspentOutputs(int tx_count) {
+  return [tx_count](State& state) {
+    auto& fixture = WalletFixture::Get(tx_count);
+    auto db = fixture.Open();
+    state.SetItemsPerIteration(fixture.wallet.utxo_count);
+    while (state.KeepRunning()) db.GetUnspentOutputs(false);
+  };
+}
+
+// Same reads on a connection opened by an API call, which traces every row
+// for GetLastCallIoStats
+std::function<void(State&)> GetTransactionsRowTraced(int tx_count) {
+  return [tx_count](State& state) {
+    static IoStatsScope::Sink sink("microbench");
+    IoStatsScope scope(sink);
+    auto db = WalletFixture::Get(tx_count).Open();
+    state.SetItemsPerIteration(tx_count);
+    while (state.KeepRunning()) db.GetTransactions(tx_count, 0);
+  };
+}
+
+void SelectCoins(State& state) {
+  auto& fixture = WalletFixture::Get(1000);
+  auto db = fixture.Open();
+  auto coins = db.GetUnspentOutputs(false);
+  Amount total = 0;
+  for (auto&& coin : coins) total += coin.get_amount();
+  std::string descriptors = GetDescriptorsImportString(
+      db.GetDescriptor(false), db.GetDescriptor(true));
+  std::string change_address = fixture.wallet.change_addresses[0];
+  CoinSelector selector{descriptors, change_address};
+  selector.set_fee_rate(CFeeRate(1000));
+  state.SetItemsPerIteration(coins.size());
+  while (state.KeepRunning()) {
+    std::vector<TxOutput> outputs = {{fixture.wallet.addresses[0], total / 3}};
+    std::vector<TxInput> inputs;
+    Amount fee = 0;
+    int change_pos = 0;
+    std::string error;
+    selector.Select(coins, {}, change_address, false, outputs, inputs, fee,
+                    error, change_pos);
+  }
+}
+
+void ParseMultisigDescriptor(State& state) {
+  std::string descriptor = GetDescriptorForSigners(
+      MakeSigners(3), 2, false, AddressType::NATIVE_SEGWIT,
+      WalletType::MULTI_SIG);
+  while (state.KeepRunning()) {
+    AddressType address_type;
+    WalletType wallet_type;
+    int m, n;
+    std::vector<SingleSigner> signers;
+    ParseDescriptors(descriptor, address_type, wallet_type, m, n, signers);
+  }
+}
+
+void DeriveAddress(State& state) {
+  auto& descriptor = WalletFixture::Get(100).wallet.descriptor;
+  int index = 0;
+  while (state.KeepRunning()) {
+    CoreUtils::getInstance().DeriveAddresses(descriptor, index++);
+  }
+}
+
+// One listunspent response line as read from the socket
+void ParseElectrumResponse(State& state) {
+  std::mt19937_64 rng(2);
+  json response = {{"jsonrpc", "2.0"}, {"id", 1},
+                   {"result", MakeUtxos(rng, 100, 700000)}};
+  std::string message = response.dump();
+  state.SetItemsPerIteration(100);
+  while (state.KeepRunning()) {
+    json parsed = json::parse(message);
+    int id = parsed["id"];
+    (void)id;
+  }
+}
+
+}  // namespace
+
+BENCHMARK("storage/open_plain", OpenPlain);
+BENCHMARK("storage/open_encrypted", OpenEncrypted);
+BENCHMARK("storage/GetWallet", GetWallet);
+BENCHMARK("storage/UpdateTransactionMemo", UpdateTransactionMemo);
+BENCHMARK("storage/SetUtxos", SetUtxos);
+BENCHMARK("storage/GetTransactions/1000", GetTransactions(1000));
+BENCHMARK("storage/GetTransactions/10000", GetTransactions(10000));
+BENCHMARK("storage/GetTransactions/10000/row_trace",
+          GetTransactionsRowTraced(10000));
+BENCHMARK("storage/GetUnspentOutputs/1000", GetUnspentOutputs(1000));
+BENCHMARK("storage/GetUnspentOutputs/10000", GetUnspentOutputs(10000));
+BENCHMARK("coinselector/Select/1000", SelectCoins);
+BENCHMARK("descriptor/ParseDescriptors/2of3", ParseMultisigDescriptor);
+BENCHMARK("coreutils/DeriveAddresses", DeriveAddress);
+BENCHMARK("electrum/parse_listunspent/100", ParseElectrumResponse);
+
+int main(int argc, char** argv) { return Main(argc, argv); }
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Usage: startup_bench [wallets] [runs]
+//
+// Creates a storage with many single-sig wallets, then measures the time to
+// construct a Nunchuk instance and list its wallets, with and without warm
+// start. The Electrum server is unreachable so only local work is timed.
+
+#include <nunchuk.h>
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace nunchuk;
+
+static const std::string PASSPHRASE = "startup-bench-passphrase";
+static const std::string TPUB =
+    "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5A"
+    "oysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL";
+
+static AppSettings MakeSettings(const std::string& storage_path,
+                                bool warm_start) {
+  AppSettings settings;
+  settings.set_chain(Chain::TESTNET);
+  // Nothing listens here, the synchronizer keeps retrying in the background
+  settings.set_testnet_servers({"127.0.0.1:1"});
+  settings.set_storage_path(storage_path);
+  settings.enable_proxy(false);
+  settings.enable_warm_start(warm_start);
+  return settings;
+}
+
+static void CreateWallets(const std::string& storage_path, int wallets) {
+  auto nu = MakeNunchuk(MakeSettings(storage_path, false), PASSPHRASE);
+  for (int i = 0; i < wallets; i++) {
+    std::stringstream fingerprint;
+    fingerprint << std::hex << std::setw(8) << std::setfill('0') << i;
+    auto signer = nu->CreateSigner("signer-" + std::to_string(i), TPUB, {},
+                                   "m/84h/1h/" + std::to_string(i) + "h",
+                                   fingerprint.str());
+    nu->CreateWallet("wallet-" + std::to_string(i), 1, 1, {signer},
+                     AddressType::NATIVE_SEGWIT, false);
+  }
+}
+
+int main(int argc, char** argv) {
+  int wallets = argc > 1 ? std::stoi(argv[1]) : 50;
+  int runs = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  auto root = boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("nunchuk-startup-%%%%%%");
+  boost::filesystem::create_directories(root);
+  std::cout << wallets << " wallets, " << runs << " runs, storage "
+            << root.string() << std::endl;
+  CreateWallets(root.string(), wallets);
+
+  auto clock = std::chrono::steady_clock::now;
+  auto ms = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  for (bool warm_start : {false, true}) {
+    // Prime the snapshot, it holds the wallets read before shutdown
+    if (warm_start) {
+      MakeNunchuk(MakeSettings(root.string(), true), PASSPHRASE)->GetWallets();
+    }
+    double open_ms = 0, list_ms = 0;
+    size_t stale = 0;
+    for (int i = 0; i < runs; i++) {
+      auto start = clock();
+      auto nu =
+          MakeNunchuk(MakeSettings(root.string(), warm_start), PASSPHRASE);
+      auto opened = clock();
+      auto list = nu->GetWallets();
+      auto listed = clock();
+      open_ms += ms(opened - start);
+      list_ms += ms(listed - opened);
+      for (auto&& wallet : list) stale += wallet.is_stale();
+    }
+    std::cout << std::left << std::setw(5) << (warm_start ? "warm" : "cold")
+              << std::right << std::fixed << std::setprecision(2) << " open "
+              << std::setw(9) << open_ms / runs << " ms  first GetWallets "
+              << std::setw(9) << list_ms / runs << " ms  stale "
+              << stale / runs << "/" << wallets << std::endl;
+  }
+
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(root, ec);
+  return 0;
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Usage: tenant_bench [tenants] [electrum server] [--no-shared]
+//
+// Opens many Nunchuk instances in one process, each with its own storage and
+// passphrase, and reports resident memory, open descriptors and CPU time per
+// instance while creating them, idling and serving a light workload.
+
+#include <nunchuk.h>
+
+#include <boost/filesystem.hpp>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nunchuk;
+
+static const int IDLE_SECOND = 30;
+
+struct Usage {
+  long rss_kb;
+  long fds;
+  double cpu_ms;
+};
+
+static long ReadRssKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) return std::stol(line.substr(6));
+  }
+  // Not Linux, fall back to the peak
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static long CountFds() {
+  boost::system::error_code ec;
+  boost::filesystem::directory_iterator it("/proc/self/fd", ec), end;
+  if (ec) return -1;
+  return std::distance(it, end);
+}
+
+static Usage Measure() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+                  (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+  return {ReadRssKb(), CountFds(), cpu_ms};
+}
+
+static void Report(const std::string& phase, const Usage& before,
+                   const Usage& after, int tenants, double wall_ms) {
+  std::cout << std::left << std::setw(10) << phase << std::right << std::fixed
+            << std::setprecision(2) << " rss " << std::setw(9)
+            << after.rss_kb / 1024.0 << " MiB (" << std::setw(7)
+            << double(after.rss_kb - before.rss_kb) / tenants
+            << " KiB/tenant)  fds " << std::setw(6) << after.fds << "  cpu "
+            << std::setw(9) << after.cpu_ms - before.cpu_ms << " ms ("
+            << std::setw(7) << (after.cpu_ms - before.cpu_ms) / tenants
+            << " ms/tenant)  wall " << std::setw(9) << wall_ms << " ms"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int tenants = 1000;
+  std::string server = "127.0.0.1:50001";
+  bool shared = true;
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--no-shared") == 0) {
+      shared = false;
+    } else if (positional++ == 0) {
+      tenants = std::stoi(argv[i]);
+    } else {
+      server = argv[i];
+    }
+  }
+
+  auto root = boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("nunchuk-tenants-%%%%%%");
+  std::cout << tenants << " tenants, server " << server << ", "
+            << (shared ? "shared" : "dedicated") << " backend, storage "
+            << root.string() << std::endl;
+
+  auto clock = std::chrono::steady_clock::now;
+  auto elapsed_ms = [&](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock() - start).count();
+  };
+
+  Usage base = Measure();
+  auto start = clock();
+  std::vector<std::unique_ptr<Nunchuk>> instances;
+  for (int i = 0; i < tenants; i++) {
+    auto dir = root / std::to_string(i);
+    boost::filesystem::create_directories(dir);
+    AppSettings settings;
+    settings.set_chain(Chain::TESTNET);
+    settings.set_testnet_servers({server});
+    settings.set_storage_path(dir.string());
+    settings.enable_proxy(false);
+    settings.enable_shared_backend(shared);
+    instances.push_back(
+        MakeNunchuk(settings, "tenant-passphrase-" + std::to_string(i)));
+  }
+  Usage created = Measure();
+  Report("create", base, created, tenants, elapsed_ms(start));
+
+  start = clock();
+  std::this_thread::sleep_for(std::chrono::seconds(IDLE_SECOND));
+  Usage idle = Measure();
+  Report("idle", created, idle, tenants, elapsed_ms(start));
+
+  start = clock();
+  for (auto&& nu : instances) {
+    nu->GetWallets();
+    nu->GetChainTip();
+  }
+  Usage work = Measure();
+  Report("workload", idle, work, tenants, elapsed_ms(start));
+
+  start = clock();
+  instances.clear();
+  Report("destroy", work, Measure(), tenants, elapsed_ms(start));
+
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(root, ec);
+  return 0;
+}
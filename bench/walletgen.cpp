@@ -0,0 +1,81 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Usage: walletgen <datadir> [--passphrase=<p>] [--name=<n>]
+//                  [--addresses=<n>] [--transactions=<n>] [--utxos=<n>]
+//                  [--drafts=<n>] [--replaced=<n>] [--seed=<n>]
+//
+// Creates a testnet wallet with a synthetic history in the storage at
+// datadir, e.g. to reproduce a 50k transaction wallet. Open it with the same
+// datadir and passphrase.
+
+#include "datagen.h"
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace nunchuk;
+
+static bool ParseFlag(const std::string& arg, const std::string& name,
+                      std::string& value) {
+  std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || std::string(argv[1]).compare(0, 2, "--") == 0) {
+    std::cerr << "usage: walletgen <datadir> [--passphrase=] [--name=] "
+                 "[--addresses=] [--transactions=] [--utxos=] [--drafts=] "
+                 "[--replaced=] [--seed=]"
+              << std::endl;
+    return 1;
+  }
+  std::string datadir = argv[1];
+  std::string passphrase;
+  datagen::WalletSpec spec;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i], value;
+    if (ParseFlag(arg, "passphrase", value)) {
+      passphrase = value;
+    } else if (ParseFlag(arg, "name", value)) {
+      spec.name = value;
+    } else if (ParseFlag(arg, "addresses", value)) {
+      spec.addresses = std::stoi(value);
+    } else if (ParseFlag(arg, "transactions", value)) {
+      spec.transactions = std::stoi(value);
+    } else if (ParseFlag(arg, "utxos", value)) {
+      spec.utxos = std::stoi(value);
+    } else if (ParseFlag(arg, "drafts", value)) {
+      spec.drafts = std::stoi(value);
+    } else if (ParseFlag(arg, "replaced", value)) {
+      spec.replaced = std::stoi(value);
+    } else if (ParseFlag(arg, "seed", value)) {
+      spec.seed = std::stoull(value);
+    } else {
+      std::cerr << "unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+  if (spec.addresses < 1) {
+    std::cerr << "--addresses must be at least 1" << std::endl;
+    return 1;
+  }
+
+  boost::filesystem::create_directories(datadir);
+  auto start = std::chrono::steady_clock::now();
+  auto wallet = datagen::GenerateWallet(datadir, passphrase, spec);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "wallet " << wallet.id << "\n"
+            << "file " << wallet.file << "\n"
+            << "transactions " << wallet.tx_ids.size() << "\n"
+            << "utxos " << wallet.utxo_count << "\n"
+            << "seconds " << elapsed.count() << std::endl;
+  return 0;
+}
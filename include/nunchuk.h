@@ -7,7 +7,9 @@
 
 #define NUNCHUK_EXPORT
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -71,6 +73,19 @@ enum class ExportFormat {
   COLDCARD,
 };
 
+enum class MetricsFormat {
+  JSON,
+  PROMETHEUS,
+};
+
+enum class LogSubsystem {
+  API,
+  STORAGE,
+  NETWORK,
+  HWI,
+  SYNC,
+};
+
 enum class Unit {
   BTC,
   SATOSHI,
@@ -111,6 +126,7 @@ class NUNCHUK_EXPORT NunchukException : public BaseException {
   static const int INVALID_CHAIN = -1016;
   static const int INVALID_PARAMETER = -1017;
   static const int CREATE_DUMMY_SIGNATURE_ERROR = -1018;
+  static const int OPERATION_CANCELLED = -1019;
   using BaseException::BaseException;
 };
 
@@ -123,6 +139,7 @@ class NUNCHUK_EXPORT StorageException : public BaseException {
   static const int INVALID_DATADIR = -2006;
   static const int SQL_ERROR = -2007;
   static const int WALLET_EXISTED = -2008;
+  static const int INVALID_BACKUP = -2009;
   using BaseException::BaseException;
 };
 
@@ -181,10 +198,10 @@ class NUNCHUK_EXPORT Device {
          bool needs_pass_phrase_sent, bool needs_pin_sent,
          bool initialized = true);
 
-  std::string get_type() const;
-  std::string get_path() const;
-  std::string get_model() const;
-  std::string get_master_fingerprint() const;
+  std::string const& get_type() const;
+  std::string const& get_path() const;
+  std::string const& get_model() const;
+  std::string const& get_master_fingerprint() const;
   bool connected() const;
   bool needs_pass_phrase_sent() const;
   bool needs_pin_sent() const;
@@ -209,12 +226,12 @@ class NUNCHUK_EXPORT SingleSigner {
                const std::string& master_fingerprint, time_t last_health_check,
                const std::string& master_signer_id = {});
 
-  std::string get_name() const;
-  std::string get_xpub() const;
-  std::string get_public_key() const;
-  std::string get_derivation_path() const;
-  std::string get_master_fingerprint() const;
-  std::string get_master_signer_id() const;
+  std::string const& get_name() const;
+  std::string const& get_xpub() const;
+  std::string const& get_public_key() const;
+  std::string const& get_derivation_path() const;
+  std::string const& get_master_fingerprint() const;
+  std::string const& get_master_signer_id() const;
   bool has_master_signer() const;
   time_t get_last_health_check() const;
   void set_name(const std::string& value);
@@ -234,9 +251,9 @@ class NUNCHUK_EXPORT MasterSigner {
   MasterSigner(const std::string& id, const Device& device,
                time_t last_health_check);
 
-  std::string get_id() const;
-  std::string get_name() const;
-  Device get_device() const;
+  std::string const& get_id() const;
+  std::string const& get_name() const;
+  Device const& get_device() const;
   time_t get_last_health_check() const;
   void set_name(const std::string& value);
 
@@ -249,23 +266,26 @@ class NUNCHUK_EXPORT MasterSigner {
 
 class NUNCHUK_EXPORT Wallet {
  public:
-  Wallet(const std::string& id, int m, int n,
-         const std::vector<SingleSigner>& signers, AddressType address_type,
-         bool is_escrow, time_t create_date);
+  Wallet(const std::string& id, int m, int n, std::vector<SingleSigner> signers,
+         AddressType address_type, bool is_escrow, time_t create_date);
 
-  std::string get_id() const;
-  std::string get_name() const;
+  std::string const& get_id() const;
+  std::string const& get_name() const;
   int get_m() const;
   int get_n() const;
-  std::vector<SingleSigner> get_signers() const;
+  std::vector<SingleSigner> const& get_signers() const;
   AddressType get_address_type() const;
   bool is_escrow() const;
   Amount get_balance() const;
   time_t get_create_date() const;
-  std::string get_description() const;
+  std::string const& get_description() const;
+  // Not synced with the chain since the app started; the balance may be
+  // out of date
+  bool is_stale() const;
   void set_name(const std::string& value);
   void set_balance(const Amount& value);
   void set_description(const std::string& value);
+  void set_stale(bool value);
 
  private:
   std::string id_;
@@ -278,8 +298,42 @@ class NUNCHUK_EXPORT Wallet {
   Amount balance_;
   time_t create_date_;
   std::string description_;
+  bool stale_;
+};
+
+namespace detail {
+
+// Address string shared by every holder of an equal address. The pool drops
+// an address once its last holder is gone
+class NUNCHUK_EXPORT InternedString {
+ public:
+  InternedString();
+  explicit InternedString(const std::string& value);
+
+  const std::string& str() const;
+
+ private:
+  std::shared_ptr<const std::string> value_;
+};
+
+// Txid held as 32 bytes when it is lowercase hex, as text otherwise, so a
+// large history does not allocate a 64-char string per hash
+class NUNCHUK_EXPORT CompactHash {
+ public:
+  CompactHash();
+  explicit CompactHash(const std::string& value);
+
+  std::string str() const;
+  bool empty() const;
+
+ private:
+  unsigned char bytes_[32];
+  InternedString text_;
+  bool binary_;
 };
 
+}  // namespace detail
+
 // Class that represents an Unspent Transaction Output (UTXO)
 class NUNCHUK_EXPORT UnspentOutput {
  public:
@@ -287,7 +341,7 @@ class NUNCHUK_EXPORT UnspentOutput {
 
   std::string get_txid() const;
   int get_vout() const;
-  std::string get_address() const;
+  std::string const& get_address() const;
   Amount get_amount() const;
   int get_height() const;
 
@@ -298,28 +352,30 @@ class NUNCHUK_EXPORT UnspentOutput {
   void set_height(int value);
 
  private:
-  std::string txid_;
+  detail::CompactHash txid_;
   int vout_;
-  std::string address_;
+  detail::InternedString address_;
   Amount amount_;
   int height_;
 };
 
-// Class that represents a Transaction
+// Class that represents a Transaction. Inputs, outputs and signers are kept
+// in a compact form and built on each call to their getters; loops over
+// them should use the counts and element accessors instead
 class Transaction {
  public:
   Transaction();
 
   std::string get_txid() const;
   int get_height() const;
-  std::vector<TxInput> const& get_inputs() const;
-  std::vector<TxOutput> const& get_outputs() const;
-  std::vector<TxOutput> const& get_user_outputs() const;
-  std::vector<TxOutput> const& get_receive_outputs() const;
+  std::vector<TxInput> get_inputs() const;
+  std::vector<TxOutput> get_outputs() const;
+  std::vector<TxOutput> get_user_outputs() const;
+  std::vector<TxOutput> get_receive_outputs() const;
   int get_change_index() const;
   int get_m() const;
-  std::map<std::string, bool> const& get_signers() const;
-  std::string get_memo() const;
+  std::map<std::string, bool> get_signers() const;
+  std::string const& get_memo() const;
   TransactionStatus get_status() const;
   std::string get_replaced_by_txid() const;
   Amount get_fee() const;
@@ -328,6 +384,19 @@ class Transaction {
   bool subtract_fee_from_amount() const;
   bool is_receive() const;
   Amount get_sub_amount() const;
+  // Sizes of the above without building them
+  size_t get_input_count() const;
+  size_t get_output_count() const;
+  size_t get_user_output_count() const;
+  size_t get_receive_output_count() const;
+  size_t get_signer_count() const;
+  // Element i of get_inputs(), get_outputs() and get_signers(). Output
+  // addresses and signer ids are returned without a copy
+  std::string get_input_txid(size_t i) const;
+  int get_input_vout(size_t i) const;
+  std::string const& get_output_address(size_t i) const;
+  Amount get_output_amount(size_t i) const;
+  std::string const& get_signer_id(size_t i) const;
 
   void set_txid(const std::string& value);
   void set_height(int value);
@@ -349,18 +418,23 @@ class Transaction {
   void set_sub_amount(const Amount& value);
 
  private:
-  std::string txid_;
+  typedef std::pair<detail::CompactHash, int> Input;
+  typedef std::pair<detail::InternedString, Amount> Output;
+  static std::vector<TxOutput> ToTxOutputs(const std::vector<Output>& value);
+
+  detail::CompactHash txid_;
   int height_;
-  std::vector<TxInput> inputs_;
-  std::vector<TxOutput> outputs_;
-  std::vector<TxOutput> user_outputs_;
-  std::vector<TxOutput> receive_output_;
+  std::vector<Input> inputs_;
+  std::vector<Output> outputs_;
+  std::vector<Output> user_outputs_;
+  std::vector<Output> receive_output_;
   int change_index_;
   int m_;
-  std::map<std::string, bool> signers_;
+  // Sorted by signer id
+  std::vector<std::pair<std::string, bool>> signers_;
   std::string memo_;
   TransactionStatus status_;
-  std::string replaced_by_txid_;
+  detail::CompactHash replaced_by_txid_;
   Amount fee_;
   Amount fee_rate_;
   time_t blocktime_;
@@ -369,21 +443,124 @@ class Transaction {
   Amount sub_amount_;
 };
 
+// What changed in a wallet after a change sequence number. Clients replace
+// the listed transactions, drop the removed ones, and replace every coin at
+// the utxo addresses with utxos.
+class NUNCHUK_EXPORT WalletChanges {
+ public:
+  WalletChanges();
+
+  // Sequence number to pass to the next GetWalletChanges call
+  int64_t get_seq() const;
+  std::vector<Transaction> const& get_transactions() const;
+  std::vector<std::string> const& get_removed_transactions() const;
+  // Addresses added or marked used
+  std::vector<std::string> const& get_addresses() const;
+  std::vector<std::string> const& get_utxo_addresses() const;
+  std::vector<UnspentOutput> const& get_utxos() const;
+
+  void set_seq(int64_t value);
+  void set_transactions(const std::vector<Transaction>& value);
+  void set_removed_transactions(const std::vector<std::string>& value);
+  void set_addresses(const std::vector<std::string>& value);
+  void set_utxo_addresses(const std::vector<std::string>& value);
+  void set_utxos(const std::vector<UnspentOutput>& value);
+  void set_transactions(std::vector<Transaction>&& value);
+  void set_removed_transactions(std::vector<std::string>&& value);
+  void set_addresses(std::vector<std::string>&& value);
+  void set_utxo_addresses(std::vector<std::string>&& value);
+  void set_utxos(std::vector<UnspentOutput>&& value);
+
+ private:
+  int64_t seq_;
+  std::vector<Transaction> transactions_;
+  std::vector<std::string> removed_transactions_;
+  std::vector<std::string> addresses_;
+  std::vector<std::string> utxo_addresses_;
+  std::vector<UnspentOutput> utxos_;
+};
+
+// Storage work done by one public API call: wallet, signer and app state
+// db opens, passphrase key derivations, SQL statements run and rows read
+class NUNCHUK_EXPORT IoStats {
+ public:
+  IoStats();
+
+  // Name of the API method, empty before the first call
+  std::string const& get_call() const;
+  int64_t get_db_opens() const;
+  int64_t get_key_derivations() const;
+  int64_t get_statements() const;
+  int64_t get_rows_read() const;
+
+  void set_call(const std::string& value);
+  void set_db_opens(int64_t value);
+  void set_key_derivations(int64_t value);
+  void set_statements(int64_t value);
+  void set_rows_read(int64_t value);
+
+ private:
+  std::string call_;
+  int64_t db_opens_;
+  int64_t key_derivations_;
+  int64_t statements_;
+  int64_t rows_read_;
+};
+
+// Confirmed wallet balance after a block with wallet activity
+class NUNCHUK_EXPORT BalancePoint {
+ public:
+  BalancePoint();
+
+  int get_height() const;
+  time_t get_blocktime() const;
+  Amount get_balance() const;
+
+  void set_height(int value);
+  void set_blocktime(time_t value);
+  void set_balance(Amount value);
+
+ private:
+  int height_;
+  time_t blocktime_;
+  Amount balance_;
+};
+
 class NUNCHUK_EXPORT AppSettings {
  public:
   AppSettings();
 
   Chain get_chain() const;
-  std::vector<std::string> get_mainnet_servers() const;
-  std::vector<std::string> get_testnet_servers() const;
-  std::string get_hwi_path() const;
-  std::string get_storage_path() const;
+  std::vector<std::string> const& get_mainnet_servers() const;
+  std::vector<std::string> const& get_testnet_servers() const;
+  std::string const& get_hwi_path() const;
+  std::string const& get_storage_path() const;
   bool use_proxy() const;
-  std::string get_proxy_host() const;
+  std::string const& get_proxy_host() const;
   int get_proxy_port() const;
-  std::string get_proxy_username() const;
-  std::string get_proxy_password() const;
-  std::string get_certificate_file() const;
+  std::string const& get_proxy_username() const;
+  std::string const& get_proxy_password() const;
+  std::string const& get_certificate_file() const;
+  // Threads of the shared executor, 0 means default. Only the settings of
+  // the first Nunchuk instance in the process take effect
+  int get_cpu_threads() const;
+  int get_io_threads() const;
+  // Threads for async API calls and chain sync, which mostly wait on
+  // devices and the Electrum server
+  int get_blocking_threads() const;
+  // Instances with the same server and proxy settings share one Electrum
+  // connection. Storage and passphrases stay per instance; all instances in
+  // the process must use the same chain
+  bool use_shared_backend() const;
+  // Serve metrics in Prometheus text format on 127.0.0.1:port, 0 disables
+  int get_metrics_port() const;
+  // Memory budget in bytes for caching wallets, coins, addresses and
+  // transaction history between reads, 0 disables the cache
+  int get_wallet_cache_size() const;
+  // Serve wallets from the snapshot saved at the last shutdown until the
+  // chain backend has synced them, see Wallet::is_stale. The snapshot is
+  // kept in the wallet cache, which gets a default budget if its size is 0
+  bool use_warm_start() const;
 
   void set_chain(Chain value);
   void set_mainnet_servers(const std::vector<std::string>& value);
@@ -396,6 +573,13 @@ class NUNCHUK_EXPORT AppSettings {
   void set_proxy_username(const std::string& value);
   void set_proxy_password(const std::string& value);
   void set_certificate_file(const std::string& value);
+  void set_cpu_threads(int value);
+  void set_io_threads(int value);
+  void set_blocking_threads(int value);
+  void enable_shared_backend(bool value);
+  void set_metrics_port(int value);
+  void set_wallet_cache_size(int value);
+  void enable_warm_start(bool value);
 
  private:
   Chain chain_;
@@ -409,6 +593,26 @@ class NUNCHUK_EXPORT AppSettings {
   std::string proxy_username_;
   std::string proxy_password_;
   std::string certificate_file_;
+  int cpu_threads_;
+  int io_threads_;
+  int blocking_threads_;
+  bool enable_shared_backend_;
+  int metrics_port_;
+  int wallet_cache_size_;
+  bool enable_warm_start_;
+};
+
+// Cooperative cancellation for the async API. Copies share the same state,
+// so keep one copy and pass another to the call.
+class NUNCHUK_EXPORT CancellationToken {
+ public:
+  CancellationToken();
+
+  void cancel();
+  bool is_cancelled() const;
+
+ private:
+  std::shared_ptr<std::atomic<bool>> cancelled_;
 };
 
 class NUNCHUK_EXPORT Nunchuk {
@@ -435,6 +639,20 @@ class NUNCHUK_EXPORT Nunchuk {
                             const std::string& file_path,
                             ExportFormat format) = 0;
   virtual Wallet ImportWalletDb(const std::string& file_path) = 0;
+  // Compressed backup, encrypted when passphrase is not empty. Restoring an
+  // interrupted restore again resumes where it stopped
+  virtual bool BackupWallet(const std::string& wallet_id,
+                            const std::string& file_path,
+                            const std::string& passphrase = {}) = 0;
+  virtual Wallet RestoreWallet(const std::string& file_path,
+                               const std::string& passphrase = {}) = 0;
+  // Only what changed since the last backup or delta of the wallet. Apply
+  // deltas in order onto the restored base backup
+  virtual bool BackupWalletDelta(const std::string& wallet_id,
+                                 const std::string& file_path,
+                                 const std::string& passphrase = {}) = 0;
+  virtual Wallet ApplyWalletDelta(const std::string& file_path,
+                                  const std::string& passphrase = {}) = 0;
   virtual Wallet ImportWalletDescriptor(const std::string& file_path,
                                         const std::string& name,
                                         const std::string& description = {}) = 0;
@@ -476,6 +694,11 @@ class NUNCHUK_EXPORT Nunchuk {
 
   virtual std::vector<Transaction> GetTransactionHistory(
       const std::string& wallet_id, int count, int skip) = 0;
+  // Balance over time, oldest first, without loading the history. With
+  // max_points > 0 at most that many points are returned, evenly spread and
+  // always including the latest
+  virtual std::vector<BalancePoint> GetBalanceHistory(
+      const std::string& wallet_id, int max_points = 0) = 0;
   virtual AppSettings GetAppSettings() = 0;
   virtual AppSettings UpdateAppSettings(const AppSettings& appSettings) = 0;
 
@@ -487,9 +710,10 @@ class NUNCHUK_EXPORT Nunchuk {
   virtual std::vector<UnspentOutput> GetUnspentOutputs(
       const std::string& wallet_id) = 0;
   virtual Transaction CreateTransaction(
-      const std::string& wallet_id, const std::map<std::string, Amount> outputs,
+      const std::string& wallet_id,
+      const std::map<std::string, Amount>& outputs,
       const std::string& memo = {},
-      const std::vector<UnspentOutput> inputs = {}, Amount fee_rate = -1,
+      const std::vector<UnspentOutput>& inputs = {}, Amount fee_rate = -1,
       bool subtract_fee_from_amount = false) = 0;
   virtual bool ExportTransaction(const std::string& wallet_id,
                                  const std::string& tx_id,
@@ -499,6 +723,12 @@ class NUNCHUK_EXPORT Nunchuk {
   virtual Transaction SignTransaction(const std::string& wallet_id,
                                       const std::string& tx_id,
                                       const Device& device) = 0;
+  // Sign with all devices concurrently and store the combined PSBT once.
+  // Signatures from devices that succeeded are kept even if another device
+  // fails; the first device error is rethrown afterwards.
+  virtual Transaction SignTransaction(const std::string& wallet_id,
+                                      const std::string& tx_id,
+                                      const std::vector<Device>& devices) = 0;
   virtual Transaction BroadcastTransaction(const std::string& wallet_id,
                                            const std::string& tx_id) = 0;
   virtual Transaction GetTransaction(const std::string& wallet_id,
@@ -507,8 +737,9 @@ class NUNCHUK_EXPORT Nunchuk {
                                  const std::string& tx_id) = 0;
 
   virtual Transaction DraftTransaction(
-      const std::string& wallet_id, const std::map<std::string, Amount> outputs,
-      const std::vector<UnspentOutput> inputs = {}, Amount fee_rate = -1,
+      const std::string& wallet_id,
+      const std::map<std::string, Amount>& outputs,
+      const std::vector<UnspentOutput>& inputs = {}, Amount fee_rate = -1,
       bool subtract_fee_from_amount = false) = 0;
   virtual Transaction ReplaceTransaction(const std::string& wallet_id,
                                          const std::string& tx_id,
@@ -530,6 +761,44 @@ class NUNCHUK_EXPORT Nunchuk {
                                 const std::vector<TxInput>& inputs) = 0;
   virtual std::string GetSelectedWallet() = 0;
   virtual bool SetSelectedWallet(const std::string& wallet_id) = 0;
+  // Change feed for incremental refresh. Every storage write to a wallet
+  // bumps its change sequence. Read GetChangeSeq before loading the wallet,
+  // then call GetWalletChanges when a listener fires.
+  virtual int64_t GetChangeSeq(const std::string& wallet_id) = 0;
+  virtual WalletChanges GetWalletChanges(const std::string& wallet_id,
+                                         int64_t since_seq) = 0;
+  // Snapshot of the process-wide metrics: storage, Electrum, coin selection,
+  // address derivation, HWI and listener latencies
+  virtual std::string GetMetrics(
+      MetricsFormat format = MetricsFormat::JSON) = 0;
+  // Debug: I/O of the last API call that finished on the calling thread.
+  // Async variants run on the executor, their I/O is not reported here
+  virtual IoStats GetLastCallIoStats() = 0;
+
+  // Async variants run on an internal executor. A cancelled token makes the
+  // operation stop at its next checkpoint and the future throws
+  // NunchukException::OPERATION_CANCELLED.
+  virtual std::future<Wallet> CreateWalletAsync(
+      const std::string& name, int m, int n,
+      const std::vector<SingleSigner>& signers, AddressType address_type,
+      bool is_escrow, const std::string& description = {},
+      CancellationToken token = {}) = 0;
+  virtual std::future<std::string> NewAddressAsync(
+      const std::string& wallet_id, bool internal = false,
+      CancellationToken token = {}) = 0;
+  // outputs and inputs are moved into the task, pass rvalues to avoid a copy
+  virtual std::future<Transaction> CreateTransactionAsync(
+      const std::string& wallet_id, std::map<std::string, Amount> outputs,
+      const std::string& memo = {}, std::vector<UnspentOutput> inputs = {},
+      Amount fee_rate = -1, bool subtract_fee_from_amount = false,
+      CancellationToken token = {}) = 0;
+  virtual std::future<Transaction> SignTransactionAsync(
+      const std::string& wallet_id, const std::string& tx_id,
+      const Device& device, CancellationToken token = {}) = 0;
+  virtual std::future<void> CacheMasterSignerXPubAsync(
+      const std::string& mastersigner_id,
+      std::function<bool /* stop */ (int /* percent */)> progress,
+      CancellationToken token = {}) = 0;
 
   virtual void AddBalanceListener(
       std::function<void(std::string /* wallet_id */, Amount /* new_balance */)>
@@ -553,6 +822,13 @@ class NUNCHUK_EXPORT Nunchuk {
 class NUNCHUK_EXPORT Utils {
  public:
   static void SetChain(Chain chain);
+  // Process-wide logging. Messages up to verbosity (loguru levels: 0 info,
+  // 1-9 debug) are queued in a bounded ring buffer and appended to file_path
+  // by a background thread; the oldest are dropped if it fills up
+  static void SetLogFile(const std::string& file_path, int verbosity = 0);
+  // Highest verbosity logged for a subsystem, 0 by default. Debug output
+  // such as Electrum messages and PSBTs is logged at verbosity 1
+  static void SetLogLevel(LogSubsystem subsystem, int verbosity);
   static std::string GenerateRandomMessage(int message_length = 20);
   static bool IsValidXPub(const std::string& value);
   static bool IsValidPublicKey(const std::string& value);
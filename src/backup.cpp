@@ -0,0 +1,333 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "backup.h"
+
+#include <nunchuk.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+
+#include <memory>
+
+namespace nunchuk {
+
+static const char MAGIC[] = {'N', 'C', 'B', 'K'};
+static const uint8_t VERSION = 1;
+static const uint8_t HEADER_ENCRYPTED = 1;
+static const uint8_t RECORD_END = 1;
+static const size_t SALT_SIZE = 16;
+static const size_t CHECK_SIZE = 16;
+static const size_t KEY_SIZE = 32;
+static const size_t NONCE_SIZE = 12;
+static const size_t TAG_SIZE = 16;
+static const size_t RECORD_HEADER_SIZE = 9;
+// Bound on record and chunk sizes read back, so a damaged size field can not
+// trigger a huge allocation
+static const uint32_t MAX_RECORD_SIZE = 64 << 20;
+// Same for the kdf iterations, which a damaged or crafted header could set
+// high enough to stall the restore
+static const uint32_t MAX_ITERATIONS = 10 * BackupWriter::DEFAULT_ITERATIONS;
+
+const size_t BackupWriter::DEFAULT_CHUNK_SIZE;
+const uint32_t BackupWriter::DEFAULT_ITERATIONS;
+
+static void InvalidBackup(const std::string& reason) {
+  throw StorageException(StorageException::INVALID_BACKUP,
+                         "invalid backup: " + reason);
+}
+
+static void WriteFailed(const std::string& reason) {
+  throw StorageException(StorageException::INVALID_BACKUP,
+                         "can not write backup: " + reason);
+}
+
+static void PutU32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out += static_cast<char>(value >> (8 * i));
+}
+
+static void PutU64(std::string& out, uint64_t value) {
+  for (int i = 0; i < 8; i++) out += static_cast<char>(value >> (8 * i));
+}
+
+static uint32_t GetU32(const char* in) {
+  uint32_t rs = 0;
+  for (int i = 0; i < 4; i++) rs |= uint32_t((unsigned char)in[i]) << (8 * i);
+  return rs;
+}
+
+static uint64_t GetU64(const char* in) {
+  uint64_t rs = 0;
+  for (int i = 0; i < 8; i++) rs |= uint64_t((unsigned char)in[i]) << (8 * i);
+  return rs;
+}
+
+static std::string Sha256(const std::string& data) {
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  SHA256((const unsigned char*)data.data(), data.size(), hash);
+  return std::string((const char*)hash, sizeof(hash));
+}
+
+static std::vector<unsigned char> DeriveKey(
+    const std::string& passphrase, const std::vector<unsigned char>& salt,
+    uint32_t iterations) {
+  std::vector<unsigned char> key(KEY_SIZE);
+  if (!PKCS5_PBKDF2_HMAC(passphrase.data(), passphrase.size(), salt.data(),
+                         salt.size(), iterations, EVP_sha256(), key.size(),
+                         key.data())) {
+    throw StorageException(StorageException::INVALID_BACKUP,
+                           "can not derive backup key");
+  }
+  return key;
+}
+
+static std::string KeyCheck(const std::vector<unsigned char>& key) {
+  std::string data(key.begin(), key.end());
+  return Sha256(data + "nunchuk backup key check").substr(0, CHECK_SIZE);
+}
+
+typedef std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>
+    CipherCtx;
+
+// AES-256-GCM over data in place, returns false if the tag does not match
+static bool Crypt(bool encrypt, const std::vector<unsigned char>& key,
+                  const std::string& nonce, const std::string& aad,
+                  std::string& data, std::string& tag) {
+  CipherCtx ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+  if (!ctx) return false;
+  int len = 0;
+  std::string out(data.size(), '\0');
+  auto u = [](const std::string& s) { return (const unsigned char*)s.data(); };
+  if (!EVP_CipherInit_ex(ctx.get(), EVP_aes_256_gcm(), NULL, key.data(),
+                         u(nonce), encrypt ? 1 : 0) ||
+      !EVP_CipherUpdate(ctx.get(), NULL, &len, u(aad), aad.size()) ||
+      !EVP_CipherUpdate(ctx.get(), (unsigned char*)&out[0], &len, u(data),
+                        data.size())) {
+    return false;
+  }
+  if (!encrypt &&
+      !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, TAG_SIZE,
+                           (void*)tag.data())) {
+    return false;
+  }
+  if (EVP_CipherFinal_ex(ctx.get(), (unsigned char*)&out[0] + len, &len) <= 0) {
+    return false;
+  }
+  if (encrypt) {
+    tag.assign(TAG_SIZE, '\0');
+    if (!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, TAG_SIZE,
+                             &tag[0])) {
+      return false;
+    }
+  }
+  data.swap(out);
+  return true;
+}
+
+static std::string RecordHeader(uint32_t index, uint8_t flags, uint32_t size) {
+  std::string rs;
+  PutU32(rs, index);
+  rs += static_cast<char>(flags);
+  PutU32(rs, size);
+  return rs;
+}
+
+BackupWriter::BackupWriter(std::ostream& out, const std::string& passphrase,
+                           size_t chunk_size, uint32_t iterations)
+    : out_(out),
+      chunk_size_(chunk_size),
+      encrypted_(!passphrase.empty()),
+      salt_(SALT_SIZE) {
+  if (encrypted_ && (iterations == 0 || iterations > MAX_ITERATIONS)) {
+    throw NunchukException(NunchukException::INVALID_PARAMETER,
+                           "invalid backup kdf iterations");
+  }
+  if (RAND_bytes(salt_.data(), salt_.size()) != 1) WriteFailed("no entropy");
+  if (!encrypted_) iterations = 0;
+  std::string header(MAGIC, sizeof(MAGIC));
+  header += static_cast<char>(VERSION);
+  header += static_cast<char>(encrypted_ ? HEADER_ENCRYPTED : 0);
+  PutU32(header, iterations);
+  header.append(salt_.begin(), salt_.end());
+  if (encrypted_) {
+    key_ = DeriveKey(passphrase, salt_, iterations);
+    header += KeyCheck(key_);
+  } else {
+    header.append(CHECK_SIZE, '\0');
+  }
+  out_.write(header.data(), header.size());
+}
+
+void BackupWriter::Write(const char* data, size_t size) {
+  buffer_.append(data, size);
+  size_t offset = 0;
+  for (; buffer_.size() - offset >= chunk_size_; offset += chunk_size_) {
+    WriteRecord(0, buffer_.substr(offset, chunk_size_));
+  }
+  buffer_.erase(0, offset);
+}
+
+void BackupWriter::Finish() {
+  if (!buffer_.empty()) WriteRecord(0, buffer_);
+  buffer_.clear();
+  std::string end;
+  PutU64(end, total_);
+  WriteRecord(RECORD_END, end);
+  out_.flush();
+}
+
+void BackupWriter::WriteRecord(uint8_t flags, const std::string& chunk) {
+  uLongf compressed_size = compressBound(chunk.size());
+  std::string compressed(compressed_size, '\0');
+  if (compress2((Bytef*)&compressed[0], &compressed_size,
+                (const Bytef*)chunk.data(), chunk.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    WriteFailed("compression failed");
+  }
+  compressed.resize(compressed_size);
+
+  std::string payload = Sha256(chunk);
+  PutU32(payload, chunk.size());
+  payload += compressed;
+
+  std::string header = RecordHeader(index_, flags, payload.size());
+  std::string nonce(NONCE_SIZE, '\0');
+  std::string tag(TAG_SIZE, '\0');
+  if (encrypted_) {
+    if (RAND_bytes((unsigned char*)&nonce[0], nonce.size()) != 1) {
+      WriteFailed("no entropy");
+    }
+    std::string aad = header + std::string(salt_.begin(), salt_.end());
+    if (!Crypt(true, key_, nonce, aad, payload, tag)) {
+      WriteFailed("encryption failed");
+    }
+  }
+  out_.write(header.data(), header.size());
+  out_.write(nonce.data(), nonce.size());
+  out_.write(payload.data(), payload.size());
+  out_.write(tag.data(), tag.size());
+  index_++;
+  if (!(flags & RECORD_END)) total_ += chunk.size();
+}
+
+BackupReader::BackupReader(std::istream& in, const std::string& passphrase)
+    : in_(in), salt_(SALT_SIZE) {
+  char header[sizeof(MAGIC) + 2 + 4 + SALT_SIZE + CHECK_SIZE];
+  if (!in_.read(header, sizeof(header)) ||
+      std::string(header, sizeof(MAGIC)) != std::string(MAGIC, sizeof(MAGIC))) {
+    InvalidBackup("bad header");
+  }
+  const char* p = header + sizeof(MAGIC);
+  if (p[0] != VERSION) InvalidBackup("unsupported version");
+  encrypted_ = p[1] & HEADER_ENCRYPTED;
+  uint32_t iterations = GetU32(p + 2);
+  salt_.assign(p + 6, p + 6 + SALT_SIZE);
+  if (!encrypted_) {
+    // A passphrase the backup was not made with is a mistake, not a no-op
+    if (!passphrase.empty()) {
+      throw NunchukException(NunchukException::INVALID_PASSPHRASE,
+                             "backup is not encrypted");
+    }
+    return;
+  }
+  if (passphrase.empty()) {
+    throw NunchukException(NunchukException::INVALID_PASSPHRASE,
+                           "backup is encrypted");
+  }
+  if (iterations == 0 || iterations > MAX_ITERATIONS) {
+    InvalidBackup("bad kdf iterations");
+  }
+  key_ = DeriveKey(passphrase, salt_, iterations);
+  std::string check(p + 6 + SALT_SIZE, CHECK_SIZE);
+  if (CRYPTO_memcmp(KeyCheck(key_).data(), check.data(), CHECK_SIZE) != 0) {
+    throw NunchukException(NunchukException::INVALID_PASSPHRASE,
+                           "invalid passphrase");
+  }
+}
+
+std::string BackupReader::GetId() const {
+  static const char hex[] = "0123456789abcdef";
+  std::string rs;
+  for (auto&& b : salt_) {
+    rs += hex[b >> 4];
+    rs += hex[b & 15];
+  }
+  return rs;
+}
+
+void BackupReader::ReadRecord(uint8_t& flags, std::string& chunk) {
+  char buf[RECORD_HEADER_SIZE];
+  if (!in_.read(buf, sizeof(buf))) InvalidBackup("truncated");
+  std::string header(buf, sizeof(buf));
+  if (GetU32(buf) != index_) InvalidBackup("record out of order");
+  flags = buf[4];
+  uint32_t size = GetU32(buf + 5);
+  if (size > MAX_RECORD_SIZE) InvalidBackup("record too large");
+
+  std::string nonce(NONCE_SIZE, '\0');
+  std::string payload(size, '\0');
+  std::string tag(TAG_SIZE, '\0');
+  if (!in_.read(&nonce[0], nonce.size()) ||
+      (size > 0 && !in_.read(&payload[0], size)) ||
+      !in_.read(&tag[0], tag.size())) {
+    InvalidBackup("truncated");
+  }
+  if (encrypted_) {
+    std::string aad = header + std::string(salt_.begin(), salt_.end());
+    if (!Crypt(false, key_, nonce, aad, payload, tag)) {
+      InvalidBackup("authentication failed");
+    }
+  }
+  if (payload.size() < SHA256_DIGEST_LENGTH + 4) InvalidBackup("bad record");
+  uLongf chunk_size = GetU32(&payload[SHA256_DIGEST_LENGTH]);
+  if (chunk_size > MAX_RECORD_SIZE) InvalidBackup("chunk too large");
+  chunk.assign(chunk_size, '\0');
+  size_t offset = SHA256_DIGEST_LENGTH + 4;
+  uLongf expected = chunk_size;
+  if (uncompress((Bytef*)&chunk[0], &chunk_size,
+                 (const Bytef*)payload.data() + offset,
+                 payload.size() - offset) != Z_OK ||
+      chunk_size != expected) {
+    InvalidBackup("bad compressed data");
+  }
+  if (Sha256(chunk) != payload.substr(0, SHA256_DIGEST_LENGTH)) {
+    InvalidBackup("checksum mismatch");
+  }
+  index_++;
+}
+
+bool BackupReader::Next(std::string& chunk) {
+  if (done_) return false;
+  uint8_t flags;
+  ReadRecord(flags, chunk);
+  if (!(flags & RECORD_END)) {
+    total_ += chunk.size();
+    return true;
+  }
+  if (chunk.size() != 8 || GetU64(chunk.data()) != total_) {
+    InvalidBackup("size mismatch");
+  }
+  done_ = true;
+  chunk.clear();
+  return false;
+}
+
+void BackupReader::Skip(uint32_t records, uint64_t bytes) {
+  for (uint32_t i = 0; i < records; i++) {
+    char buf[RECORD_HEADER_SIZE];
+    if (!in_.read(buf, sizeof(buf))) InvalidBackup("truncated");
+    if (GetU32(buf) != index_ || (buf[4] & RECORD_END)) {
+      InvalidBackup("can not resume");
+    }
+    in_.ignore(NONCE_SIZE + GetU32(buf + 5) + TAG_SIZE);
+    if (!in_) InvalidBackup("truncated");
+    index_++;
+  }
+  total_ = bytes;
+}
+
+}  // namespace nunchuk
@@ -0,0 +1,92 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_BACKUP_H
+#define NUNCHUK_BACKUP_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace nunchuk {
+
+// Streaming backup format. A backup is a header followed by records, each
+// holding one chunk of the source file:
+//
+//   header  "NCBK" | version u8 | flags u8 | kdf iterations u32 | salt[16]
+//           | key check[16]
+//   record  index u32 | flags u8 | size u32 | nonce[12] | payload[size]
+//           | tag[16]
+//   payload sha256(chunk)[32] | chunk size u32 | deflate(chunk)
+//
+// With a passphrase the payload is AES-256-GCM encrypted under a
+// PBKDF2-HMAC-SHA256 key, authenticating the record header and salt, and
+// the key check rejects a wrong passphrase up front. Without one, nonce and
+// tag are zero and only the checksums guard the data. The last record is
+// flagged END and its chunk is the total size as u64. Integers are little
+// endian.
+class BackupWriter {
+ public:
+  static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+  static const uint32_t DEFAULT_ITERATIONS = 100000;
+
+  // With a passphrase, iterations must be 1 to 10x the default; throws
+  // NunchukException::INVALID_PARAMETER otherwise. Write and Finish throw
+  // StorageException::INVALID_BACKUP if a record can not be made
+  BackupWriter(std::ostream& out, const std::string& passphrase,
+               size_t chunk_size = DEFAULT_CHUNK_SIZE,
+               uint32_t iterations = DEFAULT_ITERATIONS);
+  BackupWriter(const BackupWriter&) = delete;
+  BackupWriter& operator=(const BackupWriter&) = delete;
+
+  void Write(const char* data, size_t size);
+  // Flush the last chunk and write the end record
+  void Finish();
+
+ private:
+  void WriteRecord(uint8_t flags, const std::string& chunk);
+
+  std::ostream& out_;
+  size_t chunk_size_;
+  bool encrypted_;
+  std::vector<unsigned char> salt_;
+  std::vector<unsigned char> key_;
+  std::string buffer_;
+  uint32_t index_ = 0;
+  uint64_t total_ = 0;
+};
+
+class BackupReader {
+ public:
+  // Reads the header; throws NunchukException::INVALID_PASSPHRASE, also for
+  // a passphrase given to a plain backup, or StorageException::INVALID_BACKUP
+  BackupReader(std::istream& in, const std::string& passphrase);
+  BackupReader(const BackupReader&) = delete;
+  BackupReader& operator=(const BackupReader&) = delete;
+
+  // Hex of the salt, unique per backup, to match resumed restores
+  std::string GetId() const;
+  // Next chunk, verified. False once the end record checks out
+  bool Next(std::string& chunk);
+  // Resume after `records` chunks totalling `bytes`, already restored. Their
+  // payloads are skipped without decrypting
+  void Skip(uint32_t records, uint64_t bytes);
+
+ private:
+  void ReadRecord(uint8_t& flags, std::string& chunk);
+
+  std::istream& in_;
+  bool encrypted_;
+  std::vector<unsigned char> salt_;
+  std::vector<unsigned char> key_;
+  uint32_t index_ = 0;
+  uint64_t total_ = 0;
+  bool done_ = false;
+};
+
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_BACKUP_H
@@ -4,6 +4,7 @@
 
 #include "coinselector.h"
 
+#include <metrics.h>
 #include <key_io.h>
 #include <policy/policy.h>
 
@@ -25,33 +26,43 @@ static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -walletrejectlongchains
 static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 
+std::mutex CoinSelector::cache_mutex_;
 std::map<std::string, CScript> CoinSelector::scriptsig_cache_;
 std::map<std::string, CScriptWitness> CoinSelector::scriptwitness_cache_;
 
 CoinSelector::CoinSelector(const std::string descriptors,
                            const std::string example_address) {
-  if (scriptsig_cache_.find(descriptors) == scriptsig_cache_.end() ||
-      scriptwitness_cache_.find(descriptors) == scriptwitness_cache_.end()) {
-    UniValue uv;
-    uv.read(descriptors);
-    // Parse descriptors
-    FlatSigningProvider provider;
-    auto descs = uv.get_array();
-    for (size_t i = 0; i < descs.size(); ++i) {
-      EvalDescriptorStringOrObject(descs[i], provider);
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto sig = scriptsig_cache_.find(descriptors);
+    auto witness = scriptwitness_cache_.find(descriptors);
+    if (sig != scriptsig_cache_.end() &&
+        witness != scriptwitness_cache_.end()) {
+      dummy_scriptsig_ = sig->second;
+      dummy_scriptwitness_ = witness->second;
+      return;
     }
-    CScript spk = GetScriptForDestination(DecodeDestination(example_address));
-    SignatureData sigdata;
-    if (!ProduceSignature(provider, DUMMY_MAXIMUM_SIGNATURE_CREATOR, spk,
-                          sigdata)) {
-      throw NunchukException(NunchukException::CREATE_DUMMY_SIGNATURE_ERROR,
-                              "create dummy signature error");
-    }
-    scriptsig_cache_[descriptors] = sigdata.scriptSig;
-    scriptwitness_cache_[descriptors] = sigdata.scriptWitness;
   }
-  dummy_scriptsig_ = scriptsig_cache_.at(descriptors);
-  dummy_scriptwitness_ = scriptwitness_cache_.at(descriptors);
+  UniValue uv;
+  uv.read(descriptors);
+  // Parse descriptors
+  FlatSigningProvider provider;
+  auto descs = uv.get_array();
+  for (size_t i = 0; i < descs.size(); ++i) {
+    EvalDescriptorStringOrObject(descs[i], provider);
+  }
+  CScript spk = GetScriptForDestination(DecodeDestination(example_address));
+  SignatureData sigdata;
+  if (!ProduceSignature(provider, DUMMY_MAXIMUM_SIGNATURE_CREATOR, spk,
+                        sigdata)) {
+    throw NunchukException(NunchukException::CREATE_DUMMY_SIGNATURE_ERROR,
+                           "create dummy signature error");
+  }
+  dummy_scriptsig_ = sigdata.scriptSig;
+  dummy_scriptwitness_ = sigdata.scriptWitness;
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  scriptsig_cache_[descriptors] = sigdata.scriptSig;
+  scriptwitness_cache_[descriptors] = sigdata.scriptWitness;
 }
 
 void CoinSelector::set_fee_rate(CFeeRate value) {
@@ -269,6 +280,8 @@ bool CoinSelector::Select(const std::vector<UnspentOutput>& vAvailableCoins,
                           std::vector<TxOutput>& vecSend,
                           std::vector<TxInput>& vecInput, CAmount& nFeeRet,
                           std::string& error, int& nChangePosInOut) {
+  Metrics::Timer timer(
+      Metrics::getInstance().GetHistogram("nunchuk_coin_selection_seconds"));
   CAmount nValue = 0;
   int nChangePosRequest = nChangePosInOut;
   unsigned int nSubtractFeeFromAmount =
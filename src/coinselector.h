@@ -17,6 +17,7 @@
 #include <primitives/transaction.h>
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace nunchuk {
@@ -56,7 +57,9 @@ class CoinSelector {
 
  private:
   // Since scriptSig and scriptWitness for each descriptor have fixed sizes, we
-  // cache the sizes here to optimize CalculateMaximumSignedTxSize performance
+  // cache the sizes here to optimize CalculateMaximumSignedTxSize performance.
+  // The caches are shared by every Nunchuk instance in the process
+  static std::mutex cache_mutex_;
   static std::map<std::string, CScript> scriptsig_cache_;
   static std::map<std::string, CScriptWitness> scriptwitness_cache_;
   bool SelectCoinsMinConf(const CAmount& nTargetValue,
@@ -5,6 +5,7 @@
 #include "coreutils.h"
 
 #include <embeddedrpc.h>
+#include <metrics.h>
 #include <utils/json.hpp>
 #include <utils/addressutils.hpp>
 #include <iostream>
@@ -48,7 +49,7 @@ static json ParseResponse(const std::string &resp) {
   return rs["result"];
 }
 
-std::string CoreUtils::CombinePsbt(const std::vector<std::string> psbts) {
+std::string CoreUtils::CombinePsbt(const std::vector<std::string> &psbts) {
   json req = {{"method", "combinepsbt"},
               {"params", json::array({json(psbts)})},
               {"id", "placeholder"}};
@@ -77,8 +78,8 @@ std::string CoreUtils::DecodeRawTransaction(const std::string &raw_tx) {
   return ParseResponse(resp).dump();
 }
 
-std::string CoreUtils::CreatePsbt(const std::vector<TxInput> vin,
-                                  const std::vector<TxOutput> vout) {
+std::string CoreUtils::CreatePsbt(const std::vector<TxInput> &vin,
+                                  const std::vector<TxOutput> &vout) {
   json input = json::array();
   for (auto &el : vin) {
     input.push_back({{"txid", el.first}, {"vout", el.second}});
@@ -107,6 +108,8 @@ std::string CoreUtils::DecodePsbt(const std::string &base64_psbt) {
 
 std::string CoreUtils::DeriveAddresses(const std::string &descriptor,
                                        int index) {
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_address_derivation_seconds"));
   json params = index >= 0
                     ? json::array({descriptor, json::array({index, index})})
                     : json::array({descriptor});
@@ -12,7 +12,7 @@
 #include <key_io.h>
 #include <util/strencodings.h>
 #include <utils/json.hpp>
-#include <utils/loguru.hpp>
+#include <logging.h>
 #include <boost/algorithm/string.hpp>
 
 using json = nlohmann::json;
@@ -77,7 +77,8 @@ std::string GetDescriptorForSigners(const std::vector<SingleSigner>& signers,
   }
 
   std::string desc_with_checksum = AddChecksum(desc.str());
-  DLOG_F(INFO, "GetDescriptorForSigners(): '%s'", desc_with_checksum.c_str());
+  NDLOG_F(API, 1, "GetDescriptorForSigners(): '%s'",
+          desc_with_checksum.c_str());
 
   return desc_with_checksum;
 }
@@ -6,25 +6,45 @@
 
 namespace nunchuk {
 
-AppSettings::AppSettings() {}
+AppSettings::AppSettings()
+    : cpu_threads_(0),
+      io_threads_(0),
+      blocking_threads_(0),
+      enable_shared_backend_(false),
+      metrics_port_(0),
+      wallet_cache_size_(0),
+      enable_warm_start_(false) {}
 
 Chain AppSettings::get_chain() const { return chain_; }
-std::vector<std::string> AppSettings::get_mainnet_servers() const {
+std::vector<std::string> const& AppSettings::get_mainnet_servers() const {
   return mainnet_servers_;
 }
-std::vector<std::string> AppSettings::get_testnet_servers() const {
+std::vector<std::string> const& AppSettings::get_testnet_servers() const {
   return testnet_servers_;
 }
-std::string AppSettings::get_hwi_path() const { return hwi_path_; }
-std::string AppSettings::get_storage_path() const { return storage_path_; }
+std::string const& AppSettings::get_hwi_path() const { return hwi_path_; }
+std::string const& AppSettings::get_storage_path() const {
+  return storage_path_;
+}
 bool AppSettings::use_proxy() const { return enable_proxy_; }
-std::string AppSettings::get_proxy_host() const { return proxy_host_; }
+std::string const& AppSettings::get_proxy_host() const { return proxy_host_; }
 int AppSettings::get_proxy_port() const { return proxy_port_; }
-std::string AppSettings::get_proxy_username() const { return proxy_username_; }
-std::string AppSettings::get_proxy_password() const { return proxy_password_; }
-std::string AppSettings::get_certificate_file() const {
+std::string const& AppSettings::get_proxy_username() const {
+  return proxy_username_;
+}
+std::string const& AppSettings::get_proxy_password() const {
+  return proxy_password_;
+}
+std::string const& AppSettings::get_certificate_file() const {
   return certificate_file_;
 }
+int AppSettings::get_cpu_threads() const { return cpu_threads_; }
+int AppSettings::get_io_threads() const { return io_threads_; }
+int AppSettings::get_blocking_threads() const { return blocking_threads_; }
+bool AppSettings::use_shared_backend() const { return enable_shared_backend_; }
+int AppSettings::get_metrics_port() const { return metrics_port_; }
+int AppSettings::get_wallet_cache_size() const { return wallet_cache_size_; }
+bool AppSettings::use_warm_start() const { return enable_warm_start_; }
 
 void AppSettings::set_chain(Chain value) { chain_ = value; }
 void AppSettings::set_mainnet_servers(const std::vector<std::string>& value) {
@@ -51,5 +71,18 @@ void AppSettings::set_proxy_password(const std::string& value) {
 void AppSettings::set_certificate_file(const std::string& value) {
   certificate_file_ = value;
 }
+void AppSettings::set_cpu_threads(int value) { cpu_threads_ = value; }
+void AppSettings::set_io_threads(int value) { io_threads_ = value; }
+void AppSettings::set_blocking_threads(int value) {
+  blocking_threads_ = value;
+}
+void AppSettings::enable_shared_backend(bool value) {
+  enable_shared_backend_ = value;
+}
+void AppSettings::set_metrics_port(int value) { metrics_port_ = value; }
+void AppSettings::set_wallet_cache_size(int value) {
+  wallet_cache_size_ = value;
+}
+void AppSettings::enable_warm_start(bool value) { enable_warm_start_ = value; }
 
 }  // namespace nunchuk
\ No newline at end of file
@@ -0,0 +1,19 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+
+namespace nunchuk {
+
+BalancePoint::BalancePoint() : height_(0), blocktime_(0), balance_(0) {}
+
+int BalancePoint::get_height() const { return height_; }
+time_t BalancePoint::get_blocktime() const { return blocktime_; }
+Amount BalancePoint::get_balance() const { return balance_; }
+
+void BalancePoint::set_height(int value) { height_ = value; }
+void BalancePoint::set_blocktime(time_t value) { blocktime_ = value; }
+void BalancePoint::set_balance(Amount value) { balance_ = value; }
+
+}  // namespace nunchuk
@@ -0,0 +1,15 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+
+namespace nunchuk {
+
+CancellationToken::CancellationToken()
+    : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+void CancellationToken::cancel() { *cancelled_ = true; }
+bool CancellationToken::is_cancelled() const { return *cancelled_; }
+
+}  // namespace nunchuk
@@ -0,0 +1,47 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+
+namespace nunchuk {
+namespace detail {
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+CompactHash::CompactHash() : binary_(false) {}
+
+CompactHash::CompactHash(const std::string& value) : binary_(false) {
+  if (value.size() == 2 * sizeof(bytes_)) {
+    binary_ = true;
+    for (size_t i = 0; i < sizeof(bytes_) && binary_; i++) {
+      int high = HexValue(value[2 * i]);
+      int low = HexValue(value[2 * i + 1]);
+      binary_ = high >= 0 && low >= 0;
+      bytes_[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+  }
+  // Uppercase or malformed, keep as given so str() round-trips
+  if (!binary_) text_ = InternedString(value);
+}
+
+std::string CompactHash::str() const {
+  if (!binary_) return text_.str();
+  std::string rs(2 * sizeof(bytes_), '0');
+  for (size_t i = 0; i < sizeof(bytes_); i++) {
+    rs[2 * i] = HEX_DIGITS[bytes_[i] >> 4];
+    rs[2 * i + 1] = HEX_DIGITS[bytes_[i] & 0x0f];
+  }
+  return rs;
+}
+
+bool CompactHash::empty() const { return !binary_ && text_.str().empty(); }
+
+}  // namespace detail
+}  // namespace nunchuk
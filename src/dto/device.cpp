@@ -22,10 +22,10 @@ Device::Device(const std::string &type, const std::string &path,
       needs_pin_sent_(needs_pin_sent),
       initialized_(initialized) {}
 
-std::string Device::get_type() const { return type_; }
-std::string Device::get_path() const { return path_; }
-std::string Device::get_model() const { return model_; }
-std::string Device::get_master_fingerprint() const {
+std::string const& Device::get_type() const { return type_; }
+std::string const& Device::get_path() const { return path_; }
+std::string const& Device::get_model() const { return model_; }
+std::string const& Device::get_master_fingerprint() const {
   return master_fingerprint_;
 }
 bool Device::connected() const { return connected_; }
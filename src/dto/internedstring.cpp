@@ -0,0 +1,97 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace nunchuk {
+namespace detail {
+
+namespace {
+struct StringPtrHash {
+  size_t operator()(const std::string* value) const {
+    return std::hash<std::string>()(*value);
+  }
+};
+
+struct StringPtrEqual {
+  bool operator()(const std::string* a, const std::string* b) const {
+    return *a == *b;
+  }
+};
+
+// Keyed by the pooled string itself, so an address is stored once. Split
+// into shards by hash so threads building transactions rarely contend
+class InternPool {
+ public:
+  static InternPool& getInstance() {
+    // Never destroyed, interned strings may outlive static destruction
+    static InternPool* instance = new InternPool();
+    return *instance;
+  }
+
+  std::shared_ptr<const std::string> Intern(const std::string& value) {
+    Shard& shard = GetShard(value);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.strings.find(&value);
+    if (it != shard.strings.end()) {
+      if (auto rs = it->second.lock()) return rs;
+      // Last holder is releasing it, its Entry skips the new one
+      shard.strings.erase(it);
+    }
+    // One allocation for the count and the string, aliased to the string
+    auto entry = std::make_shared<Entry>(value);
+    std::shared_ptr<const std::string> rs(entry, &entry->value);
+    shard.strings.emplace(rs.get(), rs);
+    return rs;
+  }
+
+ private:
+  static const size_t SHARD_COUNT = 16;
+
+  struct Entry {
+    explicit Entry(const std::string& value) : value(value) {}
+    ~Entry() { getInstance().Release(&value); }
+    const std::string value;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<const std::string*, std::weak_ptr<const std::string>,
+                       StringPtrHash, StringPtrEqual>
+        strings;
+  };
+
+  Shard& GetShard(const std::string& value) {
+    return shards_[std::hash<std::string>()(value) % SHARD_COUNT];
+  }
+
+  void Release(const std::string* value) {
+    Shard& shard = GetShard(*value);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.strings.find(value);
+    if (it != shard.strings.end() && it->first == value) {
+      shard.strings.erase(it);
+    }
+  }
+
+  Shard shards_[SHARD_COUNT];
+};
+}  // namespace
+
+InternedString::InternedString() {}
+
+InternedString::InternedString(const std::string& value) {
+  if (!value.empty()) value_ = InternPool::getInstance().Intern(value);
+}
+
+const std::string& InternedString::str() const {
+  static const std::string empty;
+  return value_ ? *value_ : empty;
+}
+
+}  // namespace detail
+}  // namespace nunchuk
@@ -0,0 +1,24 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+
+namespace nunchuk {
+
+IoStats::IoStats()
+    : db_opens_(0), key_derivations_(0), statements_(0), rows_read_(0) {}
+
+std::string const& IoStats::get_call() const { return call_; }
+int64_t IoStats::get_db_opens() const { return db_opens_; }
+int64_t IoStats::get_key_derivations() const { return key_derivations_; }
+int64_t IoStats::get_statements() const { return statements_; }
+int64_t IoStats::get_rows_read() const { return rows_read_; }
+
+void IoStats::set_call(const std::string& value) { call_ = value; }
+void IoStats::set_db_opens(int64_t value) { db_opens_ = value; }
+void IoStats::set_key_derivations(int64_t value) { key_derivations_ = value; }
+void IoStats::set_statements(int64_t value) { statements_ = value; }
+void IoStats::set_rows_read(int64_t value) { rows_read_ = value; }
+
+}  // namespace nunchuk
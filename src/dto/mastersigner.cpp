@@ -11,9 +11,9 @@ MasterSigner::MasterSigner(const std::string& id, const Device& device,
                            time_t last_health_check)
     : id_(id), device_(device), last_health_check_(last_health_check) {}
 
-std::string MasterSigner::get_id() const { return id_; }
-std::string MasterSigner::get_name() const { return name_; }
-Device MasterSigner::get_device() const { return device_; }
+std::string const& MasterSigner::get_id() const { return id_; }
+std::string const& MasterSigner::get_name() const { return name_; }
+Device const& MasterSigner::get_device() const { return device_; }
 time_t MasterSigner::get_last_health_check() const {
   return last_health_check_;
 }
@@ -21,16 +21,16 @@ SingleSigner::SingleSigner(const std::string& name, const std::string& xpub,
       master_signer_id_(master_signer_id),
       last_health_check_(last_health_check) {}
 
-std::string SingleSigner::get_name() const { return name_; }
-std::string SingleSigner::get_xpub() const { return xpub_; }
-std::string SingleSigner::get_public_key() const { return public_key_; }
-std::string SingleSigner::get_derivation_path() const {
+std::string const& SingleSigner::get_name() const { return name_; }
+std::string const& SingleSigner::get_xpub() const { return xpub_; }
+std::string const& SingleSigner::get_public_key() const { return public_key_; }
+std::string const& SingleSigner::get_derivation_path() const {
   return derivation_path_;
 }
-std::string SingleSigner::get_master_fingerprint() const {
+std::string const& SingleSigner::get_master_fingerprint() const {
   return master_fingerprint_;
 }
-std::string SingleSigner::get_master_signer_id() const {
+std::string const& SingleSigner::get_master_signer_id() const {
   return master_signer_id_;
 }
 bool SingleSigner::has_master_signer() const {
@@ -4,31 +4,46 @@
 
 #include <nunchuk.h>
 
+#include <algorithm>
+
 namespace nunchuk {
 
 Transaction::Transaction() {}
 
-std::string Transaction::get_txid() const { return txid_; }
+std::vector<TxOutput> Transaction::ToTxOutputs(
+    const std::vector<Output>& value) {
+  std::vector<TxOutput> rs;
+  rs.reserve(value.size());
+  for (auto&& output : value) rs.push_back({output.first.str(), output.second});
+  return rs;
+}
+
+std::string Transaction::get_txid() const { return txid_.str(); }
 int Transaction::get_height() const { return height_; }
-std::vector<TxInput> const& Transaction::get_inputs() const { return inputs_; }
-std::vector<TxOutput> const& Transaction::get_outputs() const {
-  return outputs_;
+std::vector<TxInput> Transaction::get_inputs() const {
+  std::vector<TxInput> rs;
+  rs.reserve(inputs_.size());
+  for (auto&& input : inputs_) rs.push_back({input.first.str(), input.second});
+  return rs;
 }
-std::vector<TxOutput> const& Transaction::get_user_outputs() const {
-  return user_outputs_;
+std::vector<TxOutput> Transaction::get_outputs() const {
+  return ToTxOutputs(outputs_);
 }
-std::vector<TxOutput> const& Transaction::get_receive_outputs() const {
-  return receive_output_;
+std::vector<TxOutput> Transaction::get_user_outputs() const {
+  return ToTxOutputs(user_outputs_);
+}
+std::vector<TxOutput> Transaction::get_receive_outputs() const {
+  return ToTxOutputs(receive_output_);
 }
 int Transaction::get_change_index() const { return change_index_; }
 int Transaction::get_m() const { return m_; }
-std::map<std::string, bool> const& Transaction::get_signers() const {
-  return signers_;
+std::map<std::string, bool> Transaction::get_signers() const {
+  return {signers_.begin(), signers_.end()};
 }
-std::string Transaction::get_memo() const { return memo_; }
+std::string const& Transaction::get_memo() const { return memo_; }
 TransactionStatus Transaction::get_status() const { return status_; }
 std::string Transaction::get_replaced_by_txid() const {
-  return replaced_by_txid_;
+  return replaced_by_txid_.str();
 }
 Amount Transaction::get_fee() const { return fee_; }
 Amount Transaction::get_fee_rate() const { return fee_rate_; }
@@ -38,28 +53,64 @@ bool Transaction::subtract_fee_from_amount() const {
 }
 bool Transaction::is_receive() const { return is_receive_; }
 Amount Transaction::get_sub_amount() const { return sub_amount_; }
+size_t Transaction::get_input_count() const { return inputs_.size(); }
+size_t Transaction::get_output_count() const { return outputs_.size(); }
+size_t Transaction::get_user_output_count() const {
+  return user_outputs_.size();
+}
+size_t Transaction::get_receive_output_count() const {
+  return receive_output_.size();
+}
+size_t Transaction::get_signer_count() const { return signers_.size(); }
+std::string Transaction::get_input_txid(size_t i) const {
+  return inputs_[i].first.str();
+}
+int Transaction::get_input_vout(size_t i) const { return inputs_[i].second; }
+std::string const& Transaction::get_output_address(size_t i) const {
+  return outputs_[i].first.str();
+}
+Amount Transaction::get_output_amount(size_t i) const {
+  return outputs_[i].second;
+}
+std::string const& Transaction::get_signer_id(size_t i) const {
+  return signers_[i].first;
+}
 
-void Transaction::set_txid(const std::string& value) { txid_ = value; }
+void Transaction::set_txid(const std::string& value) {
+  txid_ = detail::CompactHash(value);
+}
 void Transaction::set_height(int value) { height_ = value; }
-void Transaction::add_input(const TxInput& value) { inputs_.push_back(value); }
+void Transaction::add_input(const TxInput& value) {
+  inputs_.push_back({detail::CompactHash(value.first), value.second});
+}
 void Transaction::add_output(const TxOutput& value) {
-  outputs_.push_back(value);
+  outputs_.push_back({detail::InternedString(value.first), value.second});
 }
 void Transaction::add_user_output(const TxOutput& value) {
-  user_outputs_.push_back(value);
+  user_outputs_.push_back({detail::InternedString(value.first), value.second});
 }
 void Transaction::add_receive_output(const TxOutput& value) {
-  receive_output_.push_back(value);
+  receive_output_.push_back(
+      {detail::InternedString(value.first), value.second});
 }
 void Transaction::set_change_index(int value) { change_index_ = value; }
 void Transaction::set_m(int value) { m_ = value; }
 void Transaction::set_signer(const std::string& signer_id, bool has_signature) {
-  signers_[signer_id] = has_signature;
+  auto it = std::lower_bound(
+      signers_.begin(), signers_.end(), signer_id,
+      [](const std::pair<std::string, bool>& signer, const std::string& id) {
+        return signer.first < id;
+      });
+  if (it != signers_.end() && it->first == signer_id) {
+    it->second = has_signature;
+  } else {
+    signers_.insert(it, {signer_id, has_signature});
+  }
 }
 void Transaction::set_memo(const std::string& value) { memo_ = value; }
 void Transaction::set_status(TransactionStatus value) { status_ = value; }
 void Transaction::set_replaced_by_txid(const std::string& value) {
-  replaced_by_txid_ = value;
+  replaced_by_txid_ = detail::CompactHash(value);
 }
 void Transaction::set_fee(const Amount& value) { fee_ = value; }
 void Transaction::set_fee_rate(const Amount& value) { fee_rate_ = value; }
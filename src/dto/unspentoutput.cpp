@@ -9,15 +9,19 @@ namespace nunchuk {
 
 UnspentOutput::UnspentOutput() {}
 
-std::string UnspentOutput::get_txid() const { return txid_; }
+std::string UnspentOutput::get_txid() const { return txid_.str(); }
 int UnspentOutput::get_vout() const { return vout_; }
-std::string UnspentOutput::get_address() const { return address_; }
+std::string const& UnspentOutput::get_address() const { return address_.str(); }
 Amount UnspentOutput::get_amount() const { return amount_; }
 int UnspentOutput::get_height() const { return height_; }
 
-void UnspentOutput::set_txid(const std::string& value) { txid_ = value; }
+void UnspentOutput::set_txid(const std::string& value) {
+  txid_ = detail::CompactHash(value);
+}
 void UnspentOutput::set_vout(int value) { vout_ = value; }
-void UnspentOutput::set_address(const std::string& value) { address_ = value; }
+void UnspentOutput::set_address(const std::string& value) {
+  address_ = detail::InternedString(value);
+}
 void UnspentOutput::set_amount(const Amount& value) { amount_ = value; }
 void UnspentOutput::set_height(int value) { height_ = value; }
 
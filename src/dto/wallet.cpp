@@ -8,27 +8,32 @@
 namespace nunchuk {
 
 Wallet::Wallet(const std::string& id, int m, int n,
-               const std::vector<SingleSigner>& signers, AddressType address_type,
+               std::vector<SingleSigner> signers, AddressType address_type,
                bool is_escrow, time_t create_date)
     : id_(id),
       m_(m),
       n_(n),
-      signers_(signers),
+      signers_(std::move(signers)),
       address_type_(address_type),
       escrow_(is_escrow),
-      create_date_(create_date) {}
-std::string Wallet::get_id() const { return id_; }
-std::string Wallet::get_name() const { return name_; }
+      create_date_(create_date),
+      stale_(false) {}
+std::string const& Wallet::get_id() const { return id_; }
+std::string const& Wallet::get_name() const { return name_; }
 int Wallet::get_m() const { return m_; }
 int Wallet::get_n() const { return n_; }
-std::vector<SingleSigner> Wallet::get_signers() const { return signers_; }
+std::vector<SingleSigner> const& Wallet::get_signers() const {
+  return signers_;
+}
 AddressType Wallet::get_address_type() const { return address_type_; }
 bool Wallet::is_escrow() const { return escrow_; }
 Amount Wallet::get_balance() const { return balance_; }
 time_t Wallet::get_create_date() const { return create_date_; }
-std::string Wallet::get_description() const { return description_; }
+std::string const& Wallet::get_description() const { return description_; }
+bool Wallet::is_stale() const { return stale_; }
 void Wallet::set_name(const std::string& value) { name_ = value; }
 void Wallet::set_balance(const Amount& value) { balance_ = value; }
 void Wallet::set_description(const std::string& value) { description_ = value; }
+void Wallet::set_stale(bool value) { stale_ = value; }
 
 }  // namespace nunchuk
\ No newline at end of file
@@ -0,0 +1,63 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <nunchuk.h>
+#include <vector>
+
+namespace nunchuk {
+
+WalletChanges::WalletChanges() : seq_(0) {}
+
+int64_t WalletChanges::get_seq() const { return seq_; }
+std::vector<Transaction> const& WalletChanges::get_transactions() const {
+  return transactions_;
+}
+std::vector<std::string> const& WalletChanges::get_removed_transactions()
+    const {
+  return removed_transactions_;
+}
+std::vector<std::string> const& WalletChanges::get_addresses() const {
+  return addresses_;
+}
+std::vector<std::string> const& WalletChanges::get_utxo_addresses() const {
+  return utxo_addresses_;
+}
+std::vector<UnspentOutput> const& WalletChanges::get_utxos() const {
+  return utxos_;
+}
+
+void WalletChanges::set_seq(int64_t value) { seq_ = value; }
+void WalletChanges::set_transactions(const std::vector<Transaction>& value) {
+  transactions_ = value;
+}
+void WalletChanges::set_removed_transactions(
+    const std::vector<std::string>& value) {
+  removed_transactions_ = value;
+}
+void WalletChanges::set_addresses(const std::vector<std::string>& value) {
+  addresses_ = value;
+}
+void WalletChanges::set_utxo_addresses(const std::vector<std::string>& value) {
+  utxo_addresses_ = value;
+}
+void WalletChanges::set_utxos(const std::vector<UnspentOutput>& value) {
+  utxos_ = value;
+}
+void WalletChanges::set_transactions(std::vector<Transaction>&& value) {
+  transactions_ = std::move(value);
+}
+void WalletChanges::set_removed_transactions(std::vector<std::string>&& value) {
+  removed_transactions_ = std::move(value);
+}
+void WalletChanges::set_addresses(std::vector<std::string>&& value) {
+  addresses_ = std::move(value);
+}
+void WalletChanges::set_utxo_addresses(std::vector<std::string>&& value) {
+  utxo_addresses_ = std::move(value);
+}
+void WalletChanges::set_utxos(std::vector<UnspentOutput>&& value) {
+  utxos_ = std::move(value);
+}
+
+}  // namespace nunchuk
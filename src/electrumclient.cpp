@@ -3,39 +3,44 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "electrumclient.h"
-#include <utils/loguru.hpp>
+#include <logging.h>
+#include <metrics.h>
+#include <tracing.h>
 #include <boost/algorithm/string.hpp>
 
+#include <sstream>
+
 using namespace boost::asio;
 namespace nunchuk {
 
 static std::string DEFAULT_SERVER = "127.0.0.1:50001";
+// A caller waits this long for a response before the request is dropped
+static int REQUEST_TIMEOUT_SECOND = 60;
 
-ElectrumClient::ElectrumClient(const AppSettings& appsettings,
-                               const std::function<void()> on_disconnect)
-    : io_thread_(),
-      signal_thread_(),
-      signal_worker_(make_work_guard(signal_service_)),
-      interval_(60),
-      timer_(io_service_, interval_) {
-  disconnect_signal_.connect(on_disconnect);
-  std::string server_url;
+static std::string GetServerUrl(const AppSettings& appsettings) {
   if (appsettings.get_chain() == Chain::TESTNET) {
     if (!appsettings.get_testnet_servers().empty()) {
-      server_url = appsettings.get_testnet_servers()[0];
-    } else {
-      server_url = DEFAULT_SERVER;
+      return appsettings.get_testnet_servers()[0];
     }
+    return DEFAULT_SERVER;
   } else if (appsettings.get_chain() == Chain::MAIN) {
     if (!appsettings.get_mainnet_servers().empty()) {
-      server_url = appsettings.get_mainnet_servers()[0];
-    } else {
-      server_url = DEFAULT_SERVER;
+      return appsettings.get_mainnet_servers()[0];
     }
-  } else {
-    throw NunchukException(NunchukException::INVALID_CHAIN,
-                           "chain not supported");
+    return DEFAULT_SERVER;
   }
+  throw NunchukException(NunchukException::INVALID_CHAIN,
+                         "chain not supported");
+}
+
+ElectrumClient::ElectrumClient(const AppSettings& appsettings)
+    : io_service_(Executor::getInstance().GetIoContext()),
+      strand_(io_service_.get_executor()),
+      resolver_(io_service_),
+      signal_strand_(Executor::getInstance().MakeBlockingStrand()),
+      interval_(60),
+      timer_(io_service_, interval_) {
+  std::string server_url = GetServerUrl(appsettings);
   size_t colonDoubleSlash = server_url.find("://");
   if (colonDoubleSlash != std::string::npos) {
     protocol_ = server_url.substr(0, colonDoubleSlash);
@@ -69,36 +74,105 @@ ElectrumClient::ElectrumClient(const AppSettings& appsettings,
     socket_ =
         std::unique_ptr<ip::tcp::socket>(new ip::tcp::socket(io_service_));
   }
-  socket_connect();
-  start();
 }
 
-ElectrumClient::~ElectrumClient() {
-  try {
-    stop();
-  } catch (...) {
-    LOG_F(ERROR, "ElectrumClient::~ElectrumClient");
+ElectrumClient::~ElectrumClient() {}
+
+namespace {
+// Stops the client once its last user lets go of it
+struct ClientLease {
+  std::shared_ptr<ElectrumClient> client;
+  ~ClientLease() { client->stop(); }
+};
+}  // namespace
+
+static std::shared_ptr<ElectrumClient> MakeLease(
+    const AppSettings& appsettings) {
+  auto lease = std::make_shared<ClientLease>();
+  lease->client = std::make_shared<ElectrumClient>(appsettings);
+  lease->client->start();
+  return std::shared_ptr<ElectrumClient>(lease, lease->client.get());
+}
+
+std::shared_ptr<ElectrumClient> ElectrumClient::Connect(
+    const AppSettings& appsettings) {
+  if (!appsettings.use_shared_backend()) return MakeLease(appsettings);
+
+  static std::mutex shared_mutex;
+  static std::map<std::string, std::weak_ptr<ElectrumClient>> shared_clients;
+  std::stringstream key;
+  key << int(appsettings.get_chain()) << "|" << GetServerUrl(appsettings);
+  if (appsettings.use_proxy()) {
+    key << "|" << appsettings.get_proxy_host() << ":"
+        << appsettings.get_proxy_port() << "|"
+        << appsettings.get_proxy_username() << ":"
+        << appsettings.get_proxy_password();
   }
+
+  std::lock_guard<std::mutex> lock(shared_mutex);
+  for (auto it = shared_clients.begin(); it != shared_clients.end();) {
+    if (it->second.expired()) {
+      it = shared_clients.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  auto client = shared_clients[key.str()].lock();
+  // A disconnected client is never reused, the first caller replaces it
+  if (!client || client->is_stopped()) {
+    client = MakeLease(appsettings);
+    shared_clients[key.str()] = client;
+  }
+  return client;
+}
+
+static json DisconnectedResponse() {
+  return {{"error", {{"code", 1}, {"message", "Disconnected"}}}};
 }
 
 void ElectrumClient::handle_error(const std::string& where,
                                   const std::string& message) {
-  LOG_F(ERROR, "%s: %s", where.c_str(), message.c_str());
-  stopped_ = true;
+  // stop() is a no-op from here on, so do its cleanup now
+  if (stopped_.exchange(true)) return;
+  NLOG_F(NETWORK, ERROR, "%s: %s", where.c_str(), message.c_str());
+  shutdown();
+  disconnect_signal_();
+}
+
+void ElectrumClient::shutdown() {
+  boost::system::error_code ec;
+  if (is_secure_) {
+    secure_socket_->lowest_layer().close(ec);
+  } else {
+    socket_->close(ec);
+  }
+  timer_.cancel(ec);
+  resolver_.cancel();
   for (auto&& i : callback_) {
-    i.second.set_value({{"error", {{"code", 1}, {"message", "Disconnected"}}}});
+    i.second->set_value(DisconnectedResponse());
   }
-  disconnect_signal_();
+  callback_.clear();
 }
 
-void ElectrumClient::subscribe(const std::string& method,
-                               const NotifySignal::slot_type& lis) {
-  sigmap_[method].connect(lis);
+boost::signals2::connection ElectrumClient::subscribe(
+    const std::string& method, const NotifySignal::slot_type& lis) {
+  std::lock_guard<std::mutex> lock(sigmap_mutex_);
+  return sigmap_[method].connect(lis);
+}
+
+boost::signals2::connection ElectrumClient::scripthash_add_listener(
+    const NotifySignal::slot_type& lis) {
+  return subscribe("blockchain.scripthash.subscribe", lis);
 }
 
-void ElectrumClient::scripthash_add_listener(
+boost::signals2::connection ElectrumClient::headers_add_listener(
     const NotifySignal::slot_type& lis) {
-  subscribe("blockchain.scripthash.subscribe", lis);
+  return subscribe("blockchain.headers.subscribe", lis);
+}
+
+boost::signals2::connection ElectrumClient::disconnect_add_listener(
+    const std::function<void()>& lis) {
+  return disconnect_signal_.connect(lis);
 }
 
 json ElectrumClient::call_method(const std::string& method,
@@ -108,24 +182,49 @@ json ElectrumClient::call_method(const std::string& method,
                            "Disconnected");
   }
 
+  NUNCHUK_TRACE_SCOPE("network", method);
+  auto& metrics = Metrics::getInstance();
+  Metrics::Timer timer(metrics.GetHistogram("nunchuk_electrum_rpc_seconds",
+                                            {{"method", method}}));
+  auto& pending = metrics.GetGauge("nunchuk_electrum_pending_requests");
   int id = id_++;
   json req = {{"jsonrpc", "2.0"}, {"method", method}, {"id", id}};
   if (params != nullptr) req["params"] = params;
 
-  callback_[id] =
-      std::promise<json>(std::allocator_arg, std::allocator<json>());
-  enqueue_message(req.dump());
-  json resp = callback_[id].get_future().get();
+  auto promise = std::make_shared<std::promise<json>>();
+  auto future = promise->get_future();
+  auto self = shared_from_this();
+  std::string message = req.dump();
+  post(strand_, [self, id, promise, message]() {
+    if (self->stopped_) return promise->set_value(DisconnectedResponse());
+    self->callback_[id] = promise;
+    self->enqueue_message(message);
+  });
+  pending.Add(1);
+  if (future.wait_for(std::chrono::seconds(REQUEST_TIMEOUT_SECOND)) !=
+      std::future_status::ready) {
+    pending.Add(-1);
+    // A late response finds no callback and is ignored
+    post(strand_, [self, id]() { self->callback_.erase(id); });
+    metrics
+        .GetCounter("nunchuk_electrum_rpc_errors_total", {{"method", method}})
+        .Increment();
+    throw NunchukException(NunchukException::SERVER_REQUEST_ERROR,
+                           "Request timed out");
+  }
+  json resp = future.get();
+  pending.Add(-1);
   if (resp["error"] != nullptr) {
+    metrics
+        .GetCounter("nunchuk_electrum_rpc_errors_total", {{"method", method}})
+        .Increment();
     std::string message = resp["error"]["message"];
     throw NunchukException(NunchukException::SERVER_REQUEST_ERROR, message);
   }
   return resp["result"];
 }
 
-json ElectrumClient::blockchain_headers_subscribe(
-    const NotifySignal::slot_type& lis) {
-  subscribe("blockchain.headers.subscribe", lis);
+json ElectrumClient::blockchain_headers_subscribe() {
   return call_method("blockchain.headers.subscribe");
 }
 
@@ -171,29 +270,13 @@ json ElectrumClient::blockchain_transaction_get(const std::string& tx_hash) {
   return call_method("blockchain.transaction.get", {tx_hash, true});
 }
 
-void ElectrumClient::start() {
-  io_thread_ = std::thread([&]() {
-    try {
-      io_service_.run();
-    } catch (std::exception& e) {
-      LOG_F(ERROR, "ElectrumClient::io_thread_ %s", e.what());
-    }
-  });
-  signal_thread_ = std::thread([&]() {
-    try {
-      signal_service_.run();
-    } catch (std::exception& e) {
-      LOG_F(ERROR, "ElectrumClient::signal_thread_ %s", e.what());
-    }
-  });
-}
+void ElectrumClient::start() { socket_connect(); }
 
 void ElectrumClient::stop() {
-  stopped_ = true;
-  signal_worker_.reset();
-  io_service_.stop();
-  signal_thread_.join();
-  io_thread_.join();
+  if (stopped_.exchange(true)) return;
+  disconnect_signal_.disconnect_all_slots();
+  auto self = shared_from_this();
+  post(strand_, [self]() { self->shutdown(); });
 }
 
 void ElectrumClient::enqueue_message(const std::string& jsonrpc_request) {
@@ -207,28 +290,37 @@ void ElectrumClient::enqueue_message(const std::string& jsonrpc_request) {
 void ElectrumClient::socket_connect() {
   std::string h = use_proxy_ ? proxy_host_ : host_;
   int p = use_proxy_ ? proxy_port_ : port_;
-  ip::tcp::resolver::query resolver_query(h, std::to_string(p));
-  ip::tcp::resolver resolver(io_service_);
-  boost::system::error_code error;
-  auto resolve_rs = resolver.resolve(resolver_query, error);
-  if (error.value() != 0) {
+  auto self = shared_from_this();
+  // Resolving may take a DNS round trip, don't hold the caller meanwhile
+  resolver_.async_resolve(
+      h, std::to_string(p),
+      bind_executor(strand_, boost::bind(&ElectrumClient::handle_resolve, self,
+                                         placeholders::error,
+                                         placeholders::results)));
+}
+
+void ElectrumClient::handle_resolve(
+    const boost::system::error_code& error,
+    const ip::tcp::resolver::results_type& results) {
+  if (stopped_) return;
+  if (error) {
     return handle_error("socket_connect", "can not resolve host");
   }
   async_connect(
-      is_secure_ ? secure_socket_->next_layer() : socket_->lowest_layer(),
-      resolve_rs,
-      boost::bind(&ElectrumClient::handle_connect, this, placeholders::error));
+      tcp_socket(), results,
+      bind_executor(strand_, boost::bind(&ElectrumClient::handle_connect,
+                                         shared_from_this(),
+                                         placeholders::error)));
 }
 
 void ElectrumClient::socket_read() {
+  auto handler = bind_executor(
+      strand_, boost::bind(&ElectrumClient::handle_read, shared_from_this(),
+                           placeholders::error));
   if (is_secure_) {
-    async_read_until(
-        *secure_socket_, receive_buffer_, "\n",
-        boost::bind(&ElectrumClient::handle_read, this, placeholders::error));
+    async_read_until(*secure_socket_, receive_buffer_, "\n", handler);
   } else {
-    async_read_until(
-        *socket_, receive_buffer_, "\n",
-        boost::bind(&ElectrumClient::handle_read, this, placeholders::error));
+    async_read_until(*socket_, receive_buffer_, "\n", handler);
   }
 }
 
@@ -236,55 +328,80 @@ void ElectrumClient::socket_write() {
   if (request_queue_.empty() || !connected_) {
     return;
   }
+  // The queue keeps the message alive until handle_write pops it
+  request_queue_.front() += "\n";
+  auto handler = bind_executor(
+      strand_, boost::bind(&ElectrumClient::handle_write, shared_from_this(),
+                           placeholders::error));
   if (is_secure_) {
-    async_write(
-        *secure_socket_, buffer(request_queue_.front() + "\n"),
-        boost::bind(&ElectrumClient::handle_write, this, placeholders::error));
+    async_write(*secure_socket_, buffer(request_queue_.front()), handler);
   } else {
-    async_write(
-        *socket_, buffer(request_queue_.front() + "\n"),
-        boost::bind(&ElectrumClient::handle_write, this, placeholders::error));
+    async_write(*socket_, buffer(request_queue_.front()), handler);
   }
 }
 
 void ElectrumClient::ping(const boost::system::error_code& error) {
+  if (error || stopped_) return;
   json req = {{"jsonrpc", "2.0"}, {"method", "server.ping"}, {"id", id_++}};
   enqueue_message(req.dump());
   timer_.expires_at(timer_.expires_at() + interval_);
-  timer_.async_wait(
-      boost::bind(&ElectrumClient::ping, this, placeholders::error));
+  timer_.async_wait(bind_executor(
+      strand_, boost::bind(&ElectrumClient::ping, shared_from_this(),
+                           placeholders::error)));
+}
+
+ip::tcp::socket& ElectrumClient::tcp_socket() {
+  return is_secure_ ? secure_socket_->next_layer() : *socket_;
 }
 
 void ElectrumClient::handle_connect(const boost::system::error_code& error) {
+  if (stopped_) return;
   if (error) {
     return handle_error("handle_connect", error.message());
   }
-  if (!handle_socks5()) {
-    return handle_error("handle_connect", "handle socks5 error");
-  }
+  if (use_proxy_) return socks5_greeting();
+  start_session();
+}
 
-  if (is_secure_) {
-    secure_socket_->lowest_layer().set_option(ip::tcp::no_delay(true));
-    secure_socket_->set_verify_mode(ssl::verify_peer);
-    secure_socket_->set_verify_callback(
-        [](bool preverified, ssl::verify_context& ctx) {
-          char subject_name[256];
-          X509* cert = X509_STORE_CTX_get_current_cert(ctx.native_handle());
-          X509_NAME_oneline(X509_get_subject_name(cert), subject_name, 256);
-          LOG_F(INFO, "Verifying %s", subject_name);
-          return preverified;
-        });
-    secure_socket_->handshake(ssl::stream_base::client);
+void ElectrumClient::start_session() {
+  if (!is_secure_) return on_connected();
+  boost::system::error_code ec;
+  secure_socket_->lowest_layer().set_option(ip::tcp::no_delay(true), ec);
+  secure_socket_->set_verify_mode(ssl::verify_peer);
+  secure_socket_->set_verify_callback(
+      [](bool preverified, ssl::verify_context& ctx) {
+        char subject_name[256];
+        X509* cert = X509_STORE_CTX_get_current_cert(ctx.native_handle());
+        X509_NAME_oneline(X509_get_subject_name(cert), subject_name, 256);
+        NLOG_F(NETWORK, INFO, "Verifying %s", subject_name);
+        return preverified;
+      });
+  secure_socket_->async_handshake(
+      ssl::stream_base::client,
+      bind_executor(strand_,
+                    boost::bind(&ElectrumClient::handle_handshake,
+                                shared_from_this(), placeholders::error)));
+}
+
+void ElectrumClient::handle_handshake(const boost::system::error_code& error) {
+  if (stopped_) return;
+  if (error) {
+    return handle_error("handle_handshake", error.message());
   }
+  on_connected();
+}
 
+void ElectrumClient::on_connected() {
   connected_ = true;
   socket_read();
   socket_write();
-  timer_.async_wait(
-      boost::bind(&ElectrumClient::ping, this, placeholders::error));
+  timer_.async_wait(bind_executor(
+      strand_, boost::bind(&ElectrumClient::ping, shared_from_this(),
+                           placeholders::error)));
 }
 
 void ElectrumClient::handle_read(const boost::system::error_code& error) {
+  if (stopped_) return;
   if (error) {
     return handle_error("handle_read", error.message());
   }
@@ -293,17 +410,31 @@ void ElectrumClient::handle_read(const boost::system::error_code& error) {
   std::string message;
   std::getline(ss, message);
   if (!message.empty()) {
-    DLOG_F(INFO, "Read message: %s", message.c_str());
+    NDLOG_F(NETWORK, 1, "Read message: %s",
+            Logging::Truncate(message).c_str());
     json response = json::parse(message);
     if (response["method"] != nullptr) {
-      signal_service_.post([this, response]() {
-        sigmap_.at(response["method"])(response["params"]);
+      Metrics::getInstance()
+          .GetCounter("nunchuk_electrum_notifications_total",
+                      {{"method", response["method"]}})
+          .Increment();
+      auto self = shared_from_this();
+      post(signal_strand_, [self, response]() {
+        if (self->stopped_) return;
+        NotifySignal* signal = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(self->sigmap_mutex_);
+          auto it = self->sigmap_.find(response["method"]);
+          if (it == self->sigmap_.end()) return;
+          signal = &it->second;
+        }
+        (*signal)(response["params"]);
       });
     } else {
       int id = response["id"];
       auto cb = callback_.find(id);
       if (cb != callback_.end()) {
-        cb->second.set_value(response);
+        cb->second->set_value(response);
         callback_.erase(cb);
       }
     }
@@ -313,26 +444,44 @@ void ElectrumClient::handle_read(const boost::system::error_code& error) {
 }
 
 void ElectrumClient::handle_write(const boost::system::error_code& error) {
+  if (stopped_) return;
   if (error) {
     return handle_error("handle_write", error.message());
   }
-  DLOG_F(INFO, "Write message: %s", request_queue_.front().c_str());
+  NDLOG_F(NETWORK, 1, "Write message: %s",
+          Logging::Truncate(request_queue_.front()).c_str());
   request_queue_.pop_front();
   socket_write();
 }
 
-// Reference: https://tools.ietf.org/html/rfc1928
-bool ElectrumClient::handle_socks5() {
-  if (!use_proxy_) return true;
-  bool auth = !proxy_username_.empty() && !proxy_password_.empty();
-
-  auto my_write = [&](const std::vector<uint8_t>& req) {
-    write(is_secure_ ? secure_socket_->next_layer() : *socket_, buffer(req));
+void ElectrumClient::socks5_write(std::vector<uint8_t> request,
+                                  std::function<void()> next) {
+  socks5_buffer_ = std::move(request);
+  auto self = shared_from_this();
+  auto handler = [self, next](const boost::system::error_code& error, size_t) {
+    if (self->stopped_) return;
+    if (error) return self->handle_error("handle_socks5", error.message());
+    next();
   };
-  auto my_read = [&](uint8_t* res, int i) {
-    read(is_secure_ ? secure_socket_->next_layer() : *socket_, buffer(res, i));
+  async_write(tcp_socket(), buffer(socks5_buffer_),
+              bind_executor(strand_, handler));
+}
+
+void ElectrumClient::socks5_read(size_t size, std::function<void()> next) {
+  socks5_buffer_.assign(size, 0);
+  auto self = shared_from_this();
+  auto handler = [self, next](const boost::system::error_code& error, size_t) {
+    if (self->stopped_) return;
+    if (error) return self->handle_error("handle_socks5", error.message());
+    next();
   };
+  async_read(tcp_socket(), buffer(socks5_buffer_),
+             bind_executor(strand_, handler));
+}
 
+// Reference: https://tools.ietf.org/html/rfc1928
+void ElectrumClient::socks5_greeting() {
+  bool auth = !proxy_username_.empty() && !proxy_password_.empty();
   std::vector<uint8_t> auth_req{0x05};
   if (auth) {
     auth_req.push_back(0x02);
@@ -342,14 +491,17 @@ bool ElectrumClient::handle_socks5() {
     auth_req.push_back(0x01);
     auth_req.push_back(0x00);
   }
-  my_write(auth_req);
-  uint8_t authen_reply[2];
-  my_read(authen_reply, 2);
+  socks5_write(std::move(auth_req), [this]() {
+    socks5_read(2, [this]() { socks5_authenticate(); });
+  });
+}
+
+void ElectrumClient::socks5_authenticate() {
+  const std::vector<uint8_t>& authen_reply = socks5_buffer_;
   if (authen_reply[0] != 0x05) {
-    LOG_F(ERROR, "Proxy failed to initialize");
-    return false;
+    return handle_error("handle_socks5", "Proxy failed to initialize");
   }
-
+  bool auth = !proxy_username_.empty() && !proxy_password_.empty();
   if (auth && authen_reply[1] == 0x02) {
     // Reference: https://tools.ietf.org/html/rfc1929
     std::vector<uint8_t> up_req{0x01};
@@ -357,50 +509,59 @@ bool ElectrumClient::handle_socks5() {
     up_req.insert(up_req.end(), proxy_username_.begin(), proxy_username_.end());
     up_req.push_back(proxy_password_.length());
     up_req.insert(up_req.end(), proxy_password_.begin(), proxy_password_.end());
-    my_write(up_req);
-    uint8_t up_reply[2];
-    my_read(up_reply, 2);
-    if (up_reply[0] != 0x01 || up_reply[1] != 0x00) {
-      LOG_F(ERROR, "Authentication unsuccessful");
-      return false;
-    }
+    socks5_write(std::move(up_req), [this]() {
+      socks5_read(2, [this]() {
+        const std::vector<uint8_t>& up_reply = socks5_buffer_;
+        if (up_reply[0] != 0x01 || up_reply[1] != 0x00) {
+          return handle_error("handle_socks5", "Authentication unsuccessful");
+        }
+        socks5_connect();
+      });
+    });
   } else if (authen_reply[1] != 0x00) {
-    LOG_F(ERROR, "Authentication wrong method: %02x", authen_reply[1]);
-    return false;
+    char method[3];
+    snprintf(method, sizeof(method), "%02x", authen_reply[1]);
+    handle_error("handle_socks5",
+                 std::string("Authentication wrong method: ") + method);
+  } else {
+    socks5_connect();
   }
+}
 
+void ElectrumClient::socks5_connect() {
   std::vector<uint8_t> connect_req{0x05, 0x01, 0x00, 0x03};
   connect_req.push_back(host_.length());
   connect_req.insert(connect_req.end(), host_.begin(), host_.end());
   connect_req.push_back((port_ >> 8) & 0xff);
   connect_req.push_back(port_ & 0xff);
-  my_write(connect_req);
-  uint8_t connect_reply[4];
-  my_read(connect_reply, 4);
+  socks5_write(std::move(connect_req), [this]() {
+    socks5_read(4, [this]() { socks5_bound_address(); });
+  });
+}
+
+void ElectrumClient::socks5_bound_address() {
+  const std::vector<uint8_t>& connect_reply = socks5_buffer_;
   if (connect_reply[0] != 0x05 || connect_reply[1] != 0x00 ||
       connect_reply[2] != 0x00) {
-    LOG_F(ERROR, "Connect socks5 failed: %02x", connect_reply[1]);
-    return false;
+    char reply[3];
+    snprintf(reply, sizeof(reply), "%02x", connect_reply[1]);
+    return handle_error("handle_socks5",
+                        std::string("Connect socks5 failed: ") + reply);
   }
-
-  uint8_t resp[256];
+  // The bound address and its 2 byte port are read and discarded
+  auto done = [this]() { start_session(); };
   switch (connect_reply[3]) {
     case 0x01:  // IP V4
-      my_read(resp, 4);
-      break;
+      return socks5_read(4 + 2, done);
     case 0x04:  // IP V6
-      my_read(resp, 16);
-      break;
+      return socks5_read(16 + 2, done);
     case 0x03:  // DOMAINNAME
-      my_read(resp, 1);
-      my_read(resp, resp[0]);
-      break;
+      return socks5_read(1, [this, done]() {
+        socks5_read(socks5_buffer_[0] + 2, done);
+      });
     default:
-      LOG_F(ERROR, "Error: malformed proxy response");
-      return false;
+      return handle_error("handle_socks5", "malformed proxy response");
   }
-  my_read(resp, 2);
-  return true;
 }
 
 }  // namespace nunchuk
\ No newline at end of file
@@ -6,6 +6,7 @@
 #define NUNCHUK_ELECTRUM_CLIENT_H
 
 #include <nunchuk.h>
+#include <executor.h>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
@@ -17,23 +18,49 @@
 #include <memory>
 #include <map>
 #include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 using json = nlohmann::json;
 
 typedef boost::signals2::signal<void(json)> NotifySignal;
 
 namespace nunchuk {
-class ElectrumClient {
+// Socket handlers run on a strand of the shared io group and notifications
+// on a strand of the blocking pool. Handlers keep the client alive through
+// shared_from_this, so it must be owned by a shared_ptr and start()ed after
+// construction; stop() closes the connection and fails pending calls.
+//
+// Listeners may be added by several owners when the client is shared, each
+// owner disconnects the returned connections before it goes away.
+class ElectrumClient : public std::enable_shared_from_this<ElectrumClient> {
  public:
-  ElectrumClient(const nunchuk::AppSettings& appsettings,
-                 const std::function<void()> on_disconnect);
+  explicit ElectrumClient(const nunchuk::AppSettings& appsettings);
   ~ElectrumClient();
 
-  void subscribe(const std::string& method, const NotifySignal::slot_type& lis);
-  void scripthash_add_listener(const NotifySignal::slot_type& lis);
+  // Returns a started client that is stopped when the last copy of the
+  // returned pointer is released. With shared backend enabled, callers with
+  // the same server and proxy settings get the same client until it
+  // disconnects.
+  static std::shared_ptr<ElectrumClient> Connect(
+      const nunchuk::AppSettings& appsettings);
+
+  void start();
+  void stop();
+  bool is_stopped() const { return stopped_; }
+
+  boost::signals2::connection subscribe(const std::string& method,
+                                        const NotifySignal::slot_type& lis);
+  boost::signals2::connection scripthash_add_listener(
+      const NotifySignal::slot_type& lis);
+  boost::signals2::connection headers_add_listener(
+      const NotifySignal::slot_type& lis);
+  boost::signals2::connection disconnect_add_listener(
+      const std::function<void()>& lis);
   json call_method(const std::string& method, const json& params = nullptr);
 
-  json blockchain_headers_subscribe(const NotifySignal::slot_type& lis);
+  json blockchain_headers_subscribe();
   json blockchain_scripthash_subscribe(const std::string& scripthash);
   json blockchain_scripthash_listunspent(const std::string& scripthash);
   json blockchain_scripthash_get_history(const std::string& scripthash);
@@ -45,18 +72,32 @@ class ElectrumClient {
   json blockchain_transaction_get(const std::string& tx_hash);
 
  private:
-  void start();
-  void stop();
   void enqueue_message(const std::string& jsonrpc_request);
   void socket_connect();
   void socket_read();
   void socket_write();
   void ping(const boost::system::error_code& error);
+  void handle_resolve(
+      const boost::system::error_code& error,
+      const boost::asio::ip::tcp::resolver::results_type& results);
   void handle_connect(const boost::system::error_code& error);
+  void handle_handshake(const boost::system::error_code& error);
   void handle_read(const boost::system::error_code& error);
   void handle_write(const boost::system::error_code& error);
-  bool handle_socks5();
+  // SOCKS5 negotiation, each step chained on strand_ from the previous one
+  void socks5_greeting();
+  void socks5_authenticate();
+  void socks5_connect();
+  void socks5_bound_address();
+  void socks5_write(std::vector<uint8_t> request, std::function<void()> next);
+  void socks5_read(size_t size, std::function<void()> next);
+  // TLS handshake, if any, once the TCP (or proxied) connection is up
+  void start_session();
+  void on_connected();
+  boost::asio::ip::tcp::socket& tcp_socket();
   void handle_error(const std::string& where, const std::string& message);
+  // Close the socket, cancel timers and fail pending calls. Runs on strand_
+  void shutdown();
 
   std::string protocol_ = "tcp";
   std::string host_;
@@ -67,12 +108,10 @@ class ElectrumClient {
   int proxy_port_ = -1;
   std::string proxy_username_ = "";
   std::string proxy_password_ = "";
-  std::thread io_thread_;
-  boost::asio::io_service io_service_;
-  std::thread signal_thread_;
-  boost::asio::io_service signal_service_;
-  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
-      signal_worker_;
+  boost::asio::io_context& io_service_;
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+  boost::asio::ip::tcp::resolver resolver_;
+  Executor::BlockingStrand signal_strand_;
   std::unique_ptr<boost::asio::ip::tcp::socket> socket_;
   std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
       secure_socket_;
@@ -80,9 +119,11 @@ class ElectrumClient {
   std::atomic<bool> stopped_{false};
   std::atomic<int> id_{0};
   boost::asio::streambuf receive_buffer_;
+  std::vector<uint8_t> socks5_buffer_;
   std::deque<std::string> request_queue_;
+  std::mutex sigmap_mutex_;
   std::map<std::string, NotifySignal> sigmap_;
-  std::map<int, std::promise<json>> callback_;
+  std::map<int, std::shared_ptr<std::promise<json>>> callback_;
   boost::signals2::signal<void()> disconnect_signal_;
   boost::posix_time::seconds interval_;
   boost::asio::deadline_timer timer_;
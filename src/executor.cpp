@@ -0,0 +1,102 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "executor.h"
+
+#include <utils/loguru.hpp>
+
+#include <algorithm>
+
+namespace nunchuk {
+
+static size_t MIN_CPU_THREADS = 2;
+static size_t DEFAULT_IO_THREADS = 1;
+// Blocking threads mostly sleep, size the pool for the number of wallets and
+// devices waited on at once rather than for the core count
+static size_t DEFAULT_BLOCKING_THREADS = 16;
+
+Executor& Executor::getInstance() {
+  static Executor instance;
+  return instance;
+}
+
+Executor::~Executor() {
+  if (!cpu_pool_) return;
+  // Queued tasks are dropped, their futures get broken_promise
+  cpu_pool_->stop();
+  blocking_pool_->stop();
+  cpu_pool_->join();
+  blocking_pool_->join();
+  for (auto&& guard : io_guards_) guard.reset();
+  for (auto&& io : io_contexts_) io->stop();
+  for (auto&& thread : io_threads_pool_) thread.join();
+}
+
+void Executor::Configure(size_t cpu_threads, size_t io_threads,
+                         size_t blocking_threads) {
+  std::call_once(start_flag_, [&]() {
+    cpu_threads_ = cpu_threads;
+    io_threads_ = io_threads;
+    blocking_threads_ = blocking_threads;
+    Start();
+  });
+}
+
+void Executor::Start() {
+  if (cpu_threads_ == 0) {
+    cpu_threads_ = std::max<size_t>(MIN_CPU_THREADS,
+                                    std::thread::hardware_concurrency());
+  }
+  if (io_threads_ == 0) io_threads_ = DEFAULT_IO_THREADS;
+  if (blocking_threads_ == 0) blocking_threads_ = DEFAULT_BLOCKING_THREADS;
+  LOG_F(INFO,
+        "Executor::Start() cpu_threads=%zu io_threads=%zu "
+        "blocking_threads=%zu",
+        cpu_threads_, io_threads_, blocking_threads_);
+
+  cpu_pool_.reset(new boost::asio::thread_pool(cpu_threads_));
+  blocking_pool_.reset(new boost::asio::thread_pool(blocking_threads_));
+  for (size_t i = 0; i < io_threads_; i++) {
+    io_contexts_.emplace_back(new boost::asio::io_context(1));
+    io_guards_.push_back(boost::asio::make_work_guard(*io_contexts_.back()));
+  }
+  for (size_t i = 0; i < io_threads_; i++) {
+    auto io = io_contexts_[i].get();
+    io_threads_pool_.emplace_back([io]() {
+      for (;;) {
+        try {
+          io->run();
+          break;  // exited normally
+        } catch (std::exception& e) {
+          LOG_F(ERROR, "Executor io thread: %s", e.what());
+        }
+      }
+    });
+  }
+}
+
+boost::asio::thread_pool& Executor::GetCpuPool() {
+  Configure(0, 0);
+  return *cpu_pool_;
+}
+
+boost::asio::thread_pool& Executor::GetBlockingPool() {
+  Configure(0, 0);
+  return *blocking_pool_;
+}
+
+Executor::CpuStrand Executor::MakeCpuStrand() {
+  return CpuStrand(GetCpuPool().get_executor());
+}
+
+Executor::BlockingStrand Executor::MakeBlockingStrand() {
+  return BlockingStrand(GetBlockingPool().get_executor());
+}
+
+boost::asio::io_context& Executor::GetIoContext() {
+  Configure(0, 0);
+  return *io_contexts_[next_io_++ % io_contexts_.size()];
+}
+
+}  // namespace nunchuk
@@ -0,0 +1,119 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_EXECUTOR_H
+#define NUNCHUK_EXECUTOR_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace nunchuk {
+
+//! Library-wide executor shared by every Nunchuk instance: a thread pool for
+//! CPU work, a larger pool for tasks that wait on devices or the network
+//! (async API, synchronizer, electrum notifications) and a group of
+//! io_contexts, one thread each, for sockets and timers.
+class Executor {
+ public:
+  typedef boost::asio::strand<boost::asio::thread_pool::executor_type>
+      CpuStrand;
+  typedef CpuStrand BlockingStrand;
+
+  static Executor& getInstance();
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+  ~Executor();
+
+  // Thread counts are fixed by the first call, later calls are ignored.
+  // 0 picks the default
+  void Configure(size_t cpu_threads, size_t io_threads,
+                 size_t blocking_threads = 0);
+
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F f) {
+    typedef typename std::result_of<F()>::type R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    auto future = task->get_future();
+    boost::asio::post(GetCpuPool(), [task]() { (*task)(); });
+    return future;
+  }
+
+  // Same as Submit, for tasks that spend most of their time waiting on a
+  // device or a server
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> SubmitBlocking(F f) {
+    typedef typename std::result_of<F()>::type R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    auto future = task->get_future();
+    boost::asio::post(GetBlockingPool(), [task]() { (*task)(); });
+    return future;
+  }
+
+  boost::asio::thread_pool& GetCpuPool();
+  boost::asio::thread_pool& GetBlockingPool();
+  // Serialized view of the CPU pool, for components with single-threaded
+  // state
+  CpuStrand MakeCpuStrand();
+  // Serialized view of the blocking pool
+  BlockingStrand MakeBlockingStrand();
+  // Round robin over the io group
+  boost::asio::io_context& GetIoContext();
+
+ private:
+  typedef boost::asio::executor_work_guard<
+      boost::asio::io_context::executor_type>
+      IoWorkGuard;
+
+  Executor() = default;
+  void Start();
+
+  std::once_flag start_flag_;
+  size_t cpu_threads_ = 0;
+  size_t io_threads_ = 0;
+  size_t blocking_threads_ = 0;
+  std::unique_ptr<boost::asio::thread_pool> cpu_pool_;
+  std::unique_ptr<boost::asio::thread_pool> blocking_pool_;
+  std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+  std::vector<IoWorkGuard> io_guards_;
+  std::vector<std::thread> io_threads_pool_;
+  std::atomic<size_t> next_io_{0};
+};
+
+//! Counts queued tasks that reference an object, so its destructor can wait
+//! for them. A task holds the token returned by Acquire() until it has run
+//! or been dropped.
+class TaskTracker {
+ public:
+  std::shared_ptr<void> Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    count_++;
+    return std::shared_ptr<void>(this, [](TaskTracker* tracker) {
+      std::lock_guard<std::mutex> lock(tracker->mutex_);
+      if (--tracker->count_ == 0) tracker->cv_.notify_all();
+    });
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return count_ == 0; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int count_ = 0;
+};
+
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_EXECUTOR_H
@@ -7,6 +7,7 @@
 #include <base58.h>
 
 #include <array>
+#include <boost/filesystem.hpp>
 #include <boost/process.hpp>
 #ifdef _WIN32
 #include <boost/process/windows.hpp>
@@ -21,8 +22,10 @@
 #include <string>
 #include <vector>
 
+#include <logging.h>
+#include <metrics.h>
+#include <tracing.h>
 #include <utils/json.hpp>
-#include <utils/loguru.hpp>
 
 using json = nlohmann::json;
 namespace bp = boost::process;
@@ -44,46 +47,93 @@ static json ParseResponse(const std::string &resp) {
   return rs;
 }
 
+// hwi subcommand of a RunCmd call, without options and payloads
+static std::string CommandName(const std::vector<std::string> &args,
+                               const std::vector<std::string> &stdin_args) {
+  if (!stdin_args.empty()) return stdin_args[0];
+  for (size_t i = 0; i < args.size(); i++) {
+    if (args[i] == "-f" || args[i] == "-d" || args[i] == "-t") {
+      i++;
+    } else if (args[i].empty() || args[i][0] != '-') {
+      return args[i];
+    }
+  }
+  return "unknown";
+}
+
 HWIService::HWIService(std::string path, Chain chain)
     : hwi_(path), testnet_(chain == Chain::TESTNET) {}
 
 void HWIService::SetPath(const std::string &path) { hwi_ = path; }
 void HWIService::SetChain(Chain chain) { testnet_ = chain == Chain::TESTNET; }
 
-std::string HWIService::RunCmd(const std::vector<std::string> &args) const {
-  // build command string
+std::string HWIService::RunCmd(
+    const std::vector<std::string> &args,
+    const std::vector<std::string> &stdin_args) const {
+  // Large payloads (e.g. PSBTs carrying full non_witness_utxo data) can exceed
+  // the argv limit, so they are passed through `hwi --stdin` instead
+  std::vector<std::string> argv = args;
+  std::string input;
+  if (!stdin_args.empty()) {
+    argv.push_back("--stdin");
+    for (auto &&arg : stdin_args) {
+      input += (input.empty() ? "" : " ") + arg;
+    }
+    input += "\n\n";
+  }
+
+  // only log the command name and payload sizes, never the payload itself
   std::stringstream cmd;
   cmd << hwi_;
-  const int v_size = args.size();
-  for (size_t i = 0; i < v_size; ++i) {
-    cmd << " " << args[i];
+  for (auto &&arg : argv) cmd << " " << arg;
+  if (!stdin_args.empty()) {
+    cmd << " <<< " << stdin_args[0] << " (" << input.size() << " bytes)";
   }
 
+  auto &metrics = Metrics::getInstance();
+  std::string command = CommandName(args, stdin_args);
+  NUNCHUK_TRACE_SCOPE("hwi", "hwi " + command);
+  Metrics::Timer timer(
+      metrics.GetHistogram("nunchuk_hwi_call_seconds", {{"command", command}}));
+  auto &errors =
+      metrics.GetCounter("nunchuk_hwi_errors_total", {{"command", command}});
+
   // run command and get output
   int exitcode;
   std::string result;
   try {
+    boost::filesystem::path exe = hwi_;
+    if (!exe.has_parent_path()) exe = bp::search_path(hwi_);
     bp::ipstream out;
+    bp::opstream in;
 #ifdef _WIN32
-    bp::child c(cmd.str().c_str(), bp::std_out > out, bp::windows::hide);
+    bp::child c(exe, bp::args(argv), bp::std_out > out, bp::std_in < in,
+                bp::windows::hide);
 #else
-    bp::child c(cmd.str().c_str(), bp::std_out > out);
+    bp::child c(exe, bp::args(argv), bp::std_out > out, bp::std_in < in);
 #endif
+    if (!input.empty()) in << input;
+    in.flush();
+    in.pipe().close();
     std::getline(out, result);
     c.wait();
     exitcode = c.exit_code();
   } catch (bp::process_error &pe) {
+    errors.Increment();
     throw HWIException(HWIException::RUN_ERROR, pe.what());
   }
 
   if (exitcode != 0) {
-    LOG_F(ERROR, "Run hwi command '%s' exit code: %d", cmd.str().c_str(),
-          exitcode);
+    errors.Increment();
+    NLOG_F(HWI, ERROR, "Run hwi command '%s' exit code: %d",
+           cmd.str().c_str(), exitcode);
     throw HWIException(HWIException::RUN_ERROR, "run command exit error!");
   }
 
-  LOG_F(INFO, "Run hwi command '%s' result: %s", cmd.str().c_str(),
-        result.c_str());
+  NLOG_F(HWI, INFO, "Run hwi command '%s' result: %zu bytes",
+         cmd.str().c_str(), result.size());
+  NDLOG_F(HWI, 1, "Run hwi command '%s' result: %s", cmd.str().c_str(),
+          Logging::Truncate(result).c_str());
   return result;
 }
 
@@ -142,12 +192,11 @@ std::string HWIService::GetMasterFingerprint(const Device &device) const {
 std::string HWIService::SignTx(const Device &device,
                                const std::string &base64_psbt) const {
   ValidateDevice(device);
-  std::vector<std::string> cmd_args = {"-f", device.get_master_fingerprint(),
-                                       "signtx", base64_psbt};
+  std::vector<std::string> cmd_args = {"-f", device.get_master_fingerprint()};
   if (testnet_) {
     cmd_args.insert(cmd_args.begin(), "--testnet");
   }
-  json rs = ParseResponse(RunCmd(cmd_args));
+  json rs = ParseResponse(RunCmd(cmd_args, {"signtx", base64_psbt}));
   return rs["psbt"];
 }
 
@@ -155,9 +204,8 @@ std::string HWIService::SignMessage(const Device &device,
                                     const std::string &message,
                                     const std::string &derivation_path) const {
   ValidateDevice(device);
-  std::string quoted_message = "\"" + message + "\"";
   std::vector<std::string> cmd_args = {"-f", device.get_master_fingerprint(),
-                                       "signmessage", quoted_message,
+                                       "signmessage", message,
                                        derivation_path};
   if (testnet_) {
     cmd_args.insert(cmd_args.begin(), "--testnet");
@@ -30,7 +30,8 @@ class HWIService {
                           const std::string &derivation_path) const;
 
  private:
-  std::string RunCmd(const std::vector<std::string> &) const;
+  std::string RunCmd(const std::vector<std::string> &args,
+                     const std::vector<std::string> &stdin_args = {}) const;
   std::string hwi_;
   bool testnet_;
 };
@@ -0,0 +1,63 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iostats.h"
+
+namespace nunchuk {
+
+namespace {
+struct Counters {
+  int64_t db_opens;
+  int64_t key_derivations;
+  int64_t statements;
+  int64_t rows_read;
+  int depth;
+};
+}  // namespace
+
+static thread_local Counters current = {0, 0, 0, 0, 0};
+static thread_local IoStats last;
+
+static Metrics::Counter& GetCounter(const char* name, const char* method) {
+  return Metrics::getInstance().GetCounter(name, {{"method", method}});
+}
+
+IoStatsScope::Sink::Sink(const char* method)
+    : method(method),
+      calls(GetCounter("nunchuk_api_calls_total", method)),
+      db_opens(GetCounter("nunchuk_api_db_opens_total", method)),
+      key_derivations(GetCounter("nunchuk_api_key_derivations_total", method)),
+      statements(GetCounter("nunchuk_api_statements_total", method)),
+      rows_read(GetCounter("nunchuk_api_rows_read_total", method)) {}
+
+IoStatsScope::IoStatsScope(Sink& sink)
+    : sink_(sink), outermost_(current.depth == 0) {
+  if (outermost_) current = {0, 0, 0, 0, 0};
+  current.depth++;
+}
+
+IoStatsScope::~IoStatsScope() {
+  current.depth--;
+  if (!outermost_) return;
+  sink_.calls.Increment();
+  sink_.db_opens.Increment(current.db_opens);
+  sink_.key_derivations.Increment(current.key_derivations);
+  sink_.statements.Increment(current.statements);
+  sink_.rows_read.Increment(current.rows_read);
+  last.set_call(sink_.method);
+  last.set_db_opens(current.db_opens);
+  last.set_key_derivations(current.key_derivations);
+  last.set_statements(current.statements);
+  last.set_rows_read(current.rows_read);
+}
+
+void IoStatsScope::RecordDbOpen() { current.db_opens++; }
+void IoStatsScope::RecordKeyDerivation() { current.key_derivations++; }
+void IoStatsScope::RecordStatement() { current.statements++; }
+void IoStatsScope::RecordRow() { current.rows_read++; }
+bool IoStatsScope::IsActive() { return current.depth > 0; }
+
+IoStats IoStatsScope::GetLast() { return last; }
+
+}  // namespace nunchuk
@@ -0,0 +1,58 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_IOSTATS_H
+#define NUNCHUK_IOSTATS_H
+
+#include <nunchuk.h>
+#include <metrics.h>
+#include <tracing.h>
+
+namespace nunchuk {
+
+// Counts storage work on the calling thread and attributes it to the
+// outermost public API call in progress. Nested API calls add to their
+// caller. Work outside any call, e.g. on the synchronizer, is not reported.
+class IoStatsScope {
+ public:
+  // Per-method metrics, created once per API function
+  struct Sink {
+    explicit Sink(const char* method);
+    const char* method;
+    Metrics::Counter& calls;
+    Metrics::Counter& db_opens;
+    Metrics::Counter& key_derivations;
+    Metrics::Counter& statements;
+    Metrics::Counter& rows_read;
+  };
+
+  explicit IoStatsScope(Sink& sink);
+  ~IoStatsScope();
+  IoStatsScope(const IoStatsScope&) = delete;
+  IoStatsScope& operator=(const IoStatsScope&) = delete;
+
+  static void RecordDbOpen();
+  static void RecordKeyDerivation();
+  static void RecordStatement();
+  static void RecordRow();
+  // An API call is in progress on this thread
+  static bool IsActive();
+
+  // Counts of the last outermost call that finished on this thread
+  static IoStats GetLast();
+
+ private:
+  Sink& sink_;
+  bool outermost_;
+};
+
+}  // namespace nunchuk
+
+// Starts a public API call: a trace span plus I/O accounting
+#define NUNCHUK_API_FUNCTION()                                        \
+  NUNCHUK_TRACE_FUNCTION("api");                                      \
+  static ::nunchuk::IoStatsScope::Sink io_stats_sink_(__func__);      \
+  ::nunchuk::IoStatsScope io_stats_scope_(io_stats_sink_)
+
+#endif  // NUNCHUK_IOSTATS_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logging.h"
+
+#include <metrics.h>
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nunchuk {
+
+static const size_t RING_CAPACITY = 4096;
+
+std::atomic<int> Logging::levels_[Logging::SUBSYSTEM_COUNT] = {
+    {0}, {0}, {0}, {0}, {0}};
+
+void Logging::SetLevel(LogSubsystem subsystem, int verbosity) {
+  levels_[static_cast<int>(subsystem)] = verbosity;
+}
+
+std::string Logging::Truncate(const std::string& payload, size_t max_size) {
+  if (payload.size() <= max_size) return payload;
+  return payload.substr(0, max_size) + "...(" +
+         std::to_string(payload.size()) + " bytes)";
+}
+
+namespace {
+// loguru formats on the calling thread; the sink only copies the line into
+// the ring so the caller never waits on disk
+class AsyncSink {
+ public:
+  static AsyncSink& getInstance() {
+    static AsyncSink instance;
+    return instance;
+  }
+
+  void Start(const std::string& file_path, int verbosity) {
+    {
+      std::lock_guard<std::mutex> lock(file_mutex_);
+      file_.close();
+      file_.clear();
+      file_.open(file_path, std::ios::out | std::ios::app);
+    }
+    if (!file_) {
+      LOG_F(ERROR, "Can not open log file %s", file_path.c_str());
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!writer_.joinable()) writer_ = std::thread(&AsyncSink::Run, this);
+    }
+    loguru::remove_callback("nunchuk_async");
+    loguru::add_callback("nunchuk_async", &AsyncSink::OnMessage, this,
+                         static_cast<loguru::Verbosity>(verbosity), nullptr,
+                         &AsyncSink::OnFlush);
+  }
+
+ private:
+  AsyncSink() : ring_(RING_CAPACITY) {}
+
+  ~AsyncSink() {
+    loguru::remove_callback("nunchuk_async");
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    if (writer_.joinable()) writer_.join();
+  }
+
+  static void OnMessage(void* user_data, const loguru::Message& message) {
+    static_cast<AsyncSink*>(user_data)->Push(
+        std::string(message.preamble) + message.indentation + message.prefix +
+        message.message);
+  }
+
+  static void OnFlush(void* user_data) {
+    static_cast<AsyncSink*>(user_data)->cv_.notify_one();
+  }
+
+  void Push(std::string line) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (size_ == ring_.size()) {
+        // Drop the oldest
+        head_ = (head_ + 1) % ring_.size();
+        size_--;
+        dropped_++;
+      }
+      ring_[(head_ + size_) % ring_.size()] = std::move(line);
+      size_++;
+    }
+    cv_.notify_one();
+  }
+
+  void Run() {
+    static auto& dropped_total =
+        Metrics::getInstance().GetCounter("nunchuk_log_dropped_total");
+    std::vector<std::string> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&]() { return stopped_ || size_ > 0; });
+      if (size_ == 0 && stopped_) return;
+      size_t dropped = dropped_;
+      dropped_ = 0;
+      batch.clear();
+      for (; size_ > 0; size_--) {
+        batch.push_back(std::move(ring_[head_]));
+        head_ = (head_ + 1) % ring_.size();
+      }
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> file_lock(file_mutex_);
+        if (dropped > 0) {
+          dropped_total.Increment(dropped);
+          file_ << "[log] dropped " << dropped << " messages\n";
+        }
+        for (auto&& line : batch) file_ << line << "\n";
+        file_.flush();
+      }
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::string> ring_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  size_t dropped_ = 0;
+  bool stopped_ = false;
+  // Held by the writer while it writes, so Start can swap the file
+  std::mutex file_mutex_;
+  std::ofstream file_;
+  std::thread writer_;
+};
+}  // namespace
+
+void Logging::StartAsyncSink(const std::string& file_path, int verbosity) {
+  AsyncSink::getInstance().Start(file_path, verbosity);
+}
+
+}  // namespace nunchuk
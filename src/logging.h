@@ -0,0 +1,58 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_LOGGING_H
+#define NUNCHUK_LOGGING_H
+
+#include <nunchuk.h>
+#include <utils/loguru.hpp>
+
+#include <atomic>
+#include <string>
+
+namespace nunchuk {
+
+// Longest payload (PSBT, Electrum message, HWI output) written to the log
+const size_t MAX_LOG_PAYLOAD = 256;
+
+class Logging {
+ public:
+  static bool IsEnabled(LogSubsystem subsystem, int verbosity) {
+    return verbosity <= levels_[static_cast<int>(subsystem)];
+  }
+  static void SetLevel(LogSubsystem subsystem, int verbosity);
+
+  // Route loguru messages up to verbosity through a bounded ring buffer to
+  // a background thread appending to file_path. When the buffer is full the
+  // oldest messages are dropped and counted
+  static void StartAsyncSink(const std::string& file_path, int verbosity);
+
+  // First max_size bytes of payload, followed by the full size if cut
+  static std::string Truncate(const std::string& payload,
+                              size_t max_size = MAX_LOG_PAYLOAD);
+
+ private:
+  static const int SUBSYSTEM_COUNT = 5;
+  static std::atomic<int> levels_[SUBSYSTEM_COUNT];
+};
+
+}  // namespace nunchuk
+
+// LOG_F / DLOG_F filtered by subsystem level, arguments are not evaluated
+// when filtered out. NDLOG_F compiles to nothing when LOGURU_DEBUG_LOGGING
+// is 0, which the build sets for release configurations
+#define NLOG_F(subsystem, verbosity_name, ...)                          \
+  (!::nunchuk::Logging::IsEnabled(::nunchuk::LogSubsystem::subsystem,   \
+                                  loguru::Verbosity_##verbosity_name))  \
+      ? (void)0                                                         \
+      : LOG_F(verbosity_name, __VA_ARGS__)
+
+#if LOGURU_DEBUG_LOGGING
+#define NDLOG_F(subsystem, verbosity_name, ...) \
+  NLOG_F(subsystem, verbosity_name, __VA_ARGS__)
+#else
+#define NDLOG_F(subsystem, verbosity_name, ...)
+#endif
+
+#endif  // NUNCHUK_LOGGING_H
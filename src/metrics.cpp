@@ -0,0 +1,269 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include <executor.h>
+#include <utils/json.hpp>
+#include <utils/loguru.hpp>
+#include <boost/asio.hpp>
+
+#include <iomanip>
+#include <sstream>
+
+using json = nlohmann::json;
+using namespace boost::asio;
+
+namespace nunchuk {
+
+const size_t Metrics::Histogram::BUCKET_COUNT;
+const std::array<double, Metrics::Histogram::BUCKET_COUNT>
+    Metrics::Histogram::BOUNDS = {0.0005, 0.001, 0.0025, 0.005, 0.01,
+                                  0.025,  0.05,  0.1,    0.25,  0.5,
+                                  1,      2.5,   5,      10};
+
+void Metrics::Histogram::Observe(double seconds) {
+  for (size_t i = 0; i < BUCKET_COUNT; i++) {
+    if (seconds <= BOUNDS[i]) {
+      buckets_[i]++;
+      break;
+    }
+  }
+  count_++;
+  sum_ns_ += uint64_t(std::max(0.0, seconds) * 1e9);
+}
+
+uint64_t Metrics::Histogram::CumulativeCount(size_t i) const {
+  uint64_t rs = 0;
+  for (size_t j = 0; j <= i && j < BUCKET_COUNT; j++) rs += buckets_[j];
+  return rs;
+}
+
+Metrics& Metrics::getInstance() {
+  static Metrics instance;
+  return instance;
+}
+
+template <typename T>
+static T& GetOrCreate(std::map<std::pair<std::string, Metrics::Labels>,
+                               std::unique_ptr<T>>& series,
+                      const std::string& name, const Metrics::Labels& labels) {
+  auto& rs = series[{name, labels}];
+  if (!rs) rs.reset(new T());
+  return *rs;
+}
+
+Metrics::Counter& Metrics::GetCounter(const std::string& name,
+                                      const Labels& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetOrCreate(counters_, name, labels);
+}
+
+Metrics::Gauge& Metrics::GetGauge(const std::string& name,
+                                  const Labels& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetOrCreate(gauges_, name, labels);
+}
+
+Metrics::Histogram& Metrics::GetHistogram(const std::string& name,
+                                          const Labels& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetOrCreate(histograms_, name, labels);
+}
+
+std::string Metrics::Export(MetricsFormat format) {
+  switch (format) {
+    case MetricsFormat::JSON:
+      return ToJson();
+    case MetricsFormat::PROMETHEUS:
+      return ToPrometheus();
+  }
+  throw NunchukException(NunchukException::INVALID_PARAMETER,
+                         "invalid metrics format");
+}
+
+std::string Metrics::ToJson() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  json counters = json::array();
+  for (auto&& i : counters_) {
+    counters.push_back({{"name", i.first.first},
+                        {"labels", i.first.second},
+                        {"value", i.second->Value()}});
+  }
+  json gauges = json::array();
+  for (auto&& i : gauges_) {
+    gauges.push_back({{"name", i.first.first},
+                      {"labels", i.first.second},
+                      {"value", i.second->Value()}});
+  }
+  json histograms = json::array();
+  for (auto&& i : histograms_) {
+    json buckets = json::array();
+    for (size_t b = 0; b < Histogram::BUCKET_COUNT; b++) {
+      buckets.push_back({{"le", Histogram::BOUNDS[b]},
+                         {"count", i.second->CumulativeCount(b)}});
+    }
+    histograms.push_back({{"name", i.first.first},
+                          {"labels", i.first.second},
+                          {"count", i.second->Count()},
+                          {"sum", i.second->Sum()},
+                          {"buckets", buckets}});
+  }
+  json rs = {{"counters", counters},
+             {"gauges", gauges},
+             {"histograms", histograms}};
+  return rs.dump();
+}
+
+static std::string EscapeLabel(const std::string& value) {
+  std::string rs;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      rs += '\\';
+      rs += c;
+    } else if (c == '\n') {
+      rs += "\\n";
+    } else {
+      rs += c;
+    }
+  }
+  return rs;
+}
+
+static std::string FormatLabels(const Metrics::Labels& labels,
+                                const std::string& le = "") {
+  if (labels.empty() && le.empty()) return "";
+  std::stringstream rs;
+  rs << "{";
+  bool first = true;
+  for (auto&& label : labels) {
+    rs << (first ? "" : ",") << label.first << "=\""
+       << EscapeLabel(label.second) << "\"";
+    first = false;
+  }
+  if (!le.empty()) rs << (first ? "" : ",") << "le=\"" << le << "\"";
+  rs << "}";
+  return rs.str();
+}
+
+std::string Metrics::ToPrometheus() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::stringstream rs;
+  rs << std::setprecision(9);
+  std::string last;
+  for (auto&& i : counters_) {
+    if (i.first.first != last) {
+      last = i.first.first;
+      rs << "# TYPE " << last << " counter\n";
+    }
+    rs << last << FormatLabels(i.first.second) << " " << i.second->Value()
+       << "\n";
+  }
+  for (auto&& i : gauges_) {
+    if (i.first.first != last) {
+      last = i.first.first;
+      rs << "# TYPE " << last << " gauge\n";
+    }
+    rs << last << FormatLabels(i.first.second) << " " << i.second->Value()
+       << "\n";
+  }
+  for (auto&& i : histograms_) {
+    if (i.first.first != last) {
+      last = i.first.first;
+      rs << "# TYPE " << last << " histogram\n";
+    }
+    auto& labels = i.first.second;
+    for (size_t b = 0; b < Histogram::BUCKET_COUNT; b++) {
+      std::stringstream le;
+      le << Histogram::BOUNDS[b];
+      rs << last << "_bucket" << FormatLabels(labels, le.str()) << " "
+         << i.second->CumulativeCount(b) << "\n";
+    }
+    rs << last << "_bucket" << FormatLabels(labels, "+Inf") << " "
+       << i.second->Count() << "\n";
+    rs << last << "_sum" << FormatLabels(labels) << " " << i.second->Sum()
+       << "\n";
+    rs << last << "_count" << FormatLabels(labels) << " "
+       << i.second->Count() << "\n";
+  }
+  return rs.str();
+}
+
+namespace {
+// Answers every request on a connection with the current metrics, then
+// closes it. Scrapers only send GET /metrics, so the request is not parsed
+class ExporterSession : public std::enable_shared_from_this<ExporterSession> {
+ public:
+  explicit ExporterSession(io_context& io) : socket_(io) {}
+  ip::tcp::socket& socket() { return socket_; }
+
+  void Start() {
+    auto self = shared_from_this();
+    async_read_until(socket_, request_, "\r\n\r\n",
+                     [self](const boost::system::error_code& error, size_t) {
+                       if (!error) self->Respond();
+                     });
+  }
+
+ private:
+  void Respond() {
+    std::string body =
+        Metrics::getInstance().Export(MetricsFormat::PROMETHEUS);
+    std::stringstream response;
+    response << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    response_ = response.str();
+    auto self = shared_from_this();
+    async_write(socket_, buffer(response_),
+                [self](const boost::system::error_code&, size_t) {
+                  boost::system::error_code ec;
+                  self->socket_.shutdown(ip::tcp::socket::shutdown_both, ec);
+                  self->socket_.close(ec);
+                });
+  }
+
+  ip::tcp::socket socket_;
+  streambuf request_;
+  std::string response_;
+};
+
+class Exporter {
+ public:
+  Exporter(io_context& io, int port)
+      : io_(io),
+        acceptor_(io, ip::tcp::endpoint(ip::address_v4::loopback(), port)) {}
+
+  void Accept() {
+    auto session = std::make_shared<ExporterSession>(io_);
+    acceptor_.async_accept(session->socket(),
+                           [this, session](const boost::system::error_code& e) {
+                             if (!e) session->Start();
+                             Accept();
+                           });
+  }
+
+ private:
+  io_context& io_;
+  ip::tcp::acceptor acceptor_;
+};
+}  // namespace
+
+void Metrics::StartExporter(int port) {
+  std::call_once(exporter_flag_, [&] {
+    try {
+      // Lives as long as the process, like the registry
+      auto exporter =
+          new Exporter(Executor::getInstance().GetIoContext(), port);
+      exporter->Accept();
+      LOG_F(INFO, "Metrics exporter listening on 127.0.0.1:%d", port);
+    } catch (boost::system::system_error& e) {
+      LOG_F(ERROR, "Metrics exporter: %s", e.what());
+    }
+  });
+}
+
+}  // namespace nunchuk
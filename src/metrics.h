@@ -0,0 +1,112 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_METRICS_H
+#define NUNCHUK_METRICS_H
+
+#include <nunchuk.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace nunchuk {
+
+//! Process-wide registry of counters, gauges and latency histograms. A series
+//! is created on first use and lives as long as the process, so callers may
+//! keep the returned reference.
+class Metrics {
+ public:
+  typedef std::map<std::string, std::string> Labels;
+
+  class Counter {
+   public:
+    void Increment(uint64_t value = 1) { value_ += value; }
+    uint64_t Value() const { return value_; }
+
+   private:
+    std::atomic<uint64_t> value_{0};
+  };
+
+  class Gauge {
+   public:
+    void Set(int64_t value) { value_ = value; }
+    void Add(int64_t value) { value_ += value; }
+    int64_t Value() const { return value_; }
+
+   private:
+    std::atomic<int64_t> value_{0};
+  };
+
+  // Latency in seconds, bucketed like a Prometheus histogram
+  class Histogram {
+   public:
+    static const size_t BUCKET_COUNT = 14;
+    static const std::array<double, BUCKET_COUNT> BOUNDS;
+
+    void Observe(double seconds);
+    uint64_t Count() const { return count_; }
+    double Sum() const { return sum_ns_ / 1e9; }
+    // Observations <= BOUNDS[i], cumulative
+    uint64_t CumulativeCount(size_t i) const;
+
+   private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+  };
+
+  // Records the lifetime of the scope into a histogram
+  class Timer {
+   public:
+    explicit Timer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~Timer() {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start_;
+      histogram_.Observe(elapsed.count());
+    }
+
+   private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  static Metrics& getInstance();
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  Counter& GetCounter(const std::string& name, const Labels& labels = {});
+  Gauge& GetGauge(const std::string& name, const Labels& labels = {});
+  Histogram& GetHistogram(const std::string& name, const Labels& labels = {});
+
+  std::string Export(MetricsFormat format);
+
+  // Serve the Prometheus text format over HTTP on 127.0.0.1:port. Only the
+  // first call starts the exporter
+  void StartExporter(int port);
+
+ private:
+  typedef std::pair<std::string, Labels> Key;
+
+  Metrics() = default;
+  std::string ToJson();
+  std::string ToPrometheus();
+
+  std::mutex mutex_;
+  std::map<Key, std::unique_ptr<Counter>> counters_;
+  std::map<Key, std::unique_ptr<Gauge>> gauges_;
+  std::map<Key, std::unique_ptr<Histogram>> histograms_;
+  std::once_flag exporter_flag_;
+};
+
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_METRICS_H
@@ -5,37 +5,117 @@
 #include "nunchukimpl.h"
 
 #include <coinselector.h>
+#include <iostats.h>
+#include <logging.h>
+#include <metrics.h>
+#include <tracing.h>
+#include <rpc/util.h>
+#include <univalue.h>
 #include <key_io.h>
 #include <utils/bip32.hpp>
 #include <utils/txutils.hpp>
 #include <utils/addressutils.hpp>
 #include <utils/json.hpp>
-#include <utils/loguru.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+
 using json = nlohmann::json;
 using namespace boost::algorithm;
 
 namespace nunchuk {
 
 static int MESSAGE_MIN_LEN = 8;
+static size_t ADDRESS_POOL_SIZE = 5;
+
+static void ThrowIfCancelled(const CancellationToken& token) {
+  if (token.is_cancelled()) {
+    throw NunchukException(NunchukException::OPERATION_CANCELLED,
+                           "operation cancelled");
+  }
+}
+
+// Callable submitted by RunAsync, holding the TaskTracker token. Unlike a
+// lambda capture, f is moved in rather than copied
+template <typename F>
+struct AsyncTask {
+  std::shared_ptr<void> token;
+  F f;
+  typename std::result_of<F()>::type operator()() { return f(); }
+};
+
+// The shared executor must be configured before any member uses it
+static const AppSettings& ConfigureExecutor(const AppSettings& appsettings) {
+  Executor::getInstance().Configure(
+      std::max(0, appsettings.get_cpu_threads()),
+      std::max(0, appsettings.get_io_threads()),
+      std::max(0, appsettings.get_blocking_threads()));
+  return appsettings;
+}
+
+// Warm start serves the snapshot from the wallet cache, so it needs one even
+// when no size is configured
+static size_t WalletCacheSize(const AppSettings& appsettings) {
+  static const int WARM_START_CACHE_SIZE = 1 << 20;
+  int size = appsettings.get_wallet_cache_size();
+  if (size <= 0 && appsettings.use_warm_start()) return WARM_START_CACHE_SIZE;
+  return std::max(0, size);
+}
 
 // Nunchuk implement
 NunchukImpl::NunchukImpl(const AppSettings& appsettings,
                          const std::string& passphrase)
-    : app_settings_(appsettings),
+    : app_settings_(ConfigureExecutor(appsettings)),
       storage_(app_settings_.get_storage_path(), passphrase),
       chain_(app_settings_.get_chain()),
       hwi_(app_settings_.get_hwi_path(), chain_),
       synchronizer_(&storage_) {
+  NUNCHUK_API_FUNCTION();
   CoreUtils::getInstance().SetChain(chain_);
-  storage_.MaybeMigrate(chain_);
+  storage_.SetWalletCacheSize(WalletCacheSize(app_settings_));
+  if (app_settings_.use_warm_start()) storage_.LoadSnapshot(chain_);
+  synchronizer_.AddAddressListener(
+      [this](std::string wallet_id, std::string address) {
+        InvalidatePooledAddress(wallet_id, address);
+      });
+  synchronizer_.AddBlockchainConnectionListener([this](ConnectionStatus s) {
+    // Subscriptions are dropped on reconnect, refill once synced again
+    if (s == ConnectionStatus::OFFLINE) {
+      InvalidateAddressPool({});
+    } else if (s == ConnectionStatus::ONLINE) {
+      std::vector<std::pair<std::string, bool>> pools;
+      {
+        std::lock_guard<std::mutex> lock(address_pool_mutex_);
+        for (auto&& pool : address_pool_) pools.push_back(pool.first);
+      }
+      for (auto&& pool : pools) RefillAddressPool(pool.first, pool.second);
+    }
+  });
   synchronizer_.Run(app_settings_);
+  if (app_settings_.get_metrics_port() > 0) {
+    Metrics::getInstance().StartExporter(app_settings_.get_metrics_port());
+  }
+  Metrics::getInstance().GetGauge("nunchuk_instances").Add(1);
 }
 Nunchuk::~Nunchuk() = default;
-NunchukImpl::~NunchukImpl() {}
+NunchukImpl::~NunchukImpl() {
+  NUNCHUK_API_FUNCTION();
+  async_tasks_.Wait();
+  if (app_settings_.use_warm_start()) {
+    try {
+      storage_.SaveSnapshot(chain_);
+    } catch (std::exception& e) {
+      NLOG_F(API, ERROR, "Can not save wallet snapshot: %s", e.what());
+    }
+  }
+  Metrics::getInstance().GetGauge("nunchuk_instances").Add(-1);
+}
 
 void NunchukImpl::SetPassphrase(const std::string& passphrase) {
+  NUNCHUK_API_FUNCTION();
   storage_.SetPassphrase(chain_, passphrase);
 }
 
@@ -43,6 +123,7 @@ Wallet NunchukImpl::CreateWallet(const std::string& name, int m, int n,
                                  const std::vector<SingleSigner>& signers,
                                  AddressType address_type, bool is_escrow,
                                  const std::string& description) {
+  NUNCHUK_API_FUNCTION();
   Wallet wallet = storage_.CreateWallet(chain_, name, m, n, signers,
                                         address_type, is_escrow, description);
   ScanNewWallet(wallet.get_id(), wallet.is_escrow());
@@ -54,6 +135,7 @@ std::string NunchukImpl::DraftWallet(const std::string& name, int m, int n,
                                      const std::vector<SingleSigner>& signers,
                                      AddressType address_type, bool is_escrow,
                                      const std::string& description) {
+  NUNCHUK_API_FUNCTION();
   WalletType wallet_type =
       n == 1 ? WalletType::SINGLE_SIG
              : (is_escrow ? WalletType::ESCROW : WalletType::MULTI_SIG);
@@ -68,6 +150,7 @@ std::string NunchukImpl::DraftWallet(const std::string& name, int m, int n,
 }
 
 std::vector<Wallet> NunchukImpl::GetWallets() {
+  NUNCHUK_API_FUNCTION();
   auto wallet_ids = storage_.ListWallets(chain_);
   std::vector<Wallet> wallets;
   std::string selected_wallet = GetSelectedWallet();
@@ -81,31 +164,74 @@ std::vector<Wallet> NunchukImpl::GetWallets() {
 }
 
 Wallet NunchukImpl::GetWallet(const std::string& wallet_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetWallet(chain_, wallet_id);
 }
 
 bool NunchukImpl::DeleteWallet(const std::string& wallet_id) {
+  NUNCHUK_API_FUNCTION();
+  {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    address_pool_.erase({wallet_id, false});
+    address_pool_.erase({wallet_id, true});
+  }
+  {
+    std::lock_guard<std::mutex> lock(tx_build_context_mutex_);
+    tx_build_context_.erase(wallet_id);
+  }
   return storage_.DeleteWallet(chain_, wallet_id);
 }
 
 bool NunchukImpl::UpdateWallet(Wallet& wallet) {
+  NUNCHUK_API_FUNCTION();
   return storage_.UpdateWallet(chain_, wallet);
 }
 
 bool NunchukImpl::ExportWallet(const std::string& wallet_id,
                                const std::string& file_path,
                                ExportFormat format) {
+  NUNCHUK_API_FUNCTION();
   return storage_.ExportWallet(chain_, wallet_id, file_path, format);
 }
 
 Wallet NunchukImpl::ImportWalletDb(const std::string& file_path) {
+  NUNCHUK_API_FUNCTION();
   std::string id = storage_.ImportWalletDb(chain_, file_path);
   return GetWallet(id);
 }
 
+bool NunchukImpl::BackupWallet(const std::string& wallet_id,
+                               const std::string& file_path,
+                               const std::string& passphrase) {
+  NUNCHUK_API_FUNCTION();
+  return storage_.BackupWallet(chain_, wallet_id, file_path, passphrase);
+}
+
+Wallet NunchukImpl::RestoreWallet(const std::string& file_path,
+                                  const std::string& passphrase) {
+  NUNCHUK_API_FUNCTION();
+  std::string id = storage_.RestoreWallet(chain_, file_path, passphrase);
+  return GetWallet(id);
+}
+
+bool NunchukImpl::BackupWalletDelta(const std::string& wallet_id,
+                                    const std::string& file_path,
+                                    const std::string& passphrase) {
+  NUNCHUK_API_FUNCTION();
+  return storage_.BackupWalletDelta(chain_, wallet_id, file_path, passphrase);
+}
+
+Wallet NunchukImpl::ApplyWalletDelta(const std::string& file_path,
+                                     const std::string& passphrase) {
+  NUNCHUK_API_FUNCTION();
+  std::string id = storage_.ApplyWalletDelta(chain_, file_path, passphrase);
+  return GetWallet(id);
+}
+
 Wallet NunchukImpl::ImportWalletDescriptor(const std::string& file_path,
                                            const std::string& name,
                                            const std::string& description) {
+  NUNCHUK_API_FUNCTION();
   std::string descs = trim_copy(storage_.LoadFile(file_path));
   AddressType address_type;
   WalletType wallet_type;
@@ -120,7 +246,8 @@ Wallet NunchukImpl::ImportWalletDescriptor(const std::string& file_path,
                       wallet_type == WalletType::ESCROW, description);
 }
 
-void NunchukImpl::ScanNewWallet(const std::string wallet_id, bool is_escrow) {
+void NunchukImpl::ScanNewWallet(const std::string& wallet_id, bool is_escrow) {
+  NUNCHUK_API_FUNCTION();
   int index = is_escrow ? -1 : 0;
   std::string address;
   if (is_escrow) {
@@ -137,8 +264,9 @@ void NunchukImpl::ScanNewWallet(const std::string wallet_id, bool is_escrow) {
   storage_.AddAddress(chain_, wallet_id, address, index, false);
 }
 
-std::string NunchukImpl::GetUnusedAddress(const std::string wallet_id,
+std::string NunchukImpl::GetUnusedAddress(const std::string& wallet_id,
                                           int& index, bool internal) {
+  NUNCHUK_API_FUNCTION();
   auto descriptor = storage_.GetDescriptor(chain_, wallet_id, internal);
   int consecutive_unused = 0;
   std::vector<std::string> unused_addresses;
@@ -169,6 +297,7 @@ std::vector<Device> NunchukImpl::GetDevices() { return hwi_.Enumerate(); }
 MasterSigner NunchukImpl::CreateMasterSigner(
     const std::string& raw_name, const Device& device,
     std::function<bool(int)> progress) {
+  NUNCHUK_API_FUNCTION();
   std::string name = trim_copy(raw_name);
   std::string id = storage_.CreateMasterSigner(chain_, name,
                                                device.get_master_fingerprint());
@@ -204,6 +333,7 @@ MasterSigner NunchukImpl::CreateMasterSigner(
 SingleSigner NunchukImpl::GetSignerFromMasterSigner(
     const std::string& mastersigner_id, const WalletType& wallet_type,
     const AddressType& address_type, int index) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetSignerFromMasterSigner(chain_, mastersigner_id,
                                             wallet_type, address_type, index);
 }
@@ -213,6 +343,7 @@ SingleSigner NunchukImpl::CreateSigner(const std::string& raw_name,
                                        const std::string& public_key,
                                        const std::string& derivation_path,
                                        const std::string& master_fingerprint) {
+  NUNCHUK_API_FUNCTION();
   std::string target_format = chain_ == Chain::MAIN ? "xpub" : "tpub";
   std::string sanitized_xpub = Utils::SanitizeBIP32Input(xpub, target_format);
   if (!Utils::IsValidXPub(sanitized_xpub) &&
@@ -236,6 +367,7 @@ SingleSigner NunchukImpl::CreateSigner(const std::string& raw_name,
 int NunchukImpl::GetCurrentIndexFromMasterSigner(
     const std::string& mastersigner_id, const WalletType& wallet_type,
     const AddressType& address_type) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetCurrentIndexFromMasterSigner(chain_, mastersigner_id,
                                                   wallet_type, address_type);
 }
@@ -243,6 +375,7 @@ int NunchukImpl::GetCurrentIndexFromMasterSigner(
 SingleSigner NunchukImpl::GetUnusedSignerFromMasterSigner(
     const std::string& mastersigner_id, const WalletType& wallet_type,
     const AddressType& address_type) {
+  NUNCHUK_API_FUNCTION();
   int index = GetCurrentIndexFromMasterSigner(mastersigner_id, wallet_type,
                                               address_type);
   if (index < 0) {
@@ -255,15 +388,18 @@ SingleSigner NunchukImpl::GetUnusedSignerFromMasterSigner(
 
 std::vector<SingleSigner> NunchukImpl::GetSignersFromMasterSigner(
     const std::string& mastersigner_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetSignersFromMasterSigner(chain_, mastersigner_id);
 }
 
 int NunchukImpl::GetNumberOfSignersFromMasterSigner(
     const std::string& mastersigner_id) {
+  NUNCHUK_API_FUNCTION();
   return GetSignersFromMasterSigner(mastersigner_id).size();
 }
 
 std::vector<MasterSigner> NunchukImpl::GetMasterSigners() {
+  NUNCHUK_API_FUNCTION();
   auto mastersigner_ids = storage_.ListMasterSigners(chain_);
   std::vector<MasterSigner> mastersigners;
   for (auto&& id : mastersigner_ids) {
@@ -273,14 +409,17 @@ std::vector<MasterSigner> NunchukImpl::GetMasterSigners() {
 }
 
 MasterSigner NunchukImpl::GetMasterSigner(const std::string& mastersigner_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetMasterSigner(chain_, mastersigner_id);
 }
 
 bool NunchukImpl::DeleteMasterSigner(const std::string& mastersigner_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.DeleteMasterSigner(chain_, mastersigner_id);
 }
 
 bool NunchukImpl::UpdateMasterSigner(MasterSigner& mastersigner) {
+  NUNCHUK_API_FUNCTION();
   return storage_.UpdateMasterSigner(chain_, mastersigner);
 }
 
@@ -292,6 +431,7 @@ std::string NunchukImpl::GetHealthCheckPath() {
 HealthStatus NunchukImpl::HealthCheckMasterSigner(
     const std::string& fingerprint, std::string& message,
     std::string& signature, std::string& path) {
+  NUNCHUK_API_FUNCTION();
   message = message.empty() ? Utils::GenerateRandomMessage() : message;
   if (message.size() < MESSAGE_MIN_LEN) {
     throw std::runtime_error("message too short!");
@@ -339,6 +479,7 @@ HealthStatus NunchukImpl::HealthCheckMasterSigner(
 HealthStatus NunchukImpl::HealthCheckSingleSigner(
     const SingleSigner& signer, const std::string& message,
     const std::string& signature) {
+  NUNCHUK_API_FUNCTION();
   if (message.size() < MESSAGE_MIN_LEN) {
     throw NunchukException(NunchukException::MESSAGE_TOO_SHORT,
                            "message too short!");
@@ -363,16 +504,77 @@ HealthStatus NunchukImpl::HealthCheckSingleSigner(
 
 std::vector<Transaction> NunchukImpl::GetTransactionHistory(
     const std::string& wallet_id, int count, int skip) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetTransactions(chain_, wallet_id, count, skip);
 }
 
+std::vector<BalancePoint> NunchukImpl::GetBalanceHistory(
+    const std::string& wallet_id, int max_points) {
+  NUNCHUK_API_FUNCTION();
+  return storage_.GetBalanceHistory(chain_, wallet_id, max_points);
+}
+
 std::vector<std::string> NunchukImpl::GetAddresses(const std::string& wallet_id,
                                                    bool used, bool internal) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetAddresses(chain_, wallet_id, used, internal);
 }
 
 std::string NunchukImpl::NewAddress(const std::string& wallet_id,
                                     bool internal) {
+  NUNCHUK_API_FUNCTION();
+  std::pair<int, std::string> entry{-1, {}};
+  int generation;
+  {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    auto& pool = address_pool_[{wallet_id, internal}];
+    if (!pool.addresses.empty()) {
+      entry = pool.addresses.front();
+      pool.addresses.pop_front();
+    } else {
+      // Pool is cold, derive inline. Any in-flight refill may now overlap
+      // with the index we take, so discard its result
+      pool.generation++;
+    }
+    // Either way hold off refills until the address is stored, they would
+    // start from the index in storage
+    pool.deriving++;
+    generation = pool.generation;
+  }
+  auto done = [&](bool failed) {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    auto pool = address_pool_.find({wallet_id, internal});
+    if (pool == address_pool_.end()) return;
+    pool->second.deriving--;
+    // Not handed out, so it is still the next unused address
+    if (failed && !entry.second.empty() &&
+        pool->second.generation == generation) {
+      pool->second.addresses.push_front(entry);
+    }
+  };
+  std::string address;
+  try {
+    // Stored without address_pool_mutex_, the write can take a while
+    if (!entry.second.empty()) {
+      storage_.AddAddress(chain_, wallet_id, entry.second, entry.first,
+                          internal);
+      address = entry.second;
+    } else {
+      std::lock_guard<std::mutex> lock(derive_address_mutex_);
+      address = DeriveNewAddress(wallet_id, internal);
+    }
+  } catch (...) {
+    done(true);
+    throw;
+  }
+  done(false);
+  RefillAddressPool(wallet_id, internal);
+  return address;
+}
+
+std::string NunchukImpl::DeriveNewAddress(const std::string& wallet_id,
+                                          bool internal) {
+  NUNCHUK_API_FUNCTION();
   std::string descriptor = storage_.GetDescriptor(chain_, wallet_id, internal);
   int index = storage_.GetCurrentAddressIndex(chain_, wallet_id, internal) + 1;
   while (true) {
@@ -385,15 +587,120 @@ std::string NunchukImpl::NewAddress(const std::string& wallet_id,
   }
 }
 
+void NunchukImpl::RefillAddressPool(const std::string& wallet_id,
+                                    bool internal) {
+  NUNCHUK_API_FUNCTION();
+  {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    auto pool = address_pool_.find({wallet_id, internal});
+    if (pool == address_pool_.end()) return;  // NewAddress never called
+    if (pool->second.refilling || pool->second.deriving > 0) return;
+    if (pool->second.addresses.size() >= ADDRESS_POOL_SIZE) return;
+    pool->second.refilling = true;
+  }
+  // Offline LookAhead can neither subscribe nor tell a used address apart,
+  // the connection listener refills once we are back online
+  if (!synchronizer_.IsOnline()) {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    auto pool = address_pool_.find({wallet_id, internal});
+    if (pool != address_pool_.end()) pool->second.refilling = false;
+    return;
+  }
+  synchronizer_.RunInBackground([this, wallet_id, internal]() {
+    try {
+      FillAddressPool(wallet_id, internal);
+    } catch (std::exception& e) {
+      NLOG_F(API, WARNING, "FillAddressPool(): %s", e.what());
+    }
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    auto pool = address_pool_.find({wallet_id, internal});
+    if (pool != address_pool_.end()) pool->second.refilling = false;
+  });
+}
+
+void NunchukImpl::FillAddressPool(const std::string& wallet_id,
+                                  bool internal) {
+  NUNCHUK_API_FUNCTION();
+  std::string descriptor = storage_.GetDescriptor(chain_, wallet_id, internal);
+  int generation = -1;
+  int index = -1;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(address_pool_mutex_);
+      auto pool = address_pool_.find({wallet_id, internal});
+      if (pool == address_pool_.end() || pool->second.deriving > 0) return;
+      if (generation != pool->second.generation) {
+        // First pass, or the pool was invalidated: start over from storage
+        generation = pool->second.generation;
+        index = -1;
+      }
+      if (pool->second.addresses.size() >= ADDRESS_POOL_SIZE) return;
+      if (index < 0 && !pool->second.addresses.empty()) {
+        index = pool->second.addresses.back().first + 1;
+      }
+    }
+    if (index < 0) {
+      index = storage_.GetCurrentAddressIndex(chain_, wallet_id, internal) + 1;
+    }
+    if (!synchronizer_.IsOnline()) return;
+    // Subscribe now so NewAddress does not need any network round trip
+    auto address = CoreUtils::getInstance().DeriveAddresses(descriptor, index);
+    bool used =
+        synchronizer_.LookAhead(chain_, wallet_id, address, index, internal);
+    if (!used) {
+      std::lock_guard<std::mutex> lock(address_pool_mutex_);
+      auto pool = address_pool_.find({wallet_id, internal});
+      if (pool == address_pool_.end()) return;
+      if (generation != pool->second.generation) continue;
+      pool->second.addresses.push_back({index, address});
+    }
+    index++;
+  }
+}
+
+void NunchukImpl::InvalidateAddressPool(const std::string& wallet_id) {
+  std::lock_guard<std::mutex> lock(address_pool_mutex_);
+  for (auto&& pool : address_pool_) {
+    if (!wallet_id.empty() && pool.first.first != wallet_id) continue;
+    pool.second.addresses.clear();
+    pool.second.generation++;
+  }
+}
+
+void NunchukImpl::InvalidatePooledAddress(const std::string& wallet_id,
+                                          const std::string& address) {
+  std::vector<bool> invalidated;
+  {
+    std::lock_guard<std::mutex> lock(address_pool_mutex_);
+    for (bool internal : {false, true}) {
+      auto pool = address_pool_.find({wallet_id, internal});
+      if (pool == address_pool_.end()) continue;
+      auto& addresses = pool->second.addresses;
+      if (std::none_of(addresses.begin(), addresses.end(),
+                       [&](const std::pair<int, std::string>& entry) {
+                         return entry.second == address;
+                       })) {
+        continue;
+      }
+      addresses.clear();
+      pool->second.generation++;
+      invalidated.push_back(internal);
+    }
+  }
+  for (bool internal : invalidated) RefillAddressPool(wallet_id, internal);
+}
+
 std::vector<UnspentOutput> NunchukImpl::GetUnspentOutputs(
     const std::string& wallet_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetUnspentOutputs(chain_, wallet_id);
 }
 
 Transaction NunchukImpl::CreateTransaction(
-    const std::string& wallet_id, const std::map<std::string, Amount> outputs,
-    const std::string& memo, const std::vector<UnspentOutput> inputs,
+    const std::string& wallet_id, const std::map<std::string, Amount>& outputs,
+    const std::string& memo, const std::vector<UnspentOutput>& inputs,
     Amount fee_rate, bool subtract_fee_from_amount) {
+  NUNCHUK_API_FUNCTION();
   Amount fee = 0;
   int change_pos = 0;
   if (fee_rate <= 0) fee_rate = EstimateFee();
@@ -406,12 +713,14 @@ Transaction NunchukImpl::CreateTransaction(
 bool NunchukImpl::ExportTransaction(const std::string& wallet_id,
                                     const std::string& tx_id,
                                     const std::string& file_path) {
+  NUNCHUK_API_FUNCTION();
   std::string psbt = storage_.GetPsbt(chain_, wallet_id, tx_id);
   return storage_.WriteFile(file_path, psbt);
 }
 
 Transaction NunchukImpl::ImportTransaction(const std::string& wallet_id,
                                            const std::string& file_path) {
+  NUNCHUK_API_FUNCTION();
   std::string psbt = storage_.LoadFile(file_path);
   boost::trim(psbt);
   std::string tx_id = GetTxIdFromPsbt(psbt);
@@ -428,17 +737,63 @@ Transaction NunchukImpl::ImportTransaction(const std::string& wallet_id,
 Transaction NunchukImpl::SignTransaction(const std::string& wallet_id,
                                          const std::string& tx_id,
                                          const Device& device) {
+  NUNCHUK_API_FUNCTION();
   std::string psbt = storage_.GetPsbt(chain_, wallet_id, tx_id);
-  DLOG_F(INFO, "NunchukImpl::SignTransaction(), psbt='%s'", psbt.c_str());
+  NDLOG_F(API, 1, "SignTransaction(), psbt='%s'",
+          Logging::Truncate(psbt).c_str());
   std::string signed_psbt = hwi_.SignTx(device, psbt);
-  DLOG_F(INFO, "NunchukImpl::SignTransaction(), signed_psbt='%s'",
-         signed_psbt.c_str());
+  NDLOG_F(API, 1, "SignTransaction(), signed_psbt='%s'",
+          Logging::Truncate(signed_psbt).c_str());
   storage_.UpdatePsbt(chain_, wallet_id, signed_psbt);
   return GetTransaction(wallet_id, tx_id);
 }
 
+Transaction NunchukImpl::SignTransaction(const std::string& wallet_id,
+                                         const std::string& tx_id,
+                                         const std::vector<Device>& devices) {
+  NUNCHUK_API_FUNCTION();
+  if (devices.empty()) {
+    throw NunchukException(NunchukException::INVALID_PARAMETER,
+                           "devices is empty");
+  }
+  std::string psbt = storage_.GetPsbt(chain_, wallet_id, tx_id);
+  NDLOG_F(API, 1, "SignTransaction(), psbt='%s'",
+          Logging::Truncate(psbt).c_str());
+
+  // Each device runs in its own hwi process, so dispatch them all at once
+  std::vector<std::future<std::string>> results;
+  for (auto&& device : devices) {
+    results.push_back(std::async(std::launch::async, [this, &psbt, &device] {
+      return hwi_.SignTx(device, psbt);
+    }));
+  }
+
+  std::vector<std::string> signed_psbts;
+  std::exception_ptr error;
+  for (auto&& result : results) {
+    try {
+      signed_psbts.push_back(result.get());
+    } catch (...) {
+      if (!error) error = std::current_exception();
+    }
+  }
+
+  if (!signed_psbts.empty()) {
+    std::string combined_psbt =
+        signed_psbts.size() == 1
+            ? signed_psbts[0]
+            : CoreUtils::getInstance().CombinePsbt(signed_psbts);
+    NDLOG_F(API, 1, "SignTransaction(), combined_psbt='%s'",
+            Logging::Truncate(combined_psbt).c_str());
+    storage_.UpdatePsbt(chain_, wallet_id, combined_psbt);
+  }
+  if (error) std::rethrow_exception(error);
+  return GetTransaction(wallet_id, tx_id);
+}
+
 Transaction NunchukImpl::BroadcastTransaction(const std::string& wallet_id,
                                               const std::string& tx_id) {
+  NUNCHUK_API_FUNCTION();
   std::string psbt = storage_.GetPsbt(chain_, wallet_id, tx_id);
   std::string raw_tx = CoreUtils::getInstance().FinalizePsbt(psbt);
   // finalizepsbt will change the txid for legacy and nested-segwit
@@ -463,30 +818,35 @@ Transaction NunchukImpl::BroadcastTransaction(const std::string& wallet_id,
 
 Transaction NunchukImpl::GetTransaction(const std::string& wallet_id,
                                         const std::string& tx_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetTransaction(chain_, wallet_id, tx_id);
 }
 
 bool NunchukImpl::DeleteTransaction(const std::string& wallet_id,
                                     const std::string& tx_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.DeleteTransaction(chain_, wallet_id, tx_id);
 }
 
 AppSettings NunchukImpl::GetAppSettings() { return app_settings_; }
 
 AppSettings NunchukImpl::UpdateAppSettings(const AppSettings& settings) {
+  NUNCHUK_API_FUNCTION();
   app_settings_ = settings;
   chain_ = app_settings_.get_chain();
   hwi_.SetPath(app_settings_.get_hwi_path());
   hwi_.SetChain(chain_);
   CoreUtils::getInstance().SetChain(chain_);
+  storage_.SetWalletCacheSize(WalletCacheSize(app_settings_));
   synchronizer_.Run(settings);
   return settings;
 }
 
 Transaction NunchukImpl::DraftTransaction(
-    const std::string& wallet_id, const std::map<std::string, Amount> outputs,
-    const std::vector<UnspentOutput> inputs, Amount fee_rate,
+    const std::string& wallet_id, const std::map<std::string, Amount>& outputs,
+    const std::vector<UnspentOutput>& inputs, Amount fee_rate,
     bool subtract_fee_from_amount) {
+  NUNCHUK_API_FUNCTION();
   Amount fee = 0;
   int change_pos = 0;
   if (fee_rate <= 0) fee_rate = EstimateFee();
@@ -508,6 +868,7 @@ Transaction NunchukImpl::DraftTransaction(
 Transaction NunchukImpl::ReplaceTransaction(const std::string& wallet_id,
                                             const std::string& tx_id,
                                             Amount new_fee_rate) {
+  NUNCHUK_API_FUNCTION();
   auto tx = storage_.GetTransaction(chain_, wallet_id, tx_id);
   if (new_fee_rate < tx.get_fee_rate()) {
     throw NunchukException(NunchukException::INVALID_FEE_RATE,
@@ -518,18 +879,8 @@ Transaction NunchukImpl::ReplaceTransaction(const std::string& wallet_id,
   for (auto&& output : tx.get_user_outputs()) {
     outputs[output.first] = output.second;
   }
-  std::vector<UnspentOutput> inputs;
-  for (auto&& input : tx.get_inputs()) {
-    auto tx = storage_.GetTransaction(chain_, wallet_id, input.first);
-    auto output = tx.get_outputs()[input.second];
-    UnspentOutput utxo;
-    utxo.set_txid(input.first);
-    utxo.set_vout(input.second);
-    utxo.set_address(output.first);
-    utxo.set_amount(output.second);
-    utxo.set_height(tx.get_height());
-    inputs.push_back(utxo);
-  }
+  auto inputs = storage_.GetUnspentOutputsFromTxInputs(chain_, wallet_id,
+                                                       tx.get_inputs());
 
   Amount fee = 0;
   int change_pos = 0;
@@ -543,11 +894,13 @@ Transaction NunchukImpl::ReplaceTransaction(const std::string& wallet_id,
 bool NunchukImpl::UpdateTransactionMemo(const std::string& wallet_id,
                                         const std::string& tx_id,
                                         const std::string& new_memo) {
+  NUNCHUK_API_FUNCTION();
   return storage_.UpdateTransactionMemo(chain_, wallet_id, tx_id, new_memo);
 }
 
 void NunchukImpl::CacheMasterSignerXPub(const std::string& mastersigner_id,
                                         std::function<bool(int)> progress) {
+  NUNCHUK_API_FUNCTION();
   std::string id = mastersigner_id;
   Device device{id};
   int count = 0;
@@ -573,15 +926,18 @@ void NunchukImpl::CacheMasterSignerXPub(const std::string& mastersigner_id,
 
 bool NunchukImpl::ExportHealthCheckMessage(const std::string& message,
                                            const std::string& file_path) {
+  NUNCHUK_API_FUNCTION();
   return storage_.WriteFile(file_path, message);
 }
 
 std::string NunchukImpl::ImportHealthCheckSignature(
     const std::string& file_path) {
+  NUNCHUK_API_FUNCTION();
   return boost::trim_copy(storage_.LoadFile(file_path));
 }
 
 Amount NunchukImpl::EstimateFee(int conf_target) {
+  NUNCHUK_API_FUNCTION();
   return synchronizer_.EstimateFee(conf_target);
 }
 
@@ -589,22 +945,114 @@ int NunchukImpl::GetChainTip() { return synchronizer_.GetChainTip(); }
 
 Amount NunchukImpl::GetTotalAmount(const std::string& wallet_id,
                                    const std::vector<TxInput>& inputs) {
+  NUNCHUK_API_FUNCTION();
+  auto utxos =
+      storage_.GetUnspentOutputsFromTxInputs(chain_, wallet_id, inputs);
   Amount total = 0;
-  for (auto&& input : inputs) {
-    auto tx = GetTransaction(wallet_id, input.first);
-    total += tx.get_outputs()[input.second].second;
+  for (auto&& utxo : utxos) {
+    total += utxo.get_amount();
   }
   return total;
 }
 
 std::string NunchukImpl::GetSelectedWallet() {
+  NUNCHUK_API_FUNCTION();
   return storage_.GetSelectedWallet(chain_);
 }
 
 bool NunchukImpl::SetSelectedWallet(const std::string& wallet_id) {
+  NUNCHUK_API_FUNCTION();
   return storage_.SetSelectedWallet(chain_, wallet_id);
 }
 
+int64_t NunchukImpl::GetChangeSeq(const std::string& wallet_id) {
+  NUNCHUK_API_FUNCTION();
+  return storage_.GetChangeSeq(chain_, wallet_id);
+}
+
+WalletChanges NunchukImpl::GetWalletChanges(const std::string& wallet_id,
+                                            int64_t since_seq) {
+  NUNCHUK_API_FUNCTION();
+  return storage_.GetChanges(chain_, wallet_id, since_seq);
+}
+
+std::string NunchukImpl::GetMetrics(MetricsFormat format) {
+  return Metrics::getInstance().Export(format);
+}
+
+IoStats NunchukImpl::GetLastCallIoStats() { return IoStatsScope::GetLast(); }
+
+template <typename F>
+std::future<typename std::result_of<F()>::type> NunchukImpl::RunAsync(F f) {
+  // Async calls wait on devices and the Electrum server, keep them off the
+  // CPU pool
+  return Executor::getInstance().SubmitBlocking(
+      AsyncTask<F>{async_tasks_.Acquire(), std::move(f)});
+}
+
+std::future<Wallet> NunchukImpl::CreateWalletAsync(
+    const std::string& name, int m, int n,
+    const std::vector<SingleSigner>& signers, AddressType address_type,
+    bool is_escrow, const std::string& description, CancellationToken token) {
+  return RunAsync([=]() {
+    // Creating and scanning the wallet is not interruptible
+    ThrowIfCancelled(token);
+    return CreateWallet(name, m, n, signers, address_type, is_escrow,
+                        description);
+  });
+}
+
+std::future<std::string> NunchukImpl::NewAddressAsync(
+    const std::string& wallet_id, bool internal, CancellationToken token) {
+  return RunAsync([=]() {
+    ThrowIfCancelled(token);
+    return NewAddress(wallet_id, internal);
+  });
+}
+
+std::future<Transaction> NunchukImpl::CreateTransactionAsync(
+    const std::string& wallet_id, std::map<std::string, Amount> outputs,
+    const std::string& memo, std::vector<UnspentOutput> inputs,
+    Amount fee_rate, bool subtract_fee_from_amount, CancellationToken token) {
+  typedef std::map<std::string, Amount> Outputs;
+  typedef std::vector<UnspentOutput> Inputs;
+  // Outputs and inputs are bound rather than captured so they are moved.
+  // Coin selection is not interruptible, only the start is a checkpoint
+  auto task = [=](const Outputs& outputs, const Inputs& inputs) {
+    ThrowIfCancelled(token);
+    return CreateTransaction(wallet_id, outputs, memo, inputs, fee_rate,
+                             subtract_fee_from_amount);
+  };
+  return RunAsync(std::bind(task, std::move(outputs), std::move(inputs)));
+}
+
+std::future<Transaction> NunchukImpl::SignTransactionAsync(
+    const std::string& wallet_id, const std::string& tx_id,
+    const Device& device, CancellationToken token) {
+  return RunAsync([=]() {
+    ThrowIfCancelled(token);
+    std::string psbt = storage_.GetPsbt(chain_, wallet_id, tx_id);
+    std::string signed_psbt = hwi_.SignTx(device, psbt);
+    // Cancelled while the device was signing: drop the signature
+    ThrowIfCancelled(token);
+    storage_.UpdatePsbt(chain_, wallet_id, signed_psbt);
+    return GetTransaction(wallet_id, tx_id);
+  });
+}
+
+std::future<void> NunchukImpl::CacheMasterSignerXPubAsync(
+    const std::string& mastersigner_id, std::function<bool(int)> progress,
+    CancellationToken token) {
+  return RunAsync([=]() {
+    ThrowIfCancelled(token);
+    // Check the token after every cached xpub
+    CacheMasterSignerXPub(mastersigner_id, [&](int percent) {
+      ThrowIfCancelled(token);
+      return progress ? progress(percent) : false;
+    });
+  });
+}
+
 void NunchukImpl::AddBalanceListener(
     std::function<void(std::string, Amount)> listener) {
   synchronizer_.AddBalanceListener(listener);
@@ -630,16 +1078,18 @@ void NunchukImpl::AddBlockchainConnectionListener(
   synchronizer_.AddBlockchainConnectionListener(listener);
 }
 
-std::string NunchukImpl::CreatePsbt(const std::string& wallet_id,
-                                    const std::map<std::string, Amount> outputs,
-                                    const std::vector<UnspentOutput> inputs,
-                                    Amount fee_rate,
-                                    bool subtract_fee_from_amount,
-                                    bool utxo_update_psbt, Amount& fee,
-                                    int& change_pos) {
-  Wallet wallet = GetWallet(wallet_id);
-  std::vector<UnspentOutput> utxos =
-      inputs.empty() ? GetUnspentOutputs(wallet_id) : inputs;
+std::string NunchukImpl::CreatePsbt(
+    const std::string& wallet_id, const std::map<std::string, Amount>& outputs,
+    const std::vector<UnspentOutput>& inputs, Amount fee_rate,
+    bool subtract_fee_from_amount, bool utxo_update_psbt, Amount& fee,
+    int& change_pos) {
+  NUNCHUK_API_FUNCTION();
+  auto context = GetTxBuildContext(wallet_id);
+  std::vector<UnspentOutput> utxos = inputs;
+  std::string change_address;
+  storage_.GetCoinSelectionState(chain_, wallet_id, context->is_escrow,
+                                 inputs.empty(), utxos, change_address);
+  if (change_address.empty()) change_address = NewAddress(wallet_id, true);
 
   std::vector<TxInput> selector_inputs;
   std::vector<TxOutput> selector_outputs;
@@ -647,24 +1097,13 @@ std::string NunchukImpl::CreatePsbt(const std::string& wallet_id,
     selector_outputs.push_back(TxOutput(output.first, output.second));
   }
 
-  std::string change_address;
-  if (wallet.is_escrow()) {
-    // Use the only address as change_address to pass in selector
-    change_address = storage_.GetAllAddresses(chain_, wallet_id)[0];
-  } else {
-    auto unused = GetAddresses(wallet_id, false, true);
-    change_address = unused.empty() ? NewAddress(wallet_id, true) : unused[0];
-  }
   std::string error;
-  std::string internal_desc = storage_.GetDescriptor(chain_, wallet_id, true);
-  std::string external_desc = storage_.GetDescriptor(chain_, wallet_id, false);
-  std::string desc = GetDescriptorsImportString(external_desc, internal_desc);
-  CoinSelector selector{desc, change_address};
+  CoinSelector selector{context->descriptors, change_address};
   selector.set_fee_rate(CFeeRate(fee_rate));
   selector.set_discard_rate(CFeeRate(synchronizer_.RelayFee()));
 
   // For escrow use all utxos as inputs
-  if (!selector.Select(utxos, wallet.is_escrow() ? utxos : inputs,
+  if (!selector.Select(utxos, context->is_escrow ? utxos : inputs,
                        change_address, subtract_fee_from_amount,
                        selector_outputs, selector_inputs, fee, error,
                        change_pos)) {
@@ -674,7 +1113,40 @@ std::string NunchukImpl::CreatePsbt(const std::string& wallet_id,
   std::string psbt =
       CoreUtils::getInstance().CreatePsbt(selector_inputs, selector_outputs);
   if (!utxo_update_psbt) return psbt;
-  return storage_.FillPsbt(chain_, wallet_id, psbt);
+  return storage_.FillPsbt(chain_, wallet_id, psbt, context->provider);
+}
+
+std::shared_ptr<const NunchukImpl::TxBuildContext>
+NunchukImpl::GetTxBuildContext(const std::string& wallet_id) {
+  {
+    std::lock_guard<std::mutex> lock(tx_build_context_mutex_);
+    auto cached = tx_build_context_.find(wallet_id);
+    if (cached != tx_build_context_.end()) return cached->second;
+  }
+
+  // Wallet id is the descriptor checksum, so none of this can change
+  // until the wallet is deleted
+  auto context = std::make_shared<TxBuildContext>();
+  std::string external_desc = storage_.GetDescriptor(chain_, wallet_id, false);
+  std::string internal_desc = storage_.GetDescriptor(chain_, wallet_id, true);
+  AddressType address_type;
+  WalletType wallet_type;
+  int m, n;
+  std::vector<SingleSigner> signers;
+  ParseDescriptors(external_desc, address_type, wallet_type, m, n, signers);
+  context->is_escrow = wallet_type == WalletType::ESCROW;
+  context->descriptors =
+      GetDescriptorsImportString(external_desc, internal_desc);
+  UniValue uv;
+  uv.read(context->descriptors);
+  auto descs = uv.get_array();
+  for (size_t i = 0; i < descs.size(); ++i) {
+    EvalDescriptorStringOrObject(descs[i], context->provider);
+  }
+
+  std::lock_guard<std::mutex> lock(tx_build_context_mutex_);
+  tx_build_context_[wallet_id] = context;
+  return context;
 }
 
 std::unique_ptr<Nunchuk> MakeNunchuk(const AppSettings& appsettings,
@@ -12,6 +12,13 @@
 #include <storage.h>
 #include <electrumclient.h>
 #include <synchronizer.h>
+#include <executor.h>
+#include <script/signingprovider.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace nunchuk {
 
@@ -38,6 +45,15 @@ class NunchukImpl : public Nunchuk {
   bool ExportWallet(const std::string& wallet_id, const std::string& file_path,
                     ExportFormat format) override;
   Wallet ImportWalletDb(const std::string& file_path) override;
+  bool BackupWallet(const std::string& wallet_id, const std::string& file_path,
+                    const std::string& passphrase = {}) override;
+  Wallet RestoreWallet(const std::string& file_path,
+                       const std::string& passphrase = {}) override;
+  bool BackupWalletDelta(const std::string& wallet_id,
+                         const std::string& file_path,
+                         const std::string& passphrase = {}) override;
+  Wallet ApplyWalletDelta(const std::string& file_path,
+                          const std::string& passphrase = {}) override;
   Wallet ImportWalletDescriptor(const std::string& file_path,
                                 const std::string& name,
                                 const std::string& description = {}) override;
@@ -79,6 +95,8 @@ class NunchukImpl : public Nunchuk {
 
   std::vector<Transaction> GetTransactionHistory(const std::string& wallet_id,
                                                  int count, int skip) override;
+  std::vector<BalancePoint> GetBalanceHistory(const std::string& wallet_id,
+                                              int max_points = 0) override;
   AppSettings GetAppSettings() override;
   AppSettings UpdateAppSettings(const AppSettings& app_settings) override;
 
@@ -90,9 +108,9 @@ class NunchukImpl : public Nunchuk {
   std::vector<UnspentOutput> GetUnspentOutputs(
       const std::string& wallet_id) override;
   Transaction CreateTransaction(const std::string& wallet_id,
-                                const std::map<std::string, Amount> outputs,
+                                const std::map<std::string, Amount>& outputs,
                                 const std::string& memo = {},
-                                const std::vector<UnspentOutput> inputs = {},
+                                const std::vector<UnspentOutput>& inputs = {},
                                 Amount fee_rate = -1,
                                 bool subtract_fee_from_amount = false) override;
   bool ExportTransaction(const std::string& wallet_id, const std::string& tx_id,
@@ -102,6 +120,9 @@ class NunchukImpl : public Nunchuk {
   Transaction SignTransaction(const std::string& wallet_id,
                               const std::string& tx_id,
                               const Device& device) override;
+  Transaction SignTransaction(const std::string& wallet_id,
+                              const std::string& tx_id,
+                              const std::vector<Device>& devices) override;
   Transaction BroadcastTransaction(const std::string& wallet_id,
                                    const std::string& tx_id) override;
   Transaction GetTransaction(const std::string& wallet_id,
@@ -110,8 +131,8 @@ class NunchukImpl : public Nunchuk {
                          const std::string& tx_id) override;
 
   Transaction DraftTransaction(const std::string& wallet_id,
-                               const std::map<std::string, Amount> outputs,
-                               const std::vector<UnspentOutput> inputs = {},
+                               const std::map<std::string, Amount>& outputs,
+                               const std::vector<UnspentOutput>& inputs = {},
                                Amount fee_rate = -1,
                                bool subtract_fee_from_amount = false) override;
   Transaction ReplaceTransaction(const std::string& wallet_id,
@@ -132,6 +153,31 @@ class NunchukImpl : public Nunchuk {
                         const std::vector<TxInput>& inputs) override;
   std::string GetSelectedWallet() override;
   bool SetSelectedWallet(const std::string& wallet_id) override;
+  int64_t GetChangeSeq(const std::string& wallet_id) override;
+  WalletChanges GetWalletChanges(const std::string& wallet_id,
+                                 int64_t since_seq) override;
+  std::string GetMetrics(MetricsFormat format = MetricsFormat::JSON) override;
+  IoStats GetLastCallIoStats() override;
+
+  std::future<Wallet> CreateWalletAsync(
+      const std::string& name, int m, int n,
+      const std::vector<SingleSigner>& signers, AddressType address_type,
+      bool is_escrow, const std::string& description = {},
+      CancellationToken token = {}) override;
+  std::future<std::string> NewAddressAsync(
+      const std::string& wallet_id, bool internal = false,
+      CancellationToken token = {}) override;
+  std::future<Transaction> CreateTransactionAsync(
+      const std::string& wallet_id, std::map<std::string, Amount> outputs,
+      const std::string& memo = {}, std::vector<UnspentOutput> inputs = {},
+      Amount fee_rate = -1, bool subtract_fee_from_amount = false,
+      CancellationToken token = {}) override;
+  std::future<Transaction> SignTransactionAsync(
+      const std::string& wallet_id, const std::string& tx_id,
+      const Device& device, CancellationToken token = {}) override;
+  std::future<void> CacheMasterSignerXPubAsync(
+      const std::string& mastersigner_id, std::function<bool(int)> progress,
+      CancellationToken token = {}) override;
 
   void AddBalanceListener(
       std::function<void(std::string, Amount)> listener) override;
@@ -146,21 +192,57 @@ class NunchukImpl : public Nunchuk {
 
  private:
   std::string CreatePsbt(const std::string& wallet_id,
-                         const std::map<std::string, Amount> outputs,
-                         const std::vector<UnspentOutput> inputs,
+                         const std::map<std::string, Amount>& outputs,
+                         const std::vector<UnspentOutput>& inputs,
                          Amount fee_rate, bool subtract_fee_from_amount,
                          bool utxo_update_psbt, Amount& fee, int& change_pos);
-  void ScanNewWallet(const std::string wallet_id, bool is_escrow);
+  void ScanNewWallet(const std::string& wallet_id, bool is_escrow);
   // Find the first unused address that the next 19 addresses are unused too
-  std::string GetUnusedAddress(const std::string wallet_id, int& index,
+  std::string GetUnusedAddress(const std::string& wallet_id, int& index,
                                bool internal);
+  // Derive and look ahead until an unused address is found
+  std::string DeriveNewAddress(const std::string& wallet_id, bool internal);
+  void RefillAddressPool(const std::string& wallet_id, bool internal);
+  void FillAddressPool(const std::string& wallet_id, bool internal);
+  void InvalidateAddressPool(const std::string& wallet_id);
+  // Rebuild the pool holding address, if any, after it got used
+  void InvalidatePooledAddress(const std::string& wallet_id,
+                               const std::string& address);
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> RunAsync(F f);
+
+  // Wallet state CreatePsbt needs that never changes for a wallet id
+  struct TxBuildContext {
+    bool is_escrow;
+    std::string descriptors;  // import string for CoinSelector
+    FlatSigningProvider provider;
+  };
+  std::shared_ptr<const TxBuildContext> GetTxBuildContext(
+      const std::string& wallet_id);
+
+  // Unused, already subscribed addresses handed out by NewAddress
+  struct AddressPool {
+    std::deque<std::pair<int, std::string>> addresses;  // (index, address)
+    int generation = 0;
+    bool refilling = false;
+    int deriving = 0;  // NewAddress calls storing an address, no refills
+  };
 
   AppSettings app_settings_;
   NunchukStorage storage_;
   Chain chain_;
   HWIService hwi_;
+  std::mutex address_pool_mutex_;
+  // Serializes NewAddress derivation without holding address_pool_mutex_
+  std::mutex derive_address_mutex_;
+  std::map<std::pair<std::string, bool>, AddressPool> address_pool_;
+  std::mutex tx_build_context_mutex_;
+  std::map<std::string, std::shared_ptr<const TxBuildContext>>
+      tx_build_context_;
   BlockSynchronizer synchronizer_;
   boost::signals2::signal<void(std::string, bool)> device_listener_;
+  // Async tasks on the shared executor, waited for in the destructor
+  TaskTracker async_tasks_;
 };
 
 }  // namespace nunchuk
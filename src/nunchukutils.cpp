@@ -4,6 +4,7 @@
 
 #include <nunchuk.h>
 #include <coreutils.h>
+#include <logging.h>
 #include <utils/addressutils.hpp>
 #include <base58.h>
 #include <amount.h>
@@ -109,4 +110,12 @@ std::string Utils::AddressToScriptPubKey(const std::string& address) {
 
 void Utils::SetChain(Chain chain) { CoreUtils::getInstance().SetChain(chain); }
 
+void Utils::SetLogFile(const std::string& file_path, int verbosity) {
+  Logging::StartAsyncSink(file_path, verbosity);
+}
+
+void Utils::SetLogLevel(LogSubsystem subsystem, int verbosity) {
+  Logging::SetLevel(subsystem, verbosity);
+}
+
 }  // namespace nunchuk
\ No newline at end of file
@@ -4,15 +4,21 @@
 
 #include "storage.h"
 
+#include <backup.h>
 #include <descriptor.h>
+#include <iostats.h>
+#include <logging.h>
+#include <metrics.h>
+#include <tracing.h>
 #include <utils/bip32.hpp>
 #include <utils/txutils.hpp>
 #include <utils/json.hpp>
-#include <utils/loguru.hpp>
 #include <boost/filesystem/string_file.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include <boost/thread/locks.hpp>
+#include <algorithm>
+#include <fstream>
 #include <set>
 #include <sstream>
 
@@ -39,12 +45,95 @@ namespace ba = boost::algorithm;
 
 namespace nunchuk {
 
+// Transactions per SQL transaction when backfilling TXBALANCE
+static const int TXBALANCE_BACKFILL_BATCH = 500;
+
+// sqlite3_trace_v2 callback recording statement latency by leading keyword,
+// and statements and rows for the API call in progress. A connection has a
+// single trace callback, so both are kept here. Rows are only traced on
+// connections opened by an API call, see NunchukDb::NunchukDb
+static int ProfileStatement(unsigned type, void*, void* stmt, void* ns) {
+  if (type == SQLITE_TRACE_ROW) {
+    IoStatsScope::RecordRow();
+    return 0;
+  }
+  if (type != SQLITE_TRACE_PROFILE) return 0;
+  IoStatsScope::RecordStatement();
+  static const std::vector<std::string> kinds = {"SELECT", "INSERT", "UPDATE",
+                                                 "DELETE", "REPLACE", "OTHER"};
+  static std::vector<Metrics::Histogram*> histograms = [] {
+    std::vector<Metrics::Histogram*> rs;
+    for (auto&& kind : kinds) {
+      rs.push_back(&Metrics::getInstance().GetHistogram(
+          "nunchuk_storage_query_seconds", {{"statement", kind}}));
+    }
+    return rs;
+  }();
+  const char* sql = sqlite3_sql(static_cast<sqlite3_stmt*>(stmt));
+  std::string keyword;
+  while (sql && isspace(*sql)) sql++;
+  for (; sql && isalpha(*sql); sql++) keyword += toupper(*sql);
+  size_t i = 0;
+  while (i < kinds.size() - 1 && kinds[i] != keyword) i++;
+  histograms[i]->Observe(*static_cast<sqlite3_int64*>(ns) / 1e9);
+  return 0;
+}
+
+static json WalletToJson(const Wallet& wallet) {
+  json signers = json::array();
+  for (auto&& signer : wallet.get_signers()) {
+    signers.push_back({{"name", signer.get_name()},
+                       {"xpub", signer.get_xpub()},
+                       {"public_key", signer.get_public_key()},
+                       {"derivation_path", signer.get_derivation_path()},
+                       {"master_fingerprint", signer.get_master_fingerprint()},
+                       {"last_health_check", signer.get_last_health_check()},
+                       {"master_signer_id", signer.get_master_signer_id()}});
+  }
+  return {{"id", wallet.get_id()},
+          {"name", wallet.get_name()},
+          {"description", wallet.get_description()},
+          {"m", wallet.get_m()},
+          {"n", wallet.get_n()},
+          {"address_type", wallet.get_address_type()},
+          {"is_escrow", wallet.is_escrow()},
+          {"create_date", wallet.get_create_date()},
+          {"balance", wallet.get_balance()},
+          {"signers", signers}};
+}
+
+static Wallet WalletFromJson(const json& value) {
+  std::vector<SingleSigner> signers;
+  for (auto&& signer : value["signers"]) {
+    signers.push_back(SingleSigner(
+        signer["name"], signer["xpub"], signer["public_key"],
+        signer["derivation_path"], signer["master_fingerprint"],
+        signer["last_health_check"], signer["master_signer_id"]));
+  }
+  Wallet wallet(value["id"], value["m"], value["n"], std::move(signers),
+                value["address_type"], value["is_escrow"],
+                value["create_date"]);
+  wallet.set_name(value["name"]);
+  wallet.set_description(value["description"]);
+  wallet.set_balance(value["balance"]);
+  return wallet;
+}
+
 NunchukDb::NunchukDb(Chain chain, const std::string& id,
                      const std::string& file_name,
                      const std::string& passphrase)
     : id_(id), chain_(chain), db_file_name_(file_name) {
   SQLCHECK(sqlite3_open(db_file_name_.c_str(), &db_));
+  IoStatsScope::RecordDbOpen();
+  // The row callback runs for every row stepped. Connections live for a
+  // single call, so one opened outside an API call (sync, migrations) never
+  // has rows to report and skips it
+  unsigned trace = SQLITE_TRACE_PROFILE;
+  if (IoStatsScope::IsActive()) trace |= SQLITE_TRACE_ROW;
+  sqlite3_trace_v2(db_, trace, ProfileStatement, nullptr);
   if (!passphrase.empty()) {
+    // SQLCipher runs the KDF on the first access below
+    IoStatsScope::RecordKeyDerivation();
     const char* key = passphrase.c_str();
     SQLCHECK(sqlite3_key(db_, (const void*)key, strlen(key)));
   }
@@ -55,6 +144,14 @@ NunchukDb::NunchukDb(Chain chain, const std::string& id,
   }
 }
 
+NunchukDb::NunchukDb(NunchukDb&& other)
+    : db_(other.db_),
+      id_(std::move(other.id_)),
+      chain_(other.chain_),
+      db_file_name_(std::move(other.db_file_name_)) {
+  other.db_ = nullptr;
+}
+
 void NunchukDb::close() { sqlite3_close(db_); }
 
 void NunchukDb::CreateTable() {
@@ -81,8 +178,10 @@ void NunchukDb::DropTable() {
 
 void NunchukDb::ReKey(const std::string& new_passphrase) {
   const char* key = new_passphrase.c_str();
+  IoStatsScope::RecordKeyDerivation();
   SQLCHECK(sqlite3_rekey(db_, (const void*)key, strlen(key)));
-  DLOG_F(INFO, "NunchukDb '%s' ReKey success", db_file_name_.c_str());
+  NDLOG_F(STORAGE, INFO, "NunchukDb '%s' ReKey success",
+          db_file_name_.c_str());
 }
 
 void NunchukDb::EncryptDb(const std::string& new_file_name,
@@ -90,6 +189,7 @@ void NunchukDb::EncryptDb(const std::string& new_file_name,
   std::stringstream attach_sql;
   attach_sql << "ATTACH DATABASE '" << new_file_name << "' AS encrypted KEY '"
              << new_passphrase << "';";
+  IoStatsScope::RecordKeyDerivation();
   SQLCHECK(sqlite3_exec(db_, attach_sql.str().c_str(), NULL, NULL, NULL));
   SQLCHECK(sqlite3_exec(db_, "SELECT sqlcipher_export('encrypted');", NULL,
                         NULL, NULL));
@@ -106,6 +206,67 @@ void NunchukDb::DecryptDb(const std::string& new_file_name) {
   SQLCHECK(sqlite3_exec(db_, "DETACH DATABASE plaintext;", NULL, NULL, NULL));
 }
 
+// Copy a few pages per step; writers on other connections only wait for one
+// step. They restart the copy when they commit, so after a few restarts the
+// rest is copied in a single step
+void NunchukDb::CopyTo(NunchukDb& dest) {
+  static const int STEP_PAGES = 64;
+  static const int MAX_RESTARTS = 3;
+  sqlite3_backup* backup = sqlite3_backup_init(dest.db_, "main", db_, "main");
+  if (!backup) {
+    throw StorageException(StorageException::SQL_ERROR,
+                           sqlite3_errmsg(dest.db_));
+  }
+  int rc;
+  int remaining = -1;
+  int restarts = 0;
+  do {
+    rc = sqlite3_backup_step(backup,
+                             restarts < MAX_RESTARTS ? STEP_PAGES : -1);
+    int now = sqlite3_backup_remaining(backup);
+    if (remaining >= 0 && now > remaining) restarts++;
+    remaining = now;
+    if (rc != SQLITE_DONE) sqlite3_sleep(1);
+  } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+  sqlite3_backup_finish(backup);
+  if (rc != SQLITE_DONE) {
+    throw StorageException(StorageException::SQL_ERROR,
+                           sqlite3_errmsg(dest.db_));
+  }
+}
+
+std::string NunchukDb::ExportImage() {
+  SQLCHECK(sqlite3_exec(db_, "ATTACH DATABASE ':memory:' AS plaintext KEY '';",
+                        NULL, NULL, NULL));
+  sqlite3_int64 size = 0;
+  unsigned char* data = nullptr;
+  if (sqlite3_exec(db_, "SELECT sqlcipher_export('plaintext');", NULL, NULL,
+                   NULL) == SQLITE_OK) {
+    data = sqlite3_serialize(db_, "plaintext", &size, 0);
+  }
+  std::string rs;
+  if (data) rs.assign(reinterpret_cast<char*>(data), size);
+  sqlite3_free(data);
+  SQLCHECK(sqlite3_exec(db_, "DETACH DATABASE plaintext;", NULL, NULL, NULL));
+  if (!data) {
+    throw StorageException(StorageException::SQL_ERROR,
+                           "can not export database");
+  }
+  return rs;
+}
+
+void NunchukDb::ImportImage(const std::string& image) {
+  auto data = static_cast<unsigned char*>(sqlite3_malloc64(image.size()));
+  if (!data) {
+    throw StorageException(StorageException::SQL_ERROR, "out of memory");
+  }
+  memcpy(data, image.data(), image.size());
+  // sqlite frees data, also on failure
+  SQLCHECK(sqlite3_deserialize(db_, "main", data, image.size(), image.size(),
+                               SQLITE_DESERIALIZE_FREEONCLOSE |
+                                   SQLITE_DESERIALIZE_RESIZEABLE));
+}
+
 bool NunchukDb::PutString(int key, const std::string& value) {
   sqlite3_stmt* stmt;
   std::string sql =
@@ -121,6 +282,21 @@ bool NunchukDb::PutString(int key, const std::string& value) {
   return updated;
 }
 
+NunchukDb::WriteScope::WriteScope(sqlite3* db)
+    : db_(db), owner_(sqlite3_get_autocommit(db) != 0) {
+  if (owner_) SQLCHECK(sqlite3_exec(db_, "BEGIN;", NULL, 0, NULL));
+}
+
+NunchukDb::WriteScope::~WriteScope() {
+  if (owner_) sqlite3_exec(db_, "ROLLBACK;", NULL, 0, NULL);
+}
+
+void NunchukDb::WriteScope::Commit() {
+  if (!owner_) return;
+  SQLCHECK(sqlite3_exec(db_, "COMMIT;", NULL, 0, NULL));
+  owner_ = false;
+}
+
 bool NunchukDb::PutInt(int key, int64_t value) {
   sqlite3_stmt* stmt;
   std::string sql =
@@ -199,6 +375,8 @@ void NunchukWalletDb::InitWallet(const std::string& name, int m, int n,
                         "MASTER_ID        TEXT    NOT NULL,"
                         "LAST_HEALTHCHECK INT     NOT NULL);",
                         NULL, 0, NULL));
+  CreateChangeLog();
+  CreateTxBalance();
   PutString(DbKeys::NAME, name);
   PutString(DbKeys::DESCRIPTION, description);
 
@@ -223,10 +401,465 @@ void NunchukWalletDb::MaybeMigrate() {
   if (current_ver < 2) {
     sqlite3_exec(db_, "ALTER TABLE VTX ADD COLUMN EXTRA TEXT;", NULL, 0, NULL);
   }
-  DLOG_F(INFO, "NunchukWalletDb migrate to version %d", STORAGE_VER);
+  if (current_ver < 3) {
+    CreateChangeLog();
+  }
+  if (current_ver < 5) {
+    // 4 added TXBALANCE, 5 the TXBALANCE_REF rows it is recomputed from.
+    // Filled in batches later, opening the wallet stays O(1)
+    CreateTxBalance();
+    PutInt(DbKeys::TXBALANCE_PENDING, 1);
+    PutString(DbKeys::TXBALANCE_CURSOR, "");
+  }
+  NDLOG_F(STORAGE, INFO, "NunchukWalletDb migrate to version %d",
+          STORAGE_VER);
   PutInt(DbKeys::VERSION, STORAGE_VER);
 }
 
+void NunchukWalletDb::CreateChangeLog() {
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE TABLE IF NOT EXISTS CHANGELOG("
+                        "KIND            INT     NOT NULL,"
+                        "KEY             TEXT    NOT NULL,"
+                        "SEQ             INT     NOT NULL,"
+                        "PRIMARY KEY (KIND, KEY));",
+                        NULL, 0, NULL));
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE INDEX IF NOT EXISTS CHANGELOG_SEQ "
+                        "ON CHANGELOG(SEQ);",
+                        NULL, 0, NULL));
+}
+
+void NunchukWalletDb::RecordChange(int kind, const std::string& key) {
+  int64_t seq = GetInt(DbKeys::CHANGE_SEQ) + 1;
+  PutInt(DbKeys::CHANGE_SEQ, seq);
+  sqlite3_stmt* stmt;
+  std::string sql =
+      "INSERT INTO CHANGELOG(KIND, KEY, SEQ)"
+      "VALUES (?1, ?2, ?3)"
+      "ON CONFLICT(KIND, KEY) DO UPDATE SET SEQ=excluded.SEQ;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_bind_int(stmt, 1, kind);
+  sqlite3_bind_text(stmt, 2, key.c_str(), key.size(), NULL);
+  sqlite3_bind_int64(stmt, 3, seq);
+  sqlite3_step(stmt);
+  SQLCHECK(sqlite3_finalize(stmt));
+}
+
+void NunchukWalletDb::CreateTxBalance() {
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE TABLE IF NOT EXISTS TXBALANCE("
+                        "ID TEXT PRIMARY KEY     NOT NULL,"
+                        "HEIGHT          INT     NOT NULL,"
+                        "BLOCKTIME       INT     NOT NULL,"
+                        "AMOUNT          INT     NOT NULL);",
+                        NULL, 0, NULL));
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE INDEX IF NOT EXISTS TXBALANCE_HEIGHT "
+                        "ON TXBALANCE(HEIGHT);",
+                        NULL, 0, NULL));
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE TABLE IF NOT EXISTS TXBALANCE_REF("
+                        "ID              TEXT    NOT NULL,"
+                        "REF             TEXT    NOT NULL,"
+                        "PRIMARY KEY (ID, REF));",
+                        NULL, 0, NULL));
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE INDEX IF NOT EXISTS TXBALANCE_REF_REF "
+                        "ON TXBALANCE_REF(REF);",
+                        NULL, 0, NULL));
+}
+
+bool NunchukWalletDb::BackfillTxBalance(int batch_size) {
+  if (GetInt(DbKeys::TXBALANCE_PENDING) == 0) return true;
+  std::string cursor = GetString(DbKeys::TXBALANCE_CURSOR);
+  std::vector<std::string> tx_ids;
+  sqlite3_stmt* stmt;
+  std::string sql =
+      "SELECT ID FROM VTX WHERE HEIGHT > 0 AND ID > ? ORDER BY ID LIMIT ?;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, cursor.c_str(), cursor.size(), NULL);
+  sqlite3_bind_int(stmt, 2, batch_size);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    tx_ids.push_back(std::string((char*)sqlite3_column_text(stmt, 0)));
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+
+  // Rows written meanwhile by UpdateTxBalance are recomputed the same way
+  bool done = tx_ids.size() < (size_t)batch_size;
+  WriteScope scope(db_);
+  UpdateTxBalance(tx_ids);
+  if (!tx_ids.empty()) PutString(DbKeys::TXBALANCE_CURSOR, tx_ids.back());
+  if (done) PutInt(DbKeys::TXBALANCE_PENDING, 0);
+  scope.Commit();
+  return done;
+}
+
+void NunchukWalletDb::UpdateTxBalance(const std::string& tx_id) {
+  std::vector<std::string> tx_ids{tx_id};
+  // Spenders tell sends from receives by the output they spend
+  for (auto&& id : GetTxBalanceDependents(tx_id, false)) {
+    if (id != tx_id) tx_ids.push_back(id);
+  }
+  UpdateTxBalance(tx_ids);
+}
+
+void NunchukWalletDb::UpdateTxBalance(const std::vector<std::string>& tx_ids) {
+  // Loaded once, and only if a confirmed transaction needs them
+  std::unordered_set<std::string> addresses;
+  bool has_addresses = false;
+  for (auto&& tx_id : tx_ids) {
+    // Only confirmed transactions count, a reorged or deleted one is dropped
+    Transaction tx;
+    try {
+      tx = GetTransaction(tx_id);
+    } catch (StorageException& se) {
+      if (se.code() != StorageException::TX_NOT_FOUND) throw;
+    }
+    sqlite3_stmt* stmt;
+    for (auto&& sql : {"DELETE FROM TXBALANCE WHERE ID = ?;",
+                       "DELETE FROM TXBALANCE_REF WHERE ID = ?;"}) {
+      sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL);
+      sqlite3_bind_text(stmt, 1, tx_id.c_str(), tx_id.size(), NULL);
+      sqlite3_step(stmt);
+      SQLCHECK(sqlite3_finalize(stmt));
+    }
+    if (tx.get_txid().empty() || tx.get_height() <= 0) continue;
+
+    if (!has_addresses) {
+      addresses = GetAllAddressSet();
+      has_addresses = true;
+    }
+    FillSendReceiveData(tx, addresses);
+    Amount amount =
+        tx.is_receive() ? tx.get_sub_amount() : -tx.get_sub_amount();
+    std::string sql =
+        "INSERT OR REPLACE INTO TXBALANCE(ID, HEIGHT, BLOCKTIME, AMOUNT)"
+        "VALUES (?1, ?2, ?3, ?4);";
+    sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, tx_id.c_str(), tx_id.size(), NULL);
+    sqlite3_bind_int64(stmt, 2, tx.get_height());
+    sqlite3_bind_int64(stmt, 3, tx.get_blocktime());
+    sqlite3_bind_int64(stmt, 4, amount);
+    sqlite3_step(stmt);
+    SQLCHECK(sqlite3_finalize(stmt));
+
+    // The amount was computed from the output spent by the first input and
+    // from which output addresses are the wallet's
+    std::set<std::string> refs;
+    refs.insert(tx.get_input_txid(0));
+    for (size_t i = 0; i < tx.get_output_count(); i++) {
+      refs.insert(tx.get_output_address(i));
+    }
+    sql = "INSERT OR IGNORE INTO TXBALANCE_REF(ID, REF) VALUES (?1, ?2);";
+    sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+    for (auto&& ref : refs) {
+      sqlite3_bind_text(stmt, 1, tx_id.c_str(), tx_id.size(), NULL);
+      sqlite3_bind_text(stmt, 2, ref.c_str(), ref.size(), NULL);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
+    SQLCHECK(sqlite3_finalize(stmt));
+  }
+}
+
+std::vector<std::string> NunchukWalletDb::GetTxBalanceDependents(
+    const std::string& ref, bool is_address) const {
+  // A new address changes the transactions paying to it, and those
+  // spending from them
+  std::string sql =
+      is_address ? "SELECT DISTINCT ID FROM TXBALANCE_REF WHERE REF = ?1 OR "
+                   "REF IN (SELECT ID FROM TXBALANCE_REF WHERE REF = ?1);"
+                 : "SELECT DISTINCT ID FROM TXBALANCE_REF WHERE REF = ?1;";
+  std::vector<std::string> rs;
+  sqlite3_stmt* stmt;
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, ref.c_str(), ref.size(), NULL);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    rs.push_back(std::string((char*)sqlite3_column_text(stmt, 0)));
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+  return rs;
+}
+
+std::vector<BalancePoint> NunchukWalletDb::GetBalanceHistory(
+    int max_points) const {
+  std::vector<BalancePoint> rs;
+  sqlite3_stmt* stmt;
+  std::string sql =
+      "SELECT HEIGHT, MAX(BLOCKTIME), SUM(AMOUNT) FROM TXBALANCE "
+      "GROUP BY HEIGHT ORDER BY HEIGHT;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  Amount balance = 0;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    balance += sqlite3_column_int64(stmt, 2);
+    BalancePoint point;
+    point.set_height(sqlite3_column_int(stmt, 0));
+    point.set_blocktime(sqlite3_column_int64(stmt, 1));
+    point.set_balance(balance);
+    rs.push_back(point);
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+  if (max_points <= 0 || rs.size() <= (size_t)max_points) return rs;
+
+  // Keep the last point of each of max_points spans, so every kept balance
+  // is exact and the latest one is always there
+  std::vector<BalancePoint> sampled;
+  sampled.reserve(max_points);
+  for (size_t i = 0; i < rs.size(); i++) {
+    size_t span = i * max_points / rs.size();
+    size_t next_span = (i + 1) * max_points / rs.size();
+    if (i + 1 == rs.size() || next_span != span) sampled.push_back(rs[i]);
+  }
+  return sampled;
+}
+
+int64_t NunchukWalletDb::GetChangeSeq() const {
+  return GetInt(DbKeys::CHANGE_SEQ);
+}
+
+WalletChanges NunchukWalletDb::GetChanges(int64_t since_seq) {
+  // Read the sequence first: a write racing with this call is returned
+  // again next time rather than missed
+  WalletChanges changes;
+  changes.set_seq(GetChangeSeq());
+
+  std::set<std::string> tx_ids;
+  std::set<std::string> addresses;
+  std::set<std::string> utxo_addresses;
+  sqlite3_stmt* stmt;
+  std::string sql = "SELECT KIND, KEY FROM CHANGELOG WHERE SEQ > ?;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_bind_int64(stmt, 1, since_seq);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    int kind = sqlite3_column_int(stmt, 0);
+    std::string key = std::string((char*)sqlite3_column_text(stmt, 1));
+    if (kind == ChangeKind::TRANSACTION) {
+      tx_ids.insert(key);
+    } else if (kind == ChangeKind::ADDRESS) {
+      addresses.insert(key);
+    } else if (kind == ChangeKind::UTXO) {
+      utxo_addresses.insert(key);
+    }
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+
+  // A changed unconfirmed transaction locks or unlocks the coins it spends
+  std::map<std::string, std::string> coin_address;
+  if (!tx_ids.empty()) {
+    for (auto&& utxo : GetUnspentOutputs(false)) {
+      coin_address[utxo.get_txid() + ":" + std::to_string(utxo.get_vout())] =
+          utxo.get_address();
+    }
+  }
+  std::vector<Transaction> transactions;
+  std::vector<std::string> removed_transactions;
+  auto my_addresses =
+      tx_ids.empty() ? std::unordered_set<std::string>{} : GetAllAddressSet();
+  for (auto&& tx_id : tx_ids) {
+    try {
+      auto tx = GetTransaction(tx_id);
+      FillSendReceiveData(tx, my_addresses);
+      for (size_t i = 0; i < tx.get_input_count(); i++) {
+        auto coin = coin_address.find(tx.get_input_txid(i) + ":" +
+                                      std::to_string(tx.get_input_vout(i)));
+        if (coin != coin_address.end()) utxo_addresses.insert(coin->second);
+      }
+      transactions.push_back(tx);
+    } catch (StorageException& se) {
+      if (se.code() != StorageException::TX_NOT_FOUND) throw;
+      removed_transactions.push_back(tx_id);
+    }
+  }
+
+  std::vector<UnspentOutput> utxos;
+  if (!utxo_addresses.empty()) {
+    for (auto&& utxo : GetUnspentOutputs(true)) {
+      if (utxo_addresses.count(utxo.get_address())) utxos.push_back(utxo);
+    }
+  }
+  changes.set_transactions(std::move(transactions));
+  changes.set_removed_transactions(std::move(removed_transactions));
+  changes.set_addresses({addresses.begin(), addresses.end()});
+  changes.set_utxo_addresses({utxo_addresses.begin(), utxo_addresses.end()});
+  changes.set_utxos(std::move(utxos));
+  return changes;
+}
+
+static void InvalidDelta(const std::string& reason) {
+  throw StorageException(StorageException::INVALID_BACKUP,
+                         "invalid delta: " + reason);
+}
+
+// Rows as column name -> value objects. Wallet tables only hold integers,
+// text and nulls
+static json SelectRows(sqlite3* db_, sqlite3_stmt* stmt) {
+  json rows = json::array();
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    json row = json::object();
+    for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+      std::string name = sqlite3_column_name(stmt, i);
+      switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+          row[name] = sqlite3_column_int64(stmt, i);
+          break;
+        case SQLITE_NULL:
+          row[name] = nullptr;
+          break;
+        default:
+          row[name] = std::string((char*)sqlite3_column_text(stmt, i));
+      }
+    }
+    rows.push_back(row);
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+  return rows;
+}
+
+static void UpsertRows(sqlite3* db_, const std::string& table,
+                       const json& rows) {
+  auto is_column = [](const std::string& name) {
+    return !name.empty() && std::all_of(name.begin(), name.end(), [](char c) {
+      return (c >= 'A' && c <= 'Z') || c == '_';
+    });
+  };
+  for (auto&& row : rows) {
+    if (!row.is_object() || row.empty()) InvalidDelta("bad row");
+    std::string columns;
+    std::string values;
+    for (auto it = row.begin(); it != row.end(); ++it) {
+      if (!is_column(it.key())) InvalidDelta("bad column");
+      columns += (columns.empty() ? "" : ",") + it.key();
+      values += values.empty() ? "?" : ",?";
+    }
+    sqlite3_stmt* stmt;
+    std::string sql = "INSERT OR REPLACE INTO " + table + "(" + columns +
+                      ") VALUES (" + values + ");";
+    SQLCHECK(sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL));
+    int i = 1;
+    for (auto&& value : row) {
+      if (value.is_number_integer()) {
+        sqlite3_bind_int64(stmt, i++, value.get<int64_t>());
+      } else if (value.is_string()) {
+        auto text = value.get<std::string>();
+        sqlite3_bind_text(stmt, i++, text.c_str(), text.size(),
+                          SQLITE_TRANSIENT);
+      } else if (value.is_null()) {
+        sqlite3_bind_null(stmt, i++);
+      } else {
+        sqlite3_finalize(stmt);
+        InvalidDelta("bad value");
+      }
+    }
+    int rc = sqlite3_step(stmt);
+    SQLCHECK(sqlite3_finalize(stmt));
+    if (rc != SQLITE_DONE) InvalidDelta(sqlite3_errmsg(db_));
+  }
+}
+
+// Only CHANGELOG knows what changed in VTX and ADDRESS. The other tables are
+// small and sent whole, except TXBALANCE which is rebuilt from VTX
+std::string NunchukWalletDb::ExportDelta(int64_t since_seq, int64_t& seq) {
+  // One read transaction, so the rows are those of seq
+  SQLCHECK(sqlite3_exec(db_, "BEGIN;", NULL, 0, NULL));
+  try {
+    seq = GetChangeSeq();
+    json rows = json::object();
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db_, "SELECT * FROM VSTR WHERE ID != ?;", -1, &stmt,
+                       NULL);
+    sqlite3_bind_int(stmt, 1, DbKeys::LAST_BACKUP_SEQ);
+    rows["VSTR"] = SelectRows(db_, stmt);
+    sqlite3_prepare_v2(db_, "SELECT * FROM VINT;", -1, &stmt, NULL);
+    rows["VINT"] = SelectRows(db_, stmt);
+    sqlite3_prepare_v2(db_, "SELECT * FROM SIGNER;", -1, &stmt, NULL);
+    rows["SIGNER"] = SelectRows(db_, stmt);
+    sqlite3_prepare_v2(db_, "SELECT * FROM CHANGELOG WHERE SEQ > ?;", -1,
+                       &stmt, NULL);
+    sqlite3_bind_int64(stmt, 1, since_seq);
+    rows["CHANGELOG"] = SelectRows(db_, stmt);
+
+    rows["VTX"] = json::array();
+    rows["ADDRESS"] = json::array();
+    json deleted = json::array();
+    std::set<std::string> addresses;
+    for (auto&& change : rows["CHANGELOG"]) {
+      std::string key = change["KEY"];
+      bool is_tx = change["KIND"] == ChangeKind::TRANSACTION;
+      if (!is_tx && !addresses.insert(key).second) continue;
+      sqlite3_prepare_v2(db_,
+                         is_tx ? "SELECT * FROM VTX WHERE ID = ?;"
+                               : "SELECT * FROM ADDRESS WHERE ADDR = ?;",
+                         -1, &stmt, NULL);
+      sqlite3_bind_text(stmt, 1, key.c_str(), key.size(), NULL);
+      json found = SelectRows(db_, stmt);
+      if (is_tx && found.empty()) deleted.push_back(key);
+      for (auto&& row : found) rows[is_tx ? "VTX" : "ADDRESS"].push_back(row);
+    }
+    SQLCHECK(sqlite3_exec(db_, "COMMIT;", NULL, 0, NULL));
+    json delta = {{"format", "nunchuk-wallet-delta"},
+                  {"wallet_id", id_},
+                  {"base_seq", since_seq},
+                  {"seq", seq},
+                  {"rows", rows},
+                  {"deleted_transactions", deleted}};
+    return delta.dump();
+  } catch (...) {
+    sqlite3_exec(db_, "ROLLBACK;", NULL, 0, NULL);
+    throw;
+  }
+}
+
+void NunchukWalletDb::ApplyDelta(const std::string& value) {
+  static const char* TABLES[] = {"VSTR",      "VINT", "SIGNER",
+                                 "CHANGELOG", "VTX",  "ADDRESS"};
+  SQLCHECK(sqlite3_exec(db_, "BEGIN IMMEDIATE;", NULL, 0, NULL));
+  try {
+    json delta = json::parse(value);
+    int64_t base_seq = delta.at("base_seq");
+    int64_t seq = delta.at("seq");
+    if (base_seq != GetChangeSeq()) {
+      InvalidDelta("wallet is at change " + std::to_string(GetChangeSeq()) +
+                   ", delta starts at " + std::to_string(base_seq));
+    }
+    json rows = delta.at("rows");
+    for (auto&& table : TABLES) {
+      if (rows.count(table)) UpsertRows(db_, table, rows[table]);
+    }
+    std::vector<std::string> tx_ids;
+    for (auto&& tx_id : delta.at("deleted_transactions")) {
+      std::string id = tx_id;
+      sqlite3_stmt* stmt;
+      sqlite3_prepare_v2(db_, "DELETE FROM VTX WHERE ID = ?;", -1, &stmt,
+                         NULL);
+      sqlite3_bind_text(stmt, 1, id.c_str(), id.size(), NULL);
+      sqlite3_step(stmt);
+      SQLCHECK(sqlite3_finalize(stmt));
+      tx_ids.push_back(id);
+    }
+    if (rows.count("VTX")) {
+      for (auto&& row : rows["VTX"]) tx_ids.push_back(row.at("ID"));
+    }
+    // TXBALANCE is derived, not sent
+    for (auto&& tx_id : tx_ids) UpdateTxBalance(tx_id);
+    if (rows.count("ADDRESS")) {
+      for (auto&& row : rows["ADDRESS"]) {
+        UpdateTxBalance(GetTxBalanceDependents(row.at("ADDR"), true));
+      }
+    }
+    PutInt(DbKeys::CHANGE_SEQ, seq);
+    // The next delta taken here continues from this one
+    PutString(DbKeys::LAST_BACKUP_SEQ, std::to_string(seq));
+    SQLCHECK(sqlite3_exec(db_, "COMMIT;", NULL, 0, NULL));
+  } catch (json::exception& e) {
+    sqlite3_exec(db_, "ROLLBACK;", NULL, 0, NULL);
+    InvalidDelta(e.what());
+  } catch (...) {
+    sqlite3_exec(db_, "ROLLBACK;", NULL, 0, NULL);
+    throw;
+  }
+}
+
 std::string NunchukWalletDb::GetSingleSignerKey(const SingleSigner& signer) {
   json basic_data = {{"xpub", signer.get_xpub()},
                      {"public_key", signer.get_public_key()},
@@ -301,6 +934,10 @@ void NunchukWalletDb::DeleteWallet() {
   SQLCHECK(sqlite3_exec(db_, "DROP TABLE IF EXISTS SIGNER;", NULL, 0, NULL));
   SQLCHECK(sqlite3_exec(db_, "DROP TABLE IF EXISTS ADDRESS;", NULL, 0, NULL));
   SQLCHECK(sqlite3_exec(db_, "DROP TABLE IF EXISTS VTX;", NULL, 0, NULL));
+  SQLCHECK(
+      sqlite3_exec(db_, "DROP TABLE IF EXISTS TXBALANCE;", NULL, 0, NULL));
+  SQLCHECK(sqlite3_exec(db_, "DROP TABLE IF EXISTS TXBALANCE_REF;", NULL, 0,
+                        NULL));
   DropTable();
 }
 
@@ -312,7 +949,7 @@ bool NunchukWalletDb::SetDescription(const std::string& value) {
   return PutString(DbKeys::DESCRIPTION, value);
 }
 
-Wallet NunchukWalletDb::GetWallet() const {
+Wallet NunchukWalletDb::GetWallet(bool include_balance) const {
   json immutable_data = json::parse(GetString(DbKeys::IMMUTABLE_DATA));
   int m = immutable_data["m"];
   int n = immutable_data["n"];
@@ -320,11 +957,10 @@ Wallet NunchukWalletDb::GetWallet() const {
   bool is_escrow = immutable_data["is_escrow"];
   time_t create_date = immutable_data["create_date"];
 
-  auto signers = GetSigners();
-  auto balance = GetBalance();
-  Wallet wallet(id_, m, n, signers, address_type, is_escrow, create_date);
+  Wallet wallet(id_, m, n, GetSigners(), address_type, is_escrow,
+                create_date);
   wallet.set_name(GetString(DbKeys::NAME));
-  wallet.set_balance(balance);
+  if (include_balance) wallet.set_balance(GetBalance());
   return wallet;
 }
 
@@ -358,6 +994,7 @@ std::vector<SingleSigner> NunchukWalletDb::GetSigners() const {
 
 bool NunchukWalletDb::AddAddress(const std::string& address, int index,
                                  bool internal) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql =
       "INSERT INTO ADDRESS(ADDR, IDX, INTERNAL, USED)"
@@ -367,12 +1004,18 @@ bool NunchukWalletDb::AddAddress(const std::string& address, int index,
   sqlite3_bind_int(stmt, 2, index);
   sqlite3_bind_int(stmt, 3, internal ? 1 : 0);
   sqlite3_step(stmt);
+  bool inserted = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  RecordChange(ChangeKind::ADDRESS, address);
+  // Transactions synced before the address was known counted it as foreign
+  if (inserted) UpdateTxBalance(GetTxBalanceDependents(address, true));
+  scope.Commit();
   return true;
 }
 
 bool NunchukWalletDb::UseAddress(const std::string& address) {
   if (address.empty()) return false;
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql = "UPDATE ADDRESS SET USED = 1 WHERE ADDR = ?;";
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
@@ -380,6 +1023,8 @@ bool NunchukWalletDb::UseAddress(const std::string& address) {
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  if (updated) RecordChange(ChangeKind::ADDRESS, address);
+  scope.Commit();
   return updated;
 }
 
@@ -415,6 +1060,11 @@ std::vector<std::string> NunchukWalletDb::GetAllAddresses() const {
   return addresses;
 }
 
+std::unordered_set<std::string> NunchukWalletDb::GetAllAddressSet() const {
+  auto addresses = GetAllAddresses();
+  return {addresses.begin(), addresses.end()};
+}
+
 int NunchukWalletDb::GetCurrentAddressIndex(bool internal) const {
   sqlite3_stmt* stmt;
   std::string sql =
@@ -434,6 +1084,7 @@ Transaction NunchukWalletDb::InsertTransaction(const std::string& raw_tx,
                                                Amount fee,
                                                const std::string& memo,
                                                int change_pos) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql =
       "INSERT INTO VTX(ID, VALUE, HEIGHT, FEE, MEMO, CHANGEPOS, BLOCKTIME, "
@@ -451,10 +1102,16 @@ Transaction NunchukWalletDb::InsertTransaction(const std::string& raw_tx,
   sqlite3_bind_int64(stmt, 7, blocktime);
   sqlite3_step(stmt);
   SQLCHECK(sqlite3_finalize(stmt));
+  RecordChange(ChangeKind::TRANSACTION, tx_id);
+  // Also when unconfirmed, confirmed spenders may have come first
+  UpdateTxBalance(tx_id);
   Transaction tx = GetTransaction(tx_id);
   if (height > 0) {
-    for (auto&& output : tx.get_outputs()) UseAddress(output.first);
+    for (size_t i = 0; i < tx.get_output_count(); i++) {
+      UseAddress(tx.get_output_address(i));
+    }
   }
+  scope.Commit();
   return tx;
 }
 
@@ -480,6 +1137,7 @@ void NunchukWalletDb::SetReplacedBy(const std::string& old_txid,
     sqlite3_bind_text(update_stmt, 2, old_txid.c_str(), old_txid.size(), NULL);
     sqlite3_step(update_stmt);
     SQLCHECK(sqlite3_finalize(update_stmt));
+    RecordChange(ChangeKind::TRANSACTION, old_txid);
   }
   SQLCHECK(sqlite3_finalize(select_stmt));
 }
@@ -492,6 +1150,7 @@ bool NunchukWalletDb::UpdateTransaction(const std::string& raw_tx, int height,
   CMutableTransaction mtx = DecodeRawTransaction(raw_tx);
   std::string tx_id = mtx.GetHash().GetHex();
 
+  WriteScope scope(db_);
   std::string extra = "";
   if (height <= 0) {
     // Persist signers to extra if the psbt existed
@@ -537,17 +1196,25 @@ bool NunchukWalletDb::UpdateTransaction(const std::string& raw_tx, int height,
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  if (updated) {
+    RecordChange(ChangeKind::TRANSACTION, tx_id);
+    UpdateTxBalance(tx_id);
+  }
   if (updated && height > 0) {
     Transaction tx = GetTransaction(tx_id);
     if (height > 0) {
-      for (auto&& output : tx.get_outputs()) UseAddress(output.first);
+      for (size_t i = 0; i < tx.get_output_count(); i++) {
+        UseAddress(tx.get_output_address(i));
+      }
     }
   }
+  scope.Commit();
   return updated;
 }
 
 bool NunchukWalletDb::UpdateTransactionMemo(const std::string& tx_id,
                                             const std::string& memo) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql = "UPDATE VTX SET MEMO = ?1 WHERE ID = ?2;";
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
@@ -556,6 +1223,8 @@ bool NunchukWalletDb::UpdateTransactionMemo(const std::string& tx_id,
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  if (updated) RecordChange(ChangeKind::TRANSACTION, tx_id);
+  scope.Commit();
   return updated;
 }
 
@@ -575,6 +1244,7 @@ Transaction NunchukWalletDb::CreatePsbt(
     extra["replace_txid"] = replace_tx;
   }
 
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql =
       "INSERT INTO "
@@ -591,10 +1261,13 @@ Transaction NunchukWalletDb::CreatePsbt(
   sqlite3_bind_text(stmt, 7, extra_str.c_str(), extra_str.size(), NULL);
   sqlite3_step(stmt);
   SQLCHECK(sqlite3_finalize(stmt));
+  RecordChange(ChangeKind::TRANSACTION, tx_id);
+  scope.Commit();
   return GetTransaction(tx_id);
 }
 
 bool NunchukWalletDb::UpdatePsbt(const std::string& psbt) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql = "UPDATE VTX SET VALUE = ?1 WHERE ID = ?2 AND HEIGHT = -1;";
   PartiallySignedTransaction psbtx = DecodePsbt(psbt);
@@ -605,11 +1278,14 @@ bool NunchukWalletDb::UpdatePsbt(const std::string& psbt) {
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  if (updated) RecordChange(ChangeKind::TRANSACTION, tx_id);
+  scope.Commit();
   return updated;
 }
 
 bool NunchukWalletDb::UpdatePsbtTxId(const std::string& old_id,
                                      const std::string& new_id) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
   std::string sql = "SELECT * FROM VTX WHERE ID = ? AND HEIGHT = -1;;";
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
@@ -641,11 +1317,14 @@ bool NunchukWalletDb::UpdatePsbtTxId(const std::string& old_id,
     sqlite3_bind_text(insert_stmt, 7, extra.c_str(), extra.size(), NULL);
     sqlite3_step(insert_stmt);
     SQLCHECK(sqlite3_finalize(insert_stmt));
+    RecordChange(ChangeKind::TRANSACTION, new_id);
   } else {
     SQLCHECK(sqlite3_finalize(stmt));
     throw StorageException(StorageException::TX_NOT_FOUND, "old tx not found!");
   }
-  return DeleteTransaction(old_id);
+  bool deleted = DeleteTransaction(old_id);
+  scope.Commit();
+  return deleted;
 }
 
 std::string NunchukWalletDb::GetPsbt(const std::string& tx_id) const {
@@ -718,6 +1397,16 @@ Transaction NunchukWalletDb::GetTransaction(const std::string& tx_id) const {
 }
 
 bool NunchukWalletDb::DeleteTransaction(const std::string& tx_id) {
+  // Coins spent by an unconfirmed transaction are unlocked by deleting it,
+  // which GetChanges can not see once the transaction is gone
+  WriteScope scope(db_);
+  std::vector<TxInput> inputs;
+  try {
+    auto tx = GetTransaction(tx_id);
+    if (tx.get_height() == 0) inputs = tx.get_inputs();
+  } catch (StorageException& se) {
+    if (se.code() != StorageException::TX_NOT_FOUND) throw;
+  }
   sqlite3_stmt* stmt;
   std::string sql = "DELETE FROM VTX WHERE ID = ?;";
   sqlite3_prepare(db_, sql.c_str(), -1, &stmt, NULL);
@@ -725,11 +1414,28 @@ bool NunchukWalletDb::DeleteTransaction(const std::string& tx_id) {
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
-  return updated;
+  if (!updated) return false;
+  RecordChange(ChangeKind::TRANSACTION, tx_id);
+  UpdateTxBalance(tx_id);
+  if (!inputs.empty()) {
+    std::set<std::string> spent;
+    for (auto&& input : inputs) {
+      spent.insert(input.first + ":" + std::to_string(input.second));
+    }
+    for (auto&& utxo : GetUnspentOutputs(false)) {
+      if (spent.count(utxo.get_txid() + ":" +
+                      std::to_string(utxo.get_vout()))) {
+        RecordChange(ChangeKind::UTXO, utxo.get_address());
+      }
+    }
+  }
+  scope.Commit();
+  return true;
 }
 
 std::string NunchukWalletDb::GetDescriptor(bool internal) const {
-  Wallet wallet = GetWallet();
+  // Balance needs every transaction decoded, skip it
+  Wallet wallet = GetWallet(false);
   WalletType wallet_type =
       wallet.get_n() == 1
           ? WalletType::SINGLE_SIG
@@ -763,14 +1469,19 @@ std::string NunchukWalletDb::GetColdcardFile() const {
 
 bool NunchukWalletDb::SetUtxos(const std::string& address,
                                const std::string& utxo) {
+  WriteScope scope(db_);
   sqlite3_stmt* stmt;
-  std::string sql = "UPDATE ADDRESS SET UTXO = ?1 WHERE ADDR = ?2;";
+  // Resyncing the same coins is not a change
+  std::string sql =
+      "UPDATE ADDRESS SET UTXO = ?1 WHERE ADDR = ?2 AND UTXO IS NOT ?1;";
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
   sqlite3_bind_text(stmt, 1, utxo.c_str(), utxo.size(), NULL);
   sqlite3_bind_text(stmt, 2, address.c_str(), address.size(), NULL);
   sqlite3_step(stmt);
   bool updated = (sqlite3_changes(db_) == 1);
   SQLCHECK(sqlite3_finalize(stmt));
+  if (updated) RecordChange(ChangeKind::UTXO, address);
+  scope.Commit();
   return updated;
 }
 
@@ -802,8 +1513,9 @@ std::vector<UnspentOutput> NunchukWalletDb::GetUnspentOutputs(
   for (auto&& tx : transactions) {
     if (tx.get_height() != 0) continue;
     // remove UTXOs of unconfirmed transactions
-    for (auto&& input : tx.get_inputs()) {
-      locked_utxos.insert(input_str(input.first, input.second));
+    for (size_t i = 0; i < tx.get_input_count(); i++) {
+      locked_utxos.insert(
+          input_str(tx.get_input_txid(i), tx.get_input_vout(i)));
     }
   }
 
@@ -837,6 +1549,59 @@ std::vector<UnspentOutput> NunchukWalletDb::GetUnspentOutputs(
   return rs;
 }
 
+std::vector<UnspentOutput> NunchukWalletDb::GetUnspentOutputsFromTxInputs(
+    const std::vector<TxInput>& inputs) const {
+  std::set<std::string> tx_ids;
+  for (auto&& input : inputs) tx_ids.insert(input.first);
+
+  // Look up the previous transactions by primary key, in chunks that stay
+  // below SQLITE_MAX_VARIABLE_NUMBER
+  const size_t chunk_size = 500;
+  std::map<std::string, std::pair<CMutableTransaction, int>> prev_txs;
+  std::vector<std::string> ids(tx_ids.begin(), tx_ids.end());
+  for (size_t begin = 0; begin < ids.size(); begin += chunk_size) {
+    size_t end = std::min(ids.size(), begin + chunk_size);
+    std::string sql = "SELECT ID, VALUE, HEIGHT FROM VTX WHERE ID IN (?";
+    for (size_t i = begin + 1; i < end; i++) sql += ",?";
+    sql += ");";
+
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+    for (size_t i = begin; i < end; i++) {
+      sqlite3_bind_text(stmt, i - begin + 1, ids[i].c_str(), ids[i].size(),
+                        NULL);
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      std::string tx_id = std::string((char*)sqlite3_column_text(stmt, 0));
+      std::string value = std::string((char*)sqlite3_column_text(stmt, 1));
+      int height = sqlite3_column_int(stmt, 2);
+      auto mtx = height == -1 ? DecodePsbt(value).tx.get()
+                              : DecodeRawTransaction(value);
+      prev_txs[tx_id] = {mtx, height};
+    }
+    SQLCHECK(sqlite3_finalize(stmt));
+  }
+
+  std::vector<UnspentOutput> rs;
+  for (auto&& input : inputs) {
+    auto prev_tx = prev_txs.find(input.first);
+    if (prev_tx == prev_txs.end() || input.second < 0 ||
+        size_t(input.second) >= prev_tx->second.first.vout.size()) {
+      throw StorageException(StorageException::TX_NOT_FOUND,
+                             "input not found!");
+    }
+    auto& output = prev_tx->second.first.vout[input.second];
+    UnspentOutput utxo;
+    utxo.set_txid(input.first);
+    utxo.set_vout(input.second);
+    utxo.set_address(ScriptPubKeyToAddress(output.scriptPubKey));
+    utxo.set_amount(output.nValue);
+    utxo.set_height(prev_tx->second.second);
+    rs.push_back(utxo);
+  }
+  return rs;
+}
+
 std::vector<Transaction> NunchukWalletDb::GetTransactions(int count,
                                                           int skip) const {
   sqlite3_stmt* stmt;
@@ -844,14 +1609,10 @@ std::vector<Transaction> NunchukWalletDb::GetTransactions(int count,
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
   sqlite3_step(stmt);
 
-  auto utxos = GetUnspentOutputs(false);
-  auto is_valid_input = [utxos](const TxInput& input) {
-    for (auto&& utxo : utxos) {
-      if (input.first == utxo.get_txid() && input.second == utxo.get_vout())
-        return true;
-    }
-    return false;
-  };
+  std::set<TxInput> utxos;
+  for (auto&& utxo : GetUnspentOutputs(false)) {
+    utxos.insert({utxo.get_txid(), utxo.get_vout()});
+  }
 
   std::vector<Transaction> rs;
   while (sqlite3_column_text(stmt, 0)) {
@@ -873,8 +1634,8 @@ std::vector<Transaction> NunchukWalletDb::GetTransactions(int count,
     if (height == -1) {
       // remove invalid, out-of-date Send transactions
       bool is_valid = true;
-      for (auto&& input : tx.get_inputs()) {
-        if (!is_valid_input(input)) {
+      for (size_t i = 0; i < tx.get_input_count(); i++) {
+        if (!utxos.count({tx.get_input_txid(i), tx.get_input_vout(i)})) {
           is_valid = false;
           break;
         }
@@ -911,9 +1672,6 @@ std::vector<Transaction> NunchukWalletDb::GetTransactions(int count,
 }
 
 std::string NunchukWalletDb::FillPsbt(const std::string& base64_psbt) {
-  auto psbt = DecodePsbt(base64_psbt);
-  if (!psbt.tx.has_value()) return base64_psbt;
-
   FlatSigningProvider provider;
   std::string internal_desc = GetDescriptor(true);
   std::string external_desc = GetDescriptor(false);
@@ -923,6 +1681,13 @@ std::string NunchukWalletDb::FillPsbt(const std::string& base64_psbt) {
   for (size_t i = 0; i < descs.size(); ++i) {
     EvalDescriptorStringOrObject(descs[i], provider);
   }
+  return FillPsbt(base64_psbt, provider);
+}
+
+std::string NunchukWalletDb::FillPsbt(const std::string& base64_psbt,
+                                      const FlatSigningProvider& provider) {
+  auto psbt = DecodePsbt(base64_psbt);
+  if (!psbt.tx.has_value()) return base64_psbt;
 
   int nin = psbt.tx.get().vin.size();
   for (int i = 0; i < nin; i++) {
@@ -952,15 +1717,18 @@ void NunchukWalletDb::FillExtra(const std::string& extra,
   if (!extra.empty()) {
     json extra_json = json::parse(extra);
     if (extra_json["signers"] != nullptr && tx.get_height() >= 0) {
-      for (auto&& signer : tx.get_signers()) {
-        tx.set_signer(signer.first, extra_json["signers"][signer.first]);
+      // set_signer only updates existing signers, indexes stay valid
+      for (size_t i = 0; i < tx.get_signer_count(); i++) {
+        const std::string& id = tx.get_signer_id(i);
+        tx.set_signer(id, extra_json["signers"][id]);
       }
     }
     if (extra_json["outputs"] != nullptr) {
-      for (auto&& output : tx.get_outputs()) {
-        auto amount = extra_json["outputs"][output.first];
+      for (size_t i = 0; i < tx.get_output_count(); i++) {
+        const std::string& address = tx.get_output_address(i);
+        auto amount = extra_json["outputs"][address];
         if (amount != nullptr) {
-          tx.add_user_output({output.first, Amount(amount)});
+          tx.add_user_output({address, Amount(amount)});
         }
       }
     }
@@ -980,34 +1748,40 @@ void NunchukWalletDb::FillExtra(const std::string& extra,
 
 // TODO (bakaoh): consider persisting these data
 void NunchukWalletDb::FillSendReceiveData(Transaction& tx) {
-  auto addresses = GetAllAddresses();
-  auto is_my_address = [addresses](std::string address) {
-    return (std::find(addresses.begin(), addresses.end(), address) !=
-            addresses.end());
+  FillSendReceiveData(tx, GetAllAddressSet());
+}
+
+void NunchukWalletDb::FillSendReceiveData(
+    Transaction& tx, const std::unordered_set<std::string>& addresses) const {
+  auto is_my_address = [&addresses](const std::string& address) {
+    return addresses.count(address) != 0;
   };
-  auto input = tx.get_inputs()[0];
-  TxOutput prev_out;
+  std::string address;
   try {
-    prev_out = GetTransaction(input.first).get_outputs()[input.second];
+    auto prev_tx = GetTransaction(tx.get_input_txid(0));
+    size_t vout = tx.get_input_vout(0);
+    if (vout < prev_tx.get_output_count()) {
+      address = prev_tx.get_output_address(vout);
+    }
   } catch (StorageException& se) {
     if (se.code() != StorageException::TX_NOT_FOUND) throw;
   }
-  auto address = prev_out.first;
   if (is_my_address(address)) {
     Amount send_amount(tx.get_fee());
-    for (auto&& output : tx.get_outputs()) {
-      if (!is_my_address(output.first)) {
-        send_amount += output.second;
+    for (size_t i = 0; i < tx.get_output_count(); i++) {
+      if (!is_my_address(tx.get_output_address(i))) {
+        send_amount += tx.get_output_amount(i);
       }
     }
     tx.set_receive(false);
     tx.set_sub_amount(send_amount);
   } else {
     Amount receive_amount{0};
-    for (auto&& output : tx.get_outputs()) {
-      if (is_my_address(output.first)) {
-        receive_amount += output.second;
-        tx.add_receive_output(output);
+    for (size_t i = 0; i < tx.get_output_count(); i++) {
+      if (is_my_address(tx.get_output_address(i))) {
+        receive_amount += tx.get_output_amount(i);
+        tx.add_receive_output(
+            {tx.get_output_address(i), tx.get_output_amount(i)});
       }
     }
     tx.set_receive(true);
@@ -1155,6 +1929,14 @@ bool NunchukAppStateDb::SetChainTip(int value) {
   return PutInt(DbKeys::CHAIN_TIP, value);
 }
 
+std::string NunchukAppStateDb::GetWalletSnapshot() const {
+  return GetString(DbKeys::WALLET_SNAPSHOT);
+}
+
+bool NunchukAppStateDb::SetWalletSnapshot(const std::string& value) {
+  return PutString(DbKeys::WALLET_SNAPSHOT, value);
+}
+
 std::string NunchukAppStateDb::GetSelectedWallet() const {
   return GetString(DbKeys::SELECTED_WALLET);
 }
@@ -1215,11 +1997,13 @@ fs::path NunchukStorage::GetDefaultDataDir() const {
 
 bool NunchukStorage::WriteFile(const std::string& file_path,
                                const std::string& value) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   fs::save_string_file(fs::system_complete(file_path), value);
   return true;
 }
 
 std::string NunchukStorage::LoadFile(const std::string& file_path) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   std::string value;
   fs::load_string_file(fs::system_complete(file_path), value);
   return value;
@@ -1228,6 +2012,7 @@ std::string NunchukStorage::LoadFile(const std::string& file_path) {
 bool NunchukStorage::ExportWallet(Chain chain, const std::string& wallet_id,
                                   const std::string& file_path,
                                   ExportFormat format) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   auto wallet_db = GetWalletDb(chain, wallet_id);
   switch (format) {
@@ -1256,20 +2041,188 @@ bool NunchukStorage::ExportWallet(Chain chain, const std::string& wallet_id,
 
 std::string NunchukStorage::ImportWalletDb(Chain chain,
                                            const std::string& file_path) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   auto wallet_db = NunchukWalletDb{chain, "", file_path, ""};
-  std::string id = wallet_db.GetId();
+  return ImportWallet(chain, wallet_db);
+}
+
+std::string NunchukStorage::ImportWallet(Chain chain, NunchukDb& db) {
+  std::string id = db.GetId();
   auto wallet_file = GetWalletDir(chain, id);
   if (fs::exists(wallet_file)) {
     throw StorageException(StorageException::WALLET_EXISTED, "wallet existed!");
   }
-  wallet_db.EncryptDb(wallet_file.string(), passphrase_);
+  db.EncryptDb(wallet_file.string(), passphrase_);
   return id;
 }
 
+bool NunchukStorage::BackupWallet(Chain chain, const std::string& wallet_id,
+                                  const std::string& file_path,
+                                  const std::string& passphrase) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  auto wallet_db = [&]() {
+    boost::shared_lock<boost::shared_mutex> lock(access_);
+    return GetWalletDb(chain, wallet_id);
+  }();
+  // Consistent copy first, keyed like the wallet, then decrypted in memory
+  // for compression and streamed out
+  auto snapshot_file =
+      (datadir_ / "tmp" / fs::unique_path("backup-%%%%%%%%")).string();
+  int64_t seq = 0;
+  auto cleanup = [&]() {
+    boost::system::error_code ec;
+    fs::remove(snapshot_file, ec);
+  };
+  try {
+    std::string image;
+    {
+      NunchukDb snapshot{chain, wallet_id, snapshot_file, passphrase_};
+      wallet_db.CopyTo(snapshot);
+      // Base for BackupWalletDelta, in the backup too so a restored wallet
+      // takes deltas from where it was backed up
+      seq = snapshot.GetInt(DbKeys::CHANGE_SEQ);
+      snapshot.PutString(DbKeys::LAST_BACKUP_SEQ, std::to_string(seq));
+      image = snapshot.ExportImage();
+    }
+    cleanup();
+    std::ofstream out(file_path, std::ios::binary | std::ios::trunc);
+    BackupWriter writer(out, passphrase);
+    for (size_t offset = 0; offset < image.size();
+         offset += BackupWriter::DEFAULT_CHUNK_SIZE) {
+      writer.Write(image.data() + offset,
+                   std::min(image.size() - offset,
+                            BackupWriter::DEFAULT_CHUNK_SIZE));
+    }
+    writer.Finish();
+    bool rs = out.good();
+    if (rs) {
+      boost::unique_lock<boost::shared_mutex> lock(access_);
+      wallet_db.PutString(DbKeys::LAST_BACKUP_SEQ, std::to_string(seq));
+    }
+    return rs;
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+}
+
+std::string NunchukStorage::RestoreWallet(Chain chain,
+                                          const std::string& file_path,
+                                          const std::string& passphrase) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  std::ifstream in(file_path, std::ios::binary);
+  if (!in) {
+    throw StorageException(StorageException::INVALID_BACKUP,
+                           "backup not found!");
+  }
+  BackupReader reader(in, passphrase);
+  // Partial restores are named after the backup, so a retry finds its own
+  auto partial_file =
+      (datadir_ / "tmp" / ("restore-" + reader.GetId())).string();
+  auto open_partial = [&]() {
+    NunchukRestoreDb partial{chain, "", partial_file, passphrase_};
+    partial.Init();
+    return partial;
+  };
+  std::unique_ptr<NunchukRestoreDb> partial;
+  try {
+    partial.reset(new NunchukRestoreDb(open_partial()));
+  } catch (NunchukException& ne) {
+    // Left by a restore under another storage passphrase, start over
+    if (ne.code() != NunchukException::INVALID_PASSPHRASE) throw;
+    fs::remove(partial_file);
+    partial.reset(new NunchukRestoreDb(open_partial()));
+  }
+  uint32_t records = 0;
+  uint64_t bytes = 0;
+  partial->GetProgress(records, bytes);
+  if (records > 0) reader.Skip(records, bytes);
+  std::string chunk;
+  while (reader.Next(chunk)) partial->AddChunk(chunk);
+
+  auto cleanup = [&]() {
+    partial.reset();
+    boost::system::error_code ec;
+    fs::remove(partial_file, ec);
+  };
+  try {
+    NunchukWalletDb wallet_db{chain, "", ":memory:", ""};
+    wallet_db.ImportImage(partial->GetImage());
+    boost::unique_lock<boost::shared_mutex> lock(access_);
+    std::string id = ImportWallet(chain, wallet_db);
+    lock.unlock();
+    cleanup();
+    return id;
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+}
+
+bool NunchukStorage::BackupWalletDelta(Chain chain,
+                                       const std::string& wallet_id,
+                                       const std::string& file_path,
+                                       const std::string& passphrase) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  int64_t seq;
+  std::string delta;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(access_);
+    auto wallet_db = GetWalletDb(chain, wallet_id);
+    std::string base = wallet_db.GetString(DbKeys::LAST_BACKUP_SEQ);
+    if (base.empty()) {
+      throw StorageException(StorageException::INVALID_BACKUP,
+                             "wallet has no full backup!");
+    }
+    delta = wallet_db.ExportDelta(std::stoll(base), seq);
+  }
+  std::ofstream out(file_path, std::ios::binary | std::ios::trunc);
+  BackupWriter writer(out, passphrase);
+  writer.Write(delta.data(), delta.size());
+  writer.Finish();
+  if (!out.good()) return false;
+  boost::unique_lock<boost::shared_mutex> lock(access_);
+  GetWalletDb(chain, wallet_id)
+      .PutString(DbKeys::LAST_BACKUP_SEQ, std::to_string(seq));
+  return true;
+}
+
+std::string NunchukStorage::ApplyWalletDelta(Chain chain,
+                                             const std::string& file_path,
+                                             const std::string& passphrase) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  std::ifstream in(file_path, std::ios::binary);
+  if (!in) {
+    throw StorageException(StorageException::INVALID_BACKUP,
+                           "backup not found!");
+  }
+  BackupReader reader(in, passphrase);
+  std::string delta;
+  std::string chunk;
+  while (reader.Next(chunk)) delta += chunk;
+  std::string wallet_id;
+  try {
+    json value = json::parse(delta);
+    if (value.value("format", "") == "nunchuk-wallet-delta") {
+      wallet_id = value.value("wallet_id", "");
+    }
+  } catch (json::exception&) {
+  }
+  if (wallet_id.empty()) {
+    throw StorageException(StorageException::INVALID_BACKUP,
+                           "not a wallet delta!");
+  }
+  boost::unique_lock<boost::shared_mutex> lock(access_);
+  GetWalletDb(chain, wallet_id).ApplyDelta(delta);
+  Invalidate(chain, wallet_id, WalletCache::ALL);
+  return wallet_id;
+}
+
 NunchukStorage::NunchukStorage(const std::string& datadir,
                                const std::string& passphrase)
     : passphrase_(passphrase) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   if (!datadir.empty()) {
     datadir_ = fs::system_complete(datadir);
     if (!fs::is_directory(datadir_)) {
@@ -1292,6 +2245,7 @@ NunchukStorage::NunchukStorage(const std::string& datadir,
 }
 
 void NunchukStorage::SetPassphrase(Chain chain, const std::string& value) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   if (value == passphrase_) {
     throw NunchukException(NunchukException::PASSPHRASE_ALREADY_USED,
                            "passphrase used");
@@ -1337,6 +2291,8 @@ void NunchukStorage::SetPassphrase(Chain chain, const std::string& value) {
       GetSignerDb(chain, signer_id).ReKey(value);
     }
   }
+  // The snapshot is only a cache, SaveSnapshot rewrites it with the new key
+  fs::remove(GetSnapshotDir(chain));
 
   passphrase_ = value;
 }
@@ -1364,18 +2320,92 @@ fs::path NunchukStorage::GetAppStateDir(Chain chain) const {
   return datadir_ / ChainStr(chain) / "state";
 }
 
+fs::path NunchukStorage::GetSnapshotDir(Chain chain) const {
+  return datadir_ / ChainStr(chain) / "snapshot";
+}
+
+void NunchukRestoreDb::Init() {
+  SQLCHECK(sqlite3_exec(db_,
+                        "CREATE TABLE IF NOT EXISTS CHUNK("
+                        "IDX INTEGER PRIMARY KEY NOT NULL,"
+                        "DATA BLOB NOT NULL);",
+                        NULL, 0, NULL));
+}
+
+void NunchukRestoreDb::AddChunk(const std::string& chunk) {
+  sqlite3_stmt* stmt;
+  std::string sql =
+      "INSERT INTO CHUNK(IDX, DATA) "
+      "VALUES ((SELECT COUNT(*) FROM CHUNK), ?);";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_bind_blob(stmt, 1, chunk.data(), chunk.size(), NULL);
+  int rc = sqlite3_step(stmt);
+  SQLCHECK(sqlite3_finalize(stmt));
+  if (rc != SQLITE_DONE) {
+    throw StorageException(StorageException::INVALID_DATADIR,
+                           "can not write restore file!");
+  }
+}
+
+void NunchukRestoreDb::GetProgress(uint32_t& records, uint64_t& bytes) const {
+  sqlite3_stmt* stmt;
+  std::string sql = "SELECT COUNT(*), TOTAL(LENGTH(DATA)) FROM CHUNK;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  sqlite3_step(stmt);
+  records = sqlite3_column_int(stmt, 0);
+  bytes = sqlite3_column_int64(stmt, 1);
+  SQLCHECK(sqlite3_finalize(stmt));
+}
+
+std::string NunchukRestoreDb::GetImage() const {
+  sqlite3_stmt* stmt;
+  std::string sql = "SELECT DATA FROM CHUNK ORDER BY IDX;";
+  sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
+  std::string rs;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    rs.append(static_cast<const char*>(sqlite3_column_blob(stmt, 0)),
+              sqlite3_column_bytes(stmt, 0));
+  }
+  SQLCHECK(sqlite3_finalize(stmt));
+  return rs;
+}
+
 NunchukWalletDb NunchukStorage::GetWalletDb(Chain chain,
                                             const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_storage_open_seconds", {{"db", "wallet"}}));
   fs::path db_file = GetWalletDir(chain, id);
   if (!fs::exists(db_file)) {
     throw StorageException(StorageException::WALLET_NOT_FOUND,
                            "wallet not exists!");
   }
-  return NunchukWalletDb{chain, id, db_file.string(), passphrase_};
+  NunchukWalletDb db{chain, id, db_file.string(), passphrase_};
+  // Readers may get here concurrently under the shared lock
+  auto migration = GetMigration(chain, id);
+  if (!migration->done) {
+    std::lock_guard<std::mutex> lock(migration->mutex);
+    if (!migration->done) {
+      db.MaybeMigrate();
+      migration->done = true;
+    }
+  }
+  return db;
+}
+
+std::shared_ptr<NunchukStorage::Migration> NunchukStorage::GetMigration(
+    Chain chain, const std::string& id) {
+  std::lock_guard<std::mutex> lock(migrate_mutex_);
+  auto& entry = migrated_wallets_[{chain, id}];
+  if (!entry) entry = std::make_shared<Migration>();
+  return entry;
 }
 
 NunchukSignerDb NunchukStorage::GetSignerDb(Chain chain,
                                             const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_storage_open_seconds", {{"db", "signer"}}));
   fs::path db_file = GetSignerDir(chain, id);
   if (!fs::exists(db_file)) {
     throw StorageException(StorageException::MASTERSIGNER_NOT_FOUND,
@@ -1385,6 +2415,9 @@ NunchukSignerDb NunchukStorage::GetSignerDb(Chain chain,
 }
 
 NunchukAppStateDb NunchukStorage::GetAppStateDb(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_storage_open_seconds", {{"db", "state"}}));
   fs::path db_file = GetAppStateDir(chain);
   bool is_new = !fs::exists(db_file);
   auto db = NunchukAppStateDb{chain, "", db_file.string(), ""};
@@ -1392,11 +2425,23 @@ NunchukAppStateDb NunchukStorage::GetAppStateDb(Chain chain) {
   return db;
 }
 
+NunchukAppStateDb NunchukStorage::GetSnapshotDb(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_storage_open_seconds", {{"db", "snapshot"}}));
+  fs::path db_file = GetSnapshotDir(chain);
+  bool is_new = !fs::exists(db_file);
+  auto db = NunchukAppStateDb{chain, "", db_file.string(), passphrase_};
+  if (is_new) db.Init();
+  return db;
+}
+
 Wallet NunchukStorage::CreateWallet(Chain chain, const std::string& name, int m,
                                     int n,
                                     const std::vector<SingleSigner>& signers,
                                     AddressType address_type, bool is_escrow,
                                     const std::string& description) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   WalletType wallet_type =
       n == 1 ? WalletType::SINGLE_SIG
@@ -1433,7 +2478,9 @@ Wallet NunchukStorage::CreateWallet(Chain chain, const std::string& name, int m,
 std::string NunchukStorage::CreateMasterSigner(Chain chain,
                                                const std::string& name,
                                                const std::string& fingerprint) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  InvalidateAll(WalletCache::WALLET);
   std::string id = fingerprint;
   NunchukSignerDb signer_db{chain, id, GetSignerDir(chain, id).string(),
                             passphrase_};
@@ -1444,6 +2491,7 @@ std::string NunchukStorage::CreateMasterSigner(Chain chain,
 SingleSigner NunchukStorage::GetSignerFromMasterSigner(
     Chain chain, const std::string& mastersigner_id,
     const WalletType& wallet_type, const AddressType& address_type, int index) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   auto signer_db = GetSignerDb(chain, mastersigner_id);
   std::string path = GetBip32Path(chain, wallet_type, address_type, index);
@@ -1455,6 +2503,7 @@ SingleSigner NunchukStorage::GetSignerFromMasterSigner(
 
 std::vector<SingleSigner> NunchukStorage::GetSignersFromMasterSigner(
     Chain chain, const std::string& mastersigner_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id).GetSingleSigners();
 }
@@ -1463,6 +2512,7 @@ bool NunchukStorage::CacheMasterSignerXPub(Chain chain,
                                            const std::string& mastersigner_id,
                                            const std::string& path,
                                            const std::string& xpub) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id).AddXPub(path, xpub, "custom");
 }
@@ -1472,6 +2522,7 @@ bool NunchukStorage::CacheMasterSignerXPub(Chain chain,
                                            const WalletType& wallet_type,
                                            const AddressType& address_type,
                                            int index, const std::string& xpub) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id)
       .AddXPub(wallet_type, address_type, index, xpub);
@@ -1480,6 +2531,7 @@ bool NunchukStorage::CacheMasterSignerXPub(Chain chain,
 int NunchukStorage::GetCurrentIndexFromMasterSigner(
     Chain chain, const std::string& mastersigner_id,
     const WalletType& wallet_type, const AddressType& address_type) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id)
       .GetUnusedIndex(wallet_type, address_type);
@@ -1488,6 +2540,7 @@ int NunchukStorage::GetCurrentIndexFromMasterSigner(
 int NunchukStorage::GetCachedIndexFromMasterSigner(
     Chain chain, const std::string& mastersigner_id,
     const WalletType& wallet_type, const AddressType& address_type) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id)
       .GetCachedIndex(wallet_type, address_type);
@@ -1495,11 +2548,13 @@ int NunchukStorage::GetCachedIndexFromMasterSigner(
 
 std::string NunchukStorage::GetMasterSignerXPub(
     Chain chain, const std::string& mastersigner_id, const std::string& path) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetSignerDb(chain, mastersigner_id).GetXpub(path);
 }
 
 std::vector<std::string> NunchukStorage::ListWallets(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   fs::path directory = (datadir_ / ChainStr(chain) / "wallets");
   std::vector<std::string> ids;
@@ -1510,6 +2565,7 @@ std::vector<std::string> NunchukStorage::ListWallets(Chain chain) {
 }
 
 std::vector<std::string> NunchukStorage::ListMasterSigners(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   fs::path directory = (datadir_ / ChainStr(chain) / "signers");
   std::vector<std::string> ids;
@@ -1520,13 +2576,26 @@ std::vector<std::string> NunchukStorage::ListMasterSigners(Chain chain) {
 }
 
 Wallet NunchukStorage::GetWallet(Chain chain, const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
+  if (auto cached = cache_.GetWallet(chain, id)) return *cached;
+  Wallet wallet = ReadWallet(chain, id);
+  cache_.PutWallet(chain, id, wallet);
+  return wallet;
+}
+
+Wallet NunchukStorage::ReadWallet(Chain chain, const std::string& id) {
   auto wallet_db = GetWalletDb(chain, id);
   Wallet wallet = wallet_db.GetWallet();
   std::vector<SingleSigner> signers;
 
+  {
+    std::lock_guard<std::mutex> single_lock(single_wallet_mutex_);
+    for (auto&& signer : wallet.get_signers()) {
+      single_wallet_[NunchukWalletDb::GetSingleSignerKey(signer)] = id;
+    }
+  }
   for (auto&& signer : wallet.get_signers()) {
-    single_wallet_[NunchukWalletDb::GetSingleSignerKey(signer)] = id;
     std::string name = signer.get_name();
     std::string master_id = signer.get_master_fingerprint();
     time_t last_health_check = signer.get_last_health_check();
@@ -1545,18 +2614,25 @@ Wallet NunchukStorage::GetWallet(Chain chain, const std::string& id) {
                              signer.get_derivation_path(),
                              signer.get_master_fingerprint(), last_health_check,
                              master_id);
-    signers.push_back(true_signer);
+    signers.push_back(std::move(true_signer));
   }
-  Wallet true_wallet(id, wallet.get_m(), wallet.get_n(), signers,
+  Wallet true_wallet(id, wallet.get_m(), wallet.get_n(), std::move(signers),
                      wallet.get_address_type(), wallet.is_escrow(),
                      wallet.get_create_date());
   true_wallet.set_name(wallet.get_name());
   true_wallet.set_balance(wallet.get_balance());
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+  true_wallet.set_stale(synced_wallets_.count({chain, id}) == 0);
+  if (snapshot_enabled_) {
+    snapshot_[{chain, id}] = WalletToJson(true_wallet).dump();
+    snapshot_dirty_.erase({chain, id});
+  }
   return true_wallet;
 }
 
 MasterSigner NunchukStorage::GetMasterSigner(Chain chain,
                                              const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   auto signer_db = GetSignerDb(chain, id);
   MasterSigner signer{id, Device(signer_db.GetFingerprint()),
@@ -1566,41 +2642,68 @@ MasterSigner NunchukStorage::GetMasterSigner(Chain chain,
 }
 
 bool NunchukStorage::UpdateWallet(Chain chain, Wallet& wallet) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet.get_id(), WalletCache::WALLET);
   auto wallet_db = GetWalletDb(chain, wallet.get_id());
   return wallet_db.SetName(wallet.get_name()) &&
          wallet_db.SetDescription(wallet.get_description());
 }
 
 bool NunchukStorage::UpdateMasterSigner(Chain chain, MasterSigner& signer) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  // Wallets show the master signer names
+  InvalidateAll(WalletCache::WALLET);
   return GetSignerDb(chain, signer.get_id()).SetName(signer.get_name());
 }
 
 bool NunchukStorage::DeleteWallet(Chain chain, const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, id, WalletCache::ALL);
   GetWalletDb(chain, id).DeleteWallet();
+  {
+    // A wallet imported later with this id may be on an older schema
+    std::lock_guard<std::mutex> migrate_lock(migrate_mutex_);
+    migrated_wallets_.erase({chain, id});
+  }
+  {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    snapshot_.erase({chain, id});
+    snapshot_dirty_.erase({chain, id});
+  }
   return fs::remove(GetWalletDir(chain, id));
 }
 
 bool NunchukStorage::DeleteMasterSigner(Chain chain, const std::string& id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  InvalidateAll(WalletCache::WALLET);
   GetSignerDb(chain, id).DeleteSigner();
   return fs::remove(GetSignerDir(chain, id));
 }
 
 bool NunchukStorage::SetHealthCheckSuccess(Chain chain,
                                            const std::string& mastersigner_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  InvalidateAll(WalletCache::WALLET);
   return GetSignerDb(chain, mastersigner_id).SetLastHealthCheck(std::time(0));
 }
 
 bool NunchukStorage::SetHealthCheckSuccess(Chain chain,
                                            const SingleSigner& signer) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
-  std::string signer_key = NunchukWalletDb::GetSingleSignerKey(signer);
-  if (single_wallet_.find(signer_key) == single_wallet_.end()) return false;
-  std::string wallet_id = single_wallet_[signer_key];
+  std::string wallet_id;
+  {
+    std::lock_guard<std::mutex> single_lock(single_wallet_mutex_);
+    auto it = single_wallet_.find(NunchukWalletDb::GetSingleSignerKey(signer));
+    if (it == single_wallet_.end()) return false;
+    wallet_id = it->second;
+  }
+  Invalidate(chain, wallet_id, WalletCache::WALLET);
   return GetWalletDb(chain, wallet_id)
       .SetSignerLastHealthCheck(signer, std::time(0));
 }
@@ -1608,6 +2711,7 @@ bool NunchukStorage::SetHealthCheckSuccess(Chain chain,
 std::string NunchukStorage::GetDescriptor(Chain chain,
                                           const std::string& wallet_id,
                                           bool internal) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetWalletDb(chain, wallet_id).GetDescriptor(internal);
 }
@@ -1615,31 +2719,51 @@ std::string NunchukStorage::GetDescriptor(Chain chain,
 bool NunchukStorage::AddAddress(Chain chain, const std::string& wallet_id,
                                 const std::string& address, int index,
                                 bool internal) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  // Send/receive amounts of the history depend on the wallet addresses
+  Invalidate(chain, wallet_id,
+              WalletCache::ADDRESSES | WalletCache::TRANSACTIONS |
+                  WalletCache::BALANCE | WalletCache::WALLET);
   return GetWalletDb(chain, wallet_id).AddAddress(address, index, internal);
 }
 
 bool NunchukStorage::UseAddress(Chain chain, const std::string& wallet_id,
                                 const std::string& address) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id,
+              WalletCache::ADDRESSES | WalletCache::BALANCE |
+                  WalletCache::WALLET);
   return GetWalletDb(chain, wallet_id).UseAddress(address);
 }
 
 std::vector<std::string> NunchukStorage::GetAddresses(
     Chain chain, const std::string& wallet_id, bool used, bool internal) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
-  return GetWalletDb(chain, wallet_id).GetAddresses(used, internal);
+  if (auto cached = cache_.GetAddresses(chain, wallet_id, used, internal)) {
+    return *cached;
+  }
+  auto rs = GetWalletDb(chain, wallet_id).GetAddresses(used, internal);
+  cache_.PutAddresses(chain, wallet_id, used, internal, rs);
+  return rs;
 }
 
 std::vector<std::string> NunchukStorage::GetAllAddresses(
     Chain chain, const std::string& wallet_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
-  return GetWalletDb(chain, wallet_id).GetAllAddresses();
+  if (auto cached = cache_.GetAllAddresses(chain, wallet_id)) return *cached;
+  auto rs = GetWalletDb(chain, wallet_id).GetAllAddresses();
+  cache_.PutAllAddresses(chain, wallet_id, rs);
+  return rs;
 }
 
 int NunchukStorage::GetCurrentAddressIndex(Chain chain,
                                            const std::string& wallet_id,
                                            bool internal) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetWalletDb(chain, wallet_id).GetCurrentAddressIndex(internal);
 }
@@ -1648,31 +2772,70 @@ Transaction NunchukStorage::InsertTransaction(
     Chain chain, const std::string& wallet_id, const std::string& raw_tx,
     int height, time_t blocktime, Amount fee, const std::string& memo,
     int change_pos) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::ALL);
   return GetWalletDb(chain, wallet_id)
       .InsertTransaction(raw_tx, height, blocktime, fee, memo, change_pos);
 }
 
 std::vector<Transaction> NunchukStorage::GetTransactions(
     Chain chain, const std::string& wallet_id, int count, int skip) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
+  if (auto cached = cache_.GetTransactions(chain, wallet_id, count, skip)) {
+    return *cached;
+  }
   auto db = GetWalletDb(chain, wallet_id);
   auto vtx = db.GetTransactions(count, skip);
+  auto addresses = db.GetAllAddressSet();
   for (auto&& tx : vtx) {
-    db.FillSendReceiveData(tx);
+    db.FillSendReceiveData(tx, addresses);
   }
+  cache_.PutTransactions(chain, wallet_id, count, skip, vtx);
   return vtx;
 }
 
+std::vector<BalancePoint> NunchukStorage::GetBalanceHistory(
+    Chain chain, const std::string& wallet_id, int max_points) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  auto db = GetWalletDb(chain, wallet_id);
+  auto migration = GetMigration(chain, wallet_id);
+  if (!migration->balance_ready) {
+    std::lock_guard<std::mutex> guard(migration->mutex);
+    while (!db.BackfillTxBalance(TXBALANCE_BACKFILL_BATCH)) {
+    }
+    migration->balance_ready = true;
+  }
+  return db.GetBalanceHistory(max_points);
+}
+
 std::vector<UnspentOutput> NunchukStorage::GetUnspentOutputs(
     Chain chain, const std::string& wallet_id, bool remove_locked) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
-  return GetWalletDb(chain, wallet_id).GetUnspentOutputs(remove_locked);
+  if (auto cached =
+          cache_.GetUnspentOutputs(chain, wallet_id, remove_locked)) {
+    return *cached;
+  }
+  auto rs = GetWalletDb(chain, wallet_id).GetUnspentOutputs(remove_locked);
+  cache_.PutUnspentOutputs(chain, wallet_id, remove_locked, rs);
+  return rs;
+}
+
+std::vector<UnspentOutput> NunchukStorage::GetUnspentOutputsFromTxInputs(
+    Chain chain, const std::string& wallet_id,
+    const std::vector<TxInput>& inputs) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  return GetWalletDb(chain, wallet_id).GetUnspentOutputsFromTxInputs(inputs);
 }
 
 Transaction NunchukStorage::GetTransaction(Chain chain,
                                            const std::string& wallet_id,
                                            const std::string& tx_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   auto db = GetWalletDb(chain, wallet_id);
   auto tx = db.GetTransaction(tx_id);
@@ -1685,7 +2848,9 @@ bool NunchukStorage::UpdateTransaction(Chain chain,
                                        const std::string& raw_tx, int height,
                                        time_t blocktime,
                                        const std::string& reject_msg) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::ALL);
   return GetWalletDb(chain, wallet_id)
       .UpdateTransaction(raw_tx, height, blocktime, reject_msg);
 }
@@ -1694,14 +2859,18 @@ bool NunchukStorage::UpdateTransactionMemo(Chain chain,
                                            const std::string& wallet_id,
                                            const std::string& tx_id,
                                            const std::string& memo) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::TRANSACTIONS);
   return GetWalletDb(chain, wallet_id).UpdateTransactionMemo(tx_id, memo);
 }
 
 bool NunchukStorage::DeleteTransaction(Chain chain,
                                        const std::string& wallet_id,
                                        const std::string& tx_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::ALL);
   return GetWalletDb(chain, wallet_id).DeleteTransaction(tx_id);
 }
 
@@ -1710,7 +2879,10 @@ Transaction NunchukStorage::CreatePsbt(
     Amount fee, const std::string& memo, int change_pos,
     const std::map<std::string, Amount>& outputs, Amount fee_rate,
     bool subtract_fee_from_amount, const std::string& replace_tx) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  // PSBTs do not lock coins until broadcast
+  Invalidate(chain, wallet_id, WalletCache::TRANSACTIONS);
   return GetWalletDb(chain, wallet_id)
       .CreatePsbt(psbt, fee, memo, change_pos, outputs, fee_rate,
                   subtract_fee_from_amount, replace_tx);
@@ -1718,19 +2890,24 @@ Transaction NunchukStorage::CreatePsbt(
 
 bool NunchukStorage::UpdatePsbt(Chain chain, const std::string& wallet_id,
                                 const std::string& psbt) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::TRANSACTIONS);
   return GetWalletDb(chain, wallet_id).UpdatePsbt(psbt);
 }
 
 bool NunchukStorage::UpdatePsbtTxId(Chain chain, const std::string& wallet_id,
                                     const std::string& old_id,
                                     const std::string& new_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id, WalletCache::TRANSACTIONS);
   return GetWalletDb(chain, wallet_id).UpdatePsbtTxId(old_id, new_id);
 }
 
 std::string NunchukStorage::GetPsbt(Chain chain, const std::string& wallet_id,
                                     const std::string& tx_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   return GetWalletDb(chain, wallet_id).GetPsbt(tx_id);
 }
@@ -1738,48 +2915,189 @@ std::string NunchukStorage::GetPsbt(Chain chain, const std::string& wallet_id,
 bool NunchukStorage::SetUtxos(Chain chain, const std::string& wallet_id,
                               const std::string& address,
                               const std::string& utxo) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
+  Invalidate(chain, wallet_id,
+              WalletCache::UTXOS | WalletCache::BALANCE | WalletCache::WALLET);
   return GetWalletDb(chain, wallet_id).SetUtxos(address, utxo);
 }
 
 Amount NunchukStorage::GetBalance(Chain chain, const std::string& wallet_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
-  return GetWalletDb(chain, wallet_id).GetBalance();
+  if (auto cached = cache_.GetBalance(chain, wallet_id)) return *cached;
+  Amount rs = GetWalletDb(chain, wallet_id).GetBalance();
+  cache_.PutBalance(chain, wallet_id, rs);
+  return rs;
 }
 std::string NunchukStorage::FillPsbt(Chain chain, const std::string& wallet_id,
                                      const std::string& psbt) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetWalletDb(chain, wallet_id).FillPsbt(psbt);
 }
 
-// non-reentrant function
-void NunchukStorage::MaybeMigrate(Chain chain) {
-  static std::once_flag flag;
-  std::call_once(flag, [&] {
-    auto wallets = ListWallets(chain);
-    boost::unique_lock<boost::shared_mutex> lock(access_);
-    for (auto&& wallet_id : wallets) {
-      GetWalletDb(chain, wallet_id).MaybeMigrate();
+std::string NunchukStorage::FillPsbt(Chain chain, const std::string& wallet_id,
+                                     const std::string& psbt,
+                                     const FlatSigningProvider& provider) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  return GetWalletDb(chain, wallet_id).FillPsbt(psbt, provider);
+}
+
+void NunchukStorage::GetCoinSelectionState(Chain chain,
+                                           const std::string& wallet_id,
+                                           bool is_escrow, bool load_utxos,
+                                           std::vector<UnspentOutput>& utxos,
+                                           std::string& change_address) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  auto wallet_db = GetWalletDb(chain, wallet_id);
+  if (load_utxos) utxos = wallet_db.GetUnspentOutputs(true);
+  // Escrow wallet uses the only address as change address
+  auto addresses = is_escrow ? wallet_db.GetAllAddresses()
+                             : wallet_db.GetAddresses(false, true);
+  change_address = addresses.empty() ? "" : addresses[0];
+}
+
+void NunchukStorage::SetWalletCacheSize(size_t bytes) {
+  cache_.SetBudget(bytes);
+}
+
+void NunchukStorage::LoadSnapshot(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::unique_lock<boost::shared_mutex> lock(access_);
+  {
+    // Versions before the snapshot db kept it in the plaintext app state
+    auto state_db = GetAppStateDb(chain);
+    if (!state_db.GetWalletSnapshot().empty()) {
+      state_db.SetWalletSnapshot("");
+      // Without the freed pages that still hold it
+      sqlite3_exec(state_db.db_, "VACUUM;", NULL, 0, NULL);
+    }
+  }
+  std::string value;
+  try {
+    value = GetSnapshotDb(chain).GetWalletSnapshot();
+  } catch (NunchukException& ne) {
+    if (ne.code() != NunchukException::INVALID_PASSPHRASE) throw;
+    // Keyed with another passphrase, start cold and overwrite it at save
+    NLOG_F(STORAGE, WARNING, "LoadSnapshot(): %s", ne.what());
+    fs::remove(GetSnapshotDir(chain));
+  }
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+  snapshot_enabled_ = true;
+  if (value.empty()) return;
+  for (auto&& item : json::parse(value)) {
+    Wallet wallet = WalletFromJson(item);
+    wallet.set_stale(true);
+    {
+      std::lock_guard<std::mutex> single_lock(single_wallet_mutex_);
+      for (auto&& signer : wallet.get_signers()) {
+        single_wallet_[NunchukWalletDb::GetSingleSignerKey(signer)] =
+            wallet.get_id();
+      }
+    }
+    snapshot_[{chain, wallet.get_id()}] = item.dump();
+    cache_.PutWallet(chain, wallet.get_id(), wallet);
+    cache_.PutBalance(chain, wallet.get_id(), wallet.get_balance());
+  }
+}
+
+void NunchukStorage::SaveSnapshot(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::unique_lock<boost::shared_mutex> lock(access_);
+  std::vector<std::string> dirty;
+  {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    for (auto&& i : snapshot_dirty_) {
+      if (i.first == chain) dirty.push_back(i.second);
+    }
+  }
+  // Refresh the wallets written since they were last read. One that can not
+  // be read keeps its previous entry
+  for (auto&& id : dirty) {
+    try {
+      ReadWallet(chain, id);
+    } catch (StorageException& se) {
+      NLOG_F(STORAGE, WARNING, "SaveSnapshot(): %s", se.what());
+    }
+  }
+  json wallets = json::array();
+  {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    for (auto&& i : snapshot_) {
+      if (i.first.first == chain) wallets.push_back(json::parse(i.second));
+    }
+  }
+  GetSnapshotDb(chain).SetWalletSnapshot(wallets.dump());
+}
+
+void NunchukStorage::SetWalletSynced(Chain chain,
+                                     const std::string& wallet_id) {
+  // Exclusive, so no reader caches the wallet as stale after this
+  boost::unique_lock<boost::shared_mutex> lock(access_);
+  {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    if (!synced_wallets_.insert({chain, wallet_id}).second) return;
+  }
+  Invalidate(chain, wallet_id, WalletCache::WALLET | WalletCache::BALANCE);
+}
+
+void NunchukStorage::Invalidate(Chain chain, const std::string& wallet_id,
+                                int parts) {
+  cache_.Invalidate(chain, wallet_id, parts);
+  if (parts & WalletCache::WALLET) {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    if (snapshot_.count({chain, wallet_id})) {
+      snapshot_dirty_.insert({chain, wallet_id});
     }
-  });
+  }
+}
+
+void NunchukStorage::InvalidateAll(int parts) {
+  cache_.InvalidateAll(parts);
+  if (parts & WalletCache::WALLET) {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    for (auto&& i : snapshot_) snapshot_dirty_.insert(i.first);
+  }
+}
+
+int64_t NunchukStorage::GetChangeSeq(Chain chain,
+                                     const std::string& wallet_id) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  return GetWalletDb(chain, wallet_id).GetChangeSeq();
+}
+
+WalletChanges NunchukStorage::GetChanges(Chain chain,
+                                         const std::string& wallet_id,
+                                         int64_t since_seq) {
+  NUNCHUK_TRACE_FUNCTION("storage");
+  boost::shared_lock<boost::shared_mutex> lock(access_);
+  return GetWalletDb(chain, wallet_id).GetChanges(since_seq);
 }
 
 int NunchukStorage::GetChainTip(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetAppStateDb(chain).GetChainTip();
 }
 
 bool NunchukStorage::SetChainTip(Chain chain, int value) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   return GetAppStateDb(chain).SetChainTip(value);
 }
 
 std::string NunchukStorage::GetSelectedWallet(Chain chain) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::shared_lock<boost::shared_mutex> lock(access_);
   return GetAppStateDb(chain).GetSelectedWallet();
 }
 
 bool NunchukStorage::SetSelectedWallet(Chain chain, const std::string& value) {
+  NUNCHUK_TRACE_FUNCTION("storage");
   boost::unique_lock<boost::shared_mutex> lock(access_);
   return GetAppStateDb(chain).SetSelectedWallet(value);
 }
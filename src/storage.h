@@ -5,7 +5,7 @@
 #ifndef NUNCHUK_STORAGE_H
 #define NUNCHUK_STORAGE_H
 #define SQLITE_HAS_CODEC
-#define STORAGE_VER 2
+#define STORAGE_VER 5
 #define HAVE_CONFIG_H
 #ifdef NDEBUG
 #undef NDEBUG
@@ -13,12 +13,20 @@
 
 #include <nunchuk.h>
 #include <sqlcipher/sqlite3.h>
+#include <walletcache.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <map>
+#include <set>
 #include <string>
+#include <unordered_set>
+
+struct FlatSigningProvider;
 
 namespace nunchuk {
 
@@ -33,13 +41,31 @@ const int VERSION = 7;
 const int DESCRIPTION = 8;
 const int CHAIN_TIP = 9;
 const int SELECTED_WALLET = 10;
+const int CHANGE_SEQ = 11;
+const int WALLET_SNAPSHOT = 12;
+// Change sequence of the last backup, empty if the wallet was never backed up
+const int LAST_BACKUP_SEQ = 13;
+// Set while TXBALANCE of a migrated wallet is being backfilled, with the
+// last VTX id backfilled so far
+const int TXBALANCE_PENDING = 14;
+const int TXBALANCE_CURSOR = 15;
 }  // namespace DbKeys
 
+// Kind of a CHANGELOG row. The key is the txid for TRANSACTION and the
+// address for ADDRESS and UTXO
+namespace ChangeKind {
+const int TRANSACTION = 0;
+const int ADDRESS = 1;
+const int UTXO = 2;
+}  // namespace ChangeKind
+
 class NunchukStorage;
 class NunchukDb {
  public:
   NunchukDb(Chain chain, const std::string &id, const std::string &file_name,
             const std::string &passphrase);
+  // Move only, the connection is closed by the last owner
+  NunchukDb(NunchukDb &&other);
   ~NunchukDb() { close(); }
   std::string GetId() const;
 
@@ -50,6 +76,27 @@ class NunchukDb {
   void EncryptDb(const std::string &new_file_name,
                  const std::string &new_passphrase);
   void DecryptDb(const std::string &new_file_name);
+  // Copy into dest with the online backup API, see BackupWallet
+  void CopyTo(NunchukDb &dest);
+  // Plaintext file image of the db. A keyed db is decrypted in memory, never
+  // to a file
+  std::string ExportImage();
+  // Replace the db with a plaintext file image. In-memory dbs only
+  void ImportImage(const std::string &image);
+  // Commits a write together with the change records it produces. Inside an
+  // already open transaction it joins that one instead
+  class WriteScope {
+   public:
+    explicit WriteScope(sqlite3 *db);
+    WriteScope(const WriteScope &) = delete;
+    WriteScope &operator=(const WriteScope &) = delete;
+    ~WriteScope();  // rolls back unless committed
+    void Commit();
+
+   private:
+    sqlite3 *db_;
+    bool owner_;
+  };
   bool PutString(int key, const std::string &value);
   bool PutInt(int key, int64_t value);
   std::string GetString(int key) const;
@@ -84,10 +131,11 @@ class NunchukWalletDb : public NunchukDb {
   bool SetSignerLastHealthCheck(const SingleSigner &signer, time_t value);
   bool AddAddress(const std::string &address, int index, bool internal);
   bool UseAddress(const std::string &address);
-  Wallet GetWallet() const;
+  Wallet GetWallet(bool include_balance = true) const;
   std::vector<SingleSigner> GetSigners() const;
   std::vector<std::string> GetAddresses(bool used, bool internal) const;
   std::vector<std::string> GetAllAddresses() const;
+  std::unordered_set<std::string> GetAllAddressSet() const;
   int GetCurrentAddressIndex(bool internal) const;
   Transaction InsertTransaction(const std::string &raw_tx, int height,
                                 time_t blocktime, Amount fee,
@@ -107,16 +155,45 @@ class NunchukWalletDb : public NunchukDb {
   std::string GetPsbt(const std::string &tx_id) const;
   std::string GetDescriptor(bool internal) const;
   std::vector<UnspentOutput> GetUnspentOutputs(bool remove_locked) const;
+  std::vector<UnspentOutput> GetUnspentOutputsFromTxInputs(
+      const std::vector<TxInput> &inputs) const;
   std::vector<Transaction> GetTransactions(int count = 1000,
                                            int skip = 0) const;
   bool SetUtxos(const std::string &address, const std::string &utxo);
   Amount GetBalance() const;
   std::string FillPsbt(const std::string &psbt);
+  std::string FillPsbt(const std::string &psbt,
+                       const FlatSigningProvider &provider);
   std::string GetColdcardFile() const;
   void FillSendReceiveData(Transaction &tx);
+  void FillSendReceiveData(
+      Transaction &tx, const std::unordered_set<std::string> &addresses) const;
   void FillExtra(const std::string &extra, Transaction &tx) const;
+  int64_t GetChangeSeq() const;
+  WalletChanges GetChanges(int64_t since_seq);
+  // Rows changed after since_seq as a json delta, see BackupWalletDelta
+  std::string ExportDelta(int64_t since_seq, int64_t &seq);
+  void ApplyDelta(const std::string &delta);
+  std::vector<BalancePoint> GetBalanceHistory(int max_points) const;
 
  private:
+  void CreateChangeLog();
+  // TXBALANCE holds the balance change of each confirmed transaction,
+  // indexed by height, and TXBALANCE_REF the txid and addresses each one
+  // was computed from. Kept in step with VTX and ADDRESS by UpdateTxBalance
+  void CreateTxBalance();
+  // Backfill the next batch_size confirmed transactions of a migrated
+  // wallet in one SQL transaction, so an interrupted backfill resumes.
+  // Returns true once TXBALANCE is complete
+  bool BackfillTxBalance(int batch_size);
+  // Recompute tx_id and the rows computed from it
+  void UpdateTxBalance(const std::string &tx_id);
+  void UpdateTxBalance(const std::vector<std::string> &tx_ids);
+  // Rows to recompute when the transaction or address ref changes
+  std::vector<std::string> GetTxBalanceDependents(const std::string &ref,
+                                                  bool is_address) const;
+  // Bump the wallet change sequence and stamp (kind, key) with it
+  void RecordChange(int kind, const std::string &key);
   void SetReplacedBy(const std::string &old_txid, const std::string &new_txid);
   bool AddSigner(const SingleSigner &signer);
   friend class NunchukStorage;
@@ -160,6 +237,25 @@ class NunchukAppStateDb : public NunchukDb {
   bool SetChainTip(int value);
   std::string GetSelectedWallet() const;
   bool SetSelectedWallet(const std::string &value);
+  std::string GetWalletSnapshot() const;
+  bool SetWalletSnapshot(const std::string &value);
+
+ private:
+  friend class NunchukStorage;
+};
+
+// Chunks of an interrupted RestoreWallet, keyed like the wallets so the
+// restored data never sits on disk decrypted
+class NunchukRestoreDb : public NunchukDb {
+ public:
+  using NunchukDb::NunchukDb;
+
+  void Init();
+  void AddChunk(const std::string &chunk);
+  // Chunks and bytes restored so far
+  void GetProgress(uint32_t &records, uint64_t &bytes) const;
+  // The chunks put back together
+  std::string GetImage() const;
 
  private:
   friend class NunchukStorage;
@@ -170,12 +266,36 @@ class NunchukStorage {
   NunchukStorage(const std::string &datadir = "",
                  const std::string &passphrase = "");
 
-  void MaybeMigrate(Chain chain);
+  // Budget for the read-through wallet cache, 0 disables it
+  void SetWalletCacheSize(size_t bytes);
+  // Warm start: serve the wallets saved by SaveSnapshot from the cache,
+  // marked stale until SetWalletSynced. Wallets are only kept for the
+  // snapshot once this was called
+  void LoadSnapshot(Chain chain);
+  void SaveSnapshot(Chain chain);
+  void SetWalletSynced(Chain chain, const std::string &wallet_id);
   bool WriteFile(const std::string &file_path, const std::string &value);
   std::string LoadFile(const std::string &file_path);
   bool ExportWallet(Chain chain, const std::string &wallet_id,
                     const std::string &file_path, ExportFormat format);
   std::string ImportWalletDb(Chain chain, const std::string &file_path);
+  // Streaming backup in the format of backup.h. Writers can keep going
+  // while the db is copied, the storage lock is only held to open it
+  bool BackupWallet(Chain chain, const std::string &wallet_id,
+                    const std::string &file_path,
+                    const std::string &passphrase);
+  // Restore a BackupWallet file. Restored chunks are kept in the tmp dir,
+  // keyed with the storage passphrase, so calling again after an
+  // interruption resumes from the last restored chunk
+  std::string RestoreWallet(Chain chain, const std::string &file_path,
+                            const std::string &passphrase);
+  // Changes since the last BackupWallet or BackupWalletDelta, in the same
+  // format. Deltas must be applied in the order they were taken
+  bool BackupWalletDelta(Chain chain, const std::string &wallet_id,
+                         const std::string &file_path,
+                         const std::string &passphrase);
+  std::string ApplyWalletDelta(Chain chain, const std::string &file_path,
+                               const std::string &passphrase);
   void SetPassphrase(Chain chain, const std::string &new_passphrase);
   Wallet CreateWallet(Chain chain, const std::string &name, int m, int n,
                       const std::vector<SingleSigner> &signers,
@@ -243,9 +363,16 @@ class NunchukStorage {
   std::vector<Transaction> GetTransactions(Chain chain,
                                            const std::string &wallet_id,
                                            int count, int skip);
+  std::vector<BalancePoint> GetBalanceHistory(Chain chain,
+                                              const std::string &wallet_id,
+                                              int max_points);
   std::vector<UnspentOutput> GetUnspentOutputs(Chain chain,
                                                const std::string &wallet_id,
                                                bool remove_locked = true);
+  // Resolve outpoints to (address, amount, height) with one db open
+  std::vector<UnspentOutput> GetUnspentOutputsFromTxInputs(
+      Chain chain, const std::string &wallet_id,
+      const std::vector<TxInput> &inputs);
   Transaction GetTransaction(Chain chain, const std::string &wallet_id,
                              const std::string &tx_id);
   bool UpdateTransaction(Chain chain, const std::string &wallet_id,
@@ -273,6 +400,20 @@ class NunchukStorage {
   Amount GetBalance(Chain chain, const std::string &wallet_id);
   std::string FillPsbt(Chain chain, const std::string &wallet_id,
                        const std::string &psbt);
+  // Same as above but with descriptors already evaluated by the caller
+  std::string FillPsbt(Chain chain, const std::string &wallet_id,
+                       const std::string &psbt,
+                       const FlatSigningProvider &provider);
+  // Load the coin selection inputs with a single db open. change_address is
+  // the escrow address, or the first unused change address (empty if none)
+  void GetCoinSelectionState(Chain chain, const std::string &wallet_id,
+                             bool is_escrow, bool load_utxos,
+                             std::vector<UnspentOutput> &utxos,
+                             std::string &change_address);
+
+  int64_t GetChangeSeq(Chain chain, const std::string &wallet_id);
+  WalletChanges GetChanges(Chain chain, const std::string &wallet_id,
+                           int64_t since_seq);
 
   int GetChainTip(Chain chain);
   bool SetChainTip(Chain chain, int height);
@@ -283,17 +424,57 @@ class NunchukStorage {
   NunchukWalletDb GetWalletDb(Chain chain, const std::string &id);
   NunchukSignerDb GetSignerDb(Chain chain, const std::string &id);
   NunchukAppStateDb GetAppStateDb(Chain chain);
+  // Wallet snapshot, keyed with passphrase_ like the wallets it copies. The
+  // app state db is never encrypted
+  NunchukAppStateDb GetSnapshotDb(Chain chain);
+  // Copy a plaintext wallet db under its id, keyed with passphrase_. Caller
+  // holds access_
+  std::string ImportWallet(Chain chain, NunchukDb &db);
+  // GetWallet without the cache, keeping the snapshot entry up to date.
+  // Caller holds access_
+  Wallet ReadWallet(Chain chain, const std::string &id);
+  // Drop cached parts. A wallet dropped from the cache keeps its snapshot
+  // entry, refreshed when it is read again or at SaveSnapshot
+  void Invalidate(Chain chain, const std::string &wallet_id, int parts);
+  void InvalidateAll(int parts);
   std::string ChainStr(Chain chain) const;
   boost::filesystem::path GetWalletDir(Chain chain,
                                        const std::string &id) const;
   boost::filesystem::path GetSignerDir(Chain chain,
                                        const std::string &id) const;
   boost::filesystem::path GetAppStateDir(Chain chain) const;
+  boost::filesystem::path GetSnapshotDir(Chain chain) const;
   boost::filesystem::path GetDefaultDataDir() const;
   boost::filesystem::path datadir_;
   std::string passphrase_;
+  // Single signer key to wallet id. Filled by readers holding access_
+  // shared, so it has its own mutex
   std::map<std::string, std::string> single_wallet_;
+  std::mutex single_wallet_mutex_;
   boost::shared_mutex access_;
+  // Wallets checked for migration since this storage was created. Each
+  // wallet is migrated on its first open instead of all at startup, under
+  // its own mutex so other wallets open meanwhile
+  struct Migration {
+    std::mutex mutex;
+    std::atomic<bool> done{false};
+    // TXBALANCE is backfilled by the first GetBalanceHistory instead
+    std::atomic<bool> balance_ready{false};
+  };
+  std::map<std::pair<Chain, std::string>, std::shared_ptr<Migration>>
+      migrated_wallets_;
+  std::mutex migrate_mutex_;
+  std::shared_ptr<Migration> GetMigration(Chain chain, const std::string &id);
+  // Filled by reads under a shared lock of access_, invalidated by writes
+  // under its exclusive lock
+  WalletCache cache_;
+  // Serialized wallets to save at shutdown, those written since they were
+  // serialized, and the wallets synced since startup
+  bool snapshot_enabled_ = false;
+  std::map<std::pair<Chain, std::string>, std::string> snapshot_;
+  std::set<std::pair<Chain, std::string>> snapshot_dirty_;
+  std::set<std::pair<Chain, std::string>> synced_wallets_;
+  std::mutex snapshot_mutex_;
 };
 
 }  // namespace nunchuk
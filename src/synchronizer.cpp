@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "synchronizer.h"
+#include <metrics.h>
+#include <tracing.h>
 #include <utils/addressutils.hpp>
 
 using namespace boost::asio;
@@ -13,29 +15,72 @@ static int CACHE_SECOND = 600;  // 10 minutes
 static int RECONNECT_DELAY_SECOND = 3;
 static long long SUBCRIBE_DELAY_MS = 100;
 
+// Emit a listener signal, recording how long the listeners took
+template <typename Signal, typename... Args>
+static void Notify(const char* name, Signal& signal, Args&&... args) {
+  Metrics::Timer timer(Metrics::getInstance().GetHistogram(
+      "nunchuk_listener_dispatch_seconds", {{"listener", name}}));
+  signal(std::forward<Args>(args)...);
+}
+
 BlockSynchronizer::BlockSynchronizer(NunchukStorage* storage)
     : storage_(storage),
-      sync_thread_(),
-      sync_worker_(make_work_guard(io_service_)) {
-  sync_thread_ = std::thread([&]() {
-    for (;;) {
-      try {
-        io_service_.run();
-        break;  // exited normally
-      } catch (...) {
-      }
-    }
-  });
-}
+      strand_(Executor::getInstance().MakeBlockingStrand()),
+      reconnect_timer_(Executor::getInstance().GetIoContext()),
+      subscribe_timer_(Executor::getInstance().GetIoContext()) {}
 
 BlockSynchronizer::~BlockSynchronizer() {
   {
     std::lock_guard<std::mutex> guard(status_mutex_);
     status_ = Status::STOPPED;
-    status_cv_.notify_all();
   }
-  sync_worker_.reset();
-  sync_thread_.join();
+  stopped_ = true;
+  // Pending timers fire now instead of holding the wait below
+  auto token = tasks_.Acquire();
+  boost::asio::post(strand_, [this, token]() {
+    boost::system::error_code ec;
+    reconnect_timer_.cancel(ec);
+    subscribe_timer_.cancel(ec);
+  });
+  token.reset();
+  // Queued tasks are skipped, a running one returns at its next status check
+  tasks_.Wait();
+  std::lock_guard<std::mutex> guard(status_mutex_);
+  ReleaseClient();
+}
+
+void BlockSynchronizer::ReleaseClient() {
+  for (auto&& connection : client_connections_) connection.disconnect();
+  client_connections_.clear();
+  client_.reset();
+}
+
+std::shared_ptr<ElectrumClient> BlockSynchronizer::GetClient() {
+  std::lock_guard<std::mutex> lock_(status_mutex_);
+  if (status_ != Status::READY && status_ != Status::SYNCING) return nullptr;
+  return client_;
+}
+
+void BlockSynchronizer::Post(std::function<void()> task) {
+  if (stopped_) return;
+  auto token = tasks_.Acquire();
+  boost::asio::post(strand_, [this, token, task]() {
+    if (stopped_) return;
+    task();
+  });
+}
+
+void BlockSynchronizer::PostAfter(boost::asio::steady_timer& timer,
+                                  std::chrono::milliseconds delay,
+                                  std::function<void()> task) {
+  if (stopped_) return;
+  auto token = tasks_.Acquire();
+  timer.expires_after(delay);
+  timer.async_wait(
+      [this, token, task](const boost::system::error_code& error) {
+        if (error) return;  // cancelled, or re-armed by a later call
+        Post(task);
+      });
 }
 
 bool BlockSynchronizer::NeedUpdateClient(const AppSettings& new_settings) {
@@ -73,64 +118,72 @@ void BlockSynchronizer::Run(const AppSettings& appsettings) {
   Connect();
 }
 
-void BlockSynchronizer::WaitForReady() {
-  std::unique_lock<std::mutex> lock_(status_mutex_);
-  status_cv_.wait(lock_, [&]() {
-    return status_ == Status::READY || status_ == Status::SYNCING;
-  });
-}
-
 void BlockSynchronizer::Connect() {
   {
     std::lock_guard<std::mutex> guard(status_mutex_);
     if (status_ == Status::STOPPED) return;
     status_ = Status::CONNECTING;
-    status_cv_.notify_all();
+    sync_generation_++;
   }
   // Clear cache
   chain_tip_ = 0;
-  scripthash_to_wallet_address_.clear();
+  {
+    std::lock_guard<std::mutex> lock(scripthash_mutex_);
+    scripthash_to_wallet_address_.clear();
+  }
   std::fill(estimate_fee_cached_time_,
             estimate_fee_cached_time_ + ESTIMATE_FEE_CACHE_SIZE, 0);
   std::fill(estimate_fee_cached_value_,
             estimate_fee_cached_value_ + ESTIMATE_FEE_CACHE_SIZE, 0);
+  relay_fee_cached_time_ = 0;
 
-  io_service_.post([&]() {
+  Post([this]() {
+    std::shared_ptr<ElectrumClient> client;
+    int generation = 0;
     try {
-      client_ = std::unique_ptr<ElectrumClient>(
-          new ElectrumClient(app_settings_, [&]() {
-            io_service_.post([&]() {
-              std::this_thread::sleep_for(
-                  std::chrono::seconds(RECONNECT_DELAY_SECOND));
-              Connect();
-            });
-          }));
+      client = ElectrumClient::Connect(app_settings_);
     } catch (...) {
       std::lock_guard<std::mutex> guard(status_mutex_);
       status_ = Status::UNINITIALIZED;
-      status_cv_.notify_all();
       return;
     }
+    auto reconnect = [this]() {
+      Post([this]() {
+        PostAfter(reconnect_timer_,
+                  std::chrono::seconds(RECONNECT_DELAY_SECOND),
+                  [this]() { Connect(); });
+      });
+    };
     {
       std::lock_guard<std::mutex> guard(status_mutex_);
+      ReleaseClient();
+      client_ = client;
+      client_connections_.push_back(
+          client_->disconnect_add_listener(reconnect));
+      // The client may have failed before we started listening
+      if (client_->is_stopped()) reconnect();
       if (status_ != Status::CONNECTING) return;
       status_ = Status::SYNCING;
-      status_cv_.notify_all();
+      generation = sync_generation_;
     }
     try {
       BlockchainSync(app_settings_.get_chain());
     } catch (...) {
       // TODO(Bakaoh): more elegant exeption handling
       // storage and CoreUtils chain-switch may cause exeption here
+      FinishSync(generation);
     }
-    std::lock_guard<std::mutex> guard(status_mutex_);
-    if (status_ != Status::SYNCING) return;
-    status_ = Status::READY;
-    status_cv_.notify_all();
   });
 }
 
-void BlockSynchronizer::UpdateTransactions(Chain chain,
+void BlockSynchronizer::FinishSync(int generation) {
+  std::lock_guard<std::mutex> guard(status_mutex_);
+  if (status_ != Status::SYNCING || generation != sync_generation_) return;
+  status_ = Status::READY;
+}
+
+void BlockSynchronizer::UpdateTransactions(ElectrumClient& client,
+                                           Chain chain,
                                            const std::string& wallet_id,
                                            const json& history) {
   if (!history.is_array()) return;
@@ -142,14 +195,15 @@ void BlockSynchronizer::UpdateTransactions(Chain chain,
       // TODO(Bakaoh): [optimize] use GetTransactions
       Transaction tx = storage_->GetTransaction(chain, wallet_id, tx_id);
       if (tx.get_status() != TransactionStatus::CONFIRMED && height > 0) {
-        auto tx = client_.get()->blockchain_transaction_get(tx_id);
+        auto tx = client.blockchain_transaction_get(tx_id);
         storage_->UpdateTransaction(chain, wallet_id, tx["hex"], height,
                                     tx["blocktime"]);
-        transaction_listener_(tx_id, TransactionStatus::CONFIRMED);
+        Notify("transaction", transaction_listener_, tx_id,
+               TransactionStatus::CONFIRMED);
       }
     } catch (StorageException& se) {
       if (se.code() == StorageException::TX_NOT_FOUND) {
-        auto tx = client_.get()->blockchain_transaction_get(tx_id);
+        auto tx = client.blockchain_transaction_get(tx_id);
         time_t time = tx["blocktime"] == nullptr ? 0 : time_t(tx["blocktime"]);
         Amount fee = 0;
         if (height <= 0) {
@@ -160,7 +214,7 @@ void BlockSynchronizer::UpdateTransactions(Chain chain,
                                     fee);
         auto status = height <= 0 ? TransactionStatus::PENDING_CONFIRMATION
                                   : TransactionStatus::CONFIRMED;
-        transaction_listener_(tx_id, status);
+        Notify("transaction", transaction_listener_, tx_id, status);
       }
     }
   }
@@ -168,73 +222,133 @@ void BlockSynchronizer::UpdateTransactions(Chain chain,
 
 void BlockSynchronizer::OnScripthashStatusChange(Chain chain,
                                                  const json& notification) {
+  NUNCHUK_TRACE_FUNCTION("sync");
   std::string scripthash = notification[0];
-  if (scripthash_to_wallet_address_.count(scripthash) == 0) return;
-  std::string wallet_id = scripthash_to_wallet_address_.at(scripthash).first;
-  std::string address = scripthash_to_wallet_address_.at(scripthash).second;
-  json utxo = client_.get()->blockchain_scripthash_listunspent(scripthash);
+  std::string wallet_id;
+  std::string address;
+  {
+    std::lock_guard<std::mutex> lock(scripthash_mutex_);
+    auto it = scripthash_to_wallet_address_.find(scripthash);
+    if (it == scripthash_to_wallet_address_.end()) return;
+    wallet_id = it->second.first;
+    address = it->second.second;
+  }
+  auto client = GetClient();
+  if (!client) return;
+  json utxo = client->blockchain_scripthash_listunspent(scripthash);
   storage_->SetUtxos(chain, wallet_id, address, utxo.dump());
-  json history = client_.get()->blockchain_scripthash_get_history(scripthash);
-  UpdateTransactions(chain, wallet_id, history);
+  json history = client->blockchain_scripthash_get_history(scripthash);
+  UpdateTransactions(*client, chain, wallet_id, history);
+  Notify("address", address_listener_, wallet_id, address);
   Amount balance = storage_->GetBalance(chain, wallet_id);
-  balance_listener_(wallet_id, balance);
+  Notify("balance", balance_listener_, wallet_id, balance);
 }
 
-std::string BlockSynchronizer::SubscribeAddress(const std::string& wallet_id,
+std::string BlockSynchronizer::SubscribeAddress(ElectrumClient& client,
+                                                const std::string& wallet_id,
                                                 const std::string& address) {
   std::string scripthash = AddressToScriptHash(address);
-  scripthash_to_wallet_address_[scripthash] = {wallet_id, address};
-  client_.get()->blockchain_scripthash_subscribe(scripthash);
+  {
+    std::lock_guard<std::mutex> lock(scripthash_mutex_);
+    scripthash_to_wallet_address_[scripthash] = {wallet_id, address};
+  }
+  client.blockchain_scripthash_subscribe(scripthash);
   return scripthash;
 }
 
 void BlockSynchronizer::BlockchainSync(Chain chain) {
-  connection_listener_(ConnectionStatus::OFFLINE);
+  NUNCHUK_TRACE_FUNCTION("sync");
+  Notify("connection", connection_listener_, ConnectionStatus::OFFLINE);
+  std::shared_ptr<ElectrumClient> client;
+  auto queue = std::make_shared<SyncQueue>();
   {
     std::unique_lock<std::mutex> lock_(status_mutex_);
     if (status_ != Status::READY && status_ != Status::SYNCING) return;
-    auto header = client_.get()->blockchain_headers_subscribe([&](json rs) {
-      chain_tip_ = rs[0]["height"];
-      storage_->SetChainTip(app_settings_.get_chain(), chain_tip_);
-      block_listener_(rs[0]["height"], rs[0]["hex"]);
-    });
-    connection_listener_(ConnectionStatus::SYNCING);
-    chain_tip_ = header["height"];
-    storage_->SetChainTip(chain, header["height"]);
-    block_listener_(header["height"], header["hex"]);
-    client_.get()->scripthash_add_listener([&](json notification) {
-      OnScripthashStatusChange(app_settings_.get_chain(), notification);
-    });
+    client = client_;
+    queue->generation = sync_generation_;
+    client_connections_.push_back(
+        client_->headers_add_listener([this](json rs) {
+          chain_tip_ = rs[0]["height"];
+          storage_->SetChainTip(app_settings_.get_chain(), chain_tip_);
+          Notify("block", block_listener_, rs[0]["height"], rs[0]["hex"]);
+        }));
+    client_connections_.push_back(
+        client_->scripthash_add_listener([this](json notification) {
+          {
+            // A shared client notifies every instance, skip the scripthashes
+            // we did not subscribe
+            std::lock_guard<std::mutex> lock(scripthash_mutex_);
+            std::string scripthash = notification[0];
+            if (scripthash_to_wallet_address_.count(scripthash) == 0) return;
+          }
+          // Serialize with BlockchainSync, both touch the wallet storage
+          Post([this, notification]() {
+            OnScripthashStatusChange(app_settings_.get_chain(), notification);
+          });
+        }));
   }
+  auto header = client->blockchain_headers_subscribe();
+  Notify("connection", connection_listener_, ConnectionStatus::SYNCING);
+  chain_tip_ = header["height"];
+  storage_->SetChainTip(chain, header["height"]);
+  Notify("block", block_listener_, header["height"], header["hex"]);
   auto wallet_ids = storage_->ListWallets(chain);
   for (auto i = wallet_ids.rbegin(); i != wallet_ids.rend(); ++i) {
-    auto wallet_id = *i;
-    auto addresses = storage_->GetAllAddresses(chain, wallet_id);
-    for (auto a = addresses.rbegin(); a != addresses.rend(); ++a) {
-      std::unique_lock<std::mutex> lock_(status_mutex_);
-      if (status_ != Status::READY && status_ != Status::SYNCING) return;
-      auto address = *a;
-      auto scripthash = SubscribeAddress(wallet_id, address);
-      json utxo = client_.get()->blockchain_scripthash_listunspent(scripthash);
+    auto addresses = storage_->GetAllAddresses(chain, *i);
+    queue->wallets.push_back(
+        {*i, std::deque<std::string>(addresses.rbegin(), addresses.rend())});
+  }
+  SyncNextAddress(chain, queue);
+}
+
+void BlockSynchronizer::SyncNextAddress(Chain chain,
+                                        std::shared_ptr<SyncQueue> queue) {
+  NUNCHUK_TRACE_FUNCTION("sync");
+  while (!queue->wallets.empty()) {
+    auto& wallet_id = queue->wallets.front().first;
+    auto& addresses = queue->wallets.front().second;
+    if (!addresses.empty()) {
+      std::shared_ptr<ElectrumClient> client;
+      {
+        std::unique_lock<std::mutex> lock_(status_mutex_);
+        if (status_ != Status::READY && status_ != Status::SYNCING) return;
+        if (queue->generation != sync_generation_) return;
+        client = client_;
+      }
+      auto address = addresses.front();
+      addresses.pop_front();
+      auto scripthash = SubscribeAddress(*client, wallet_id, address);
+      json utxo = client->blockchain_scripthash_listunspent(scripthash);
       storage_->SetUtxos(chain, wallet_id, address, utxo.dump());
-      json history =
-          client_.get()->blockchain_scripthash_get_history(scripthash);
-      UpdateTransactions(chain, wallet_id, history);
-      std::this_thread::sleep_for(std::chrono::milliseconds(SUBCRIBE_DELAY_MS));
+      json history = client->blockchain_scripthash_get_history(scripthash);
+      UpdateTransactions(*client, chain, wallet_id, history);
+      PostAfter(subscribe_timer_,
+                std::chrono::milliseconds(SUBCRIBE_DELAY_MS),
+                [this, chain, queue]() {
+                  try {
+                    SyncNextAddress(chain, queue);
+                  } catch (...) {
+                    FinishSync(queue->generation);
+                  }
+                });
+      return;
     }
+    storage_->SetWalletSynced(chain, wallet_id);
     Amount balance = storage_->GetBalance(chain, wallet_id);
-    balance_listener_(wallet_id, balance);
+    Notify("balance", balance_listener_, wallet_id, balance);
+    queue->wallets.pop_front();
   }
-  connection_listener_(ConnectionStatus::ONLINE);
+  Notify("connection", connection_listener_, ConnectionStatus::ONLINE);
+  FinishSync(queue->generation);
 }
 
 void BlockSynchronizer::Broadcast(const std::string& raw_tx) {
-  std::unique_lock<std::mutex> lock_(status_mutex_);
-  if (status_ != Status::READY && status_ != Status::SYNCING) {
+  auto client = GetClient();
+  if (!client) {
     throw NunchukException(NunchukException::SERVER_REQUEST_ERROR,
                            "Disconnected");
   }
-  client_.get()->blockchain_transaction_broadcast(raw_tx);
+  client->blockchain_transaction_broadcast(raw_tx);
 }
 
 Amount BlockSynchronizer::EstimateFee(int conf_target) {
@@ -255,13 +369,13 @@ Amount BlockSynchronizer::EstimateFee(int conf_target) {
       current_time - estimate_fee_cached_time_[cached_index] <= CACHE_SECOND) {
     return estimate_fee_cached_value_[cached_index];
   }
-  std::unique_lock<std::mutex> lock_(status_mutex_);
-  if (status_ != Status::READY && status_ != Status::SYNCING) {
+  auto client = GetClient();
+  if (!client) {
     throw NunchukException(NunchukException::SERVER_REQUEST_ERROR,
                            "Disconnected");
   }
   Amount rs = Utils::AmountFromValue(
-      client_.get()->blockchain_estimatefee(conf_target).dump());
+      client->blockchain_estimatefee(conf_target).dump());
   if (cached_index >= 0) {
     estimate_fee_cached_value_[cached_index] = rs;
     estimate_fee_cached_time_[cached_index] = current_time;
@@ -270,12 +384,19 @@ Amount BlockSynchronizer::EstimateFee(int conf_target) {
 }
 
 Amount BlockSynchronizer::RelayFee() {
-  std::unique_lock<std::mutex> lock_(status_mutex_);
-  if (status_ != Status::READY && status_ != Status::SYNCING) {
+  auto current_time = std::time(0);
+  if (current_time - relay_fee_cached_time_ <= CACHE_SECOND) {
+    return relay_fee_cached_value_;
+  }
+  auto client = GetClient();
+  if (!client) {
     throw NunchukException(NunchukException::SERVER_REQUEST_ERROR,
                            "Disconnected");
   }
-  return Utils::AmountFromValue(client_.get()->blockchain_relayfee().dump());
+  relay_fee_cached_value_ =
+      Utils::AmountFromValue(client->blockchain_relayfee().dump());
+  relay_fee_cached_time_ = current_time;
+  return relay_fee_cached_value_;
 }
 
 int BlockSynchronizer::GetChainTip() {
@@ -284,28 +405,43 @@ int BlockSynchronizer::GetChainTip() {
   return rs;
 }
 
+bool BlockSynchronizer::IsOnline() {
+  std::lock_guard<std::mutex> lock_(status_mutex_);
+  return status_ == Status::READY || status_ == Status::SYNCING;
+}
+
 bool BlockSynchronizer::LookAhead(Chain chain, const std::string& wallet_id,
                                   const std::string& address, int index,
                                   bool internal) {
-  std::unique_lock<std::mutex> lock_(status_mutex_);
-  if (status_ != Status::READY && status_ != Status::SYNCING) return false;
+  NUNCHUK_TRACE_FUNCTION("sync");
   if (chain != app_settings_.get_chain()) return false;
+  auto client = GetClient();
+  if (!client) return false;
 
-  auto scripthash = SubscribeAddress(wallet_id, address);
-  json history = client_.get()->blockchain_scripthash_get_history(scripthash);
+  auto scripthash = SubscribeAddress(*client, wallet_id, address);
+  json history = client->blockchain_scripthash_get_history(scripthash);
   if (!history.is_array() || history.empty()) return false;
   storage_->AddAddress(chain, wallet_id, address, index, internal);
-  UpdateTransactions(chain, wallet_id, history);
-  json utxo = client_.get()->blockchain_scripthash_listunspent(scripthash);
+  UpdateTransactions(*client, chain, wallet_id, history);
+  json utxo = client->blockchain_scripthash_listunspent(scripthash);
   storage_->SetUtxos(chain, wallet_id, address, utxo.dump());
   return true;
 }
 
+void BlockSynchronizer::RunInBackground(std::function<void()> task) {
+  Post(task);
+}
+
 void BlockSynchronizer::AddBalanceListener(
     std::function<void(std::string, Amount)> listener) {
   balance_listener_.connect(listener);
 }
 
+void BlockSynchronizer::AddAddressListener(
+    std::function<void(std::string, std::string)> listener) {
+  address_listener_.connect(listener);
+}
+
 void BlockSynchronizer::AddBlockListener(
     std::function<void(int, std::string)> listener) {
   block_listener_.connect(listener);
@@ -11,8 +11,10 @@
 #include <coreutils.h>
 #include <storage.h>
 #include <electrumclient.h>
+#include <executor.h>
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
+#include <deque>
 #include <boost/asio.hpp>
 #include <boost/signals2.hpp>
 
@@ -31,11 +33,18 @@ class BlockSynchronizer {
   Amount EstimateFee(int conf_target);
   Amount RelayFee();
   int GetChainTip();
+  // Connected to the Electrum server, subscriptions are live
+  bool IsOnline();
   bool LookAhead(Chain chain, const std::string& wallet_id,
                  const std::string& address, int index, bool internal);
+  // Queue a task on the sync thread
+  void RunInBackground(std::function<void()> task);
 
   void Run(const AppSettings& appsettings);
   void AddBalanceListener(std::function<void(std::string, Amount)> listener);
+  // Notified with (wallet_id, address) when a subscribed address changes
+  void AddAddressListener(
+      std::function<void(std::string, std::string)> listener);
   void AddBlockListener(std::function<void(int, std::string)> listener);
   void AddTransactionListener(
       std::function<void(std::string, TransactionStatus)> listener);
@@ -52,30 +61,54 @@ class BlockSynchronizer {
   };
 
   bool NeedUpdateClient(const AppSettings& appsettings);
-  void UpdateTransactions(Chain chain, const std::string& wallet_id,
-                          const json& history);
+  void UpdateTransactions(ElectrumClient& client, Chain chain,
+                          const std::string& wallet_id, const json& history);
   void OnScripthashStatusChange(Chain chain, const json& notification);
-  std::string SubscribeAddress(const std::string& wallet_id,
+  std::string SubscribeAddress(ElectrumClient& client,
+                               const std::string& wallet_id,
                                const std::string& address);
+  // Addresses BlockchainSync has left to subscribe, wallet by wallet
+  struct SyncQueue {
+    int generation;
+    std::deque<std::pair<std::string, std::deque<std::string>>> wallets;
+  };
   void BlockchainSync(Chain chain);
+  // Sync the next address of queue, then schedule the rest after
+  // SUBCRIBE_DELAY_MS. Runs on strand_
+  void SyncNextAddress(Chain chain, std::shared_ptr<SyncQueue> queue);
+  void FinishSync(int generation);
   void Connect();
-  void WaitForReady();
+  // Drop our listeners from client_ and release it. Caller holds
+  // status_mutex_
+  void ReleaseClient();
+  // client_ while connected, null otherwise. Network calls go through the
+  // returned copy so status_mutex_ is never held across a round trip
+  std::shared_ptr<ElectrumClient> GetClient();
+  // Run a task on strand_, skipped once the synchronizer is stopped
+  void Post(std::function<void()> task);
+  // Post a task once timer expires, without holding a pool thread in the
+  // meantime. Runs on strand_, which owns both timers
+  void PostAfter(boost::asio::steady_timer& timer,
+                 std::chrono::milliseconds delay, std::function<void()> task);
 
   AppSettings app_settings_;
   NunchukStorage* storage_;
-  std::unique_ptr<ElectrumClient> client_;
+  std::shared_ptr<ElectrumClient> client_;
+  std::vector<boost::signals2::connection> client_connections_;
 
   Status status_ = Status::UNINITIALIZED;
+  int sync_generation_ = 0;  // bumped by Connect, stops a stale SyncQueue
   std::mutex status_mutex_;
-  std::condition_variable status_cv_;
 
-  std::thread sync_thread_;
-  boost::asio::io_service io_service_;
-  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
-      sync_worker_;
+  std::atomic<bool> stopped_{false};
+  Executor::BlockingStrand strand_;
+  TaskTracker tasks_;
+  boost::asio::steady_timer reconnect_timer_;
+  boost::asio::steady_timer subscribe_timer_;
 
   // Listener
   boost::signals2::signal<void(std::string, Amount)> balance_listener_;
+  boost::signals2::signal<void(std::string, std::string)> address_listener_;
   boost::signals2::signal<void(int, std::string)> block_listener_;
   boost::signals2::signal<void(std::string, TransactionStatus)>
       transaction_listener_;
@@ -86,6 +119,9 @@ class BlockSynchronizer {
   std::atomic<int> chain_tip_;
   time_t estimate_fee_cached_time_[ESTIMATE_FEE_CACHE_SIZE];
   Amount estimate_fee_cached_value_[ESTIMATE_FEE_CACHE_SIZE];
+  time_t relay_fee_cached_time_ = 0;
+  Amount relay_fee_cached_value_ = 0;
+  std::mutex scripthash_mutex_;
   std::map<std::string, std::pair<std::string, std::string>>
       scripthash_to_wallet_address_;
 };
@@ -0,0 +1,133 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "tracing.h"
+
+#ifdef NUNCHUK_TRACE
+
+#include <utils/json.hpp>
+#include <utils/loguru.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace nunchuk {
+
+static const size_t FLUSH_EVENTS = 4096;
+
+// Buffers complete ("X") events and appends them to the trace file in the
+// JSON array format, which viewers accept without the closing bracket, so a
+// crashed process still leaves a readable trace
+class TraceWriter {
+ public:
+  static TraceWriter& getInstance() {
+    static TraceWriter instance;
+    return instance;
+  }
+
+  bool enabled() const { return enabled_; }
+
+  void Add(const char* category, const std::string& name,
+           std::chrono::steady_clock::time_point start,
+           std::chrono::steady_clock::time_point end) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    json event = {
+        {"ph", "X"},
+        {"cat", category},
+        {"name", name},
+        {"pid", pid_},
+        {"tid", ThreadId()},
+        {"ts", duration_cast<microseconds>(start - epoch_).count()},
+        {"dur", duration_cast<microseconds>(end - start).count()},
+    };
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_) return;
+    events_.push_back(event.dump());
+    if (events_.size() >= FLUSH_EVENTS) Flush();
+  }
+
+ private:
+  TraceWriter() : epoch_(std::chrono::steady_clock::now()), pid_(getpid()) {
+    const char* path = std::getenv("NUNCHUK_TRACE_FILE");
+    if (path == nullptr || *path == '\0') return;
+    file_.open(path, std::ios::out | std::ios::trunc);
+    if (!file_) {
+      LOG_F(ERROR, "Can not open trace file %s", path);
+      return;
+    }
+    file_ << "[\n";
+    enabled_ = true;
+  }
+
+  ~TraceWriter() {
+    if (!enabled_) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Spans still open on other threads are dropped
+    enabled_ = false;
+    Flush();
+    json process = {{"ph", "M"},
+                    {"name", "process_name"},
+                    {"pid", pid_},
+                    {"args", {{"name", "nunchuk"}}}};
+    file_ << process.dump() << "\n]\n";
+  }
+
+  int ThreadId() {
+    static std::atomic<int> next{1};
+    static thread_local int id = next++;
+    return id;
+  }
+
+  void Flush() {
+    for (auto&& event : events_) file_ << event << ",\n";
+    file_.flush();
+    events_.clear();
+  }
+
+  std::atomic<bool> enabled_{false};
+  std::chrono::steady_clock::time_point epoch_;
+  int pid_;
+  std::mutex mutex_;
+  std::ofstream file_;
+  std::vector<std::string> events_;
+};
+
+TraceSpan::TraceSpan(const char* category, const char* name)
+    : enabled_(IsEnabled()), category_(category) {
+  if (!enabled_) return;
+  name_ = name;
+  start_ = std::chrono::steady_clock::now();
+}
+
+TraceSpan::TraceSpan(const char* category, const std::string& name)
+    : enabled_(IsEnabled()), category_(category) {
+  if (!enabled_) return;
+  name_ = name;
+  start_ = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan() {
+  if (!enabled_) return;
+  TraceWriter::getInstance().Add(category_, name_, start_,
+                                 std::chrono::steady_clock::now());
+}
+
+bool TraceSpan::IsEnabled() { return TraceWriter::getInstance().enabled(); }
+
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_TRACE
@@ -0,0 +1,62 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_TRACING_H
+#define NUNCHUK_TRACING_H
+
+// Scoped spans written as Chrome trace events (chrome://tracing, Perfetto).
+// Spans are compiled in only when the library is built with NUNCHUK_TRACE,
+// and recorded only when NUNCHUK_TRACE_FILE names the output file:
+//
+//   cmake -DNUNCHUK_TRACE=ON ..
+//   NUNCHUK_TRACE_FILE=/tmp/nunchuk.json ./app
+//
+// NUNCHUK_TRACE_SCOPE(category, name) traces the rest of the enclosing scope,
+// NUNCHUK_TRACE_FUNCTION(category) names the span after the function.
+
+#ifdef NUNCHUK_TRACE
+
+#include <chrono>
+#include <string>
+
+namespace nunchuk {
+
+class TraceSpan {
+ public:
+  TraceSpan(const char* category, const char* name);
+  TraceSpan(const char* category, const std::string& name);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  static bool IsEnabled();
+
+ private:
+  bool enabled_;
+  const char* category_;
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace nunchuk
+
+#define NUNCHUK_TRACE_CONCAT_(a, b) a##b
+#define NUNCHUK_TRACE_CONCAT(a, b) NUNCHUK_TRACE_CONCAT_(a, b)
+#define NUNCHUK_TRACE_SCOPE(category, name)                           \
+  ::nunchuk::TraceSpan NUNCHUK_TRACE_CONCAT(trace_span_, __LINE__)( \
+      category, name)
+#define NUNCHUK_TRACE_FUNCTION(category) NUNCHUK_TRACE_SCOPE(category, __func__)
+
+#else
+
+#define NUNCHUK_TRACE_SCOPE(category, name) \
+  do {                                      \
+  } while (0)
+#define NUNCHUK_TRACE_FUNCTION(category) \
+  do {                                   \
+  } while (0)
+
+#endif  // NUNCHUK_TRACE
+
+#endif  // NUNCHUK_TRACING_H
@@ -0,0 +1,286 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletcache.h"
+
+#include <metrics.h>
+
+namespace nunchuk {
+
+// Estimated heap footprint, strings are counted at their length plus the
+// object; good enough to keep the total near the budget
+static size_t EstimateSize(const std::string& value) {
+  return sizeof(std::string) + value.size();
+}
+
+static size_t EstimateSize(const std::vector<std::string>& value) {
+  size_t rs = sizeof(value);
+  for (auto&& i : value) rs += EstimateSize(i);
+  return rs;
+}
+
+// Transaction keeps hashes in binary and shares address strings, so only
+// the compact entries are counted
+static size_t EstimateSize(const Transaction& tx) {
+  const size_t input_size = sizeof(detail::CompactHash) + sizeof(int);
+  const size_t output_size = sizeof(detail::InternedString) + sizeof(Amount);
+  size_t rs = sizeof(tx) + tx.get_memo().size();
+  rs += tx.get_input_count() * input_size;
+  rs += (tx.get_output_count() + tx.get_user_output_count() +
+         tx.get_receive_output_count()) *
+        output_size;
+  rs += tx.get_signer_count() * sizeof(std::pair<std::string, bool>);
+  return rs;
+}
+
+static size_t EstimateSize(const Wallet& wallet) {
+  size_t rs = sizeof(wallet) + wallet.get_id().size() +
+              wallet.get_name().size() + wallet.get_description().size();
+  for (auto&& signer : wallet.get_signers()) {
+    rs += sizeof(signer) + signer.get_name().size() +
+          signer.get_xpub().size() + signer.get_public_key().size() +
+          signer.get_derivation_path().size() +
+          signer.get_master_fingerprint().size() +
+          signer.get_master_signer_id().size();
+  }
+  return rs;
+}
+
+static size_t EstimateSize(const UnspentOutput& utxo) { return sizeof(utxo); }
+
+template <typename K, typename V>
+static size_t EstimateSize(const std::map<K, std::vector<V>>& value) {
+  size_t rs = 0;
+  for (auto&& i : value) {
+    rs += sizeof(i) + 4 * sizeof(void*);
+    for (auto&& item : i.second) rs += EstimateSize(item);
+  }
+  return rs;
+}
+
+WalletCache::WalletCache() {}
+
+void WalletCache::SetBudget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = bytes;
+  Evict();
+}
+
+WalletCache::Entry* WalletCache::Find(const Key& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) return nullptr;
+  lru_.splice(lru_.begin(), lru_, it->second.lru);
+  return &it->second;
+}
+
+WalletCache::Entry& WalletCache::FindOrCreate(const Key& key) {
+  if (auto entry = Find(key)) return *entry;
+  auto& entry = entries_[key];
+  lru_.push_front(key);
+  entry.lru = lru_.begin();
+  return entry;
+}
+
+void WalletCache::Resize(Entry& entry, size_t size) {
+  size_ = size_ - entry.size + size;
+  entry.size = size;
+  static auto& bytes = Metrics::getInstance().GetGauge(
+      "nunchuk_wallet_cache_bytes");
+  bytes.Set(size_);
+}
+
+void WalletCache::Evict() {
+  while (size_ > budget_ && !lru_.empty()) {
+    auto it = entries_.find(lru_.back());
+    Resize(it->second, 0);
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+// Count the lookup and copy the cached value out, if any
+template <typename T>
+boost::optional<T> WalletCache::Record(const T* value) {
+  static auto& hits =
+      Metrics::getInstance().GetCounter("nunchuk_wallet_cache_hits_total");
+  static auto& misses =
+      Metrics::getInstance().GetCounter("nunchuk_wallet_cache_misses_total");
+  (value ? hits : misses).Increment();
+  if (!value) return boost::none;
+  return *value;
+}
+
+size_t WalletCache::EstimateSize(const Entry& entry) {
+  using nunchuk::EstimateSize;
+  size_t rs = sizeof(entry) + EstimateSize(entry.utxos) +
+              EstimateSize(entry.transactions) + EstimateSize(entry.addresses);
+  if (entry.wallet) rs += EstimateSize(*entry.wallet);
+  if (entry.all_addresses) rs += EstimateSize(*entry.all_addresses);
+  return rs;
+}
+
+void WalletCache::Drop(Entry& entry, int parts) {
+  if (parts & WALLET) entry.wallet = boost::none;
+  if (parts & BALANCE) entry.balance = boost::none;
+  if (parts & UTXOS) entry.utxos.clear();
+  if (parts & TRANSACTIONS) entry.transactions.clear();
+  if (parts & ADDRESSES) {
+    entry.addresses.clear();
+    entry.all_addresses = boost::none;
+  }
+}
+
+boost::optional<Wallet> WalletCache::GetWallet(Chain chain,
+                                               const std::string& wallet_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  return Record(entry ? entry->wallet.get_ptr() : nullptr);
+}
+
+void WalletCache::PutWallet(Chain chain, const std::string& wallet_id,
+                            const Wallet& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.wallet = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+boost::optional<Amount> WalletCache::GetBalance(Chain chain,
+                                                const std::string& wallet_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  return Record(entry ? entry->balance.get_ptr() : nullptr);
+}
+
+void WalletCache::PutBalance(Chain chain, const std::string& wallet_id,
+                             Amount value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.balance = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+boost::optional<std::vector<UnspentOutput>> WalletCache::GetUnspentOutputs(
+    Chain chain, const std::string& wallet_id, bool remove_locked) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  const std::vector<UnspentOutput>* value = nullptr;
+  if (entry) {
+    auto it = entry->utxos.find(remove_locked);
+    if (it != entry->utxos.end()) value = &it->second;
+  }
+  return Record(value);
+}
+
+void WalletCache::PutUnspentOutputs(Chain chain, const std::string& wallet_id,
+                                    bool remove_locked,
+                                    const std::vector<UnspentOutput>& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.utxos[remove_locked] = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+boost::optional<std::vector<Transaction>> WalletCache::GetTransactions(
+    Chain chain, const std::string& wallet_id, int count, int skip) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  const std::vector<Transaction>* value = nullptr;
+  if (entry) {
+    auto it = entry->transactions.find({count, skip});
+    if (it != entry->transactions.end()) value = &it->second;
+  }
+  return Record(value);
+}
+
+void WalletCache::PutTransactions(Chain chain, const std::string& wallet_id,
+                                  int count, int skip,
+                                  const std::vector<Transaction>& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.transactions[{count, skip}] = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+boost::optional<std::vector<std::string>> WalletCache::GetAddresses(
+    Chain chain, const std::string& wallet_id, bool used, bool internal) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  const std::vector<std::string>* value = nullptr;
+  if (entry) {
+    auto it = entry->addresses.find({used, internal});
+    if (it != entry->addresses.end()) value = &it->second;
+  }
+  return Record(value);
+}
+
+void WalletCache::PutAddresses(Chain chain, const std::string& wallet_id,
+                               bool used, bool internal,
+                               const std::vector<std::string>& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.addresses[{used, internal}] = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+boost::optional<std::vector<std::string>> WalletCache::GetAllAddresses(
+    Chain chain, const std::string& wallet_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return boost::none;
+  auto entry = Find({chain, wallet_id});
+  return Record(entry ? entry->all_addresses.get_ptr() : nullptr);
+}
+
+void WalletCache::PutAllAddresses(Chain chain, const std::string& wallet_id,
+                                  const std::vector<std::string>& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEnabled()) return;
+  auto& entry = FindOrCreate({chain, wallet_id});
+  entry.all_addresses = value;
+  Resize(entry, EstimateSize(entry));
+  Evict();
+}
+
+void WalletCache::Invalidate(Chain chain, const std::string& wallet_id,
+                             int parts) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find({chain, wallet_id});
+  if (it == entries_.end()) return;
+  auto& entry = it->second;
+  Drop(entry, parts);
+  Resize(entry, EstimateSize(entry));
+}
+
+void WalletCache::InvalidateAll(int parts) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto&& i : entries_) {
+    auto& entry = i.second;
+    Drop(entry, parts);
+    Resize(entry, EstimateSize(entry));
+  }
+}
+
+void WalletCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+  size_ = 0;
+}
+
+}  // namespace nunchuk
@@ -0,0 +1,102 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NUNCHUK_WALLETCACHE_H
+#define NUNCHUK_WALLETCACHE_H
+
+#include <nunchuk.h>
+#include <boost/optional.hpp>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nunchuk {
+
+// Read-through cache of decoded wallet state, owned by NunchukStorage.
+// Reads fill it, storage writes invalidate the parts they touch. Wallets are
+// evicted least recently used first once the estimated size exceeds the
+// budget.
+class WalletCache {
+ public:
+  // Parts of a wallet's state, combined as a mask for Invalidate
+  enum Part {
+    WALLET = 1,
+    BALANCE = 2,
+    UTXOS = 4,
+    TRANSACTIONS = 8,
+    ADDRESSES = 16,
+    ALL = 31,
+  };
+
+  WalletCache();
+
+  // 0 disables the cache and drops everything
+  void SetBudget(size_t bytes);
+  bool IsEnabled() const { return budget_ > 0; }
+
+  boost::optional<Wallet> GetWallet(Chain chain, const std::string& wallet_id);
+  void PutWallet(Chain chain, const std::string& wallet_id,
+                 const Wallet& value);
+  boost::optional<Amount> GetBalance(Chain chain, const std::string& wallet_id);
+  void PutBalance(Chain chain, const std::string& wallet_id, Amount value);
+  boost::optional<std::vector<UnspentOutput>> GetUnspentOutputs(
+      Chain chain, const std::string& wallet_id, bool remove_locked);
+  void PutUnspentOutputs(Chain chain, const std::string& wallet_id,
+                         bool remove_locked,
+                         const std::vector<UnspentOutput>& value);
+  boost::optional<std::vector<Transaction>> GetTransactions(
+      Chain chain, const std::string& wallet_id, int count, int skip);
+  void PutTransactions(Chain chain, const std::string& wallet_id, int count,
+                       int skip, const std::vector<Transaction>& value);
+  boost::optional<std::vector<std::string>> GetAddresses(
+      Chain chain, const std::string& wallet_id, bool used, bool internal);
+  void PutAddresses(Chain chain, const std::string& wallet_id, bool used,
+                    bool internal, const std::vector<std::string>& value);
+  boost::optional<std::vector<std::string>> GetAllAddresses(
+      Chain chain, const std::string& wallet_id);
+  void PutAllAddresses(Chain chain, const std::string& wallet_id,
+                       const std::vector<std::string>& value);
+
+  void Invalidate(Chain chain, const std::string& wallet_id, int parts);
+  // Invalidate parts of every cached wallet, e.g. signer names
+  void InvalidateAll(int parts);
+  void Clear();
+
+ private:
+  typedef std::pair<Chain, std::string> Key;
+  struct Entry {
+    boost::optional<Wallet> wallet;
+    boost::optional<Amount> balance;
+    std::map<bool, std::vector<UnspentOutput>> utxos;
+    std::map<std::pair<int, int>, std::vector<Transaction>> transactions;
+    std::map<std::pair<bool, bool>, std::vector<std::string>> addresses;
+    boost::optional<std::vector<std::string>> all_addresses;
+    size_t size = 0;
+    std::list<Key>::iterator lru;
+  };
+
+  // Entry of a hit, moved to the front of the LRU list
+  Entry* Find(const Key& key);
+  Entry& FindOrCreate(const Key& key);
+  static size_t EstimateSize(const Entry& entry);
+  static void Drop(Entry& entry, int parts);
+  void Resize(Entry& entry, size_t size);
+  void Evict();
+  template <typename T>
+  boost::optional<T> Record(const T* value);
+
+  std::mutex mutex_;
+  size_t budget_ = 0;
+  size_t size_ = 0;
+  std::map<Key, Entry> entries_;
+  std::list<Key> lru_;
+};
+
+}  // namespace nunchuk
+
+#endif  // NUNCHUK_WALLETCACHE_H
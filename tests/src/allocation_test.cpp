@@ -0,0 +1,63 @@
+#include <nunchuk.h>
+
+#include <doctest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long> allocations{0};
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+// Heap allocations made by f
+template <typename F>
+static long CountAllocations(F f) {
+  long before = allocations;
+  f();
+  return allocations - before;
+}
+
+TEST_CASE("testing accessors do not copy") {
+  using namespace nunchuk;
+  std::string xpub =
+      "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5A"
+      "oysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL";
+  std::vector<SingleSigner> signers;
+  for (int i = 0; i < 3; i++) {
+    signers.push_back(SingleSigner("a signer with a long name", xpub, {},
+                                   "m/48h/1h/0h/2h", "0b93c52e", 0));
+  }
+
+  std::string id = "wallet-id-that-is-longer-than-sso";
+  Wallet wallet(id, 2, 3, {}, {}, false, 0);
+  // Only the id is copied, the signers are moved in
+  CHECK(CountAllocations([&]() {
+          wallet = Wallet(id, 2, 3, std::move(signers),
+                          AddressType::NATIVE_SEGWIT, false, 0);
+        }) == 1);
+
+  size_t size = 0;
+  CHECK(CountAllocations([&]() {
+          for (auto&& signer : wallet.get_signers()) {
+            size += signer.get_name().size() + signer.get_xpub().size() +
+                    signer.get_derivation_path().size();
+          }
+          size += wallet.get_id().size();
+        }) == 0);
+  CHECK(size > 0);
+
+  std::vector<Transaction> transactions(100);
+  WalletChanges changes;
+  CHECK(CountAllocations(
+            [&]() { changes.set_transactions(std::move(transactions)); }) ==
+        0);
+  CHECK(changes.get_transactions().size() == 100);
+}
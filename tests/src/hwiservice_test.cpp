@@ -0,0 +1,104 @@
+#include <nunchuk.h>
+#include <coreutils.h>
+#include <descriptor.h>
+#include <hwiservice.h>
+#include <key_io.h>
+#include <univalue.h>
+#include <rpc/util.h>
+#include <script/signingprovider.h>
+#include <utils/bip32.hpp>
+#include <utils/txutils.hpp>
+
+#include <chrono>
+#include <doctest.h>
+
+using namespace nunchuk;
+
+// HWI_EMULATOR points at the hwi-emulator tool built alongside the tests,
+// which signs with the BIP32 test vector 1 seed (fingerprint 3442193e)
+static const std::string EMULATOR_FINGERPRINT = "3442193e";
+
+static long ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+TEST_CASE("testing HWIService enumerate and xpub") {
+  Utils::SetChain(Chain::TESTNET);
+  HWIService hwi(HWI_EMULATOR, Chain::TESTNET);
+
+  auto devices = hwi.Enumerate();
+  REQUIRE(devices.size() == 1);
+  CHECK(devices[0].get_master_fingerprint() == EMULATOR_FINGERPRINT);
+  CHECK(hwi.GetMasterFingerprint(devices[0]) == EMULATOR_FINGERPRINT);
+
+  Device other{"00000000"};
+  CHECK_THROWS_AS(hwi.GetXpubAtPath(other, "m/48h"), HWIException);
+}
+
+TEST_CASE("testing HWIService sign message") {
+  Utils::SetChain(Chain::TESTNET);
+  HWIService hwi(HWI_EMULATOR, Chain::TESTNET);
+  Device device{EMULATOR_FINGERPRINT};
+
+  std::string message = Utils::GenerateRandomMessage();
+  std::string xpub = hwi.GetXpubAtPath(device, TESTNET_HEALTH_CHECK_PATH);
+  std::string address =
+      CoreUtils::getInstance().DeriveAddresses(GetPkhDescriptor(xpub));
+
+  auto start = std::chrono::steady_clock::now();
+  std::string signature =
+      hwi.SignMessage(device, message, TESTNET_HEALTH_CHECK_PATH);
+  MESSAGE("signmessage: " << ElapsedMs(start) << " ms");
+  CHECK(CoreUtils::getInstance().VerifyMessage(address, signature, message));
+}
+
+TEST_CASE("testing HWIService sign tx") {
+  Utils::SetChain(Chain::TESTNET);
+  HWIService hwi(HWI_EMULATOR, Chain::TESTNET);
+  Device device{EMULATOR_FINGERPRINT};
+
+  // 2-of-2 with a cosigner the emulator does not hold, so the signed PSBT
+  // keeps exactly one partial signature
+  std::string path = "m/48'/1'/0'/2'";
+  std::vector<SingleSigner> signers = {
+      {"emulator", hwi.GetXpubAtPath(device, path), "", path,
+       EMULATOR_FINGERPRINT, 0},
+      {"cosigner",
+       "tpubDD4VXPr1QFidEe6xJSjz1xw7V4GtKmWKzNaGLp5Ko4Aqf18FA7XkDMqmsHA6kefMFH"
+       "TgF2jEH4b2oyTUmw116wjZmPNWo8E725ZqdPgK58G",
+       "", "m/48'/1'/6'", "423faab6", 0}};
+  std::string desc = GetDescriptorForSigners(
+      signers, 2, false, AddressType::NATIVE_SEGWIT, WalletType::MULTI_SIG);
+  std::string address = CoreUtils::getInstance().DeriveAddresses(desc, 0);
+
+  CMutableTransaction prev;
+  prev.vin.push_back(CTxIn(COutPoint(uint256::ONE, 0)));
+  prev.vout.push_back(
+      CTxOut(100000, GetScriptForDestination(DecodeDestination(address))));
+  std::string base64_psbt = CoreUtils::getInstance().CreatePsbt(
+      {{prev.GetHash().GetHex(), 0}}, {{address, 90000}});
+
+  PartiallySignedTransaction psbtx = DecodePsbt(base64_psbt);
+  psbtx.inputs[0].non_witness_utxo = MakeTransactionRef(prev);
+  psbtx.inputs[0].witness_utxo = prev.vout[0];
+  FlatSigningProvider provider;
+  UniValue uv;
+  uv.read(GetDescriptorsImportString(desc));
+  auto descs = uv.get_array();
+  for (size_t i = 0; i < descs.size(); ++i) {
+    EvalDescriptorStringOrObject(descs[i], provider);
+  }
+  SignPSBTInput(provider, psbtx, 0, 1);
+
+  auto start = std::chrono::steady_clock::now();
+  std::string signed_psbt = hwi.SignTx(device, EncodePsbt(psbtx));
+  MESSAGE("signtx: " << ElapsedMs(start) << " ms");
+
+  Transaction tx =
+      GetTransactionFromPartiallySignedTransaction(DecodePsbt(signed_psbt), 2);
+  CHECK(tx.get_signers().at(EMULATOR_FINGERPRINT));
+  CHECK_FALSE(tx.get_signers().at("423faab6"));
+  CHECK(tx.get_status() == TransactionStatus::PENDING_SIGNATURES);
+}
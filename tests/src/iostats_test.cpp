@@ -0,0 +1,74 @@
+#include <nunchuk.h>
+#include <iostats.h>
+#include <storage.h>
+
+#include <boost/filesystem.hpp>
+
+#include <doctest.h>
+
+static void Inner() {
+  NUNCHUK_API_FUNCTION();
+  nunchuk::IoStatsScope::RecordDbOpen();
+  nunchuk::IoStatsScope::RecordStatement();
+  CHECK(nunchuk::IoStatsScope::IsActive());
+}
+
+static void Outer() {
+  NUNCHUK_API_FUNCTION();
+  nunchuk::IoStatsScope::RecordDbOpen();
+  nunchuk::IoStatsScope::RecordKeyDerivation();
+  Inner();
+}
+
+TEST_CASE("testing IoStatsScope") {
+  using namespace nunchuk;
+  CHECK(IoStatsScope::GetLast().get_call().empty());
+
+  // Work outside any call is not reported
+  CHECK_FALSE(IoStatsScope::IsActive());
+  IoStatsScope::RecordDbOpen();
+  Outer();
+  CHECK_FALSE(IoStatsScope::IsActive());
+  IoStats stats = IoStatsScope::GetLast();
+  CHECK(stats.get_call() == "Outer");
+  CHECK(stats.get_db_opens() == 2);
+  CHECK(stats.get_key_derivations() == 1);
+  CHECK(stats.get_statements() == 1);
+  CHECK(stats.get_rows_read() == 0);
+  CHECK(Metrics::getInstance()
+            .GetCounter("nunchuk_api_db_opens_total", {{"method", "Outer"}})
+            .Value() == 2);
+  CHECK(Metrics::getInstance()
+            .GetCounter("nunchuk_api_calls_total", {{"method", "Inner"}})
+            .Value() == 0);
+}
+
+TEST_CASE("testing storage I/O accounting") {
+  using namespace nunchuk;
+  auto datadir = boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path("nunchuk-iostats-%%%%%%");
+  boost::filesystem::create_directories(datadir);
+  NunchukStorage storage(datadir.string(), "iostats-passphrase");
+  SingleSigner signer(
+      "signer",
+      "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5A"
+      "oysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL",
+      {}, "m/84h/1h/0h", "0b93c52e", 0);
+  std::string id = storage
+                       .CreateWallet(Chain::TESTNET, "wallet", 1, 1, {signer},
+                                     AddressType::NATIVE_SEGWIT, false, {})
+                       .get_id();
+
+  [&]() {
+    NUNCHUK_API_FUNCTION();
+    storage.GetWallet(Chain::TESTNET, id);
+  }();
+  IoStats stats = IoStatsScope::GetLast();
+  CHECK(stats.get_db_opens() == 1);
+  CHECK(stats.get_key_derivations() == 1);
+  CHECK(stats.get_statements() > 0);
+  CHECK(stats.get_rows_read() > 0);
+
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(datadir, ec);
+}
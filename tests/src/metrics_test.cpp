@@ -0,0 +1,47 @@
+#include <nunchuk.h>
+#include <metrics.h>
+#include <utils/json.hpp>
+
+#include <doctest.h>
+
+TEST_CASE("testing Metrics") {
+  using namespace nunchuk;
+  using json = nlohmann::json;
+  auto& metrics = Metrics::getInstance();
+
+  auto& counter = metrics.GetCounter("test_calls_total", {{"method", "a"}});
+  counter.Increment();
+  counter.Increment(2);
+  CHECK(&metrics.GetCounter("test_calls_total", {{"method", "a"}}) == &counter);
+  CHECK(counter.Value() == 3);
+
+  metrics.GetGauge("test_pending").Set(5);
+  metrics.GetGauge("test_pending").Add(-2);
+
+  auto& histogram = metrics.GetHistogram("test_latency_seconds");
+  histogram.Observe(0.0002);
+  histogram.Observe(0.02);
+  histogram.Observe(60);
+  CHECK(histogram.Count() == 3);
+  CHECK(histogram.CumulativeCount(0) == 1);
+  CHECK(histogram.CumulativeCount(Metrics::Histogram::BUCKET_COUNT - 1) == 2);
+
+  json rs = json::parse(metrics.Export(MetricsFormat::JSON));
+  bool found = false;
+  for (auto&& c : rs["counters"]) {
+    if (c["name"] == "test_calls_total") {
+      CHECK(c["labels"]["method"] == "a");
+      CHECK(c["value"] == 3);
+      found = true;
+    }
+  }
+  CHECK(found);
+
+  std::string text = metrics.Export(MetricsFormat::PROMETHEUS);
+  CHECK(text.find("# TYPE test_calls_total counter\n") != std::string::npos);
+  CHECK(text.find("test_calls_total{method=\"a\"} 3\n") != std::string::npos);
+  CHECK(text.find("test_pending 3\n") != std::string::npos);
+  CHECK(text.find("test_latency_seconds_bucket{le=\"+Inf\"} 3\n") !=
+        std::string::npos);
+  CHECK(text.find("test_latency_seconds_count 3\n") != std::string::npos);
+}
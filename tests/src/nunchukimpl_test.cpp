@@ -0,0 +1,207 @@
+#include <nunchuk.h>
+#include <coreutils.h>
+#include <descriptor.h>
+#include <hwiservice.h>
+#include <key_io.h>
+#include <univalue.h>
+#include <rpc/util.h>
+#include <script/signingprovider.h>
+#include <utils/bip32.hpp>
+#include <utils/txutils.hpp>
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <doctest.h>
+
+using namespace nunchuk;
+namespace fs = boost::filesystem;
+
+// Two emulated devices, BIP32 test vectors 1 and 2
+static const std::string EMULATOR_SEEDS =
+    "000102030405060708090a0b0c0d0e0f,"
+    "fffcf9f6f3f0edeae7e4e1dedbd8d5d2cfccc9c6c3c0bdbab7b4b1aeaba8a5a29f9c99"
+    "9693908d8a8784817e7b7875726f6c696663605d5a5754514e4b484542";
+static const std::string SIGNER_PATH = "m/48'/1'/0'/2'";
+
+// Error code the future fails with, 0 when it succeeds
+template <typename T>
+static int ErrorCode(std::future<T> future) {
+  try {
+    future.get();
+  } catch (BaseException& e) {
+    return e.code();
+  }
+  return 0;
+}
+
+// Offline instance on a fresh storage, signing with hwi-emulator
+struct NunchukFixture {
+  NunchukFixture()
+      : datadir(fs::temp_directory_path() /
+                fs::unique_path("nunchuk-impl-%%%%%%")) {
+    setenv("HWI_EMULATOR_SEED", EMULATOR_SEEDS.c_str(), 1);
+    fs::create_directories(datadir);
+    AppSettings settings;
+    settings.set_chain(Chain::TESTNET);
+    // Nothing listens here, the synchronizer keeps retrying in the background
+    settings.set_testnet_servers({"127.0.0.1:1"});
+    settings.set_storage_path(datadir.string());
+    settings.set_hwi_path(HWI_EMULATOR);
+    settings.enable_proxy(false);
+    nu = MakeNunchuk(settings);
+  }
+  ~NunchukFixture() {
+    nu.reset();
+    boost::system::error_code ec;
+    fs::remove_all(datadir, ec);
+  }
+
+  // 2-of-2 wallet of both emulated devices
+  Wallet CreateWallet() {
+    HWIService hwi(HWI_EMULATOR, Chain::TESTNET);
+    devices = nu->GetDevices();
+    REQUIRE(devices.size() == 2);
+    for (auto&& device : devices) {
+      signers.push_back({device.get_path(),
+                         hwi.GetXpubAtPath(device, SIGNER_PATH), "",
+                         SIGNER_PATH, device.get_master_fingerprint(), 0});
+    }
+    return nu->CreateWallet("multi", 2, 2, signers,
+                            AddressType::NATIVE_SEGWIT, false);
+  }
+
+  // Imports a PSBT spending a made up coin of the wallet's first address
+  Transaction ImportPsbt(const Wallet& wallet, uint32_t prev_n) {
+    std::string desc =
+        GetDescriptorForSigners(signers, 2, false, AddressType::NATIVE_SEGWIT,
+                                WalletType::MULTI_SIG);
+    std::string address = CoreUtils::getInstance().DeriveAddresses(desc, 0);
+    CMutableTransaction prev;
+    prev.vin.push_back(CTxIn(COutPoint(uint256::ONE, prev_n)));
+    prev.vout.push_back(
+        CTxOut(100000, GetScriptForDestination(DecodeDestination(address))));
+    PartiallySignedTransaction psbtx =
+        DecodePsbt(CoreUtils::getInstance().CreatePsbt(
+            {{prev.GetHash().GetHex(), 0}}, {{address, 90000}}));
+    psbtx.inputs[0].non_witness_utxo = MakeTransactionRef(prev);
+    psbtx.inputs[0].witness_utxo = prev.vout[0];
+    // Key paths only, the provider has no private keys
+    FlatSigningProvider provider;
+    UniValue uv;
+    uv.read(GetDescriptorsImportString(desc));
+    auto descs = uv.get_array();
+    for (size_t i = 0; i < descs.size(); ++i) {
+      EvalDescriptorStringOrObject(descs[i], provider);
+    }
+    SignPSBTInput(provider, psbtx, 0, 1);
+
+    auto file = datadir / fs::unique_path("%%%%%%.psbt");
+    std::ofstream(file.string()) << EncodePsbt(psbtx);
+    return nu->ImportTransaction(wallet.get_id(), file.string());
+  }
+
+  fs::path datadir;
+  std::unique_ptr<Nunchuk> nu;
+  std::vector<Device> devices;
+  std::vector<SingleSigner> signers;
+};
+
+TEST_CASE("testing sign transaction with several devices") {
+  NunchukFixture fixture;
+  auto& nu = fixture.nu;
+  Wallet wallet = fixture.CreateWallet();
+  auto& devices = fixture.devices;
+  std::string fp0 = devices[0].get_master_fingerprint();
+  std::string fp1 = devices[1].get_master_fingerprint();
+  REQUIRE(fp0 != fp1);
+
+  SUBCASE("both devices sign") {
+    Transaction tx = fixture.ImportPsbt(wallet, 0);
+    CHECK(tx.get_status() == TransactionStatus::PENDING_SIGNATURES);
+    tx = nu->SignTransaction(wallet.get_id(), tx.get_txid(), devices);
+    CHECK(tx.get_signers().at(fp0));
+    CHECK(tx.get_signers().at(fp1));
+    CHECK(tx.get_status() == TransactionStatus::READY_TO_BROADCAST);
+  }
+
+  SUBCASE("a failed device keeps the other signature") {
+    Transaction tx = fixture.ImportPsbt(wallet, 1);
+    std::vector<Device> with_missing = {devices[0], Device{"00000000"}};
+    CHECK_THROWS_AS(
+        nu->SignTransaction(wallet.get_id(), tx.get_txid(), with_missing),
+        HWIException);
+    tx = nu->GetTransaction(wallet.get_id(), tx.get_txid());
+    CHECK(tx.get_signers().at(fp0));
+    CHECK_FALSE(tx.get_signers().at(fp1));
+    CHECK(tx.get_status() == TransactionStatus::PENDING_SIGNATURES);
+  }
+}
+
+TEST_CASE("testing async variants") {
+  NunchukFixture fixture;
+  auto& nu = fixture.nu;
+  Wallet wallet = fixture.CreateWallet();
+  std::string wallet_id = wallet.get_id();
+
+  SUBCASE("futures resolve to the sync results") {
+    std::string address = nu->NewAddressAsync(wallet_id).get();
+    auto addresses = nu->GetAddresses(wallet_id, false, false);
+    CHECK(std::count(addresses.begin(), addresses.end(), address) == 1);
+
+    Transaction tx = fixture.ImportPsbt(wallet, 0);
+    for (auto&& device : fixture.devices) {
+      tx = nu->SignTransactionAsync(wallet_id, tx.get_txid(), device).get();
+    }
+    CHECK(tx.get_status() == TransactionStatus::READY_TO_BROADCAST);
+
+    Wallet copy = nu->CreateWalletAsync("copy", 1, 2, fixture.signers,
+                                        AddressType::NATIVE_SEGWIT, false)
+                      .get();
+    CHECK(nu->GetWallet(copy.get_id()).get_m() == 1);
+  }
+
+  SUBCASE("errors are thrown from get") {
+    // No coins to select from
+    CHECK(ErrorCode(nu->CreateTransactionAsync(
+              wallet_id, {{nu->NewAddress(wallet_id), 10000}}, {}, {},
+              1000)) != 0);
+  }
+
+  SUBCASE("a cancelled token stops before any change") {
+    CancellationToken token;
+    token.cancel();
+    const int cancelled = NunchukException::OPERATION_CANCELLED;
+    auto addresses = nu->GetAddresses(wallet_id, false, false);
+    CHECK(ErrorCode(nu->NewAddressAsync(wallet_id, false, token)) ==
+          cancelled);
+    CHECK(nu->GetAddresses(wallet_id, false, false) == addresses);
+
+    CHECK(ErrorCode(nu->CreateWalletAsync("copy", 1, 2, fixture.signers,
+                                          AddressType::NATIVE_SEGWIT, false,
+                                          {}, token)) == cancelled);
+    CHECK(nu->GetWallets().size() == 1);
+
+    Transaction tx = fixture.ImportPsbt(wallet, 1);
+    CHECK(ErrorCode(nu->SignTransactionAsync(wallet_id, tx.get_txid(),
+                                             fixture.devices[0], token)) ==
+          cancelled);
+    tx = nu->GetTransaction(wallet_id, tx.get_txid());
+    for (auto&& signer : tx.get_signers()) CHECK_FALSE(signer.second);
+
+    CHECK(ErrorCode(nu->CreateTransactionAsync(
+              wallet_id, {{"tb1qxyz", 10000}}, {}, {}, 1000, false, token)) ==
+          cancelled);
+    CHECK(nu->GetTransactionHistory(wallet_id, 10, 0).size() == 1);
+  }
+
+  SUBCASE("cancelling a copy cancels every holder") {
+    CancellationToken token;
+    CancellationToken copy = token;
+    CHECK_FALSE(token.is_cancelled());
+    copy.cancel();
+    CHECK(token.is_cancelled());
+  }
+}
@@ -0,0 +1,158 @@
+#include <nunchuk.h>
+#include <metrics.h>
+#include <storage.h>
+#include <datagen.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+
+#include <doctest.h>
+
+// Budgets are for an optimized build; NUNCHUK_PERF_BUDGET_SCALE multiplies
+// the time budgets, e.g. 10 under sanitizers
+static double Budget(double ms) {
+  const char* scale = std::getenv("NUNCHUK_PERF_BUDGET_SCALE");
+  return scale ? ms * std::atof(scale) : ms;
+}
+
+// Best of three, in milliseconds
+static double Time(const std::function<void()>& f) {
+  double best = 0;
+  for (int i = 0; i < 3; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = i == 0 ? elapsed.count() : std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+// For one-time costs, in milliseconds
+static double TimeOnce(const std::function<void()>& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static uint64_t WalletDbOpens() {
+  return nunchuk::Metrics::getInstance()
+      .GetHistogram("nunchuk_storage_open_seconds", {{"db", "wallet"}})
+      .Count();
+}
+
+static uint64_t Opens(const std::function<void()>& f) {
+  uint64_t before = WalletDbOpens();
+  f();
+  return WalletDbOpens() - before;
+}
+
+// 10k transaction wallet, generated once for all cases
+struct PerfWallet {
+  PerfWallet()
+      : datadir(boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("nunchuk-perf-%%%%%%")) {
+    boost::filesystem::create_directories(datadir);
+    nunchuk::datagen::WalletSpec spec;
+    spec.transactions = 10000;
+    spec.utxos = 2000;
+    spec.drafts = 10;
+    spec.replaced = 10;
+    id = nunchuk::datagen::GenerateWallet(datadir.string(), "", spec).id;
+  }
+  ~PerfWallet() {
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(datadir, ec);
+  }
+
+  static PerfWallet& Get() {
+    static PerfWallet wallet;
+    return wallet;
+  }
+
+  boost::filesystem::path datadir;
+  std::string id;
+};
+
+TEST_CASE("testing storage latency budgets") {
+  using namespace nunchuk;
+  auto& wallet = PerfWallet::Get();
+  const std::string& id = wallet.id;
+  NunchukStorage storage(wallet.datadir.string());
+  // Pays the one-time migration check
+  storage.GetWallet(Chain::TESTNET, id);
+
+  CHECK(Time([&]() {
+          CHECK(storage.GetTransactions(Chain::TESTNET, id, 10000, 0).size() ==
+                10000);
+        }) < Budget(2000));
+  CHECK(Time([&]() { storage.GetBalance(Chain::TESTNET, id); }) < Budget(50));
+  CHECK(Time([&]() { storage.GetUnspentOutputs(Chain::TESTNET, id); }) <
+        Budget(200));
+  CHECK(Time([&]() { storage.GetWallet(Chain::TESTNET, id); }) < Budget(50));
+  CHECK(Time([&]() {
+          CHECK(storage.GetBalanceHistory(Chain::TESTNET, id, 100).size() ==
+                100);
+        }) < Budget(50));
+}
+
+TEST_CASE("testing first open of a version 2 wallet") {
+  using namespace nunchuk;
+  auto& wallet = PerfWallet::Get();
+  const std::string& id = wallet.id;
+  auto datadir = boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path("nunchuk-perf-%%%%%%");
+  auto dir = datadir / "testnet" / "wallets";
+  boost::filesystem::create_directories(dir);
+  boost::filesystem::copy_file(wallet.datadir / "testnet" / "wallets" / id,
+                               dir / id);
+  // Back to a version 2 wallet, from before the balance history
+  sqlite3* db;
+  REQUIRE(sqlite3_open((dir / id).string().c_str(), &db) == SQLITE_OK);
+  std::string sql =
+      "DROP TABLE TXBALANCE; DROP TABLE TXBALANCE_REF;"
+      "UPDATE VINT SET VALUE = 2 WHERE ID = " +
+      std::to_string(DbKeys::VERSION) + ";";
+  CHECK(sqlite3_exec(db, sql.c_str(), NULL, 0, NULL) == SQLITE_OK);
+  sqlite3_close(db);
+
+  {
+    NunchukStorage storage(datadir.string());
+    // The migration defers the backfill, the first open stays cheap
+    CHECK(TimeOnce([&]() { storage.GetWallet(Chain::TESTNET, id); }) <
+          Budget(100));
+    CHECK(TimeOnce([&]() {
+            CHECK(storage.GetBalanceHistory(Chain::TESTNET, id, 100).size() ==
+                  100);
+          }) < Budget(4000));
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(datadir, ec);
+}
+
+TEST_CASE("testing wallet db opens per storage call") {
+  using namespace nunchuk;
+  auto& wallet = PerfWallet::Get();
+  const std::string& id = wallet.id;
+  NunchukStorage storage(wallet.datadir.string());
+
+  CHECK(Opens([&]() { storage.GetWallet(Chain::TESTNET, id); }) <= 1);
+  CHECK(Opens([&]() { storage.GetBalance(Chain::TESTNET, id); }) <= 1);
+  CHECK(Opens([&]() {
+          storage.GetTransactions(Chain::TESTNET, id, 1000, 0);
+        }) <= 1);
+  CHECK(Opens([&]() { storage.GetUnspentOutputs(Chain::TESTNET, id); }) <= 1);
+  std::vector<UnspentOutput> utxos;
+  std::string change_address;
+  CHECK(Opens([&]() {
+          storage.GetCoinSelectionState(Chain::TESTNET, id, false, true,
+                                        utxos, change_address);
+        }) <= 1);
+  CHECK(!utxos.empty());
+}
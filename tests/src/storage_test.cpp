@@ -0,0 +1,713 @@
+#include <nunchuk.h>
+#include <coreutils.h>
+#include <metrics.h>
+#include <storage.h>
+#include <utils/json.hpp>
+#include <utils/bip32.hpp>
+#include <utils/txutils.hpp>
+
+#include <core_io.h>
+#include <key_io.h>
+#include <primitives/transaction.h>
+#include <pubkey.h>
+#include <script/standard.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include <doctest.h>
+
+using namespace nunchuk;
+using json = nlohmann::json;
+namespace fs = boost::filesystem;
+
+static const Chain CHAIN = Chain::TESTNET;
+static const std::string TPUB =
+    "tpubDHEmo3q4q5sUomHPDgAg9FpJkopKFjpCawgtuTQn449ZWamgArxkpRswYMHX3BG1tv5A"
+    "oysgXRq4pF3ZCSg8oZvZVUesmZjyivpjzGcUHhL";
+
+// Single-sig wallet on a fresh storage, with helpers to make up its history
+struct StorageFixture {
+  StorageFixture()
+      : datadir(fs::temp_directory_path() /
+                fs::unique_path("nunchuk-storage-%%%%%%")) {
+    fs::create_directories(datadir);
+    CoreUtils::getInstance().SetChain(CHAIN);
+    storage.reset(new NunchukStorage(datadir.string()));
+    SingleSigner signer("test", TPUB, {}, "m/84h/1h/0h", "0b93c52e", 0);
+    wallet_id = storage
+                    ->CreateWallet(CHAIN, "test", 1, 1, {signer},
+                                   AddressType::NATIVE_SEGWIT, false, {})
+                    .get_id();
+  }
+  ~StorageFixture() {
+    storage.reset();
+    boost::system::error_code ec;
+    fs::remove_all(datadir, ec);
+  }
+
+  std::string Address(int index, bool internal = false) {
+    return CoreUtils::getInstance().DeriveAddresses(
+        storage->GetDescriptor(CHAIN, wallet_id, internal), index);
+  }
+
+  static CScript Script(const std::string& address) {
+    return GetScriptForDestination(DecodeDestination(address));
+  }
+
+  // Raw transaction paying amount to address out of a made up coin
+  static std::string Pay(const std::string& address, Amount amount,
+                         uint32_t prev_n) {
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(uint256::ONE, prev_n)));
+    mtx.vout.push_back(CTxOut(amount, Script(address)));
+    return EncodeHexTx(CTransaction(mtx));
+  }
+
+  // Raw transaction spending output n of tx_id to address
+  static std::string Spend(const std::string& tx_id, uint32_t n,
+                           const std::string& address, Amount amount) {
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(uint256S(tx_id), n)));
+    mtx.vout.push_back(CTxOut(amount, Script(address)));
+    return EncodeHexTx(CTransaction(mtx));
+  }
+
+  // Unsigned PSBT spending output n of tx_id
+  static std::string Psbt(const std::string& tx_id, uint32_t n,
+                          const std::string& address, Amount amount) {
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(uint256S(tx_id), n)));
+    mtx.vout.push_back(CTxOut(amount, Script(address)));
+    return EncodePsbt(PartiallySignedTransaction(mtx));
+  }
+
+  // The PSBT with a signature, enough for the 1-of-1 wallet
+  static std::string Sign(const std::string& psbt) {
+    PartiallySignedTransaction psbtx = DecodePsbt(psbt);
+    CPubKey pubkey(ParseHex(
+        "0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798"));
+    psbtx.inputs[0].partial_sigs[pubkey.GetID()] = {
+        pubkey, std::vector<unsigned char>(71, 1)};
+    return EncodePsbt(psbtx);
+  }
+
+  // Electrum listunspent result holding one coin
+  static std::string Utxos(const std::string& tx_id, uint32_t n, Amount value,
+                           int height) {
+    json utxo = {{"tx_hash", tx_id},
+                 {"tx_pos", n},
+                 {"height", height},
+                 {"value", value}};
+    return json::array({utxo}).dump();
+  }
+
+  static std::string TxId(const std::string& raw_tx) {
+    return DecodeRawTransaction(raw_tx).GetHash().GetHex();
+  }
+
+  fs::path datadir;
+  std::unique_ptr<NunchukStorage> storage;
+  std::string wallet_id;
+};
+
+template <typename T>
+static bool Contains(const std::vector<T>& values, const T& value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+static std::vector<std::string> TxIds(const std::vector<Transaction>& txs) {
+  std::vector<std::string> rs;
+  for (auto&& tx : txs) rs.push_back(tx.get_txid());
+  return rs;
+}
+
+TEST_CASE("testing wallet change log") {
+  StorageFixture f;
+  auto& storage = *f.storage;
+  const std::string& id = f.wallet_id;
+  std::string address = f.Address(0);
+  int64_t seq = storage.GetChangeSeq(CHAIN, id);
+  // Changes since the last call
+  auto next = [&]() {
+    auto rs = storage.GetChanges(CHAIN, id, seq);
+    CHECK(rs.get_seq() == storage.GetChangeSeq(CHAIN, id));
+    seq = rs.get_seq();
+    return rs;
+  };
+
+  SUBCASE("nothing changed") {
+    auto changes = next();
+    CHECK(changes.get_transactions().empty());
+    CHECK(changes.get_removed_transactions().empty());
+    CHECK(changes.get_addresses().empty());
+    CHECK(changes.get_utxo_addresses().empty());
+  }
+
+  SUBCASE("addresses") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    CHECK(storage.GetChangeSeq(CHAIN, id) == seq + 1);
+    auto changes = next();
+    CHECK(changes.get_addresses() == std::vector<std::string>{address});
+    CHECK(changes.get_transactions().empty());
+
+    CHECK(storage.UseAddress(CHAIN, id, address));
+    CHECK(next().get_addresses() == std::vector<std::string>{address});
+    // Already used, not a change
+    CHECK_FALSE(storage.UseAddress(CHAIN, id, address));
+    CHECK(next().get_addresses().empty());
+  }
+
+  SUBCASE("transactions") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    next();
+    std::string raw = f.Pay(address, 100000, 0);
+    std::string tx_id = f.TxId(raw);
+    storage.InsertTransaction(CHAIN, id, raw, 0, 0);
+    auto changes = next();
+    CHECK(TxIds(changes.get_transactions()) ==
+          std::vector<std::string>{tx_id});
+    CHECK(changes.get_addresses().empty());
+
+    storage.UpdateTransactionMemo(CHAIN, id, tx_id, "memo");
+    changes = next();
+    REQUIRE(changes.get_transactions().size() == 1);
+    CHECK(changes.get_transactions()[0].get_memo() == "memo");
+
+    // Confirming marks the receiving address used
+    storage.UpdateTransaction(CHAIN, id, raw, 100, 1600000000);
+    changes = next();
+    REQUIRE(changes.get_transactions().size() == 1);
+    CHECK(changes.get_transactions()[0].get_height() == 100);
+    CHECK(changes.get_addresses() == std::vector<std::string>{address});
+
+    storage.DeleteTransaction(CHAIN, id, tx_id);
+    changes = next();
+    CHECK(changes.get_transactions().empty());
+    CHECK(changes.get_removed_transactions() ==
+          std::vector<std::string>{tx_id});
+  }
+
+  SUBCASE("psbts") {
+    std::string psbt = f.Psbt(uint256::ONE.GetHex(), 0, address, 1000);
+    std::string tx_id = storage.CreatePsbt(CHAIN, id, psbt).get_txid();
+    CHECK(TxIds(next().get_transactions()) == std::vector<std::string>{tx_id});
+    CHECK(storage.UpdatePsbt(CHAIN, id, psbt));
+    CHECK(TxIds(next().get_transactions()) == std::vector<std::string>{tx_id});
+
+    std::string new_id = uint256S("02").GetHex();
+    storage.UpdatePsbtTxId(CHAIN, id, tx_id, new_id);
+    auto changes = next();
+    CHECK(TxIds(changes.get_transactions()) ==
+          std::vector<std::string>{new_id});
+    CHECK(changes.get_removed_transactions() ==
+          std::vector<std::string>{tx_id});
+  }
+
+  SUBCASE("utxos") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    next();
+    std::string utxos = f.Utxos(uint256::ONE.GetHex(), 0, 5000, 100);
+    CHECK(storage.SetUtxos(CHAIN, id, address, utxos));
+    auto changes = next();
+    CHECK(changes.get_utxo_addresses() == std::vector<std::string>{address});
+    REQUIRE(changes.get_utxos().size() == 1);
+    CHECK(changes.get_utxos()[0].get_amount() == 5000);
+    CHECK(changes.get_transactions().empty());
+
+    // Resyncing the same coins is not a change
+    CHECK_FALSE(storage.SetUtxos(CHAIN, id, address, utxos));
+    CHECK(next().get_utxo_addresses().empty());
+  }
+
+  SUBCASE("every write stamps one sequence number") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    storage.InsertTransaction(CHAIN, id, f.Pay(address, 1000, 1), 0, 0);
+    // Rows stamped before since_seq are not returned again
+    auto changes = storage.GetChanges(CHAIN, id, seq + 1);
+    CHECK(changes.get_addresses().empty());
+    CHECK(changes.get_transactions().size() == 1);
+    CHECK(changes.get_seq() == seq + 2);
+  }
+}
+
+TEST_CASE("testing storage reads after writes with the cache enabled") {
+  StorageFixture f;
+  auto& storage = *f.storage;
+  storage.SetWalletCacheSize(1 << 20);
+  const std::string& id = f.wallet_id;
+  std::string address = f.Address(0);
+
+  SUBCASE("AddAddress") {
+    // The history is read before the wallet knows its address
+    std::string raw = f.Pay(address, 100000, 0);
+    storage.InsertTransaction(CHAIN, id, raw, 0, 0);
+    auto txs = storage.GetTransactions(CHAIN, id, 1000, 0);
+    REQUIRE(txs.size() == 1);
+    CHECK(txs[0].get_sub_amount() == 0);
+    CHECK(storage.GetAddresses(CHAIN, id, false, false).empty());
+    CHECK(storage.GetAllAddresses(CHAIN, id).empty());
+
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    CHECK(storage.GetAddresses(CHAIN, id, false, false) ==
+          std::vector<std::string>{address});
+    CHECK(storage.GetAllAddresses(CHAIN, id) ==
+          std::vector<std::string>{address});
+    txs = storage.GetTransactions(CHAIN, id, 1000, 0);
+    REQUIRE(txs.size() == 1);
+    CHECK(txs[0].is_receive());
+    CHECK(txs[0].get_sub_amount() == 100000);
+  }
+
+  SUBCASE("SetUtxos") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    CHECK(storage.GetUnspentOutputs(CHAIN, id).empty());
+    CHECK(storage.GetBalance(CHAIN, id) == 0);
+    CHECK(storage.GetWallet(CHAIN, id).get_balance() == 0);
+
+    storage.SetUtxos(CHAIN, id, address,
+                     f.Utxos(uint256::ONE.GetHex(), 0, 5000, 100));
+    CHECK(storage.GetUnspentOutputs(CHAIN, id).size() == 1);
+    CHECK(storage.GetUnspentOutputs(CHAIN, id, false).size() == 1);
+    CHECK(storage.GetBalance(CHAIN, id) == 5000);
+    CHECK(storage.GetWallet(CHAIN, id).get_balance() == 5000);
+
+    storage.SetUtxos(CHAIN, id, address, "[]");
+    CHECK(storage.GetUnspentOutputs(CHAIN, id).empty());
+    CHECK(storage.GetBalance(CHAIN, id) == 0);
+  }
+
+  SUBCASE("CreatePsbt and UpdatePsbt") {
+    CHECK(storage.GetTransactions(CHAIN, id, 1000, 0).empty());
+    std::string psbt = f.Psbt(uint256::ONE.GetHex(), 0, address, 1000);
+    std::string tx_id = storage.CreatePsbt(CHAIN, id, psbt).get_txid();
+    auto txs = storage.GetTransactions(CHAIN, id, 1000, 0);
+    REQUIRE(txs.size() == 1);
+    CHECK(txs[0].get_txid() == tx_id);
+    CHECK(txs[0].get_status() == TransactionStatus::PENDING_SIGNATURES);
+
+    storage.UpdatePsbt(CHAIN, id, f.Sign(psbt));
+    txs = storage.GetTransactions(CHAIN, id, 1000, 0);
+    REQUIRE(txs.size() == 1);
+    CHECK(txs[0].get_status() == TransactionStatus::READY_TO_BROADCAST);
+
+    storage.UpdateTransactionMemo(CHAIN, id, tx_id, "memo");
+    CHECK(storage.GetTransactions(CHAIN, id, 1000, 0)[0].get_memo() == "memo");
+
+    std::string new_id = uint256S("02").GetHex();
+    storage.UpdatePsbtTxId(CHAIN, id, tx_id, new_id);
+    CHECK(TxIds(storage.GetTransactions(CHAIN, id, 1000, 0)) ==
+          std::vector<std::string>{new_id});
+  }
+
+  SUBCASE("transactions") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    CHECK(storage.GetAddresses(CHAIN, id, true, false).empty());
+    std::string raw = f.Pay(address, 100000, 0);
+    storage.InsertTransaction(CHAIN, id, raw, 0, 0);
+    auto txs = storage.GetTransactions(CHAIN, id, 1000, 0);
+    REQUIRE(txs.size() == 1);
+    CHECK(txs[0].get_height() == 0);
+
+    storage.UpdateTransaction(CHAIN, id, raw, 100, 1600000000);
+    CHECK(storage.GetTransactions(CHAIN, id, 1000, 0)[0].get_height() == 100);
+    CHECK(storage.GetAddresses(CHAIN, id, true, false) ==
+          std::vector<std::string>{address});
+
+    storage.DeleteTransaction(CHAIN, id, f.TxId(raw));
+    CHECK(storage.GetTransactions(CHAIN, id, 1000, 0).empty());
+  }
+}
+
+static std::string ReadFile(const fs::path& path) {
+  std::ifstream in(path.string(), std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("testing wallet snapshot") {
+  StorageFixture f;
+  const std::string& id = f.wallet_id;
+  // A new instance on the same data, like the next start of the app
+  auto restart = [&](bool warm_start) {
+    f.storage.reset(new NunchukStorage(f.datadir.string()));
+    f.storage->SetWalletCacheSize(1 << 20);
+    if (warm_start) f.storage->LoadSnapshot(CHAIN);
+  };
+  auto& misses =
+      Metrics::getInstance().GetCounter("nunchuk_wallet_cache_misses_total");
+  // Reads the wallet, recording whether the snapshot served it
+  bool from_snapshot = false;
+  auto get_wallet = [&] {
+    uint64_t before = misses.Value();
+    Wallet wallet = f.storage->GetWallet(CHAIN, id);
+    from_snapshot = misses.Value() == before;
+    return wallet;
+  };
+
+  SUBCASE("loaded wallets are stale until synced") {
+    restart(true);
+    CHECK(get_wallet().is_stale());
+    CHECK_FALSE(from_snapshot);
+    f.storage->SaveSnapshot(CHAIN);
+
+    restart(true);
+    Wallet wallet = get_wallet();
+    CHECK(from_snapshot);
+    CHECK(wallet.is_stale());
+    CHECK(wallet.get_name() == "test");
+    f.storage->SetWalletSynced(CHAIN, id);
+    CHECK_FALSE(get_wallet().is_stale());
+    CHECK_FALSE(from_snapshot);
+    CHECK_FALSE(get_wallet().is_stale());
+  }
+
+  SUBCASE("a written wallet keeps its entry, refreshed at save") {
+    restart(true);
+    Wallet wallet = get_wallet();
+    wallet.set_name("renamed");
+    f.storage->UpdateWallet(CHAIN, wallet);
+    f.storage->SaveSnapshot(CHAIN);
+
+    restart(true);
+    CHECK(get_wallet().get_name() == "renamed");
+    CHECK(from_snapshot);
+  }
+
+  SUBCASE("a deleted wallet leaves the snapshot") {
+    restart(true);
+    get_wallet();
+    f.storage->DeleteWallet(CHAIN, id);
+    f.storage->SaveSnapshot(CHAIN);
+
+    restart(true);
+    CHECK(f.storage->ListWallets(CHAIN).empty());
+    CHECK_THROWS_AS(f.storage->GetWallet(CHAIN, id), StorageException);
+  }
+
+  SUBCASE("nothing is kept without warm start") {
+    restart(false);
+    get_wallet();
+    f.storage->SaveSnapshot(CHAIN);
+
+    restart(true);
+    CHECK(get_wallet().is_stale());
+    CHECK_FALSE(from_snapshot);
+  }
+
+  SUBCASE("a passphrase keeps the snapshot encrypted") {
+    f.storage->SetPassphrase(CHAIN, "secret");
+    auto start = [&] {
+      f.storage.reset(new NunchukStorage(f.datadir.string(), "secret"));
+      f.storage->SetWalletCacheSize(1 << 20);
+      f.storage->LoadSnapshot(CHAIN);
+    };
+    start();
+    get_wallet();
+    f.storage->SaveSnapshot(CHAIN);
+    f.storage.reset();
+
+    for (auto&& name : {"state", "snapshot"}) {
+      CHECK(ReadFile(f.datadir / "testnet" / name).find(TPUB) ==
+            std::string::npos);
+    }
+    auto file = f.datadir / "testnet" / "snapshot";
+    sqlite3* db;
+    REQUIRE(sqlite3_open(file.string().c_str(), &db) == SQLITE_OK);
+    CHECK(sqlite3_exec(db, "SELECT count(*) FROM VSTR;", NULL, 0, NULL) !=
+          SQLITE_OK);
+    sqlite3_close(db);
+
+    start();
+    CHECK(get_wallet().get_name() == "test");
+    CHECK(from_snapshot);
+  }
+}
+
+// What a restored wallet must agree on, in a comparable form
+static std::vector<std::string> History(NunchukStorage& storage,
+                                        const std::string& id) {
+  std::vector<std::string> rs;
+  for (auto&& tx : storage.GetTransactions(CHAIN, id, 1000, 0)) {
+    rs.push_back(tx.get_txid() + " " + std::to_string(tx.get_height()) + " " +
+                 std::to_string((int)tx.get_status()) + " " +
+                 std::to_string(tx.get_sub_amount()) + " " + tx.get_memo());
+  }
+  std::sort(rs.begin(), rs.end());
+  return rs;
+}
+
+static std::vector<std::string> Coins(NunchukStorage& storage,
+                                      const std::string& id) {
+  std::vector<std::string> rs;
+  for (auto&& utxo : storage.GetUnspentOutputs(CHAIN, id, false)) {
+    rs.push_back(utxo.get_txid() + ":" + std::to_string(utxo.get_vout()) +
+                 " " + utxo.get_address() + " " +
+                 std::to_string(utxo.get_amount()) + " " +
+                 std::to_string(utxo.get_height()));
+  }
+  std::sort(rs.begin(), rs.end());
+  return rs;
+}
+
+TEST_CASE("testing wallet delta backups") {
+  StorageFixture f;
+  auto& storage = *f.storage;
+  const std::string& id = f.wallet_id;
+  std::string address = f.Address(0);
+  std::string change = f.Address(0, true);
+  auto file = [&](const std::string& name) {
+    return (f.datadir / name).string();
+  };
+  // Wallet as of the base backup: one address, a pending tx and a draft
+  storage.AddAddress(CHAIN, id, address, 0, false);
+  std::string pending = f.Pay(address, 100000, 0);
+  std::string dropped = f.Pay(address, 20000, 1);
+  storage.InsertTransaction(CHAIN, id, pending, 0, 0);
+  storage.InsertTransaction(CHAIN, id, dropped, 0, 0);
+  std::string draft = f.Psbt(f.TxId(pending), 0, change, 90000);
+  std::string draft_id = storage.CreatePsbt(CHAIN, id, draft).get_txid();
+  REQUIRE(storage.BackupWallet(CHAIN, id, file("base"), ""));
+
+  // Restores the base into a fresh datadir
+  fs::path restore_dir = f.datadir / "restore";
+  fs::create_directories(restore_dir);
+  NunchukStorage restored(restore_dir.string());
+  REQUIRE(restored.RestoreWallet(CHAIN, file("base"), "") == id);
+  auto check_same = [&] {
+    CHECK(History(restored, id) == History(storage, id));
+    CHECK(Coins(restored, id) == Coins(storage, id));
+    for (bool internal : {false, true}) {
+      for (bool used : {false, true}) {
+        CHECK(restored.GetAddresses(CHAIN, id, used, internal) ==
+              storage.GetAddresses(CHAIN, id, used, internal));
+      }
+    }
+    CHECK(restored.GetBalance(CHAIN, id) == storage.GetBalance(CHAIN, id));
+  };
+  check_same();
+
+  // Insert, confirm, memo, txid update, delete and coins
+  storage.AddAddress(CHAIN, id, change, 0, true);
+  std::string received = f.Pay(address, 5000, 2);
+  storage.InsertTransaction(CHAIN, id, received, 0, 0);
+  storage.UpdateTransaction(CHAIN, id, pending, 100, 1600000000);
+  storage.UpdateTransactionMemo(CHAIN, id, f.TxId(pending), "memo");
+  std::string new_id = uint256S("03").GetHex();
+  storage.UpdatePsbtTxId(CHAIN, id, draft_id, new_id);
+  storage.DeleteTransaction(CHAIN, id, f.TxId(dropped));
+  storage.SetUtxos(CHAIN, id, address,
+                   f.Utxos(f.TxId(pending), 0, 100000, 100));
+
+  SUBCASE("round trip") {
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, file("delta"), ""));
+    REQUIRE(restored.ApplyWalletDelta(CHAIN, file("delta"), "") == id);
+    check_same();
+    auto history = History(restored, id);
+    CHECK(std::none_of(history.begin(), history.end(),
+                       [&](const std::string& tx) {
+                         return tx.find(f.TxId(dropped)) == 0 ||
+                                tx.find(draft_id) == 0;
+                       }));
+
+    // The next delta continues from this one, on both sides
+    storage.UpdateTransactionMemo(CHAIN, id, new_id, "draft");
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, file("delta2"), ""));
+    restored.ApplyWalletDelta(CHAIN, file("delta2"), "");
+    check_same();
+  }
+
+  SUBCASE("a replayed or skipped delta is rejected") {
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, file("delta"), ""));
+    storage.UpdateTransactionMemo(CHAIN, id, new_id, "draft");
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, file("delta2"), ""));
+    // delta2 starts where delta ends
+    CHECK_THROWS_AS(restored.ApplyWalletDelta(CHAIN, file("delta2"), ""),
+                    StorageException);
+    restored.ApplyWalletDelta(CHAIN, file("delta"), "");
+    CHECK_THROWS_AS(restored.ApplyWalletDelta(CHAIN, file("delta"), ""),
+                    StorageException);
+    restored.ApplyWalletDelta(CHAIN, file("delta2"), "");
+    check_same();
+  }
+
+  SUBCASE("encrypted delta") {
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, file("delta"), "secret"));
+    CHECK_THROWS_AS(restored.ApplyWalletDelta(CHAIN, file("delta"), ""),
+                    NunchukException);
+    CHECK_THROWS_AS(restored.ApplyWalletDelta(CHAIN, file("delta"), "wrong"),
+                    NunchukException);
+    restored.ApplyWalletDelta(CHAIN, file("delta"), "secret");
+    check_same();
+  }
+}
+
+TEST_CASE("testing wallet backup with a storage passphrase") {
+  StorageFixture f;
+  const std::string& id = f.wallet_id;
+  f.storage->SetPassphrase(CHAIN, "secret");
+  f.storage.reset(new NunchukStorage(f.datadir.string(), "secret"));
+  auto backup = f.datadir / "backup";
+  REQUIRE(f.storage->BackupWallet(CHAIN, id, backup.string(), ""));
+  CHECK(fs::is_empty(f.datadir / "tmp"));
+
+  fs::path restore_dir = f.datadir / "restore";
+  fs::create_directories(restore_dir);
+  NunchukStorage restored(restore_dir.string(), "secret");
+  // Cut short in the end record, the chunks before it are kept
+  auto truncated = f.datadir / "truncated";
+  std::string content = ReadFile(backup);
+  std::ofstream(truncated.string(), std::ios::binary)
+      << content.substr(0, content.size() - 1);
+  CHECK_THROWS_AS(restored.RestoreWallet(CHAIN, truncated.string(), ""),
+                  StorageException);
+  std::vector<fs::path> partials{fs::directory_iterator(restore_dir / "tmp"),
+                                 fs::directory_iterator()};
+  REQUIRE(partials.size() == 1);
+  CHECK(ReadFile(partials[0]).find(TPUB) == std::string::npos);
+  sqlite3* db;
+  REQUIRE(sqlite3_open(partials[0].string().c_str(), &db) == SQLITE_OK);
+  CHECK(sqlite3_exec(db, "SELECT count(*) FROM CHUNK;", NULL, 0, NULL) !=
+        SQLITE_OK);
+  sqlite3_close(db);
+
+  // The full backup resumes from there
+  CHECK(restored.RestoreWallet(CHAIN, backup.string(), "") == id);
+  CHECK(fs::is_empty(restore_dir / "tmp"));
+  CHECK(restored.GetWallet(CHAIN, id).get_name() == "test");
+}
+
+// (height, balance) of each balance history point
+static std::vector<std::pair<int, Amount>> Series(NunchukStorage& storage,
+                                                  const std::string& id,
+                                                  int max_points = 0) {
+  std::vector<std::pair<int, Amount>> rs;
+  for (auto&& point : storage.GetBalanceHistory(CHAIN, id, max_points)) {
+    rs.push_back({point.get_height(), point.get_balance()});
+  }
+  return rs;
+}
+
+TEST_CASE("testing balance history") {
+  typedef std::vector<std::pair<int, Amount>> Points;
+  StorageFixture f;
+  auto& storage = *f.storage;
+  const std::string& id = f.wallet_id;
+  std::string address = f.Address(0);
+  // Derived far ahead, never added, so not the wallet's
+  std::string foreign = f.Address(50);
+  std::string funding = f.Pay(address, 100000, 0);
+  std::string other = f.Pay(address, 5000, 1);
+  // Sends 90000 out of the funding coin with a 10000 fee
+  std::string spend = f.Spend(f.TxId(funding), 0, foreign, 90000);
+  auto insert = [&](const std::string& raw, int height, Amount fee) {
+    storage.InsertTransaction(CHAIN, id, raw, height, 1600000000 + height,
+                              fee);
+  };
+
+  SUBCASE("series values") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(funding, 100, 0);
+    insert(other, 100, 0);
+    insert(spend, 101, 10000);
+    CHECK(Series(storage, id) == Points{{100, 105000}, {101, 5000}});
+    CHECK(Series(storage, id, 1) == Points{{101, 5000}});
+    // Unconfirmed transactions are not in the history
+    insert(f.Pay(address, 7000, 2), 0, 0);
+    CHECK(Series(storage, id) == Points{{100, 105000}, {101, 5000}});
+  }
+
+  SUBCASE("a spend synced before its funding transaction") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(spend, 101, 10000);
+    CHECK(Series(storage, id) == Points{{101, 0}});
+    insert(funding, 100, 0);
+    CHECK(Series(storage, id) == Points{{100, 100000}, {101, 0}});
+  }
+
+  SUBCASE("an address added after its transactions") {
+    insert(funding, 100, 0);
+    insert(spend, 101, 10000);
+    CHECK(Series(storage, id) == Points{{100, 0}, {101, 0}});
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    CHECK(Series(storage, id) == Points{{100, 100000}, {101, 0}});
+  }
+
+  SUBCASE("reorg to unconfirmed") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(funding, 100, 0);
+    insert(other, 101, 0);
+    storage.UpdateTransaction(CHAIN, id, other, 0, 0);
+    CHECK(Series(storage, id) == Points{{100, 100000}});
+    storage.UpdateTransaction(CHAIN, id, other, 102, 1600000102);
+    CHECK(Series(storage, id) == Points{{100, 100000}, {102, 105000}});
+  }
+
+  SUBCASE("deleted transactions") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(funding, 100, 0);
+    insert(spend, 101, 10000);
+    storage.DeleteTransaction(CHAIN, id, f.TxId(spend));
+    CHECK(Series(storage, id) == Points{{100, 100000}});
+    insert(spend, 101, 10000);
+    // Without its funding transaction the spend is no longer the wallet's
+    storage.DeleteTransaction(CHAIN, id, f.TxId(funding));
+    CHECK(Series(storage, id) == Points{{101, 0}});
+  }
+
+  SUBCASE("applied deltas") {
+    insert(funding, 100, 0);
+    REQUIRE(storage.BackupWallet(CHAIN, id, (f.datadir / "base").string(),
+                                 ""));
+    fs::path restore_dir = f.datadir / "restore";
+    fs::create_directories(restore_dir);
+    NunchukStorage restored(restore_dir.string());
+    REQUIRE(restored.RestoreWallet(CHAIN, (f.datadir / "base").string(),
+                                   "") == id);
+    CHECK(Series(restored, id) == Points{{100, 0}});
+
+    // The address arrives with the delta, after the transaction it owns
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(spend, 101, 10000);
+    auto delta = (f.datadir / "delta").string();
+    REQUIRE(storage.BackupWalletDelta(CHAIN, id, delta, ""));
+    restored.ApplyWalletDelta(CHAIN, delta, "");
+    CHECK(Series(restored, id) == Points{{100, 100000}, {101, 0}});
+    CHECK(Series(restored, id) == Series(storage, id));
+  }
+
+  SUBCASE("migration backfill") {
+    storage.AddAddress(CHAIN, id, address, 0, false);
+    insert(funding, 100, 0);
+    insert(spend, 101, 10000);
+    f.storage.reset();
+    // Back to a version 3 wallet, from before the balance history
+    auto file = f.datadir / "testnet" / "wallets" / id;
+    sqlite3* db;
+    REQUIRE(sqlite3_open(file.string().c_str(), &db) == SQLITE_OK);
+    std::string sql =
+        "DROP TABLE TXBALANCE; DROP TABLE TXBALANCE_REF;"
+        "UPDATE VINT SET VALUE = 3 WHERE ID = " +
+        std::to_string(DbKeys::VERSION) + ";";
+    CHECK(sqlite3_exec(db, sql.c_str(), NULL, 0, NULL) == SQLITE_OK);
+    sqlite3_close(db);
+
+    f.storage.reset(new NunchukStorage(f.datadir.string()));
+    // Opening the wallet leaves the backfill to the first balance history
+    f.storage->GetWallet(CHAIN, id);
+    REQUIRE(sqlite3_open(file.string().c_str(), &db) == SQLITE_OK);
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM TXBALANCE;", -1, &stmt, NULL);
+    REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+    CHECK(sqlite3_column_int(stmt, 0) == 0);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    CHECK(Series(*f.storage, id) == Points{{100, 100000}, {101, 0}});
+    // The backfilled rows are kept up to date too
+    f.storage->DeleteTransaction(CHAIN, id, f.TxId(funding));
+    CHECK(Series(*f.storage, id) == Points{{101, 0}});
+  }
+}
@@ -0,0 +1,209 @@
+// Copyright (c) 2020 Enigmo
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// A minimal software stand-in for the `hwi` binary. It speaks the subset of
+// the HWI command line that HWIService uses (enumerate, getxpub, signtx,
+// signmessage, --testnet, -f, -d and --stdin) and signs with BIP32 keys
+// derived from HWI_EMULATOR_SEED. That is a comma separated list of hex seeds,
+// one emulated device each, picked by fingerprint (-f) or by the path
+// enumerate reports (-d), otherwise the first one. Only meant for tests and
+// benchmarks.
+
+#include <nunchuk.h>
+#include <key.h>
+#include <key_io.h>
+#include <psbt.h>
+#include <script/signingprovider.h>
+#include <util/bip32.h>
+#include <util/message.h>
+#include <util/strencodings.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <utils/json.hpp>
+#include <utils/txutils.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+// BIP32 test vector 1
+const std::string DEFAULT_SEED = "000102030405060708090a0b0c0d0e0f";
+
+struct EmulatorError {
+  int code;
+  std::string message;
+};
+
+std::vector<CExtKey> GetMasterKeys() {
+  const char* env = std::getenv("HWI_EMULATOR_SEED");
+  std::stringstream seeds(env != nullptr && *env ? env : DEFAULT_SEED);
+  std::vector<CExtKey> rs;
+  std::string seed_hex;
+  while (std::getline(seeds, seed_hex, ',')) {
+    if (!IsHex(seed_hex)) throw EmulatorError{-1, "invalid seed"};
+    std::vector<unsigned char> seed = ParseHex(seed_hex);
+    CExtKey master;
+    master.SetSeed(seed.data(), seed.size());
+    rs.push_back(master);
+  }
+  if (rs.empty()) throw EmulatorError{-1, "invalid seed"};
+  return rs;
+}
+
+std::string GetPath(size_t index) {
+  return "emulator:" + std::to_string(index);
+}
+
+std::string GetFingerprint(const CExtKey& master) {
+  CKeyID id = master.key.GetPubKey().GetID();
+  return HexStr(std::vector<unsigned char>(id.begin(), id.begin() + 4));
+}
+
+CExtKey DeriveKey(const CExtKey& master, const std::vector<uint32_t>& path) {
+  CExtKey key = master;
+  for (auto&& index : path) {
+    CExtKey child;
+    if (!key.Derive(child, index)) throw EmulatorError{-1, "derive failed"};
+    key = child;
+  }
+  return key;
+}
+
+CExtKey DeriveKey(const CExtKey& master, std::string path) {
+  std::vector<uint32_t> keypath;
+  if (!ParseHDKeypath(path, keypath)) {
+    throw EmulatorError{-7, "invalid derivation path"};
+  }
+  return DeriveKey(master, keypath);
+}
+
+json Enumerate(const std::vector<CExtKey>& masters) {
+  json devices = json::array();
+  for (size_t i = 0; i < masters.size(); ++i) {
+    devices.push_back({{"type", "emulator"},
+                       {"path", GetPath(i)},
+                       {"model", "emulator"},
+                       {"fingerprint", GetFingerprint(masters[i])},
+                       {"needs_passphrase_sent", false},
+                       {"needs_pin_sent", false}});
+  }
+  return devices;
+}
+
+const CExtKey& SelectDevice(const std::vector<CExtKey>& masters,
+                            const std::string& fingerprint,
+                            const std::string& path) {
+  for (size_t i = 0; i < masters.size(); ++i) {
+    if (!fingerprint.empty() ? fingerprint == GetFingerprint(masters[i])
+                             : path.empty() || path == GetPath(i)) {
+      return masters[i];
+    }
+  }
+  throw EmulatorError{-3, "Could not find device with specified fingerprint"};
+}
+
+json GetXpub(const CExtKey& master, const std::string& path) {
+  return {{"xpub", EncodeExtPubKey(DeriveKey(master, path).Neuter())}};
+}
+
+json SignMessage(const CExtKey& master, const std::string& message,
+                 const std::string& path) {
+  std::string signature;
+  if (!MessageSign(DeriveKey(master, path).key, message, signature)) {
+    throw EmulatorError{-13, "sign message failed"};
+  }
+  return {{"signature", signature}};
+}
+
+json SignTx(const CExtKey& master, const std::string& base64_psbt) {
+  PartiallySignedTransaction psbtx = DecodePsbt(base64_psbt);
+  CKeyID id = master.key.GetPubKey().GetID();
+
+  // Like a real device, only provide keys for the paths the PSBT claims
+  // belong to this master fingerprint
+  FlatSigningProvider provider;
+  for (auto&& input : psbtx.inputs) {
+    for (auto&& entry : input.hd_keypaths) {
+      if (std::memcmp(entry.second.fingerprint, id.begin(), 4) != 0) continue;
+      CKey key = DeriveKey(master, entry.second.path).key;
+      if (key.GetPubKey() != entry.first) continue;
+      provider.keys[entry.first.GetID()] = key;
+    }
+  }
+  for (unsigned int i = 0; i < psbtx.inputs.size(); ++i) {
+    SignPSBTInput(provider, psbtx, i, SIGHASH_ALL);
+  }
+  return {{"psbt", EncodePsbt(psbtx)}};
+}
+
+json Run(std::vector<std::string> args) {
+  bool testnet = false;
+  bool use_stdin = false;
+  std::string fingerprint;
+  std::string path;
+  std::vector<std::string> positional;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--testnet") {
+      testnet = true;
+    } else if (args[i] == "--stdin") {
+      use_stdin = true;
+    } else if (args[i] == "-f" && i + 1 < args.size()) {
+      fingerprint = args[++i];
+    } else if (args[i] == "-d" && i + 1 < args.size()) {
+      path = args[++i];
+    } else {
+      positional.push_back(args[i]);
+    }
+  }
+  if (use_stdin) {
+    // HWI reads one command per line and stops at an empty line
+    std::string line;
+    while (std::getline(std::cin, line) && !line.empty()) {
+      std::istringstream iss(line);
+      std::string token;
+      while (iss >> token) positional.push_back(token);
+    }
+  }
+  if (positional.empty()) throw EmulatorError{-1, "missing command"};
+
+  nunchuk::Utils::SetChain(testnet ? nunchuk::Chain::TESTNET
+                                   : nunchuk::Chain::MAIN);
+  std::vector<CExtKey> masters = GetMasterKeys();
+  const std::string& command = positional[0];
+  if (command == "enumerate") return Enumerate(masters);
+  const CExtKey& master = SelectDevice(masters, fingerprint, path);
+  if (command == "getxpub" && positional.size() == 2) {
+    return GetXpub(master, positional[1]);
+  }
+  if (command == "signmessage" && positional.size() == 3) {
+    return SignMessage(master, positional[1], positional[2]);
+  }
+  if (command == "signtx" && positional.size() == 2) {
+    return SignTx(master, positional[1]);
+  }
+  throw EmulatorError{-1, "unsupported command"};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ECC_Start();
+  json rs;
+  try {
+    rs = Run(std::vector<std::string>(argv + 1, argv + argc));
+  } catch (EmulatorError& ee) {
+    rs = {{"error", ee.message}, {"code", ee.code}};
+  } catch (std::exception& e) {
+    rs = {{"error", e.what()}, {"code", -13}};
+  }
+  std::cout << rs.dump() << std::endl;
+  ECC_Stop();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <nunchuk.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <doctest.h>
+
+TEST_CASE("testing Transaction compact layout") {
+  using namespace nunchuk;
+  std::string txid =
+      "27574e539fdf228179d53dd34ee1f68818bfbf4e6ea25871a9cc381710ac53b9";
+  std::string address = "tb1qy9htg6adln6lthgswd92dz2scl8vtke05jtvcj";
+
+  Transaction tx;
+  CHECK(tx.get_txid().empty());
+  tx.set_txid(txid);
+  CHECK(tx.get_txid() == txid);
+  // Not lowercase hex, kept as given
+  tx.set_replaced_by_txid("ABCD");
+  CHECK(tx.get_replaced_by_txid() == "ABCD");
+
+  tx.add_input({txid, 1});
+  tx.add_output({address, 1000});
+  tx.add_output({address, 2000});
+  tx.add_receive_output({address, 2000});
+  CHECK(tx.get_inputs() == std::vector<TxInput>{{txid, 1}});
+  CHECK(tx.get_outputs() ==
+        std::vector<TxOutput>{{address, 1000}, {address, 2000}});
+  CHECK(tx.get_receive_outputs() == std::vector<TxOutput>{{address, 2000}});
+  CHECK(tx.get_user_outputs().empty());
+  CHECK(tx.get_input_count() == 1);
+  CHECK(tx.get_output_count() == 2);
+  CHECK(tx.get_receive_output_count() == 1);
+  CHECK(tx.get_user_output_count() == 0);
+  CHECK(tx.get_input_txid(0) == txid);
+  CHECK(tx.get_input_vout(0) == 1);
+  CHECK(tx.get_output_address(1) == address);
+  CHECK(tx.get_output_amount(1) == 2000);
+
+  tx.set_signer("b", false);
+  tx.set_signer("a", false);
+  tx.set_signer("b", true);
+  auto signers = tx.get_signers();
+  CHECK(signers.size() == 2);
+  CHECK(signers["a"] == false);
+  CHECK(signers["b"] == true);
+  CHECK(tx.get_signer_count() == 2);
+  CHECK(tx.get_signer_id(0) == "a");
+  CHECK(tx.get_signer_id(1) == "b");
+
+  UnspentOutput utxo;
+  utxo.set_txid(txid);
+  utxo.set_address(address);
+  CHECK(utxo.get_txid() == txid);
+  CHECK(utxo.get_address() == address);
+  // Released addresses leave the pool, a new one starts fresh
+  tx = Transaction();
+  utxo = UnspentOutput();
+  CHECK(utxo.get_address().empty());
+  utxo.set_address(address);
+  CHECK(utxo.get_address() == address);
+}
+
+TEST_CASE("testing interned strings from several threads") {
+  using namespace nunchuk;
+  std::vector<std::thread> threads;
+  std::vector<std::vector<UnspentOutput>> results(4);
+  for (size_t t = 0; t < results.size(); ++t) {
+    threads.emplace_back([&results, t] {
+      for (int i = 0; i < 1000; ++i) {
+        UnspentOutput utxo;
+        utxo.set_address("address" + std::to_string(i % 100));
+        results[t].push_back(utxo);
+        // Drop some so addresses leave and reenter the pool
+        if (i % 3 == 0) results[t].pop_back();
+      }
+    });
+  }
+  for (auto&& thread : threads) thread.join();
+  for (auto&& result : results) {
+    for (auto&& utxo : result) {
+      CHECK(utxo.get_address().compare(0, 7, "address") == 0);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#include <nunchuk.h>
+#include <walletcache.h>
+
+#include <doctest.h>
+
+TEST_CASE("testing WalletCache") {
+  using namespace nunchuk;
+  WalletCache cache;
+
+  // Disabled by default
+  cache.PutBalance(Chain::TESTNET, "w1", 1000);
+  CHECK(!cache.GetBalance(Chain::TESTNET, "w1"));
+
+  cache.SetBudget(1 << 20);
+  CHECK(!cache.GetBalance(Chain::TESTNET, "w1"));
+  cache.PutBalance(Chain::TESTNET, "w1", 1000);
+  cache.PutAddresses(Chain::TESTNET, "w1", false, true, {"a", "b"});
+  cache.PutAllAddresses(Chain::TESTNET, "w1", {"a", "b", "c"});
+  CHECK(*cache.GetBalance(Chain::TESTNET, "w1") == 1000);
+  CHECK(cache.GetAddresses(Chain::TESTNET, "w1", false, true)->size() == 2);
+  CHECK(!cache.GetAddresses(Chain::TESTNET, "w1", true, true));
+  CHECK(!cache.GetBalance(Chain::MAIN, "w1"));
+
+  SUBCASE("invalidate parts") {
+    cache.Invalidate(Chain::TESTNET, "w1", WalletCache::BALANCE);
+    CHECK(!cache.GetBalance(Chain::TESTNET, "w1"));
+    CHECK(cache.GetAllAddresses(Chain::TESTNET, "w1").is_initialized());
+    cache.InvalidateAll(WalletCache::ADDRESSES);
+    CHECK(!cache.GetAddresses(Chain::TESTNET, "w1", false, true));
+    CHECK(!cache.GetAllAddresses(Chain::TESTNET, "w1"));
+  }
+
+  SUBCASE("evict least recently used") {
+    std::vector<std::string> big(1000, std::string(400, 'x'));
+    cache.PutAllAddresses(Chain::TESTNET, "w2", big);
+    CHECK(cache.GetAllAddresses(Chain::TESTNET, "w2").is_initialized());
+    // w1 was used last, w2 goes first
+    CHECK(cache.GetBalance(Chain::TESTNET, "w1").is_initialized());
+    cache.PutAllAddresses(Chain::TESTNET, "w3", big);
+    cache.PutAllAddresses(Chain::TESTNET, "w4", big);
+    CHECK(!cache.GetAllAddresses(Chain::TESTNET, "w2"));
+    CHECK(cache.GetAllAddresses(Chain::TESTNET, "w4").is_initialized());
+  }
+
+  SUBCASE("disable") {
+    cache.SetBudget(0);
+    CHECK(!cache.GetBalance(Chain::TESTNET, "w1"));
+  }
+}